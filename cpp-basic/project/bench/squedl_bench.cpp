@@ -0,0 +1,327 @@
+// Throughput and latency of the hot paths: put from one or many producers, put_many, next with
+// ack, ack alone, and put-to-execute through scheduler and worker_pool across worker threads and
+// kinds. Latency percentiles are reported as counters, in microseconds.
+//
+// usage: squedl_bench [--benchmark_filter=...] and the other Google Benchmark flags
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "squedl/manual_clock.hpp"
+#include "squedl/metrics.hpp"
+#include "squedl/simulation.hpp"
+#include "squedl/squedl.hpp"
+
+namespace {
+using namespace std::chrono_literals;
+using steady = std::chrono::steady_clock;
+using bus_t = squedl::test_bus<>;
+
+constexpr size_t max_kinds{64};
+constexpr size_t body_size{16};
+
+std::int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               steady::now().time_since_epoch())
+        .count();
+}
+
+std::vector<squedl::kind_id> kinds_named(const std::string& prefix, size_t count) {
+    std::vector<squedl::kind_id> result;
+    for (size_t i{}; i < count; ++i)
+        result.emplace_back(prefix + std::to_string(i));
+    return result;
+}
+
+// A bus every benchmark thread puts into, emptied by one consumer per kind so memory stays flat
+// however long the benchmark runs.
+struct drained_bus {
+    bus_t bus{1min, true};
+    std::vector<squedl::kind_id> kinds;
+    std::vector<std::thread> drainers;
+
+    explicit drained_bus(size_t kind_count) : kinds{kinds_named("bench_put_", kind_count)} {
+        for (auto kind : kinds)
+            drainers.emplace_back([this, kind] {
+                while (bus.next(kind, 4096, 10ms).has_value()) {
+                }
+            });
+    };
+
+    drained_bus(drained_bus const& other) = delete;
+    drained_bus(drained_bus&& other) = delete;
+    drained_bus& operator=(drained_bus const& other) = delete;
+    drained_bus& operator=(drained_bus&& other) = delete;
+
+    ~drained_bus() {
+        bus.stop();
+        for (auto& x : drainers)
+            x.join();
+    };
+};
+
+std::unique_ptr<drained_bus> shared;
+
+void start_shared(const benchmark::State& state) {
+    shared = std::make_unique<drained_bus>(static_cast<size_t>(state.range(0)));
+}
+
+void stop_shared(const benchmark::State& /*state*/) { shared.reset(); }
+
+// Single puts; each thread cycles through the kinds starting at its own.
+void BM_put(benchmark::State& state) {
+    const squedl::bytes body(body_size, std::byte{1});
+    auto& bus{shared->bus};
+    const auto& kinds{shared->kinds};
+    auto i{static_cast<size_t>(state.thread_index())};
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(bus.put(kinds[i++ % kinds.size()], squedl::byte_view{body}));
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_put)
+    ->Setup(start_shared)
+    ->Teardown(stop_shared)
+    ->ArgNames({"kinds"})
+    ->Arg(1)
+    ->Arg(16)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+
+// Batches serialized back to back into one buffer, as scheduler::schedule_many puts them.
+void BM_put_many(benchmark::State& state) {
+    auto batch{static_cast<size_t>(state.range(1))};
+    squedl::bytes buffer(body_size * batch, std::byte{1});
+    std::vector<size_t> ends;
+    for (size_t i{1}; i <= batch; ++i)
+        ends.push_back(body_size * i);
+
+    auto& bus{shared->bus};
+    const auto& kinds{shared->kinds};
+    auto i{static_cast<size_t>(state.thread_index())};
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(
+            bus.put_many(kinds[i++ % kinds.size()], squedl::byte_view{buffer}, ends));
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(batch));
+}
+BENCHMARK(BM_put_many)
+    ->Setup(start_shared)
+    ->Teardown(stop_shared)
+    ->ArgNames({"kinds", "batch"})
+    ->ArgsProduct({{1}, {16, 256}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+
+// Takes a batch and acks it; refilling the kind is not timed.
+void BM_next_ack(benchmark::State& state) {
+    auto batch{static_cast<size_t>(state.range(0))};
+    bus_t bus{1min};
+    squedl::kind_id kind{"bench_next_ack"};
+    const std::vector<squedl::bytes> bodies(batch, squedl::bytes(body_size, std::byte{1}));
+    std::vector<bus_t::handle_t> handles;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        bus.put_many(kind, bodies);
+        state.ResumeTiming();
+
+        auto taken{bus.next(kind, batch)};
+        handles.clear();
+        for (const auto& x : taken.value())
+            handles.push_back(x.handle);
+        bus.ack_many(kind, handles);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(batch));
+    bus.stop();
+}
+BENCHMARK(BM_next_ack)->ArgNames({"batch"})->Arg(1)->Arg(64)->Arg(1024);
+
+// Acks alone, one by one or all at once.
+void BM_ack(benchmark::State& state) {
+    auto batch{static_cast<size_t>(state.range(0))};
+    auto many{state.range(1) != 0};
+    bus_t bus{1min};
+    squedl::kind_id kind{"bench_ack"};
+    const std::vector<squedl::bytes> bodies(batch, squedl::bytes(body_size, std::byte{1}));
+    std::vector<bus_t::handle_t> handles;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        bus.put_many(kind, bodies);
+        auto taken{bus.next(kind, batch)};
+        handles.clear();
+        for (const auto& x : taken.value())
+            handles.push_back(x.handle);
+        state.ResumeTiming();
+
+        if (many) {
+            bus.ack_many(kind, handles);
+        } else {
+            for (const auto& x : handles)
+                bus.ack(kind, x);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(batch));
+    bus.stop();
+}
+BENCHMARK(BM_ack)->ArgNames({"batch", "many"})->ArgsProduct({{1024}, {0, 1}});
+
+// Put-to-execute: tasks carry their put time, and record how long they took to start running.
+std::unique_ptr<squedl::histogram> latencies;
+std::atomic<std::int64_t> executed{};
+
+template <size_t I>
+class timed_task {
+public:
+    struct args {
+        std::int64_t stamp{};
+    };
+
+    static std::string kind() { return "bench_task_" + std::to_string(I); }
+
+    static squedl::bytes serialize(const args& arg) {
+        const auto* data{reinterpret_cast<const std::byte*>(&arg.stamp)};
+        return {data, data + sizeof(arg.stamp)};
+    }
+
+    static args deserialize(const squedl::bytes& data) {
+        args result{};
+        if (data.size() >= sizeof(result.stamp))
+            std::memcpy(&result.stamp, data.data(), sizeof(result.stamp));
+        return result;
+    }
+
+    std::optional<squedl::error> operator()(args arg) {
+        latencies->record(static_cast<std::uint64_t>(now_ns() - arg.stamp));
+        executed.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+};
+
+using pool_t = squedl::worker_pool<bus_t>;
+using scheduler_t = squedl::scheduler<bus_t>;
+using work_fn = void (*)(pool_t&, size_t);
+using schedule_fn = void (*)(scheduler_t&, std::int64_t);
+
+template <size_t I>
+void work_on(pool_t& pool, size_t concurrency) {
+    pool.work_on(timed_task<I>{}, concurrency);
+}
+
+template <size_t I>
+void schedule(scheduler_t& scheduler, std::int64_t stamp) {
+    scheduler.schedule<timed_task<I>>(typename timed_task<I>::args{stamp});
+}
+
+// Kinds are task types, so picking one at run time goes through a table of instantiations.
+template <size_t... I>
+constexpr auto make_work_table(std::index_sequence<I...> /*kinds*/) {
+    return std::array<work_fn, sizeof...(I)>{&work_on<I>...};
+}
+
+template <size_t... I>
+constexpr auto make_schedule_table(std::index_sequence<I...> /*kinds*/) {
+    return std::array<schedule_fn, sizeof...(I)>{&schedule<I>...};
+}
+
+constexpr auto work_table{make_work_table(std::make_index_sequence<max_kinds>{})};
+constexpr auto schedule_table{make_schedule_table(std::make_index_sequence<max_kinds>{})};
+
+// Every iteration puts a wave of tasks spread over the kinds and waits until all of them ran.
+void BM_put_to_execute(benchmark::State& state) {
+    constexpr std::int64_t wave{1024};
+    auto workers{static_cast<size_t>(state.range(0))};
+    auto kinds{static_cast<size_t>(state.range(1))};
+
+    latencies = std::make_unique<squedl::histogram>();
+    executed = 0;
+    bus_t bus{1min};
+    scheduler_t scheduler{bus};
+    pool_t pool{bus, pool_t::default_ack_batch_size, 1ms, workers};
+    for (size_t i{}; i < kinds; ++i)
+        work_table[i](pool, 64);
+
+    std::int64_t expected{};
+    for (auto _ : state) {
+        for (std::int64_t i{}; i < wave; ++i)
+            schedule_table[static_cast<size_t>(i) % kinds](scheduler, now_ns());
+        expected += wave;
+        while (executed.load(std::memory_order_relaxed) < expected)
+            std::this_thread::yield();
+    }
+
+    pool.stop();
+    bus.stop();
+
+    auto result{latencies->snapshot()};
+    state.SetItemsProcessed(expected);
+    state.counters["p50_us"] = static_cast<double>(result.quantile(0.5)) / 1e3;
+    state.counters["p99_us"] = static_cast<double>(result.quantile(0.99)) / 1e3;
+    state.counters["p999_us"] = static_cast<double>(result.quantile(0.999)) / 1e3;
+}
+BENCHMARK(BM_put_to_execute)
+    ->ArgNames({"workers", "kinds"})
+    ->ArgsProduct({{1, 2, 4, 8}, {1, 8, static_cast<std::int64_t>(max_kinds)}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// Delayed tasks spread over a day, run to completion by a simulation: the cost of the timing
+// wheels and of moving the clock from one deadline to the next.
+std::int64_t simulated{};
+
+class counted_task {
+public:
+    struct args {};
+
+    static std::string kind() { return "bench_simulated"; }
+    static squedl::bytes serialize(const args& /*arg*/) { return {}; }
+    static args deserialize(squedl::byte_view /*data*/) { return {}; }
+
+    std::optional<squedl::error> operator()(args /*arg*/) {
+        ++simulated;
+        return std::nullopt;
+    }
+};
+
+void BM_simulate_delayed(benchmark::State& state) {
+    using manual_bus = squedl::test_bus<squedl::manual_clock>;
+    auto count{state.range(0)};
+    std::minstd_rand rng{1};
+    std::uniform_int_distribution<std::int64_t> delay{0, std::chrono::nanoseconds{24h}.count()};
+
+    simulated = 0;
+    for (auto _ : state) {
+        manual_bus bus{1min};
+        squedl::scheduler scheduler{bus};
+        squedl::simulation sim{bus};
+        sim.work_on(counted_task{});
+        for (std::int64_t i{}; i < count; ++i)
+            scheduler.schedule<counted_task>(counted_task::args{},
+                                             std::chrono::nanoseconds{delay(rng)});
+        benchmark::DoNotOptimize(sim.run());
+        bus.stop();
+    }
+    state.SetItemsProcessed(simulated);
+}
+BENCHMARK(BM_simulate_delayed)
+    ->ArgNames({"tasks"})
+    ->Arg(1 << 20)
+    ->Unit(benchmark::kMillisecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,171 @@
+// Dequeue latency with many kinds, each drained by its own blocked consumer: from a put to the
+// consumer of that kind getting the message. Compares test_bus, whose kinds wake only their own
+// waiters, with a bus sharing one condition variable between all kinds, where notify_one may
+// wake a consumer of another kind while the right one sleeps until its timeout.
+//
+// usage: squedl_wakeup_latency [kinds] [messages]
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "squedl/metrics.hpp"
+#include "squedl/squedl.hpp"
+
+namespace {
+using namespace std::chrono_literals;
+using steady = std::chrono::steady_clock;
+
+constexpr auto consumer_timeout{10ms};
+constexpr auto put_interval{20us};
+
+std::int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               steady::now().time_since_epoch())
+        .count();
+}
+
+// All kinds behind one mutex and one condition variable.
+class shared_cv_bus {
+public:
+    explicit shared_cv_bus(size_t kinds) : queues(kinds) {};
+
+    void put(size_t kind, std::int64_t stamp) {
+        {
+            std::lock_guard<std::mutex> _{mtx};
+            queues[kind].push_back(stamp);
+        }
+        cv.notify_one();
+    };
+
+    bool next(size_t kind, std::int64_t& stamp) {
+        std::unique_lock lock{mtx};
+        cv.wait_for(lock, consumer_timeout,
+                    [this, kind] { return stopping || !queues[kind].empty(); });
+        if (queues[kind].empty())
+            return false;
+
+        stamp = queues[kind].front();
+        queues[kind].pop_front();
+        return true;
+    };
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> _{mtx};
+            stopping = true;
+        }
+        cv.notify_all();
+    };
+
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<std::deque<std::int64_t>> queues;
+    bool stopping{};
+};
+
+// Runs one consumer per kind and puts messages to random kinds, spaced so consumers are
+// asleep most of the time.
+squedl::histogram_snapshot measure(size_t kinds, size_t messages,
+                                   const std::function<void(size_t, std::int64_t)>& put,
+                                   const std::function<bool(size_t, std::int64_t&)>& next,
+                                   const std::function<void()>& stop) {
+    squedl::histogram latencies;
+    std::atomic<size_t> received{};
+    std::atomic<bool> done{};
+
+    std::vector<std::thread> consumers;
+    consumers.reserve(kinds);
+    for (size_t kind{}; kind < kinds; ++kind)
+        consumers.emplace_back([&, kind] {
+            std::int64_t stamp{};
+            while (!done) {
+                if (!next(kind, stamp))
+                    continue;
+                latencies.record(static_cast<std::uint64_t>(now_ns() - stamp));
+                ++received;
+            }
+        });
+
+    std::this_thread::sleep_for(50ms);
+    std::minstd_rand rng{42};
+    for (size_t i{}; i < messages; ++i) {
+        put(rng() % kinds, now_ns());
+        auto until{steady::now() + put_interval};
+        while (steady::now() < until)
+            std::this_thread::yield();
+    }
+
+    while (received != messages)
+        std::this_thread::sleep_for(1ms);
+    done = true;
+    stop();
+    for (auto& x : consumers)
+        x.join();
+
+    return latencies.snapshot();
+}
+
+void report(const char* name, const squedl::histogram_snapshot& result) {
+    std::printf("%-14s p50 %9.1f us  p99 %9.1f us  p99.9 %9.1f us  mean %9.1f us\n", name,
+                static_cast<double>(result.quantile(0.5)) / 1e3,
+                static_cast<double>(result.quantile(0.99)) / 1e3,
+                static_cast<double>(result.quantile(0.999)) / 1e3, result.mean() / 1e3);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t kinds{argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 64};
+    size_t messages{argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 20000};
+    if (kinds == 0 || messages == 0)
+        return 1;
+
+    std::printf("%zu kinds, %zu messages\n", kinds, messages);
+
+    {
+        shared_cv_bus bus{kinds};
+        report("shared cv",
+               measure(
+                   kinds, messages,
+                   [&bus](size_t kind, std::int64_t stamp) { bus.put(kind, stamp); },
+                   [&bus](size_t kind, std::int64_t& stamp) { return bus.next(kind, stamp); },
+                   [&bus] { bus.stop(); }));
+    }
+
+    {
+        squedl::test_bus<> bus{1min, true};
+        std::vector<squedl::kind_id> ids;
+        for (size_t kind{}; kind < kinds; ++kind)
+            ids.emplace_back("wakeup_latency_" + std::to_string(kind));
+
+        report("test_bus",
+               measure(
+                   kinds, messages,
+                   [&bus, &ids](size_t kind, std::int64_t stamp) {
+                       const auto* data{reinterpret_cast<const std::byte*>(&stamp)};
+                       bus.put(ids[kind], squedl::byte_view{data, sizeof(stamp)});
+                   },
+                   [&bus, &ids](size_t kind, std::int64_t& stamp) {
+                       auto batch{bus.next(ids[kind], 1, consumer_timeout)};
+                       if (!batch.has_value() || batch.value().empty())
+                           return false;
+                       std::memcpy(&stamp, batch.value().front().payload.data(), sizeof(stamp));
+                       return true;
+                   },
+                   [&bus] { bus.stop(); }));
+    }
+
+    return 0;
+}
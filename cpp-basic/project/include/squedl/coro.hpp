@@ -0,0 +1,282 @@
+#ifndef SQUEDL_CORO_HPP
+#define SQUEDL_CORO_HPP
+
+// Coroutine front end for the buses and worker_pool. It needs C++20 while the rest of squedl
+// stays on C++17, so everything here is inline and the header is empty for older standards.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "squedl/detail/event_count.hpp"
+#include "squedl/detail/mpmc_queue.hpp"
+#include "squedl/kind.hpp"
+#include "squedl/squedl.hpp"
+
+namespace squedl {
+namespace detail {
+
+template <typename T>
+struct task_result {
+    std::optional<T> value;
+
+    void return_value(T result) { value.emplace(std::move(result)); };
+    T take() { return std::move(value).value(); };
+};
+
+template <>
+struct task_result<void> {
+    void return_void() {};
+    void take() {};
+};
+
+// A coroutine nobody awaits: it starts right away and frees itself when it ends.
+struct detached {
+    struct promise_type {
+        detached get_return_object() noexcept { return {}; };
+        std::suspend_never initial_suspend() noexcept { return {}; };
+        std::suspend_never final_suspend() noexcept { return {}; };
+        void return_void() noexcept {};
+        void unhandled_exception() noexcept { std::terminate(); };
+    };
+};
+
+} // namespace detail
+
+// A coroutine that starts once awaited and hands control straight back to its awaiter when it
+// ends, through symmetric transfer rather than a nested resume. Exceptions travel to the
+// awaiter.
+template <typename T = void>
+class [[nodiscard]] task {
+public:
+    struct promise_type;
+    using handle = std::coroutine_handle<promise_type>;
+
+    struct promise_type : detail::task_result<T> {
+        std::coroutine_handle<> continuation{std::noop_coroutine()};
+        std::exception_ptr failure;
+
+        task get_return_object() noexcept { return task{handle::from_promise(*this)}; };
+        std::suspend_always initial_suspend() noexcept { return {}; };
+
+        auto final_suspend() noexcept {
+            struct resume_awaiter {
+                bool await_ready() noexcept { return false; };
+                std::coroutine_handle<> await_suspend(handle self) noexcept {
+                    return self.promise().continuation;
+                };
+                void await_resume() noexcept {};
+            };
+            return resume_awaiter{};
+        };
+
+        void unhandled_exception() noexcept { failure = std::current_exception(); };
+    };
+
+    task(task const& other) = delete;
+    task(task&& other) noexcept : self{std::exchange(other.self, {})} {};
+    task& operator=(task const& other) = delete;
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            destroy();
+            self = std::exchange(other.self, {});
+        }
+        return *this;
+    };
+    ~task() { destroy(); };
+
+    auto operator co_await() && noexcept {
+        struct awaiter {
+            handle self;
+
+            bool await_ready() noexcept { return self.done(); };
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                self.promise().continuation = awaiting;
+                return self;
+            };
+            T await_resume() {
+                if (self.promise().failure)
+                    std::rethrow_exception(self.promise().failure);
+                return self.promise().take();
+            };
+        };
+        return awaiter{self};
+    };
+
+    // Lets worker_pool run coroutine tasks: drives the task on its own and reports how it
+    // ended, an exception counting as an error.
+    void start(completion done) &&
+        requires std::is_same_v<T, std::optional<error>>
+    {
+        drive(std::move(*this), std::move(done));
+    };
+
+private:
+    handle self{};
+
+    explicit task(handle self) : self{self} {};
+
+    void destroy() {
+        if (self)
+            self.destroy();
+    };
+
+    static detail::detached drive(task work, completion done) {
+        std::optional<error> result{error{}};
+        try {
+            result = co_await std::move(work);
+        } catch (std::exception& e) {
+        }
+        done(std::move(result));
+    };
+}; // task
+
+// Resumes coroutines on a fixed set of threads. Coroutines waiting on a bus or anything else
+// hold no thread, so thousands of them can be in flight on a handful.
+class executor {
+public:
+    static constexpr size_t default_queue_capacity{4096};
+
+    explicit executor(size_t thread_count = std::thread::hardware_concurrency(),
+                      size_t queue_capacity = default_queue_capacity)
+        : queue{std::max<size_t>(queue_capacity, 1)} {
+        thread_count = std::max<size_t>(thread_count, 1);
+        threads.reserve(thread_count);
+        for (size_t i{}; i < thread_count; ++i)
+            threads.emplace_back([this] { run(); });
+    };
+
+    executor(executor const& other) = delete;
+    executor(executor&& other) = delete;
+    executor& operator=(executor const& other) = delete;
+    executor& operator=(executor&& other) = delete;
+    ~executor() { stop(); };
+
+    // Queues the coroutine for one of the threads. It runs on the calling thread instead when
+    // the queue is full or the executor stopped, so nothing posted is ever lost.
+    void post(std::coroutine_handle<> work) {
+        ++posting;
+        if (stopping || !queue.try_push(std::move(work))) {
+            --posting;
+            work.resume();
+            return;
+        }
+        --posting;
+        ready.notify_one();
+    };
+
+    // co_await schedule() moves the awaiting coroutine onto the executor.
+    auto schedule() noexcept {
+        struct awaiter {
+            executor* owner{};
+
+            bool await_ready() noexcept { return false; };
+            void await_suspend(std::coroutine_handle<> awaiting) { owner->post(awaiting); };
+            void await_resume() noexcept {};
+        };
+        return awaiter{this};
+    };
+
+    // Runs work on the executor with nobody awaiting it; an exception escaping it terminates,
+    // as one escaping a std::thread does.
+    template <typename T>
+    void spawn(task<T> work) {
+        run_detached(*this, std::move(work));
+    };
+
+    // Waits for the threads after they ran everything queued so far.
+    void stop() {
+        if (stopping.exchange(true))
+            return;
+
+        while (posting != 0)
+            std::this_thread::yield();
+        ready.notify_all();
+        for (auto& thread : threads)
+            if (thread.joinable())
+                thread.join();
+
+        std::coroutine_handle<> work{};
+        while (queue.try_pop(work))
+            work.resume();
+    };
+
+private:
+    detail::mpmc_queue<std::coroutine_handle<>> queue;
+    detail::event_count ready;
+    std::atomic<bool> stopping{};
+    // Posts that may have missed stopping; stop waits them out so none lands after the drain.
+    std::atomic<size_t> posting{};
+    std::vector<std::thread> threads;
+
+    void run() {
+        std::coroutine_handle<> work{};
+        for (;;) {
+            if (queue.try_pop(work)) {
+                work.resume();
+                continue;
+            }
+
+            auto ticket{ready.prepare_wait()};
+            if (queue.try_pop(work)) {
+                ready.cancel_wait();
+                work.resume();
+                continue;
+            }
+            if (stopping) {
+                ready.cancel_wait();
+                break;
+            }
+            ready.wait(ticket);
+        }
+    };
+
+    template <typename T>
+    static detail::detached run_detached(executor& owner, task<T> work) {
+        co_await owner.schedule();
+        co_await std::move(work);
+    };
+}; // executor
+
+// co_await next(bus, on, kind, count) suspends until the bus hands out up to count messages of
+// the kind and resumes on the executor. Like next_async it yields an empty batch after
+// interrupt(kind) and nullopt once the bus stops. Works with any bus that has next_async.
+template <typename Bus>
+auto next(Bus bus, executor& on, kind_id kind, size_t count) {
+    struct awaiter {
+        Bus bus;
+        executor* on{};
+        kind_id kind;
+        size_t count{};
+        std::optional<std::vector<typename Bus::delivery>> result;
+
+        bool await_ready() noexcept { return false; };
+        void await_suspend(std::coroutine_handle<> awaiting) {
+            // The receiver may resume the coroutine, and free this awaiter, before next_async
+            // returns, so the call must not run on the awaiter's own bus.
+            auto source{bus};
+            source.next_async(kind, count, [this, awaiting](auto batch) {
+                result = std::move(batch);
+                on->post(awaiting);
+            });
+        };
+        std::optional<std::vector<typename Bus::delivery>> await_resume() {
+            return std::move(result);
+        };
+    };
+    return awaiter{std::move(bus), &on, kind, count, std::nullopt};
+}
+
+} // namespace squedl
+
+#endif // __cpp_impl_coroutine
+
+#endif // SQUEDL_CORO_HPP
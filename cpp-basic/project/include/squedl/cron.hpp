@@ -0,0 +1,41 @@
+#ifndef SQUEDL_CRON_HPP
+#define SQUEDL_CRON_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace squedl {
+
+// A five-field cron expression, "minute hour day-of-month month day-of-week", evaluated in UTC.
+// Fields take *, numbers, ranges a-b, lists a,b,c and steps */n, a-b/n or a/n; months and days
+// of the week may also be named jan..dec and sun..sat, and 7 is Sunday as well as 0. As in cron,
+// when neither day field starts with * a day matching either of them matches. @yearly,
+// @monthly, @weekly, @daily and @hourly stand for the usual expressions.
+class cron_schedule {
+public:
+    // nullopt when expression is not valid.
+    static std::optional<cron_schedule> parse(std::string_view expression);
+
+    // The first matching minute strictly after after, both in seconds since the Unix epoch;
+    // nullopt when none comes within the next few decades, as for "0 0 30 2 *".
+    std::optional<std::chrono::seconds> next_after(std::chrono::seconds after) const;
+
+private:
+    cron_schedule() = default;
+
+    bool matches_day(std::int64_t days, unsigned day) const;
+
+    std::uint64_t minutes{};
+    std::uint32_t hours{};
+    // Bit d for day d of the month, m for month m and w for weekday w, Sunday being 0.
+    std::uint32_t days{};
+    std::uint16_t months{};
+    std::uint8_t weekdays{};
+    bool either_day{};
+};
+
+} // namespace squedl
+
+#endif // SQUEDL_CRON_HPP
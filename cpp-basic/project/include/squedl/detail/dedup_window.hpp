@@ -0,0 +1,170 @@
+#ifndef SQUEDL_DETAIL_DEDUP_WINDOW_HPP
+#define SQUEDL_DETAIL_DEDUP_WINDOW_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace squedl::detail {
+
+// Remembers 64-bit key hashes, each with a value, for at least window. Keys go into the newest
+// of a few generations, open addressing tables that take turns: every window / (generations -
+// 1) the oldest one is cleared and becomes the newest, so expiry costs nothing per key and a
+// lookup probes a fixed number of tables. A generation holding its share of max_keys is retired
+// early, so memory stays bounded and only a burst beyond max_keys within one window shortens
+// how long keys are remembered.
+template <typename Value, typename Clock>
+class dedup_window {
+public:
+    using time_point = typename Clock::time_point;
+    using duration = typename Clock::duration;
+
+    static constexpr size_t generations{4};
+
+    dedup_window(duration window, size_t max_keys)
+        : span{std::max(window / static_cast<int>(generations - 1), duration{1})},
+          window{window},
+          per_generation{std::max<size_t>(max_keys / (generations - 1), 1)} {};
+
+    // The value remembered under hash, if it was inserted within the window.
+    std::optional<Value> find(std::uint64_t hash, time_point now) const {
+        hash = nonzero(hash);
+        for (const auto& x : tables) {
+            if (!live(x, now))
+                continue;
+            if (const auto* found{x.find(hash)}; found != nullptr && found->live)
+                return found->value;
+        }
+        return std::nullopt;
+    };
+
+    void insert(std::uint64_t hash, Value value, time_point now) {
+        hash = nonzero(hash);
+        auto& newest{advance(now)};
+        newest.insert(hash, value, per_generation);
+    };
+
+    // Forgets hash if it still maps to value.
+    void erase(std::uint64_t hash, const Value& value) {
+        hash = nonzero(hash);
+        for (auto& x : tables)
+            if (auto* found{x.find(hash)}; found != nullptr && found->live &&
+                                           found->value == value)
+                found->live = false;
+    };
+
+private:
+    struct entry {
+        std::uint64_t hash{};
+        Value value{};
+        bool live{};
+    };
+
+    // Linear probing over a power-of-two array; a zero hash marks an empty slot. Erased keys
+    // leave their slot behind, reused when the same key comes back.
+    struct table {
+        std::vector<entry> slots;
+        size_t size{};
+        time_point started{};
+        bool used{};
+
+        entry* find(std::uint64_t hash) { return find_in(*this, hash); };
+        const entry* find(std::uint64_t hash) const { return find_in(*this, hash); };
+
+        template <typename Self>
+        static auto* find_in(Self& self, std::uint64_t hash) {
+            decltype(&self.slots[0]) result{};
+            if (self.slots.empty())
+                return result;
+
+            auto mask{self.slots.size() - 1};
+            for (auto i{static_cast<size_t>(hash) & mask};; i = (i + 1) & mask) {
+                if (self.slots[i].hash == hash)
+                    return &self.slots[i];
+                if (self.slots[i].hash == 0)
+                    return result;
+            }
+        };
+
+        void insert(std::uint64_t hash, const Value& value, size_t limit) {
+            if (auto* found{find(hash)}; found != nullptr) {
+                found->value = value;
+                found->live = true;
+                return;
+            }
+
+            if ((size + 1) * 2 > slots.size())
+                grow(std::min(slots.size() * 2, capacity_for(limit)));
+
+            auto mask{slots.size() - 1};
+            auto i{static_cast<size_t>(hash) & mask};
+            while (slots[i].hash != 0)
+                i = (i + 1) & mask;
+            slots[i] = entry{hash, value, true};
+            ++size;
+        };
+
+        void grow(size_t capacity) {
+            capacity = std::max<size_t>(capacity, 16);
+            if (capacity <= slots.size())
+                return;
+
+            std::vector<entry> old(capacity);
+            old.swap(slots);
+            auto mask{slots.size() - 1};
+            for (const auto& x : old) {
+                if (x.hash == 0)
+                    continue;
+                auto i{static_cast<size_t>(x.hash) & mask};
+                while (slots[i].hash != 0)
+                    i = (i + 1) & mask;
+                slots[i] = x;
+            }
+        };
+
+        // Keeps at least half of the slots empty for limit keys.
+        static size_t capacity_for(size_t limit) {
+            size_t result{16};
+            while (result < limit * 2)
+                result *= 2;
+            return result;
+        };
+
+        void reset(time_point now) {
+            std::fill(slots.begin(), slots.end(), entry{});
+            size = 0;
+            started = now;
+            used = true;
+        };
+    };
+
+    duration span;
+    duration window;
+    size_t per_generation{};
+    std::array<table, generations> tables{};
+    size_t newest{};
+
+    // Keys of a generation are at most span younger than its start.
+    bool live(const table& x, time_point now) const {
+        return x.used && now - x.started < window + span;
+    };
+
+    table& advance(time_point now) {
+        auto& current{tables[newest]};
+        if (current.used && now - current.started < span && current.size < per_generation)
+            return current;
+
+        newest = (newest + 1) % generations;
+        tables[newest].reset(now);
+        return tables[newest];
+    };
+
+    static std::uint64_t nonzero(std::uint64_t hash) { return hash == 0 ? 1 : hash; };
+};
+
+} // namespace squedl::detail
+
+#endif // SQUEDL_DETAIL_DEDUP_WINDOW_HPP
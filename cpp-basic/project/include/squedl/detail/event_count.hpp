@@ -0,0 +1,85 @@
+#ifndef SQUEDL_DETAIL_EVENT_COUNT_HPP
+#define SQUEDL_DETAIL_EVENT_COUNT_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace squedl::detail {
+
+// Blocking for lock-free structures: notifiers only touch the mutex when somebody is actually
+// asleep. A waiter calls prepare_wait(), re-checks its condition and then either cancel_wait()s
+// or wait()s on the returned key; any notify after prepare_wait() makes wait() return.
+class event_count {
+public:
+    using key = std::uint64_t;
+
+    key prepare_wait() {
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch.load(std::memory_order_acquire);
+    };
+
+    void cancel_wait() { waiters.fetch_sub(1, std::memory_order_seq_cst); };
+
+    template <typename TimePoint>
+    bool wait_until(key ticket, const TimePoint& deadline) {
+        std::unique_lock lock{mtx};
+        auto woken{cv.wait_until(lock, deadline, [this, ticket] {
+            return epoch.load(std::memory_order_acquire) != ticket;
+        })};
+        waiters.fetch_sub(1, std::memory_order_seq_cst);
+        return woken;
+    };
+
+    void wait(key ticket) {
+        std::unique_lock lock{mtx};
+        cv.wait(lock, [this, ticket] { return epoch.load(std::memory_order_acquire) != ticket; });
+        waiters.fetch_sub(1, std::memory_order_seq_cst);
+    };
+
+    void notify_one() {
+        if (bump())
+            cv.notify_one();
+    };
+
+    void notify_all() {
+        if (bump())
+            cv.notify_all();
+    };
+
+    // Wakes up to count sleepers, one per item made available, rather than all of them.
+    void notify(size_t count) {
+        if (count == 0 || !bump())
+            return;
+
+        if (count >= waiters.load(std::memory_order_relaxed)) {
+            cv.notify_all();
+            return;
+        }
+        for (size_t i{}; i < count; ++i)
+            cv.notify_one();
+    };
+
+private:
+    std::atomic<key> epoch{};
+    std::atomic<std::uint32_t> waiters{};
+    std::mutex mtx;
+    std::condition_variable cv;
+
+    bool bump() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_seq_cst) == 0)
+            return false;
+
+        std::lock_guard<std::mutex> _{mtx};
+        epoch.fetch_add(1, std::memory_order_release);
+        return true;
+    };
+};
+
+} // namespace squedl::detail
+
+#endif // SQUEDL_DETAIL_EVENT_COUNT_HPP
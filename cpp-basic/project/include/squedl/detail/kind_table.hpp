@@ -0,0 +1,93 @@
+#ifndef SQUEDL_DETAIL_KIND_TABLE_HPP
+#define SQUEDL_DETAIL_KIND_TABLE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <tuple>
+#include <utility>
+
+namespace squedl::detail {
+
+// Per-kind values indexed by kind_id::index(). Lookups are two atomic loads into a two-level
+// table; only inserting a kind for the first time and walking all of them take the mutex.
+// Values are never erased, so references stay valid for the lifetime of the table.
+template <typename T, std::size_t Capacity>
+class kind_table {
+public:
+    kind_table() = default;
+    kind_table(kind_table const& other) = delete;
+    kind_table(kind_table&& other) = delete;
+    kind_table& operator=(kind_table const& other) = delete;
+    kind_table& operator=(kind_table&& other) = delete;
+    ~kind_table() = default;
+
+    T* find(std::uint32_t index) const {
+        auto* found{chunks[index >> chunk_bits].load(std::memory_order_acquire)};
+        if (found == nullptr)
+            return nullptr;
+        return (*found)[index & chunk_mask].load(std::memory_order_acquire);
+    };
+
+    template <typename... Args>
+    T& get(std::uint32_t index, Args&&... args) {
+        if (auto* found{find(index)}; found != nullptr)
+            return *found;
+
+        std::unique_lock _{mtx};
+        if (auto* found{find(index)}; found != nullptr)
+            return *found;
+
+        auto& slot{chunks[index >> chunk_bits]};
+        auto* target{slot.load(std::memory_order_relaxed)};
+        if (target == nullptr) {
+            target = &owned_chunks.emplace_back();
+            slot.store(target, std::memory_order_release);
+        }
+
+        auto& added{values.emplace_back(std::piecewise_construct,
+                                        std::forward_as_tuple(index),
+                                        std::forward_as_tuple(std::forward<Args>(args)...))};
+        (*target)[index & chunk_mask].store(&added.second, std::memory_order_release);
+        return added.second;
+    };
+
+    // Calls fn(index, value) for every value, in insertion order, while inserts wait.
+    template <typename Fn>
+    void for_each(Fn&& fn) {
+        std::shared_lock _{mtx};
+        for (auto& [index, value] : values)
+            fn(index, value);
+    };
+
+    template <typename Pred>
+    bool all_of(Pred&& pred) {
+        std::shared_lock _{mtx};
+        for (auto& [index, value] : values)
+            if (!pred(index, value))
+                return false;
+        return true;
+    };
+
+private:
+    static constexpr std::size_t chunk_bits{6};
+    static constexpr std::size_t chunk_size{std::size_t{1} << chunk_bits};
+    static constexpr std::size_t chunk_mask{chunk_size - 1};
+    static constexpr std::size_t chunk_count{(Capacity + chunk_size - 1) / chunk_size};
+
+    using chunk = std::array<std::atomic<T*>, chunk_size>;
+
+    std::array<std::atomic<chunk*>, chunk_count> chunks{};
+    std::shared_mutex mtx;
+    std::deque<chunk> owned_chunks;
+    std::deque<std::pair<const std::uint32_t, T>> values;
+};
+
+} // namespace squedl::detail
+
+#endif // SQUEDL_DETAIL_KIND_TABLE_HPP
@@ -0,0 +1,108 @@
+#ifndef SQUEDL_DETAIL_MPMC_QUEUE_HPP
+#define SQUEDL_DETAIL_MPMC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace squedl::detail {
+
+inline constexpr std::size_t cache_line_size{64};
+
+// Bounded lock-free multi-producer/multi-consumer ring (Vyukov). Every cell carries a sequence
+// number telling producers and consumers whose turn it is, so a push or pop is one CAS on the
+// shared position plus a release store on the cell. Capacity is rounded up to a power of two.
+template <typename T>
+class mpmc_queue {
+public:
+    explicit mpmc_queue(std::size_t capacity)
+        : mask{round_up(capacity) - 1}, cells{std::make_unique<cell[]>(mask + 1)} {
+        for (std::size_t i{}; i <= mask; ++i)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+    };
+
+    mpmc_queue(mpmc_queue const& other) = delete;
+    mpmc_queue(mpmc_queue&& other) = delete;
+    mpmc_queue& operator=(mpmc_queue const& other) = delete;
+    mpmc_queue& operator=(mpmc_queue&& other) = delete;
+    ~mpmc_queue() = default;
+
+    // Leaves value untouched when the ring is full.
+    bool try_push(T&& value) {
+        std::size_t at{};
+        auto* slot{claim(enqueue_pos, 0, at)};
+        if (slot == nullptr)
+            return false;
+
+        slot->value = std::move(value);
+        slot->seq.store(at + 1, std::memory_order_release);
+        return true;
+    };
+
+    bool try_pop(T& value) {
+        std::size_t at{};
+        auto* slot{claim(dequeue_pos, 1, at)};
+        if (slot == nullptr)
+            return false;
+
+        value = std::move(slot->value);
+        slot->seq.store(at + mask + 1, std::memory_order_release);
+        return true;
+    };
+
+    // Approximate under concurrent use.
+    std::size_t size() const {
+        auto head{dequeue_pos.load(std::memory_order_acquire)};
+        auto tail{enqueue_pos.load(std::memory_order_acquire)};
+        return tail > head ? tail - head : 0;
+    };
+
+    bool empty() const { return size() == 0; };
+
+    std::size_t capacity() const { return mask + 1; };
+
+private:
+    struct cell {
+        std::atomic<std::size_t> seq;
+        T value;
+    };
+
+    alignas(cache_line_size) std::atomic<std::size_t> enqueue_pos{};
+    alignas(cache_line_size) std::atomic<std::size_t> dequeue_pos{};
+    alignas(cache_line_size) std::size_t mask;
+    std::unique_ptr<cell[]> cells;
+
+    // Wins the cell at pos for this thread, or returns nullptr when the ring is full (producer)
+    // or empty (consumer). lag is how far the cell sequence runs ahead of pos when it is ready.
+    cell* claim(std::atomic<std::size_t>& pos, std::size_t lag, std::size_t& at) {
+        auto current{pos.load(std::memory_order_relaxed)};
+        for (;;) {
+            auto& slot{cells[current & mask]};
+            auto seq{slot.seq.load(std::memory_order_acquire)};
+            auto diff{static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(current + lag)};
+
+            if (diff == 0) {
+                if (pos.compare_exchange_weak(current, current + 1, std::memory_order_relaxed)) {
+                    at = current;
+                    return &slot;
+                }
+            } else if (diff < 0) {
+                return nullptr;
+            } else {
+                current = pos.load(std::memory_order_relaxed);
+            }
+        }
+    };
+
+    static std::size_t round_up(std::size_t capacity) {
+        std::size_t result{2};
+        while (result < capacity)
+            result <<= 1;
+        return result;
+    };
+};
+
+} // namespace squedl::detail
+
+#endif // SQUEDL_DETAIL_MPMC_QUEUE_HPP
@@ -0,0 +1,177 @@
+#ifndef SQUEDL_DETAIL_NET_WIRE_HPP
+#define SQUEDL_DETAIL_NET_WIRE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "squedl/payload.hpp"
+
+namespace squedl::detail {
+
+// Protocol between net_bus and net_server. Integers are sent in host byte order, so both ends
+// must share it. Every frame is
+//
+//   [u32 size of what follows][u8 op or status][u64 tag][body]
+//
+// and a response carries the tag of its request; one tagged net_unanswered_tag is fire and
+// forget and gets no response at all, not even an error. Requests are pipelined: a client sends
+// more before earlier ones are answered, and a blocked next does not hold up anything behind it,
+// so responses can come back in any order. Both ends write whatever frames piled up meanwhile
+// with a single send.
+//
+// Request bodies, all but empty starting with [u16 kind size][kind]:
+//   put            [i64 after ns][u8 priority][u16 key size][key][payload]
+//   put_many       [i64 after ns][u8 priority][u32 count][u32 end]... [payloads back to back]
+//   next           [u32 count][i64 timeout ns]
+//   ack, nack,
+//   reject         [u32 count][u32 index][u32 generation]...
+//   interrupt, enqueued_size, delayed_size, unacked_size: nothing more
+//
+// Response bodies when ok:
+//   put            [u64 id]
+//   put_many       [u32 count][u64 id]...
+//   next           [u32 count] then [u64 id][u32 index][u32 generation][u32 size][payload]...
+//   ack, reject    [u32 settled]
+//   *_size         [u64 size]
+//   empty          [u8 empty]
+enum class net_op : std::uint8_t {
+    put = 1,
+    put_many,
+    next,
+    ack,
+    nack,
+    reject,
+    interrupt,
+    enqueued_size,
+    delayed_size,
+    unacked_size,
+    empty,
+};
+
+enum class net_status : std::uint8_t { ok = 0, refused, stopped, malformed };
+
+constexpr size_t net_header_size{sizeof(std::uint32_t) + sizeof(std::uint8_t) +
+                                 sizeof(std::uint64_t)};
+// Tags requests that want no response, such as the acks and nacks of settle.
+constexpr std::uint64_t net_unanswered_tag{0};
+// Larger frames are taken for garbage and end the connection.
+constexpr size_t net_max_frame{size_t{256} << 20};
+
+// Appends frames to a buffer; the size field is filled in by finish.
+class frame_writer {
+public:
+    frame_writer(bytes& out, std::uint8_t code, std::uint64_t tag) : out{out}, start{out.size()} {
+        out.resize(start + net_header_size);
+        auto* at{out.data() + start + sizeof(std::uint32_t)};
+        std::memcpy(at, &code, sizeof(code));
+        std::memcpy(at + sizeof(code), &tag, sizeof(tag));
+    };
+
+    template <typename T>
+    frame_writer& pod(T value) {
+        const auto* data{reinterpret_cast<const std::byte*>(&value)};
+        out.insert(out.end(), data, data + sizeof(value));
+        return *this;
+    };
+
+    frame_writer& raw(byte_view data) {
+        out.insert(out.end(), data.begin(), data.end());
+        return *this;
+    };
+
+    frame_writer& str(std::string_view text) {
+        pod(static_cast<std::uint16_t>(text.size()));
+        const auto* data{reinterpret_cast<const std::byte*>(text.data())};
+        return raw(byte_view{data, text.size()});
+    };
+
+    // Whether the frame so far is small enough for the other side to take.
+    bool fits() const { return out.size() - start - sizeof(std::uint32_t) <= net_max_frame; };
+
+    // Takes the frame back out of the buffer.
+    void discard() { out.resize(start); };
+
+    void finish() {
+        auto size{static_cast<std::uint32_t>(out.size() - start - sizeof(std::uint32_t))};
+        std::memcpy(out.data() + start, &size, sizeof(size));
+    };
+
+private:
+    bytes& out;
+    size_t start{};
+};
+
+// Reads a frame body front to back; reading past its end makes it bad instead.
+class frame_reader {
+public:
+    explicit frame_reader(byte_view body) : at{body.data()}, end{body.data() + body.size()} {};
+
+    template <typename T>
+    T pod() {
+        T result{};
+        if (static_cast<size_t>(end - at) < sizeof(T)) {
+            failed = true;
+            return result;
+        }
+        std::memcpy(&result, at, sizeof(T));
+        at += sizeof(T);
+        return result;
+    };
+
+    byte_view raw(size_t size) {
+        if (static_cast<size_t>(end - at) < size) {
+            failed = true;
+            return {};
+        }
+        byte_view result{at, size};
+        at += size;
+        return result;
+    };
+
+    std::string_view str() {
+        auto data{raw(pod<std::uint16_t>())};
+        return {reinterpret_cast<const char*>(data.data()), data.size()};
+    };
+
+    byte_view rest() { return raw(static_cast<size_t>(end - at)); };
+
+    bool bad() const { return failed; };
+
+private:
+    const std::byte* at{};
+    const std::byte* end{};
+    bool failed{};
+};
+
+// Splits complete frames off the front of buffer, calling fn(code, tag, body) for each, and
+// drops them; returns false on a frame too large to be real.
+template <typename Fn>
+bool for_each_frame(bytes& buffer, Fn&& fn) {
+    size_t offset{};
+    while (buffer.size() - offset >= net_header_size) {
+        std::uint32_t size{};
+        std::memcpy(&size, buffer.data() + offset, sizeof(size));
+        if (size > net_max_frame || size < net_header_size - sizeof(size))
+            return false;
+        if (buffer.size() - offset < sizeof(size) + size)
+            break;
+
+        const auto* frame{buffer.data() + offset + sizeof(size)};
+        std::uint8_t code{};
+        std::uint64_t tag{};
+        std::memcpy(&code, frame, sizeof(code));
+        std::memcpy(&tag, frame + sizeof(code), sizeof(tag));
+        auto body_size{size - sizeof(code) - sizeof(tag)};
+        fn(code, tag, byte_view{frame + sizeof(code) + sizeof(tag), body_size});
+        offset += sizeof(size) + size;
+    }
+    buffer.erase(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(offset));
+    return true;
+}
+
+} // namespace squedl::detail
+
+#endif // SQUEDL_DETAIL_NET_WIRE_HPP
@@ -0,0 +1,300 @@
+#ifndef SQUEDL_DETAIL_TIMING_WHEEL_HPP
+#define SQUEDL_DETAIL_TIMING_WHEEL_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace squedl::detail {
+
+// Stable reference to a slab entry; the generation makes handles to released entries stale.
+struct slab_handle {
+    static constexpr std::uint32_t npos{std::numeric_limits<std::uint32_t>::max()};
+
+    std::uint32_t index{npos};
+    std::uint32_t generation{};
+};
+
+// Hierarchical timing wheel. Entries live in a slab and are threaded into per-slot intrusive
+// lists, so insert and cancel are O(1) and never allocate once the slab has grown. Level 0 has
+// one slot per resolution tick; every further level is coarser by 64x and is cascaded down when
+// the lower level wraps. Exact deadlines are kept, so expiry is precise regardless of resolution.
+template <typename T, typename Clock>
+class timing_wheel {
+public:
+    using time_point = typename Clock::time_point;
+    using duration = typename Clock::duration;
+
+    using handle = slab_handle;
+
+    timing_wheel(duration resolution, time_point origin)
+        : resolution{std::max(resolution, duration{1})}, origin{origin} {
+        heads.fill(npos);
+        tails.fill(npos);
+    };
+
+    handle insert(time_point at, T&& value) {
+        auto index{allocate()};
+        auto& entry{nodes[index]};
+        entry.at = at;
+        entry.value = std::move(value);
+        link(index);
+        ++count;
+
+        return handle{index, entry.generation};
+    };
+
+    std::optional<T> cancel(handle entry) {
+        if (!contains(entry))
+            return std::nullopt;
+
+        unlink(entry.index);
+        std::optional<T> result{std::move(nodes[entry.index].value)};
+        release(entry.index);
+
+        return result;
+    };
+
+    bool contains(handle entry) const {
+        return entry.index < nodes.size() && nodes[entry.index].slot != npos &&
+               nodes[entry.index].generation == entry.generation;
+    };
+
+    // Hands every entry due at now to fn(T&&), in deadline-slot order.
+    template <typename F>
+    size_t expire(time_point now, F&& fn) {
+        auto target{ticks_of(now)};
+        size_t result{};
+
+        while (current < target) {
+            if (count == 0) {
+                current = target;
+                break;
+            }
+
+            result += drain(current & level0_mask, time_point::max(), fn);
+
+            // Nothing happens before the next occupied level 0 slot or the next cascade of an
+            // occupied coarser slot, so a long jump of the clock skips straight to either.
+            auto next{next_occupied(1).value_or(target)};
+            if (next > (current | level0_mask) + 1)
+                next = std::min(next, next_cascade().value_or(next));
+            current = std::min(next, target);
+            if ((current & level0_mask) == 0)
+                cascade();
+        }
+
+        result += drain(current & level0_mask, now, fn);
+
+        return result;
+    };
+
+    // Earliest exact deadline among the nearest level 0 entries, or the time the nearest coarser
+    // slot is cascaded, whichever comes first. Never later than the true earliest deadline.
+    std::optional<time_point> next_deadline() const {
+        std::optional<time_point> result{};
+        if (count == 0)
+            return result;
+
+        if (auto slot{next_occupied(0)}; slot.has_value())
+            for (auto entry{heads[*slot & level0_mask]}; entry != npos; entry = nodes[entry].next)
+                if (!result || nodes[entry].at < *result)
+                    result = nodes[entry].at;
+
+        if (auto ticks{next_cascade()}; ticks.has_value()) {
+            auto cascade_at{time_of(*ticks)};
+            if (!result || cascade_at < *result)
+                result = cascade_at;
+        }
+
+        return result;
+    };
+
+    size_t size() const { return count; };
+    bool empty() const { return count == 0; };
+
+private:
+    static constexpr std::uint32_t npos{slab_handle::npos};
+    static constexpr size_t level0_bits{8};
+    static constexpr size_t level_bits{6};
+    static constexpr size_t levels{5};
+    static constexpr std::uint64_t level0_mask{(1U << level0_bits) - 1};
+    static constexpr std::uint64_t level_mask{(1U << level_bits) - 1};
+    static constexpr size_t slot_count{(level0_mask + 1) + (levels - 1) * (level_mask + 1)};
+
+    struct node {
+        T value{};
+        time_point at{};
+        std::uint32_t prev{npos};
+        std::uint32_t next{npos};
+        std::uint32_t slot{npos};
+        std::uint32_t generation{};
+    };
+
+    duration resolution;
+    time_point origin;
+    std::uint64_t current{};
+    size_t count{};
+
+    std::vector<node> nodes;
+    std::uint32_t free_head{npos};
+    std::array<std::uint32_t, slot_count> heads{};
+    std::array<std::uint32_t, slot_count> tails{};
+
+    static constexpr size_t shift(size_t level) {
+        return level == 0 ? 0 : level0_bits + (level - 1) * level_bits;
+    };
+
+    static constexpr size_t base(size_t level) {
+        return level == 0 ? 0 : (level0_mask + 1) + (level - 1) * (level_mask + 1);
+    };
+
+    static constexpr std::uint64_t span(size_t level) {
+        return std::uint64_t{1} << (level0_bits + level * level_bits);
+    };
+
+    std::uint64_t ticks_of(time_point at) const {
+        if (at <= origin)
+            return 0;
+        return static_cast<std::uint64_t>((at - origin) / resolution);
+    };
+
+    time_point time_of(std::uint64_t ticks) const {
+        return origin + resolution * static_cast<typename duration::rep>(ticks);
+    };
+
+    size_t slot_of(time_point at) const {
+        auto ticks{std::max(ticks_of(at), current)};
+        if (ticks - current >= span(levels - 1))
+            ticks = current + span(levels - 1) - 1;
+
+        size_t level{};
+        while (ticks - current >= span(level))
+            ++level;
+
+        auto mask{level == 0 ? level0_mask : level_mask};
+        return base(level) + ((ticks >> shift(level)) & mask);
+    };
+
+    // The tick of the nearest occupied level 0 slot, looking from first ticks after current on.
+    std::optional<std::uint64_t> next_occupied(std::uint64_t first) const {
+        for (auto i{first}; i <= level0_mask; ++i)
+            if (heads[(current + i) & level0_mask] != npos)
+                return current + i;
+        return std::nullopt;
+    };
+
+    // The tick at which the nearest occupied coarser slot is cascaded.
+    std::optional<std::uint64_t> next_cascade() const {
+        std::optional<std::uint64_t> result{};
+        for (size_t level{1}; level < levels; ++level) {
+            auto window{current >> shift(level)};
+            for (std::uint64_t k{1}; k <= level_mask + 1; ++k) {
+                if (heads[base(level) + ((window + k) & level_mask)] == npos)
+                    continue;
+
+                auto ticks{(window + k) << shift(level)};
+                if (!result || ticks < *result)
+                    result = ticks;
+                break;
+            }
+        }
+        return result;
+    };
+
+    std::uint32_t allocate() {
+        if (free_head == npos) {
+            nodes.emplace_back();
+            return static_cast<std::uint32_t>(nodes.size() - 1);
+        }
+
+        auto index{free_head};
+        free_head = nodes[index].next;
+        return index;
+    };
+
+    void release(std::uint32_t index) {
+        auto& entry{nodes[index]};
+        entry.value = T{};
+        entry.slot = npos;
+        entry.prev = npos;
+        entry.next = free_head;
+        ++entry.generation;
+        free_head = index;
+        --count;
+    };
+
+    void link(std::uint32_t index) {
+        auto& entry{nodes[index]};
+        auto slot{static_cast<std::uint32_t>(slot_of(entry.at))};
+
+        entry.slot = slot;
+        entry.next = npos;
+        entry.prev = tails[slot];
+        if (tails[slot] != npos)
+            nodes[tails[slot]].next = index;
+        else
+            heads[slot] = index;
+        tails[slot] = index;
+    };
+
+    void unlink(std::uint32_t index) {
+        auto& entry{nodes[index]};
+        if (entry.prev != npos)
+            nodes[entry.prev].next = entry.next;
+        else
+            heads[entry.slot] = entry.next;
+
+        if (entry.next != npos)
+            nodes[entry.next].prev = entry.prev;
+        else
+            tails[entry.slot] = entry.prev;
+    };
+
+    template <typename F>
+    size_t drain(size_t slot, time_point limit, F& fn) {
+        size_t result{};
+        auto entry{heads[slot]};
+        while (entry != npos) {
+            auto next{nodes[entry].next};
+            if (nodes[entry].at <= limit) {
+                unlink(entry);
+                fn(std::move(nodes[entry].value));
+                release(entry);
+                ++result;
+            }
+            entry = next;
+        }
+
+        return result;
+    };
+
+    // Re-files the coarser slots whose window has just become current.
+    void cascade() {
+        for (size_t level{1}; level < levels; ++level) {
+            auto index{(current >> shift(level)) & level_mask};
+            auto slot{base(level) + index};
+
+            auto entry{heads[slot]};
+            heads[slot] = npos;
+            tails[slot] = npos;
+            while (entry != npos) {
+                auto next{nodes[entry].next};
+                link(entry);
+                entry = next;
+            }
+
+            if (index != 0)
+                break;
+        }
+    };
+};
+
+} // namespace squedl::detail
+
+#endif // SQUEDL_DETAIL_TIMING_WHEEL_HPP
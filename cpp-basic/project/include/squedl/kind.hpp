@@ -0,0 +1,88 @@
+#ifndef SQUEDL_KIND_HPP
+#define SQUEDL_KIND_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace squedl {
+
+using kind = std::string;
+
+namespace detail {
+
+// 64-bit FNV-1a; constexpr so constant kind names are hashed at compile time.
+constexpr std::uint64_t hash_kind(std::string_view name) {
+    std::uint64_t result{0xcbf29ce484222325ULL};
+    for (char c : name) {
+        result ^= static_cast<unsigned char>(c);
+        result *= 0x100000001b3ULL;
+    }
+    return result;
+}
+
+template <typename T, typename = void>
+inline constexpr bool has_constexpr_kind_v = false;
+
+template <typename T>
+inline constexpr bool has_constexpr_kind_v<
+    T, std::void_t<std::integral_constant<std::uint64_t, hash_kind(T::kind())>>> = true;
+
+} // namespace detail
+
+// Process-wide interned kind name. Ids are dense, starting at zero, and never reused, so per-kind
+// state can live in flat tables indexed by them instead of maps keyed by strings.
+class kind_id {
+public:
+    static constexpr std::size_t max_count{std::size_t{1} << 16};
+
+    // Implicit so that plain kind names keep working wherever a kind_id is expected; every such
+    // conversion hashes the name and looks it up, so hot paths should hold on to the id instead.
+    kind_id(std::string_view name) : kind_id{name, detail::hash_kind(name)} {};
+    kind_id(const kind& name) : kind_id{std::string_view{name}} {};
+    kind_id(const char* name) : kind_id{std::string_view{name}} {};
+
+    // The id of name when it was interned already, without interning it; for names from
+    // untrusted sources, which could otherwise use up max_count.
+    static std::optional<kind_id> find(std::string_view name);
+
+    // Interned once per task type; the name is hashed at compile time when T::kind() is
+    // constexpr.
+    template <typename T>
+    static kind_id of() {
+        static const kind_id id{intern<T>()};
+        return id;
+    };
+
+    std::uint32_t index() const { return value; };
+    std::string_view name() const;
+
+    friend bool operator==(kind_id lhs, kind_id rhs) { return lhs.value == rhs.value; };
+    friend bool operator!=(kind_id lhs, kind_id rhs) { return lhs.value != rhs.value; };
+
+private:
+    std::uint32_t value{};
+
+    kind_id(std::string_view name, std::uint64_t hash);
+
+    struct index_tag {};
+    kind_id(index_tag /*tag*/, std::uint32_t value) : value{value} {};
+
+    template <typename T>
+    static kind_id intern() {
+        if constexpr (detail::has_constexpr_kind_v<T>) {
+            constexpr auto hash{detail::hash_kind(T::kind())};
+            return kind_id{T::kind(), hash};
+        } else {
+            const auto& name{T::kind()};
+            return kind_id{std::string_view{name}};
+        }
+    };
+};
+
+} // namespace squedl
+
+#endif // SQUEDL_KIND_HPP
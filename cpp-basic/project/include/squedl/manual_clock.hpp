@@ -0,0 +1,58 @@
+#ifndef SQUEDL_MANUAL_CLOCK_HPP
+#define SQUEDL_MANUAL_CLOCK_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ratio>
+#include <type_traits>
+#include <utility>
+
+namespace squedl {
+
+// A clock that stands still until told to move, for tests and simulations that must not depend
+// on wall time. Like any clock its now() is static, so all its users share one time; it only
+// ever moves forward, since timing wheels built on it would not survive going back.
+class manual_clock {
+public:
+    using rep = std::int64_t;
+    using period = std::nano;
+    using duration = std::chrono::nanoseconds;
+    using time_point = std::chrono::time_point<manual_clock>;
+    static constexpr bool is_steady{true};
+
+    static time_point now() noexcept {
+        return time_point{duration{ticks.load(std::memory_order_acquire)}};
+    };
+
+    static void advance(duration span) {
+        if (span > duration::zero())
+            ticks.fetch_add(span.count(), std::memory_order_acq_rel);
+    };
+
+    // Does nothing when at has already passed.
+    static void advance_to(time_point at) {
+        auto target{at.time_since_epoch().count()};
+        auto current{ticks.load(std::memory_order_relaxed)};
+        while (current < target &&
+               !ticks.compare_exchange_weak(current, target, std::memory_order_acq_rel)) {
+        }
+    };
+
+private:
+    inline static std::atomic<rep> ticks{};
+};
+
+// A test_bus on a clock like this runs no timer thread: delayed messages mature and unacked ones
+// time out only when someone calls run_due, next or try_next.
+template <typename Clock, typename = void>
+inline constexpr bool is_manual_clock_v = false;
+
+template <typename Clock>
+inline constexpr bool is_manual_clock_v<
+    Clock, std::void_t<decltype(Clock::advance_to(std::declval<typename Clock::time_point>()))>> =
+    true;
+
+} // namespace squedl
+
+#endif // SQUEDL_MANUAL_CLOCK_HPP
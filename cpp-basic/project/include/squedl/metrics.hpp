@@ -0,0 +1,119 @@
+#ifndef SQUEDL_METRICS_HPP
+#define SQUEDL_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace squedl {
+
+// Counts of a histogram taken at one moment; counts[i] covers histogram::lower_bound(i) up to
+// histogram::upper_bound(i).
+struct histogram_snapshot {
+    std::vector<std::uint64_t> counts;
+    std::uint64_t count{};
+    std::uint64_t sum{};
+
+    // Upper bound of the bucket holding the q-quantile, q in [0, 1]; 0 when empty.
+    std::uint64_t quantile(double q) const;
+    double mean() const { return count == 0 ? 0.0 : static_cast<double>(sum) / count; };
+};
+
+// Log-linear histogram of nanoseconds in the spirit of HdrHistogram: every power of two is split
+// into sub_buckets equal buckets, so any value is off by less than 1/sub_buckets. Recording is
+// a few relaxed atomic increments.
+class histogram {
+public:
+    static constexpr size_t sub_bucket_bits{4};
+    static constexpr size_t sub_buckets{size_t{1} << sub_bucket_bits};
+    static constexpr size_t bucket_count{(64 - sub_bucket_bits + 1) * sub_buckets};
+
+    void record(std::uint64_t value) {
+        counts[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+    };
+
+    template <typename Rep, typename Period>
+    void record(std::chrono::duration<Rep, Period> value) {
+        auto nanos{std::chrono::duration_cast<std::chrono::nanoseconds>(value).count()};
+        record(static_cast<std::uint64_t>(nanos < 0 ? 0 : nanos));
+    };
+
+    histogram_snapshot snapshot() const;
+
+    static size_t bucket_of(std::uint64_t value) {
+        if (value < sub_buckets)
+            return static_cast<size_t>(value);
+
+        auto exponent{highest_bit(value)};
+        auto top{static_cast<size_t>(value >> (exponent - sub_bucket_bits))};
+        return (exponent - sub_bucket_bits + 1) * sub_buckets + top - sub_buckets;
+    };
+
+    static std::uint64_t lower_bound(size_t bucket);
+    static std::uint64_t upper_bound(size_t bucket);
+
+private:
+    std::array<std::atomic<std::uint64_t>, bucket_count> counts{};
+    std::atomic<std::uint64_t> sum{};
+
+    static size_t highest_bit(std::uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<size_t>(63 - __builtin_clzll(value));
+#else
+        size_t result{};
+        while (value >>= 1U)
+            ++result;
+        return result;
+#endif
+    };
+};
+
+// What a bus did with the messages of one kind, since it was created.
+struct bus_counters {
+    std::uint64_t put{};
+    std::uint64_t delivered{};
+    std::uint64_t acked{};
+    std::uint64_t nacked{};
+    // Deliveries that timed out unacked.
+    std::uint64_t redelivered{};
+    // Messages out of attempts, moved to the dead letter kind or dropped.
+    std::uint64_t dead_lettered{};
+    // Puts turned away by a full kind.
+    std::uint64_t refused{};
+    // Ready messages dropped to make room under overflow_policy::drop_oldest.
+    std::uint64_t dropped{};
+    // Puts skipped for repeating an idempotency key.
+    std::uint64_t deduplicated{};
+};
+
+struct kind_stats {
+    std::string kind;
+    bus_counters counters;
+    size_t enqueued{};
+    size_t delayed{};
+    size_t unacked{};
+    // From becoming ready, by put, delay, nack or timeout, to being handed out.
+    histogram_snapshot wait;
+};
+
+struct work_stats {
+    std::string kind;
+    std::uint64_t succeeded{};
+    std::uint64_t failed{};
+    size_t in_flight{};
+    // From a task being called to its job finishing, asynchronous tasks included.
+    histogram_snapshot execution;
+};
+
+// Prometheus text exposition format, ready to be served on a /metrics endpoint.
+std::string to_prometheus(const std::vector<kind_stats>& stats);
+std::string to_prometheus(const std::vector<work_stats>& stats);
+
+} // namespace squedl
+
+#endif // SQUEDL_METRICS_HPP
@@ -0,0 +1,133 @@
+#ifndef SQUEDL_NET_BUS_HPP
+#define SQUEDL_NET_BUS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "squedl/kind.hpp"
+#include "squedl/payload.hpp"
+#include "squedl/squedl.hpp"
+
+namespace squedl {
+
+// A bus whose messages live in a net_server, reached over one TCP connection; producers and
+// workers on other hosts share the server's test_bus through it. Calls from any number of
+// threads are pipelined on the connection, and frames queued while a send is underway go out
+// together with the next one. A single ack or reject waits for the server, since it reports
+// whether the delivery was still in flight; ack_many, nack and nack_many are not waited for.
+//
+// Interrupting a kind ends the blocked nexts of this client right away, and those of every other
+// client of the server on that kind with an empty batch. stop() closes the connection; messages
+// this client took and did not settle are redelivered once their ack timeout passes on the
+// server.
+class net_bus {
+public:
+    using id_t = std::uint64_t;
+    using clock = std::chrono::system_clock;
+    using duration = clock::duration;
+    using time_point = clock::time_point;
+    using handle_t = detail::slab_handle;
+
+    struct delivery {
+        id_t id{};
+        squedl::payload payload;
+        handle_t handle{};
+    };
+
+    // Connects to a net_server; throws std::system_error when it cannot.
+    net_bus(const std::string& host, std::uint16_t port);
+
+    expected<id_t> put(kind_id kind, byte_view payload, duration after = duration::zero(),
+                       priority prio = priority::normal, std::string_view idempotency_key = {});
+
+    expected<id_t> put(kind_id kind, const squedl::payload& payload,
+                       duration after = duration::zero(), priority prio = priority::normal,
+                       std::string_view idempotency_key = {}) {
+        return put(kind, payload.view(), after, prio, idempotency_key);
+    };
+
+    // All or none, in one frame.
+    template <typename Payloads>
+    expected<std::vector<id_t>> put_many(kind_id kind, const Payloads& payloads,
+                                         duration after = duration::zero(),
+                                         priority prio = priority::normal) {
+        std::vector<byte_view> views{};
+        for (const auto& x : payloads) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(x)>, squedl::payload>)
+                views.push_back(x.view());
+            else
+                views.emplace_back(byte_view{x});
+        }
+        return put_views(kind, views.data(), views.size(), after, prio);
+    };
+
+    expected<std::vector<id_t>> put_many(kind_id kind, byte_view buffer,
+                                         const std::vector<size_t>& ends,
+                                         duration after = duration::zero(),
+                                         priority prio = priority::normal) {
+        if (!detail::valid_ends(ends, buffer.size()))
+            return unexpected{error{}};
+
+        std::vector<byte_view> views{};
+        views.reserve(ends.size());
+        size_t begin{};
+        for (auto end : ends) {
+            views.emplace_back(buffer.data() + begin, end - begin);
+            begin = end;
+        }
+        return put_views(kind, views.data(), views.size(), after, prio);
+    };
+
+    // Blocks until messages of the kind are ready, timeout passes (zero waits indefinitely) or
+    // the kind is interrupted; returns nullopt once this bus stopped or lost the server.
+    std::optional<std::vector<delivery>> next(kind_id kind, size_t count,
+                                              duration timeout = duration::zero());
+
+    // Returns false when the delivery was no longer in flight, e.g. it had timed out.
+    bool ack(kind_id kind, handle_t handle);
+    void nack(kind_id kind, handle_t handle) { settle(kind, &handle, 1, false); };
+    bool reject(kind_id kind, handle_t handle);
+
+    template <typename Handles>
+    void ack_many(kind_id kind, const Handles& handles) {
+        std::vector<handle_t> all{std::begin(handles), std::end(handles)};
+        settle(kind, all.data(), all.size(), true);
+    };
+
+    template <typename Handles>
+    void nack_many(kind_id kind, const Handles& handles) {
+        std::vector<handle_t> all{std::begin(handles), std::end(handles)};
+        settle(kind, all.data(), all.size(), false);
+    };
+
+    void interrupt(kind_id kind);
+    void stop();
+
+    // Zero once the connection is gone.
+    size_t enqueued_size(kind_id kind);
+    size_t delayed_size(kind_id kind);
+    size_t unacked_size(kind_id kind);
+    bool empty();
+
+private:
+    struct state;
+    std::shared_ptr<state> data;
+
+    expected<std::vector<id_t>> put_views(kind_id kind, const byte_view* payloads, size_t count,
+                                          duration after, priority prio);
+
+    // Sends acks or nacks without waiting for the answer.
+    void settle(kind_id kind, const handle_t* handles, size_t count, bool acked);
+};
+
+} // namespace squedl
+
+#endif // SQUEDL_NET_BUS_HPP
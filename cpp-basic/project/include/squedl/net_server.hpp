@@ -0,0 +1,50 @@
+#ifndef SQUEDL_NET_SERVER_HPP
+#define SQUEDL_NET_SERVER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "squedl/squedl.hpp"
+
+namespace squedl {
+
+// Serves a test_bus to net_bus clients over TCP. One thread runs an epoll loop over the listening
+// socket and every connection: it handles all complete frames that arrived and writes the
+// responses they produced with one send per connection. A next that finds nothing ready waits
+// through next_async and is answered from whichever thread makes messages ready, so it holds up
+// neither its connection nor the loop; one with a timeout is withdrawn by the loop once that
+// passes.
+//
+// Messages a client took and did not settle before disconnecting come back after the bus's ack
+// timeout.
+class net_server {
+public:
+    using bus_type = test_bus<>;
+
+    // Listens on host:port, port 0 picking a free one; throws std::system_error when it cannot.
+    // Without accept_new_kinds, requests for kinds this process has not interned yet are
+    // refused, so clients cannot add kinds. Either way, a request that would take the process
+    // past kind_id::max_count is refused.
+    explicit net_server(bus_type bus, const std::string& host = "127.0.0.1",
+                        std::uint16_t port = 0, bool accept_new_kinds = true);
+
+    net_server(net_server const& other) = delete;
+    net_server(net_server&& other) = delete;
+    net_server& operator=(net_server const& other) = delete;
+    net_server& operator=(net_server&& other) = delete;
+    ~net_server();
+
+    std::uint16_t port() const;
+
+    // Closes the listener and every connection; the bus itself keeps running.
+    void stop();
+
+private:
+    struct state;
+    std::shared_ptr<state> data;
+};
+
+} // namespace squedl
+
+#endif // SQUEDL_NET_SERVER_HPP
@@ -0,0 +1,168 @@
+#ifndef SQUEDL_PAYLOAD_HPP
+#define SQUEDL_PAYLOAD_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace squedl {
+
+using bytes = std::vector<std::byte>;
+
+// Non-owning view of contiguous bytes.
+class byte_view {
+public:
+    constexpr byte_view() = default;
+    constexpr byte_view(const std::byte* data, size_t size) : ptr{data}, len{size} {};
+    byte_view(const bytes& bytes) : ptr{bytes.data()}, len{bytes.size()} {};
+
+    constexpr const std::byte* data() const { return ptr; };
+    constexpr size_t size() const { return len; };
+    constexpr bool empty() const { return len == 0; };
+    constexpr const std::byte* begin() const { return ptr; };
+    constexpr const std::byte* end() const { return ptr + len; };
+
+private:
+    const std::byte* ptr{};
+    size_t len{};
+};
+
+namespace detail {
+
+// Shared, reference counted storage behind a payload. release runs when the last reference
+// goes away and decides where the memory returns to.
+struct payload_block {
+    std::atomic<std::uint32_t> refs{1};
+    void (*release)(payload_block*){};
+};
+
+// Returns a block with room for size bytes at data. Blocks come from per-thread caches of
+// power-of-two size classes backed by a shared depot, so steady state traffic does not touch
+// the heap.
+payload_block* allocate_block(size_t size, std::byte*& data);
+
+// Whether ends cut size bytes into back to back bodies: in order and none past the end.
+inline bool valid_ends(const std::vector<size_t>& ends, size_t size) {
+    return std::is_sorted(ends.begin(), ends.end()) && (ends.empty() || ends.back() <= size);
+}
+
+} // namespace detail
+
+// Immutable message body. Payloads of up to inline_capacity bytes are stored in the object
+// itself; larger ones point into a pooled, reference counted block, so copies never copy bytes.
+class payload {
+public:
+    static constexpr size_t inline_capacity{56};
+
+    payload() = default;
+
+    explicit payload(byte_view bytes) : len{bytes.size()} {
+        if (bytes.empty())
+            return;
+
+        std::byte* target{};
+        if (is_inline()) {
+            target = storage.local;
+        } else {
+            storage.shared.owner = detail::allocate_block(len, target);
+            storage.shared.ptr = target;
+        }
+        std::memcpy(target, bytes.data(), len);
+    };
+
+    explicit payload(const bytes& bytes) : payload{byte_view{bytes}} {};
+
+    // Refers to size bytes at data kept alive by owner; takes over one reference.
+    payload(detail::payload_block* owner, const std::byte* data, size_t size) : len{size} {
+        if (is_inline()) {
+            if (size != 0)
+                std::memcpy(storage.local, data, size);
+            unref(owner);
+            return;
+        }
+
+        storage.shared.owner = owner;
+        storage.shared.ptr = data;
+    };
+
+    payload(const payload& other) : len{other.len} {
+        storage = other.storage;
+        if (!is_inline())
+            storage.shared.owner->refs.fetch_add(1, std::memory_order_relaxed);
+    };
+
+    payload(payload&& other) noexcept : len{other.len} {
+        storage = other.storage;
+        other.len = 0;
+    };
+
+    payload& operator=(const payload& other) {
+        if (this != &other)
+            *this = payload{other};
+        return *this;
+    };
+
+    payload& operator=(payload&& other) noexcept {
+        if (this == &other)
+            return *this;
+
+        reset();
+        len = other.len;
+        storage = other.storage;
+        other.len = 0;
+        return *this;
+    };
+
+    ~payload() { reset(); };
+
+    const std::byte* data() const { return is_inline() ? storage.local : storage.shared.ptr; };
+    size_t size() const { return len; };
+    bool empty() const { return len == 0; };
+    const std::byte* begin() const { return data(); };
+    const std::byte* end() const { return data() + len; };
+    byte_view view() const { return byte_view{data(), len}; };
+
+    bytes to_bytes() const { return bytes{begin(), end()}; };
+
+    // The size bytes at offset, sharing this payload's block unless they fit inline; lets a
+    // batch serialized into one buffer become many payloads with a single copy. They have to lie
+    // within this payload.
+    payload slice(size_t offset, size_t size) const {
+        if (size <= inline_capacity)
+            return payload{byte_view{data() + offset, size}};
+
+        storage.shared.owner->refs.fetch_add(1, std::memory_order_relaxed);
+        return payload{storage.shared.owner, storage.shared.ptr + offset, size};
+    };
+
+private:
+    size_t len{};
+    union {
+        std::byte local[inline_capacity];
+        struct {
+            detail::payload_block* owner;
+            const std::byte* ptr;
+        } shared;
+    } storage{};
+
+    bool is_inline() const { return len <= inline_capacity; };
+
+    static void unref(detail::payload_block* owner) {
+        if (owner != nullptr && owner->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            owner->release(owner);
+    };
+
+    void reset() {
+        if (!is_inline())
+            unref(storage.shared.owner);
+        len = 0;
+    };
+};
+
+} // namespace squedl
+
+#endif // SQUEDL_PAYLOAD_HPP
@@ -0,0 +1,56 @@
+#ifndef SQUEDL_SEGMENT_STORE_HPP
+#define SQUEDL_SEGMENT_STORE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "squedl/payload.hpp"
+
+namespace squedl {
+
+namespace detail {
+struct mapped_segment;
+} // namespace detail
+
+// Keeps payload bytes in memory-mapped, append-only segment files, so the kernel can page a big
+// backlog out to disk instead of it sitting in the heap. Payloads written here point straight
+// into the mapping and keep their segment mapped; a segment goes away once the store moved on
+// from it and its last payload is gone. Files are unlinked right after they are created, so
+// nothing is left behind on a crash; durability is wal_bus's business, not this one's.
+class segment_store {
+public:
+    static constexpr size_t default_segment_size{size_t{64} << 20};
+
+    explicit segment_store(std::string directory, size_t segment_size = default_segment_size);
+
+    segment_store(segment_store const& other) = delete;
+    segment_store(segment_store&& other) = delete;
+    segment_store& operator=(segment_store const& other) = delete;
+    segment_store& operator=(segment_store&& other) = delete;
+    ~segment_store();
+
+    // Copies bytes into the active segment; payloads larger than a segment get one of their own.
+    // Throws std::system_error when a segment cannot be created, given disk space or mapped.
+    payload write(byte_view bytes);
+
+    // Segments currently mapped, including the active one.
+    size_t mapped_segments() const { return mapped->load(); };
+
+private:
+    std::string directory;
+    size_t segment_size{};
+    std::shared_ptr<std::atomic<size_t>> mapped;
+
+    std::mutex mtx;
+    detail::mapped_segment* active{};
+    size_t offset{};
+
+    detail::mapped_segment* map_segment(size_t size);
+};
+
+} // namespace squedl
+
+#endif // SQUEDL_SEGMENT_STORE_HPP
@@ -0,0 +1,178 @@
+#ifndef SQUEDL_SHM_BUS_HPP
+#define SQUEDL_SHM_BUS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "squedl/kind.hpp"
+#include "squedl/payload.hpp"
+#include "squedl/squedl.hpp"
+
+namespace squedl {
+
+// A bus living in a named POSIX shared memory segment, so processes on one host share it: a
+// scheduler in one process puts and a worker_pool in another takes, with no sockets involved.
+// Messages and their payloads sit in an arena inside the segment, linked by offsets since every
+// process maps it elsewhere; payloads too big to be inline are delivered pointing straight into
+// the mapping. Each kind has its own futex mutex and a futex its consumers sleep on, both
+// process-shared. A process dying while it holds one of them leaves the segment stuck.
+//
+// Timing uses steady_clock, which all processes of a host share. Delays and ack timeouts are
+// enforced by whoever calls next, so no process needs to run a timer. Stop and interrupt only
+// concern the calling process. Idempotency keys are not supported; puts with one are refused.
+class shm_bus {
+public:
+    using id_t = std::uint64_t;
+    using clock = std::chrono::steady_clock;
+    using duration = clock::duration;
+    using time_point = clock::time_point;
+
+    // Identifies one delivery: a message is redelivered with its attempts counted up, which
+    // makes handles of earlier deliveries stale.
+    struct handle_t {
+        std::uint64_t offset{};
+        id_t id{};
+        std::uint32_t attempt{};
+    };
+
+    struct delivery {
+        id_t id{};
+        squedl::payload payload;
+        handle_t handle{};
+    };
+
+    static constexpr size_t default_size{size_t{64} << 20};
+    static constexpr size_t max_kinds{256};
+    static constexpr size_t max_kind_name{64};
+
+    // Opens the segment called name, like "/jobs", creating it with size bytes when it does not
+    // exist yet; size is ignored otherwise. Throws std::system_error when it cannot be created
+    // or mapped, and std::invalid_argument when it is not a squedl segment. ack_timeout applies
+    // to messages this process takes.
+    explicit shm_bus(std::string name, size_t size = default_size,
+                     duration ack_timeout = std::chrono::minutes{1});
+
+    // Removes the name; processes that have the segment open keep using it.
+    static void unlink(const std::string& name);
+
+    expected<id_t> put(kind_id kind, byte_view payload, duration after = duration::zero(),
+                       priority prio = priority::normal, std::string_view idempotency_key = {}) {
+        if (!idempotency_key.empty())
+            return unexpected{error{}};
+
+        auto first{put_views(kind, &payload, 1, after, prio)};
+        if (!first.has_value())
+            return unexpected{error{}};
+        return expected<id_t>{first.value()};
+    };
+
+    expected<id_t> put(kind_id kind, const squedl::payload& payload,
+                       duration after = duration::zero(), priority prio = priority::normal,
+                       std::string_view idempotency_key = {}) {
+        return put(kind, payload.view(), after, prio, idempotency_key);
+    };
+
+    // All or none, under consecutive ids with one lock acquisition and one wakeup.
+    template <typename Payloads>
+    expected<std::vector<id_t>> put_many(kind_id kind, const Payloads& payloads,
+                                         duration after = duration::zero(),
+                                         priority prio = priority::normal) {
+        std::vector<byte_view> views{};
+        for (const auto& x : payloads) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(x)>, squedl::payload>)
+                views.push_back(x.view());
+            else
+                views.emplace_back(byte_view{x});
+        }
+        return put_batch(kind, views, after, prio);
+    };
+
+    expected<std::vector<id_t>> put_many(kind_id kind, byte_view buffer,
+                                         const std::vector<size_t>& ends,
+                                         duration after = duration::zero(),
+                                         priority prio = priority::normal) {
+        if (!detail::valid_ends(ends, buffer.size()))
+            return unexpected{error{}};
+
+        std::vector<byte_view> views{};
+        views.reserve(ends.size());
+        size_t begin{};
+        for (auto end : ends) {
+            views.emplace_back(buffer.data() + begin, end - begin);
+            begin = end;
+        }
+        return put_batch(kind, views, after, prio);
+    };
+
+    // Blocks until messages of the kind are ready, timeout passes (zero waits indefinitely) or
+    // interrupt(kind) is called; returns nullopt once this bus stopped.
+    std::optional<std::vector<delivery>> next(kind_id kind, size_t count,
+                                              duration timeout = duration::zero());
+
+    // Returns false when the delivery was no longer in flight, e.g. it had timed out.
+    bool ack(kind_id kind, handle_t handle);
+    void nack(kind_id kind, handle_t handle);
+    bool reject(kind_id kind, handle_t handle) { return ack(kind, handle); };
+
+    template <typename Handles>
+    void ack_many(kind_id kind, const Handles& handles) {
+        settle_many(kind, handles, true);
+    };
+
+    template <typename Handles>
+    void nack_many(kind_id kind, const Handles& handles) {
+        settle_many(kind, handles, false);
+    };
+
+    // Makes every next() of this process currently blocked on kind return an empty batch.
+    void interrupt(kind_id kind);
+    void stop();
+
+    size_t enqueued_size(kind_id kind);
+    size_t delayed_size(kind_id kind);
+    size_t unacked_size(kind_id kind);
+    bool empty();
+
+    // Bytes of the arena not handed out yet, free lists aside.
+    size_t available();
+
+private:
+    struct state;
+    std::shared_ptr<state> data;
+
+    std::optional<id_t> put_views(kind_id kind, const byte_view* payloads, size_t count,
+                                  duration after, priority prio);
+
+    expected<std::vector<id_t>> put_batch(kind_id kind, const std::vector<byte_view>& views,
+                                          duration after, priority prio) {
+        auto first{put_views(kind, views.data(), views.size(), after, prio)};
+        if (!first.has_value())
+            return unexpected{error{}};
+
+        std::vector<id_t> result(views.size());
+        for (size_t i{}; i < result.size(); ++i)
+            result[i] = first.value() + i;
+        return expected<std::vector<id_t>>{std::move(result)};
+    };
+
+    // How many of the deliveries were still in flight.
+    size_t settle(kind_id kind, const handle_t* handles, size_t count, bool acked);
+
+    template <typename Handles>
+    void settle_many(kind_id kind, const Handles& handles, bool acked) {
+        std::vector<handle_t> all{std::begin(handles), std::end(handles)};
+        settle(kind, all.data(), all.size(), acked);
+    };
+};
+
+} // namespace squedl
+
+#endif // SQUEDL_SHM_BUS_HPP
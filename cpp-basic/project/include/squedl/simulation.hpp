@@ -0,0 +1,180 @@
+#ifndef SQUEDL_SIMULATION_HPP
+#define SQUEDL_SIMULATION_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "squedl/manual_clock.hpp"
+#include "squedl/squedl.hpp"
+
+namespace squedl {
+
+// Runs tasks off a test_bus on a manual clock in the calling thread, jumping the clock from one
+// deadline to the next instead of waiting for it. The same puts and the same tasks always run in
+// the same order at the same clock times, and hours of delays and ack timeouts pass in however
+// long the tasks themselves take.
+//
+// Kinds run in the order they were registered, a batch at a time, until none has anything
+// ready. A task that finishes asynchronously may settle its job from anywhere; until it does,
+// the job is unacked and times out like any other. Recurring schedules tick along with the
+// clock for the schedulers handed to drive.
+template <typename Clock = manual_clock>
+class simulation {
+public:
+    using bus_type = test_bus<Clock>;
+    using time_point = typename Clock::time_point;
+    using duration = typename Clock::duration;
+    using handle_t = typename bus_type::handle_t;
+
+    static constexpr size_t default_batch_size{256};
+
+    explicit simulation(bus_type bus, size_t batch_size = default_batch_size)
+        : bus{bus}, batch_size{std::max<size_t>(batch_size, 1)} {
+        static_assert(is_manual_clock_v<Clock>, "a simulation moves its clock itself");
+    };
+
+    // Registering a kind twice keeps the first task.
+    template <typename T, typename TArgs = typename T::args>
+    void work_on(T task) {
+        static_assert(is_workable_v<T, TArgs> && has_kind_v<T>);
+
+        auto kind{kind_id::of<T>()};
+        if (std::any_of(workers.begin(), workers.end(),
+                        [&kind](const auto& x) { return x.kind == kind; }))
+            return;
+
+        workers.push_back(worker{
+            kind, [task, kind, bus = bus, scratch = bytes{}](
+                      byte_view payload, handle_t handle) mutable -> std::optional<bool> {
+                auto args{[&] {
+                    if constexpr (is_view_deserializable_v<T, TArgs>) {
+                        return T::deserialize(payload);
+                    } else {
+                        scratch.assign(payload.begin(), payload.end());
+                        return T::deserialize(scratch);
+                    }
+                }()};
+
+                if constexpr (is_callback_task_v<T, TArgs> || is_startable_task_v<T, TArgs>) {
+                    completion done{[bus, kind, handle](std::optional<error> result) mutable {
+                        if (result == std::nullopt)
+                            bus.ack(kind, handle);
+                        else
+                            bus.nack(kind, handle);
+                    }};
+                    try {
+                        if constexpr (is_callback_task_v<T, TArgs>)
+                            task(std::move(args), done);
+                        else
+                            task(std::move(args)).start(done);
+                    } catch (std::exception& e) {
+                        done(error{});
+                    }
+                    return std::nullopt;
+                } else {
+                    return task(std::move(args)) == std::nullopt;
+                }
+            }});
+    };
+
+    // Puts the recurring tasks of timers whenever they are due.
+    void drive(scheduler<bus_type> timers) { schedulers.push_back(std::move(timers)); };
+
+    // Runs tasks until no registered kind has anything ready, without moving the clock;
+    // returns how many ran. Tasks failing with the default retry policy come back right away,
+    // so one that always fails keeps this going.
+    size_t run_ready() {
+        size_t result{};
+        for (auto progress{true}; progress;) {
+            progress = false;
+            for (auto& x : workers) {
+                auto batch{bus.try_next(x.kind, batch_size)};
+                if (!batch.has_value() || batch.value().empty())
+                    continue;
+
+                progress = true;
+                result += batch.value().size();
+                acked.clear();
+                nacked.clear();
+                for (const auto& job : batch.value()) {
+                    std::optional<bool> ok{};
+                    try {
+                        ok = x.task(job.payload.view(), job.handle);
+                    } catch (std::exception& e) {
+                        ok = false;
+                    }
+                    if (ok.has_value())
+                        (ok.value() ? acked : nacked).push_back(job.handle);
+                }
+                if (!acked.empty())
+                    bus.ack_many(x.kind, acked);
+                if (!nacked.empty())
+                    bus.nack_many(x.kind, nacked);
+            }
+        }
+        return result;
+    };
+
+    // Runs what is ready, then moves the clock to every deadline up to until in turn and runs
+    // what became ready there. Leaves the clock at until, or where it was if that is later;
+    // returns how many tasks ran.
+    size_t run_until(time_point until) {
+        auto result{run_ready()};
+        for (auto due{next_due()}; due.has_value() && due.value() <= until; due = next_due()) {
+            Clock::advance_to(due.value());
+            for (auto& x : schedulers)
+                x.run_due();
+            bus.run_due();
+            result += run_ready();
+        }
+        Clock::advance_to(until);
+        return result;
+    };
+
+    size_t run_for(duration span) { return run_until(Clock::now() + span); };
+
+    // Runs until nothing is delayed, unacked or ready for a registered kind, however far that
+    // moves the clock; returns how many tasks ran. Never returns while tasks keep putting more
+    // or a driven recurring schedule is left.
+    size_t run() {
+        auto result{run_ready()};
+        for (auto due{next_due()}; due.has_value(); due = next_due())
+            result += run_until(std::max(due.value(), Clock::now()));
+        return result;
+    };
+
+private:
+    // Returns whether the job succeeded, or nullopt when it finishes through its completion.
+    using task_fn = std::function<std::optional<bool>(byte_view, handle_t)>;
+
+    struct worker {
+        kind_id kind;
+        task_fn task;
+    };
+
+    std::optional<time_point> next_due() {
+        auto result{bus.next_due()};
+        for (auto& x : schedulers) {
+            auto due{x.next_due()};
+            if (due.has_value() && (!result.has_value() || due.value() < result.value()))
+                result = due;
+        }
+        return result;
+    };
+
+    bus_type bus;
+    size_t batch_size{};
+    std::vector<worker> workers;
+    std::vector<scheduler<bus_type>> schedulers;
+    std::vector<handle_t> acked;
+    std::vector<handle_t> nacked;
+};
+
+} // namespace squedl
+
+#endif // SQUEDL_SIMULATION_HPP
@@ -2,52 +2,130 @@
 #define SQUEDL_SQUEDL_HPP
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <exception>
+#include <functional>
 #include <iostream>
-#include <map>
+#include <iterator>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <queue>
-#include <set>
+#include <random>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <thread>
 #include <tuple>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "squedl/cron.hpp"
+#include "squedl/detail/dedup_window.hpp"
+#include "squedl/detail/event_count.hpp"
 #include "squedl/detail/expected.hpp"
+#include "squedl/detail/kind_table.hpp"
+#include "squedl/detail/mpmc_queue.hpp"
+#include "squedl/detail/timing_wheel.hpp"
+#include "squedl/kind.hpp"
+#include "squedl/manual_clock.hpp"
+#include "squedl/metrics.hpp"
+#include "squedl/payload.hpp"
+#include "squedl/segment_store.hpp"
 namespace squedl {
 
 int add();
 
-using bytes = std::vector<std::byte>;
-using kind = std::string;
-
 class error : public std::exception {};
 
+// Ready messages of a higher priority are delivered first within their kind.
+enum class priority : std::uint8_t { low, normal, high, urgent };
+
+inline constexpr size_t priority_levels{4};
+
+// What a put into a full kind does: fail right away, wait for room until a timeout, or make room
+// by dropping the oldest ready message of the lowest priority.
+enum class overflow_policy : std::uint8_t { fail, block, drop_oldest };
+
+// What a recurring schedule does about ticks that passed before it could put them, say while the
+// process was suspended: put a task for every one of them, or one for the latest only.
+enum class missed_ticks : std::uint8_t { catch_up, skip };
+
 template <typename T = void>
 using expected = detail::expected<T, error>;
 
 using unexpected = detail::unexpected<error>;
 
+// serialize(const args&, bytes& out) appends to out, which the scheduler reuses between calls.
+template <typename T, typename TArgs = typename T::args, typename = void>
+inline constexpr bool is_buffer_serializable_v = false;
+
+template <typename T, typename TArgs>
+inline constexpr bool is_buffer_serializable_v<
+    T, TArgs,
+    std::void_t<decltype(T::serialize(std::declval<const TArgs&>(), std::declval<bytes&>()))>> =
+    true;
+
+template <typename T, typename TArgs = typename T::args, typename = void>
+inline constexpr bool is_value_serializable_v = false;
+
+template <typename T, typename TArgs>
+inline constexpr bool is_value_serializable_v<
+    T, TArgs, std::void_t<decltype(T::serialize(std::declval<const TArgs&>()))>> =
+    std::is_same_v<decltype(T::serialize(std::declval<const TArgs&>())), bytes> ||
+    std::is_same_v<decltype(T::serialize(std::declval<const TArgs&>())), payload>;
+
 template <typename T, typename TArgs = typename T::args>
 inline constexpr bool is_serializable_v =
-    std::is_same_v<decltype(T::serialize(std::declval<const TArgs&>())), bytes>;
+    is_buffer_serializable_v<T, TArgs> || is_value_serializable_v<T, TArgs>;
 
 template <typename T>
-inline constexpr bool has_kind_v = std::is_same_v<decltype(T::kind()), kind>;
+inline constexpr bool has_kind_v = std::is_convertible_v<decltype(T::kind()), std::string_view>;
+
+// deserialize(byte_view) reads the payload in place; deserialize(const bytes&) gets a copy.
+template <typename T, typename TArgs = typename T::args>
+inline constexpr bool is_view_deserializable_v =
+    std::is_invocable_r_v<TArgs, decltype(&T::deserialize), byte_view>;
+
+template <typename T, typename TArgs = typename T::args, typename = void>
+inline constexpr bool is_sync_task_v = false;
+
+template <typename T, typename TArgs>
+inline constexpr bool is_sync_task_v<T, TArgs, std::void_t<std::invoke_result_t<T&, TArgs>>> =
+    std::is_same_v<std::optional<error>, std::invoke_result_t<T&, TArgs>>;
+
+// Told the outcome of a job that finishes after its task returned; call it exactly once.
+using completion = std::function<void(std::optional<error>)>;
+
+// A task finishes asynchronously when it takes a completion next to its args...
+template <typename T, typename TArgs = typename T::args>
+inline constexpr bool is_callback_task_v = std::is_invocable_v<T&, TArgs, completion>;
+
+// ...or when what it returns has to be started with one, like a coroutine.
+template <typename T, typename TArgs = typename T::args, typename = void>
+inline constexpr bool is_startable_task_v = false;
+
+template <typename T, typename TArgs>
+inline constexpr bool is_startable_task_v<
+    T, TArgs,
+    std::void_t<decltype(std::declval<std::invoke_result_t<T&, TArgs>>().start(
+        std::declval<completion>()))>> = true;
 
 template <typename T, typename TArgs = typename T::args>
 inline constexpr bool is_workable_v =
-    std::is_same_v<TArgs, decltype(T::deserialize(std::declval<const bytes&>()))> &&
-    std::is_same_v<std::optional<error>, decltype(std::declval<T>()(std::declval<TArgs>()))>;
+    (is_view_deserializable_v<T, TArgs> ||
+     std::is_same_v<TArgs, decltype(T::deserialize(std::declval<const bytes&>()))>) &&
+    (is_sync_task_v<T, TArgs> || is_callback_task_v<T, TArgs> || is_startable_task_v<T, TArgs>);
 
 template <typename Clock = std::chrono::system_clock>
 class test_bus {
@@ -56,455 +134,2337 @@ public:
     using time_point = typename Clock::time_point;
     using duration = typename Clock::duration;
     using clock = Clock;
+    // Identifies one delivery of an in-flight message; stale once it is acked, nacked or timed out.
+    using handle_t = detail::slab_handle;
 
-    explicit test_bus(duration ack_timeout = std::chrono::minutes{1}, bool auto_ack = false,
-                      duration tick_duration = std::chrono::seconds{1})
-        : data{std::make_shared<state>(ack_timeout, auto_ack, tick_duration)} {};
+    struct delivery {
+        id_t id{};
+        squedl::payload payload;
+        handle_t handle{};
+    };
+
+    using receiver = std::function<void(std::optional<std::vector<delivery>>)>;
+
+    // What happens to deliveries of a kind that are nacked or time out. The default retries
+    // right away, forever.
+    struct retry_policy {
+        // Deliveries a message gets in total; 0 for no limit.
+        size_t max_attempts{};
+        // Wait before the first retry, doubled for every later one up to max_backoff.
+        duration initial_backoff{duration::zero()};
+        duration max_backoff{std::chrono::minutes{1}};
+        // Where messages out of attempts go, under their id; without one they are dropped.
+        std::optional<kind_id> dead_letter;
+
+        duration backoff(size_t attempt) const {
+            auto result{initial_backoff};
+            for (size_t i{1}; i < attempt && result < max_backoff; ++i)
+                result += result;
+            return std::min(result, max_backoff);
+        };
+    };
 
-    expected<id_t> put(const kind& kind, bytes&& payload, duration after = duration::zero()) {
-        std::lock_guard<std::mutex> _(data->mtx);
-        const auto id{data->next_id()};
+    // How long a kind remembers the idempotency keys of puts, and how many keys at most. A put
+    // refused for lack of room is never remembered; one that was delivered and acked is.
+    struct dedup_policy {
+        duration window{std::chrono::minutes{10}};
+        size_t max_keys{size_t{1} << 20};
+    };
+
+    // Bounds the messages of a kind waiting for delivery, ready or delayed. Failed deliveries
+    // coming back are always taken, so a kind can briefly hold more.
+    struct capacity_limit {
+        static constexpr size_t unbounded{std::numeric_limits<size_t>::max()};
+
+        size_t max_messages{unbounded};
+        overflow_policy on_full{overflow_policy::fail};
+        duration block_timeout{std::chrono::seconds{1}};
+    };
+
+    static constexpr size_t default_ready_capacity{4096};
+
+    // With a store, payloads put as bytes live in its memory-mapped segments instead of the heap
+    // and deliveries point into the mapping.
+    explicit test_bus(duration ack_timeout = std::chrono::minutes{1}, bool auto_ack = false,
+                      duration tick_duration = std::chrono::milliseconds{1},
+                      size_t ready_capacity = default_ready_capacity,
+                      std::shared_ptr<segment_store> store = {})
+        : data{std::make_shared<state>(ack_timeout, auto_ack, tick_duration, ready_capacity,
+                                       std::move(store))} {};
+
+    // With an idempotency key, a put repeating the key of one accepted within the kind's
+    // dedup_policy window puts nothing and returns the id of the first.
+    expected<id_t> put(kind_id kind, squedl::payload payload, duration after = duration::zero(),
+                       priority prio = priority::normal, std::string_view idempotency_key = {}) {
         auto now{Clock::now()};
-        auto at{now + after};
+        return enqueue(kind, data->next_id(), std::move(payload), now + after, now, prio,
+                       idempotency_key);
+    };
 
-        if (at > now) {
-            data->delayed[kind].emplace(std::piecewise_construct, std::forward_as_tuple(at),
-                                        std::forward_as_tuple(id, std::move(payload), at));
-        } else {
-            data->enqueued[kind].emplace(id, std::move(payload));
+    // Copies the bytes once, into the segment store if there is one and a pooled payload
+    // otherwise.
+    expected<id_t> put(kind_id kind, byte_view payload, duration after = duration::zero(),
+                       priority prio = priority::normal, std::string_view idempotency_key = {}) {
+        auto stored{data->make_payload(payload)};
+        if (!stored.has_value())
+            return unexpected{error{}};
+
+        return put(kind, std::move(stored.value()), after, prio, idempotency_key);
+    };
+
+    // Puts all payloads, payloads or anything viewable as bytes, under consecutive ids with one
+    // lock acquisition and one wakeup, or none of them. A batch is never waited for: a kind
+    // without room for all of it refuses it, unless it drops its oldest messages to make room.
+    template <typename Payloads>
+    expected<std::vector<id_t>> put_many(kind_id kind, const Payloads& payloads,
+                                         duration after = duration::zero(),
+                                         priority prio = priority::normal) {
+        auto& shard{data->get(kind)};
+        auto count{static_cast<size_t>(std::distance(std::begin(payloads), std::end(payloads)))};
+        if (!data->admit_all(shard, count))
+            return unexpected{error{}};
+
+        auto now{Clock::now()};
+        std::vector<message> batch{};
+        if (make_messages(payloads, count, now, prio, batch) != count) {
+            data->release(shard, count);
+            return unexpected{error{}};
         }
+        return expected<std::vector<id_t>>{
+            data->store_batch(shard, std::move(batch), now + after)};
+    };
+
+    // Like put_many for payloads serialized back to back into buffer, payload i ending at
+    // ends[i]. The buffer is copied once, and payloads too big to be inline share that copy.
+    // Fails when ends are out of order or reach past the buffer.
+    expected<std::vector<id_t>> put_many(kind_id kind, byte_view buffer,
+                                         const std::vector<size_t>& ends,
+                                         duration after = duration::zero(),
+                                         priority prio = priority::normal) {
+        if (!detail::valid_ends(ends, buffer.size()))
+            return unexpected{error{}};
+
+        auto stored{data->make_payload(buffer)};
+        if (!stored.has_value())
+            return unexpected{error{}};
+
+        return put_many(kind, split(stored.value(), ends), after, prio);
+    };
+
+    // Puts as many leading payloads, payloads or anything viewable as bytes, as the kind has
+    // room for without waiting or, under drop_oldest, all of them. Returns the ids of those put;
+    // the rest were refused.
+    template <typename Payloads>
+    std::vector<id_t> try_put_many(kind_id kind, const Payloads& payloads,
+                                   duration after = duration::zero(),
+                                   priority prio = priority::normal) {
+        auto& shard{data->get(kind)};
+        auto count{static_cast<size_t>(std::distance(std::begin(payloads), std::end(payloads)))};
+        auto admitted{data->admit_up_to(shard, count)};
+
+        auto now{Clock::now()};
+        std::vector<message> batch{};
+        auto made{make_messages(payloads, admitted, now, prio, batch)};
+        data->release(shard, admitted - made);
+        return data->store_batch(shard, std::move(batch), now + after);
+    };
 
-        data->cv.notify_one();
+    // Cuts a payload holding back to back bodies into one payload per body, body i ending at
+    // ends[i], without copying the bodies too big to be inline. ends have to be valid_ends for
+    // the payload.
+    static std::vector<squedl::payload> split(const squedl::payload& whole,
+                                              const std::vector<size_t>& ends) {
+        std::vector<squedl::payload> result{};
+        result.reserve(ends.size());
+        size_t begin{};
+        for (auto end : ends) {
+            result.push_back(whole.slice(begin, end - begin));
+            begin = end;
+        }
+        return result;
+    };
 
-        return expected{id};
+    // The id of the put accepted under idempotency_key within the kind's dedup_policy window,
+    // counted as deduplicated when there is one; for buses that do work before putting, like
+    // logging, and can skip it for a duplicate.
+    std::optional<id_t> find_duplicate(kind_id kind, std::string_view idempotency_key) {
+        if (idempotency_key.empty())
+            return std::nullopt;
+        return data->get(kind).recall(detail::hash_kind(idempotency_key), Clock::now());
     };
 
-    expected<id_t> put(const kind& kind, const bytes& payload, duration after = duration::zero()) {
-        return put(kind, bytes{payload}, after);
+    // Enqueues under an id chosen by the caller, due at an absolute time; for buses that keep
+    // messages elsewhere too and restore them here. Such ids must not clash with those put()
+    // hands out.
+    expected<id_t> put_with_id(kind_id kind, id_t id, squedl::payload payload, time_point at,
+                               priority prio = priority::normal,
+                               std::string_view idempotency_key = {}) {
+        return enqueue(kind, id, std::move(payload), at, Clock::now(), prio, idempotency_key);
     };
 
-    std::optional<std::vector<std::pair<id_t, std::shared_ptr<const bytes>>>>
-    next(const kind& kind, size_t count, duration timeout = duration::zero()) {
-        std::unique_lock lock{data->mtx};
+    // Like put_with_id for a batch under the consecutive ids from first on, put like put_many.
+    expected<std::vector<id_t>> put_with_ids(kind_id kind, id_t first,
+                                             std::vector<squedl::payload> payloads,
+                                             time_point at, priority prio = priority::normal) {
+        auto& shard{data->get(kind)};
+        if (!data->admit_all(shard, payloads.size()))
+            return unexpected{error{}};
 
         auto now{Clock::now()};
-        data->put_due(kind, now);
+        std::vector<message> batch{};
+        batch.reserve(payloads.size());
+        for (auto& x : payloads)
+            batch.emplace_back(first++, std::move(x), now, prio);
+        return expected<std::vector<id_t>>{data->store_batch(shard, std::move(batch), at)};
+    };
 
-        auto& enqueued{data->enqueued[kind]};
-        auto& unacked{data->unacked[kind]};
-        auto& unacked_time_points{data->unacked_time_points[kind]};
+    std::optional<std::vector<delivery>> next(kind_id kind, size_t count,
+                                              duration timeout = duration::zero()) {
+        auto& shard{data->get(kind)};
+        auto deadline{Clock::now() + timeout};
+        auto interrupts{shard.interrupts.load()};
 
         if (count == 0)
             return opt_with_empty_vec();
 
-        auto waited_for_condition{true};
-        if (timeout == duration::zero())
-            data->cv.wait(lock, [this, &enqueued] { return !enqueued.empty() || data->stopping; });
-        else
-            waited_for_condition = data->cv.wait_for(
-                lock, timeout, [this, &enqueued] { return !enqueued.empty() || data->stopping; });
+        std::vector<message> batch{};
+        batch.reserve(count);
+        for (;;) {
+            if (data->stopping)
+                return std::nullopt;
+
+            data->requeue_due(shard);
+            if (shard.pop(batch, count))
+                break;
+
+            auto ticket{shard.ready.prepare_wait()};
+            if (shard.pop(batch, count) || data->stopping) {
+                shard.ready.cancel_wait();
+                continue;
+            }
+
+            if (shard.interrupts != interrupts) {
+                shard.ready.cancel_wait();
+                return opt_with_empty_vec();
+            }
+
+            if (timeout == duration::zero())
+                shard.ready.wait(ticket);
+            else if (!shard.ready.wait_until(ticket, deadline))
+                return opt_with_empty_vec();
+        }
+
+        return std::optional{data->deliver(shard, batch)};
+    };
 
+    // Takes up to count messages that are ready without waiting for any: an empty batch when
+    // there are none, nullopt once the bus stopped.
+    std::optional<std::vector<delivery>> try_next(kind_id kind, size_t count) {
+        auto& shard{data->get(kind)};
         if (data->stopping)
             return std::nullopt;
 
-        if (!waited_for_condition)
+        data->requeue_due(shard);
+        std::vector<message> batch{};
+        if (count == 0 || !shard.pop(batch, count))
             return opt_with_empty_vec();
 
-        std::vector<std::pair<id_t, std::shared_ptr<const bytes>>> result{};
-        result.reserve(count);
-        message msg{};
-        while (count && !enqueued.empty()) {
-            msg = std::move(enqueued.front());
-            auto id{msg.id};
+        return std::optional{data->deliver(shard, batch)};
+    };
 
-            --count;
-            enqueued.pop();
+    // Hands up to count messages to receive as soon as there are any, without blocking: right
+    // away when some are ready, otherwise from whichever thread makes them ready. receive gets an
+    // empty batch after interrupt(kind) and nullopt once the bus stops. Returns a ticket for
+    // cancel_async when receive was left waiting, and zero when it already ran.
+    std::uint64_t next_async(kind_id kind, size_t count, receiver receive) {
+        auto& shard{data->get(kind)};
+        if (count == 0) {
+            receive(opt_with_empty_vec());
+            return 0;
+        }
 
-            if (data->auto_ack) {
-                result.push_back(std::make_pair(id, std::move(msg.payload)));
+        data->requeue_due(shard);
 
-                continue;
+        std::vector<message> batch{};
+        batch.reserve(count);
+        {
+            std::lock_guard<std::mutex> _{shard.receivers_mtx};
+            if (!data->stopping) {
+                // Announced before looking, so a put that misses this pop serves the receiver.
+                shard.receivers_count.fetch_add(1);
+                if (!shard.pop(batch, count)) {
+                    auto ticket{++shard.receivers_issued};
+                    shard.receivers.push_back(pending_receive{count, std::move(receive), ticket});
+                    return ticket;
+                }
+                shard.receivers_count.fetch_sub(1);
             }
-
-            auto unacked_due{now + data->ack_timeout};
-            auto payload{msg.payload};
-            unacked_time_points[msg.id] = unacked_due;
-            unacked.emplace(unacked_due, std::move(msg));
-
-            result.push_back(std::make_pair(id, std::move(payload)));
         }
 
-        return std::optional{std::move(result)};
+        if (batch.empty())
+            receive(std::nullopt);
+        else
+            receive(std::optional{data->deliver(shard, batch)});
+        return 0;
+    };
+
+    // Withdraws a receiver next_async left waiting, which then never runs; false when it ran
+    // or is running already.
+    bool cancel_async(kind_id kind, std::uint64_t ticket) {
+        auto& shard{data->get(kind)};
+        std::lock_guard<std::mutex> _{shard.receivers_mtx};
+        auto found{std::find_if(shard.receivers.begin(), shard.receivers.end(),
+                                [ticket](const auto& x) { return x.ticket == ticket; })};
+        if (found == shard.receivers.end())
+            return false;
+
+        shard.receivers.erase(found);
+        shard.receivers_count.fetch_sub(1);
+        return true;
     };
 
-    void ack(kind kind, id_t id) {
+    // Returns false when the delivery was no longer in flight, e.g. it had timed out.
+    bool ack(kind_id kind, handle_t handle) {
         if (data->auto_ack)
-            return;
+            return false;
+
+        auto& shard{data->get(kind)};
+        {
+            std::lock_guard<std::mutex> _{shard.mtx};
+            if (!shard.unacked.cancel(handle).has_value())
+                return false;
+        }
+        shard.stats.acked.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    };
 
-        std::lock_guard<std::mutex> _{data->mtx};
-        auto& unacked{data->unacked[kind]};
-        auto& unacked_time_points{data->unacked_time_points[kind]};
+    // Settles a whole range of handles under a single lock acquisition.
+    template <typename Handles>
+    void ack_many(kind_id kind, const Handles& handles) {
+        ack_many(kind, handles, [](size_t /*position*/) {});
+    };
 
-        auto time_point_it{unacked_time_points.find(id)};
-        if (time_point_it == unacked_time_points.end())
+    // Calls settled(position) for every handle in the range that was still in flight.
+    template <typename Handles, typename Settled>
+    void ack_many(kind_id kind, const Handles& handles, Settled&& settled) {
+        if (data->auto_ack)
             return;
 
-        auto range = unacked.equal_range(time_point_it->second);
-        for (auto unacked_it = range.first; unacked_it != range.second; ++unacked_it) {
-            if (unacked_it->second.id != id)
-                continue;
-
-            unacked.erase(unacked_it);
-            break;
+        auto& shard{data->get(kind)};
+        size_t acked{};
+        {
+            std::lock_guard<std::mutex> _{shard.mtx};
+            size_t position{};
+            for (const auto& handle : handles) {
+                if (shard.unacked.cancel(handle).has_value()) {
+                    settled(position);
+                    ++acked;
+                }
+                ++position;
+            }
         }
-
-        unacked_time_points.erase(time_point_it);
+        shard.stats.acked.fetch_add(acked, std::memory_order_relaxed);
     };
 
-    void reject(kind kind, id_t id) { ack(kind, id); };
+    bool reject(kind_id kind, handle_t handle) { return ack(kind, handle); };
 
-    void nack(kind kind, id_t id) {
+    void nack(kind_id kind, handle_t handle) {
         if (data->auto_ack)
             return;
 
-        std::lock_guard<std::mutex> _{data->mtx};
+        auto& shard{data->get(kind)};
+        auto now{Clock::now()};
+        burial buried{};
+        bool ready{};
+        {
+            std::lock_guard<std::mutex> _{shard.mtx};
 
-        auto& enqueued = data->enqueued[kind];
-        auto& unacked = data->unacked[kind];
-        auto& unacked_time_points = data->unacked_time_points[kind];
+            auto msg{shard.unacked.cancel(handle)};
+            if (!msg.has_value())
+                return;
 
-        auto time_point_it{unacked_time_points.find(id)};
-        if (time_point_it == unacked_time_points.end())
-            return;
+            ready = shard.retry_locked(std::move(msg.value()), now, buried);
+        }
+        shard.stats.nacked.fetch_add(1, std::memory_order_relaxed);
+        if (ready)
+            data->wake(shard, 1);
+        data->bury(shard, buried);
+    };
 
-        auto range = unacked.equal_range(time_point_it->second);
-        for (auto unacked_it = range.first; unacked_it != range.second; ++unacked_it) {
-            if (unacked_it->second.id != id)
-                continue;
+    template <typename Handles>
+    void nack_many(kind_id kind, const Handles& handles) {
+        if (data->auto_ack)
+            return;
 
-            enqueued.emplace(unacked_it->second.id, std::move(unacked_it->second.payload));
-            unacked.erase(unacked_it);
-            break;
+        auto& shard{data->get(kind)};
+        auto now{Clock::now()};
+        burial buried{};
+        size_t nacked{};
+        size_t ready{};
+        {
+            std::lock_guard<std::mutex> _{shard.mtx};
+            for (const auto& handle : handles) {
+                auto msg{shard.unacked.cancel(handle)};
+                if (!msg.has_value())
+                    continue;
+
+                ready += shard.retry_locked(std::move(msg.value()), now, buried) ? 1 : 0;
+                ++nacked;
+            }
         }
+
+        shard.stats.nacked.fetch_add(nacked, std::memory_order_relaxed);
+        data->wake(shard, ready);
+        data->bury(shard, buried);
+    };
+
+    // Makes every next() currently blocked on kind return an empty batch.
+    void interrupt(kind_id kind) {
+        auto& shard{data->get(kind)};
+        ++shard.interrupts;
+        shard.ready.notify_all();
+        data->release_receivers(shard, opt_with_empty_vec());
     };
 
     void stop() {
         if (data->stopping)
             return;
-        {
-            std::lock_guard<std::mutex> _{data->mtx};
-            data->stopping = true;
-            data->cv.notify_all();
-        }
+
+        data->stop();
     };
 
-    size_t enqueued_size(kind kind) {
-        std::lock_guard<std::mutex> _{data->mtx};
-        return data->enqueued[kind].size();
+    size_t enqueued_size(kind_id kind) { return data->get(kind).enqueued_size(); };
+    // Makes every delayed message that is due ready and every unacked one that timed out
+    // ready again, as the timer thread does; returns how many became ready. On a manual clock
+    // there is no timer thread, so whoever moves the clock calls this.
+    size_t run_due() {
+        auto earliest{never};
+        return data->run_due(earliest);
     };
-    size_t delayed_size(kind kind) {
-        std::lock_guard<std::mutex> _{data->mtx};
-        return data->delayed[kind].size();
+
+    // No later than the earliest deadline of a delayed or unacked message, if there is any; it
+    // can be earlier, so run_due at that time may find nothing to do.
+    std::optional<time_point> next_due() {
+        auto earliest{never};
+        data->shards.for_each([&earliest](auto /*index*/, auto& shard) {
+            earliest = std::min(earliest, shard.next_due.load());
+        });
+        if (earliest == never)
+            return std::nullopt;
+        return time_point{duration{earliest}};
+    };
+
+    size_t delayed_size(kind_id kind) {
+        auto& shard{data->get(kind)};
+        std::lock_guard<std::mutex> _{shard.mtx};
+        return shard.delayed.size();
     };
-    size_t unacked_size(kind kind) {
-        std::lock_guard<std::mutex> _{data->mtx};
-        return data->unacked[kind].size();
+    size_t unacked_size(kind_id kind) {
+        auto& shard{data->get(kind)};
+        std::lock_guard<std::mutex> _{shard.mtx};
+        return shard.unacked.size();
     };
 
     bool empty() {
-        std::lock_guard<std::mutex> _{data->mtx};
-        return std::all_of(data->enqueued.cbegin(), data->enqueued.cend(),
-                           [](auto x) { return x.second.empty(); }) &&
-               std::all_of(data->delayed.cbegin(), data->delayed.cend(),
-                           [](auto x) { return x.second.empty(); }) &&
-               std::all_of(data->unacked.cbegin(), data->unacked.cend(),
-                           [](auto x) { return x.second.empty(); });
+        return data->shards.all_of([](auto /*index*/, auto& shard) {
+            if (shard.enqueued_size() != 0)
+                return false;
+
+            std::lock_guard<std::mutex> _{shard.mtx};
+            return shard.delayed.empty() && shard.unacked.empty();
+        });
     }
 
-private:
-    struct message {
-        id_t id{};
-        std::shared_ptr<const bytes> payload;
-        std::optional<time_point> after;
+    // Applies to puts from now on; messages already held stay.
+    void set_capacity(kind_id kind, capacity_limit limit) {
+        auto& shard{data->get(kind)};
+        {
+            std::lock_guard<std::mutex> _{shard.mtx};
+            shard.on_full = limit.on_full;
+            shard.block_timeout = limit.block_timeout;
+            shard.max_held = limit.max_messages;
+        }
+        shard.space.notify_all();
+    };
 
-        message() = default;
-        message(id_t id, bytes&& payload)
-            : id{id}, payload{std::make_shared<bytes>(std::move(payload))}, after{std::nullopt} {};
-        message(id_t id, bytes&& payload, std::optional<time_point> after)
-            : id{id}, payload{std::make_shared<bytes>(std::move(payload))}, after{after} {};
-        message(id_t id, std::shared_ptr<const bytes>&& payload)
-            : id{id}, payload{std::move(payload)}, after{std::nullopt} {};
-        message(id_t id, const std::shared_ptr<const bytes>&& payload)
-            : id{id}, payload{payload}, after{std::nullopt} {};
-        message(id_t id, std::shared_ptr<const bytes>&& payload, std::optional<time_point> after)
-            : id{id}, payload{std::move(payload)}, after{after} {};
-        message(id_t id, const std::shared_ptr<const bytes>&& payload,
-                std::optional<time_point> after)
-            : id{id}, payload{payload}, after{after} {};
+    // Calls handler with the id of every message a full kind drops under drop_oldest, from the
+    // put that dropped it; for buses that keep messages elsewhere too. Set it before any put.
+    void set_drop_handler(std::function<void(id_t)> handler) {
+        data->on_drop = std::move(handler);
     };
 
-    struct state {
-        std::mutex mtx;
-        std::condition_variable cv;
-        std::atomic<bool> stopping{};
+    // Calls handler for every message that used up its attempts, with the dead letter kind it
+    // moves to or nullopt when it is dropped, before it gets there; for buses that keep messages
+    // elsewhere too. Set it before any put.
+    void set_bury_handler(
+        std::function<void(id_t, const squedl::payload&, priority, std::optional<kind_id>)>
+            handler) {
+        data->on_bury = std::move(handler);
+    };
 
-        std::map<kind, std::queue<message>> enqueued;
-        std::map<kind, std::multimap<time_point, message>> delayed;
-        std::map<kind, std::map<id_t, time_point>> unacked_time_points;
-        std::map<kind, std::multimap<time_point, message>> unacked;
+    // Starts a fresh window, forgetting the keys seen so far.
+    void set_dedup_policy(kind_id kind, dedup_policy policy) {
+        auto& shard{data->get(kind)};
+        std::lock_guard<std::mutex> _{shard.dedup_mtx};
+        shard.dedup_config = policy;
+        shard.dedup.reset();
+    };
 
-        std::atomic<id_t> id{1};
-        id_t next_id() { return id++; };
+    // Applies to deliveries failing from now on; messages keep the attempts they used up.
+    void set_retry_policy(kind_id kind, retry_policy policy) {
+        if (policy.dead_letter.has_value())
+            data->get(policy.dead_letter.value());
 
-        duration ack_timeout{};
-        bool auto_ack{};
-        std::thread tick;
-        duration tick_dur;
-
-        explicit state(duration ack_timeout, bool auto_ack, duration tick_duration)
-            : auto_ack{auto_ack}, ack_timeout{ack_timeout}, tick_dur{tick_duration} {
-            tick = std::thread{[this] {
-                while (!stopping) {
-                    std::this_thread::sleep_for(tick_dur);
-
-                    std::lock_guard<std::mutex> _{mtx};
-                    auto now{Clock::now()};
-                    std::set<kind> kinds{};
-                    for (const auto& [k, _] : enqueued)
-                        kinds.insert(k);
-                    for (const auto& [k, _] : delayed)
-                        kinds.insert(k);
-                    for (const auto& k : kinds)
-                        if (put_due(k, now))
-                            cv.notify_one();
-                };
-            }};
-        };
+        auto& shard{data->get(kind)};
+        std::lock_guard<std::mutex> _{shard.mtx};
+        shard.retry = std::move(policy);
+    };
 
-        state(state const& other) = delete;
-        state(state&& other) = delete;
-        state& operator=(state const& other) = delete;
-        state& operator=(state&& other) = delete;
+    // Lock-free snapshot of one kind, cheap enough to scrape often; its gauges are derived from
+    // the counters, so unlike the *_size methods they may be off by in-flight operations.
+    kind_stats metrics(kind_id kind) { return data->get(kind).snapshot(data->auto_ack); };
+
+    // Every kind the bus has seen.
+    std::vector<kind_stats> metrics() {
+        std::vector<kind_stats> result;
+        data->shards.for_each([this, &result](auto /*index*/, auto& shard) {
+            result.push_back(shard.snapshot(data->auto_ack));
+        });
+        return result;
+    };
 
-        ~state() {
-            if (!stopping) {
-                std::lock_guard<std::mutex> _{mtx};
-                stopping = true;
-                cv.notify_all();
-            }
+private:
+    struct message {
+        id_t id{};
+        squedl::payload payload;
+        // When it last became ready for delivery, for the wait histogram.
+        time_point ready{};
+        priority prio{priority::normal};
+        // Deliveries that were nacked or timed out.
+        std::uint32_t attempts{};
 
-            if (tick.joinable())
-                tick.join();
-        };
+        message() = default;
+        message(id_t id, squedl::payload&& payload, time_point ready, priority prio)
+            : id{id}, payload{std::move(payload)}, ready{ready}, prio{prio} {};
+    };
 
-        size_t put_due(const kind& kind, time_point now) {
-            auto& k_enqueued{enqueued[kind]};
-            auto& k_delayed{delayed[kind]};
-            auto& k_unacked{unacked[kind]};
-            auto& k_unacked_time_points{unacked_time_points[kind]};
+    expected<id_t> enqueue(kind_id kind, id_t id, squedl::payload&& payload, time_point at,
+                           time_point now, priority prio, std::string_view idempotency_key) {
+        auto& shard{data->get(kind)};
+        auto key{detail::hash_kind(idempotency_key)};
+        if (!idempotency_key.empty()) {
+            if (auto first{shard.recall(key, now)}; first.has_value())
+                return expected<id_t>{first.value()};
+        }
 
-            size_t result{};
+        if (!data->admit(shard))
+            return unexpected{error{}};
 
-            auto delayed_due{k_delayed.lower_bound(now)};
-            for (auto delayed_it{k_delayed.cbegin()}; delayed_it != delayed_due; ++delayed_it) {
-                k_enqueued.emplace(delayed_it->second.id, std::move(delayed_it->second.payload));
-                ++result;
+        // Remembered only once admitted, so a duplicate never gets the id of a put that is then
+        // refused; a concurrent put of the same key that got there first wins.
+        if (!idempotency_key.empty()) {
+            if (auto first{shard.remember(key, id, now)}; first.has_value()) {
+                data->release(shard, 1);
+                return expected<id_t>{first.value()};
             }
-            k_delayed.erase(k_delayed.begin(), delayed_due);
+        }
 
-            auto unacked_due{k_unacked.lower_bound(now)};
-            for (auto unacked_it{k_unacked.cbegin()}; unacked_it != unacked_due; ++unacked_it) {
-                k_enqueued.emplace(unacked_it->second.id, std::move(unacked_it->second.payload));
-                k_unacked_time_points.erase(unacked_it->second.id);
-                ++result;
-            }
-            k_unacked.erase(k_unacked.begin(), unacked_due);
+        if (shard.store(message{id, std::move(payload), now, prio}, at))
+            data->wake(shard, 1);
 
-            return result;
-        };
+        return expected<id_t>{id};
     };
 
-    std::shared_ptr<state> data;
-
-    static std::optional<std::vector<std::pair<id_t, std::shared_ptr<const bytes>>>>
-    opt_with_empty_vec() {
-        return std::optional{std::vector<std::pair<id_t, std::shared_ptr<const bytes>>>{}};
-    }
-}; // test_bus
+    // Appends messages for up to count leading payloads under consecutive ids; stops early
+    // when one cannot be stored. Returns how many it made.
+    template <typename Payloads>
+    size_t make_messages(const Payloads& payloads, size_t count, time_point now, priority prio,
+                         std::vector<message>& batch) {
+        batch.reserve(batch.size() + count);
+        auto id{data->next_ids(count)};
+        size_t made{};
+        for (const auto& x : payloads) {
+            if (made == count)
+                break;
+
+            std::optional<squedl::payload> body{};
+            if constexpr (std::is_same_v<std::decay_t<decltype(x)>, squedl::payload>)
+                body.emplace(x);
+            else
+                body = data->make_payload(byte_view{x});
+            if (!body.has_value())
+                break;
+
+            batch.emplace_back(id + made, std::move(body.value()), now, prio);
+            ++made;
+        }
+        return made;
+    };
 
-template <typename Bus>
-class scheduler {
-    Bus bus;
+    struct pending_receive {
+        size_t count{};
+        receiver receive;
+        std::uint64_t ticket{};
+    };
 
-public:
-    using clock = typename Bus::clock;
-    using duration = typename Bus::clock::duration;
-    using time_point = typename Bus::clock::time_point;
-    using id_t = typename Bus::id_t;
+    // Messages out of attempts, collected under a shard's mtx and moved on once it is released.
+    struct burial {
+        std::optional<kind_id> to;
+        std::vector<message> messages;
+    };
 
-    explicit scheduler<Bus>(Bus bus) : bus{bus} {};
+    using rep = typename duration::rep;
+    static constexpr rep never{std::numeric_limits<rep>::max()};
 
-    template <typename T, typename Args = typename T::args>
-    expected<id_t> try_schedule(const Args& task, duration after = duration::zero()) {
-        static_assert(is_serializable_v<T, Args> && has_kind_v<T>);
+    // The deadline the timer thread sleeps towards. Lowering it wakes the thread; later deadlines
+    // are left alone without touching mtx.
+    struct deadline_timer {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::atomic<rep> due{never};
 
-        auto kind{T::kind()};
+        void lower(rep at) {
+            if (at >= due)
+                return;
 
-        return bus.put(kind, std::move(T::serialize(task)), after);
-    };
+            std::lock_guard<std::mutex> _{mtx};
+            if (at >= due)
+                return;
 
-    template <typename T, typename Args = typename T::args>
-    expected<id_t> try_schedule(const Args& task, time_point after) {
-        return try_schedule<T, Args>(task, after - clock::now());
+            due = at;
+            cv.notify_one();
+        };
     };
 
-    template <typename T, typename Args = typename T::args>
-    id_t schedule(const Args& task, duration after = duration::zero()) {
-        auto result{try_schedule<T, Args>(task, after)};
-        if (result.has_value())
-            return result.value();
+    // All messages of one kind. Ready messages live in lock-free rings, one per priority, so put
+    // and next only take mtx when a ring overflows or there is delayed or unacked bookkeeping to
+    // do.
+    struct shard {
+        using wheel = detail::timing_wheel<message, Clock>;
 
-        throw result.error();
-    };
+        // Ready messages of one priority. Those that did not fit into the ring wait in overflow,
+        // in arrival order.
+        struct lane {
+            detail::mpmc_queue<message> ring;
+            std::atomic<size_t> overflow_size{};
+            std::deque<message> overflow;
 
-    template <typename T, typename Args = typename T::args>
-    id_t schedule(const Args& task, time_point after) {
-        return schedule<T, Args>(task, after - clock::now());
-    };
-}; // scheduler
+            explicit lane(size_t capacity) : ring{capacity} {};
 
-template <typename Bus>
-class worker_pool {
-public:
-    using id_t = typename Bus::id_t;
-    using duration = typename Bus::duration;
-    using job = std::pair<typename Bus::id_t, std::shared_ptr<const bytes>>;
+            size_t size() const { return ring.size() + overflow_size; };
+        };
 
-    static constexpr duration default_polling_interval = std::chrono::milliseconds(100);
+        // Out of every starvation_interval messages popped while several lanes hold some, one
+        // comes from the lowest of them.
+        static constexpr size_t starvation_interval{16};
+        static constexpr unsigned normal_bit{1U << static_cast<size_t>(priority::normal)};
+
+        // Lanes other than normal are created on first use, under mtx.
+        std::array<std::atomic<lane*>, priority_levels> lanes{};
+        std::array<std::unique_ptr<lane>, priority_levels> owned_lanes;
+        // Bit p is set while lane p may hold messages. The normal bit is always set, so puts of
+        // normal priority never touch it.
+        std::atomic<unsigned> nonempty{normal_bit};
+        std::atomic<size_t> contended_pops{};
+        size_t ready_capacity{};
+
+        detail::event_count ready;
+        std::atomic<std::uint64_t> interrupts{};
+
+        // Callbacks of next_async waiting for messages, served in order.
+        std::mutex receivers_mtx;
+        std::deque<pending_receive> receivers;
+        std::atomic<size_t> receivers_count{};
+        std::uint64_t receivers_issued{};
 
-    explicit worker_pool<Bus>(Bus bus, duration polling_interval = default_polling_interval)
-        : data{std::make_shared<state>(bus, polling_interval)} {};
+        std::mutex mtx;
+        wheel delayed;
+        wheel unacked;
+        // Never later than the earliest delayed or unacked deadline, so callers can skip mtx
+        // when nothing is due.
+        std::atomic<rep> next_due{never};
+
+        deadline_timer& timer;
+
+        // Relaxed counters; delayed and matured count puts into and out of the delayed wheel.
+        struct counters {
+            std::atomic<std::uint64_t> put{};
+            std::atomic<std::uint64_t> delivered{};
+            std::atomic<std::uint64_t> acked{};
+            std::atomic<std::uint64_t> nacked{};
+            std::atomic<std::uint64_t> redelivered{};
+            std::atomic<std::uint64_t> dead_lettered{};
+            std::atomic<std::uint64_t> refused{};
+            std::atomic<std::uint64_t> dropped{};
+            std::atomic<std::uint64_t> deduplicated{};
+            std::atomic<std::uint64_t> delayed{};
+            std::atomic<std::uint64_t> matured{};
+        };
 
-    worker_pool(worker_pool const& other) = delete;
-    worker_pool(worker_pool&& other) = delete;
-    worker_pool& operator=(worker_pool const& other) = delete;
-    worker_pool& operator=(worker_pool&& other) = delete;
-    ~worker_pool() { stop(); }
+        kind_id name;
+        counters stats;
+        histogram wait;
+        // Guarded by mtx.
+        retry_policy retry;
+
+        // Messages ready or delayed, checked against max_held by puts. Producers blocked on a
+        // full kind wait on space; the other capacity settings are guarded by mtx.
+        std::atomic<size_t> held{};
+        std::atomic<size_t> max_held{capacity_limit::unbounded};
+        overflow_policy on_full{overflow_policy::fail};
+        duration block_timeout{};
+        detail::event_count space;
+
+        // Idempotency keys, created on the first put that has one.
+        std::mutex dedup_mtx;
+        std::optional<detail::dedup_window<id_t, Clock>> dedup;
+        dedup_policy dedup_config;
+
+        shard(kind_id name, size_t ready_capacity, duration resolution, deadline_timer& timer)
+            : ready_capacity{ready_capacity}, delayed{resolution, Clock::now()},
+              unacked{resolution, Clock::now()}, timer{timer}, name{name} {
+            std::lock_guard<std::mutex> _{mtx};
+            lane_locked(priority::normal);
+        };
 
-    template <typename T, typename TArgs = typename T::args>
-    void work_on(T task, size_t pool_size) {
-        data->workers.try_emplace(T::kind(), data->bus, data->polling_interval, task, pool_size);
-    };
+        size_t enqueued_size() const {
+            size_t result{};
+            for (const auto& x : lanes)
+                if (auto* found{x.load(std::memory_order_acquire)}; found != nullptr)
+                    result += found->size();
+            return result;
+        };
 
-    void stop() {
-        for (auto& [_, worker] : data->workers)
-            worker.stop();
-    };
+        // Makes a put message ready, or delayed until at; returns whether it is ready.
+        bool store(message&& msg, time_point at) {
+            stats.put.fetch_add(1, std::memory_order_relaxed);
+            if (at <= msg.ready) {
+                push(std::move(msg));
+                return true;
+            }
 
-private:
-    class worker {
-        Bus bus;
-        duration polling_interval;
-        kind kind;
-        size_t size{};
+            stats.delayed.fetch_add(1, std::memory_order_relaxed);
+            msg.ready = at;
+            std::lock_guard<std::mutex> _(mtx);
+            delayed.insert(at, std::move(msg));
+            lower_next_due(at);
+            return false;
+        };
 
-        std::vector<std::thread> threads;
-        std::mutex mtx;
-        std::vector<job> jobs;
-        size_t ready_at{};
-        size_t ready_count{};
-        std::atomic<bool> stopping{};
-        std::set<id_t> seen_ids;
+        // Like store for a batch of one priority that became ready together, taking mtx at
+        // most once; returns how many are ready.
+        size_t store_many(std::vector<message>&& batch, time_point at) {
+            if (batch.empty())
+                return 0;
+
+            stats.put.fetch_add(batch.size(), std::memory_order_relaxed);
+            if (at > batch.front().ready) {
+                stats.delayed.fetch_add(batch.size(), std::memory_order_relaxed);
+                std::lock_guard<std::mutex> _(mtx);
+                for (auto& msg : batch) {
+                    msg.ready = at;
+                    delayed.insert(at, std::move(msg));
+                }
+                lower_next_due(at);
+                return 0;
+            }
 
-    public:
-        template <typename T, typename TArgs = typename T::args>
-        worker(Bus bus, duration polling_interval, T task, size_t size)
-            : bus{bus}, polling_interval(polling_interval), kind{T::kind()}, size{size} {
-            std::lock_guard<std::mutex> _{mtx};
+            auto index{static_cast<size_t>(batch.front().prio)};
+            auto* target{lanes[index].load(std::memory_order_acquire)};
+            size_t pushed{};
+            if (target != nullptr)
+                while (pushed < batch.size() && target->overflow_size == 0 &&
+                       target->ring.try_push(std::move(batch[pushed])))
+                    ++pushed;
+            if (pushed != 0)
+                mark(index);
+
+            if (pushed < batch.size()) {
+                std::lock_guard<std::mutex> _{mtx};
+                for (auto i{pushed}; i < batch.size(); ++i)
+                    push_locked(std::move(batch[i]));
+            }
+            return batch.size();
+        };
 
-            threads.reserve(size);
-            jobs.reserve(size);
-
-            for (size_t i{}; i < size; ++i) {
-                jobs.emplace_back();
-                threads.emplace_back([this, task]() mutable {
-                    std::optional<job> opt_job{};
-                    while ((opt_job = next()).has_value() && !stopping) {
-                        auto& [id, payload]{opt_job.value()};
-                        try {
-                            if (task(T::deserialize(*payload)) == std::nullopt)
-                                ack(id);
-                            else
-                                nack(id);
-                        } catch (std::exception& e) {
-                            nack(id);
-                        }
-                    }
-                });
+        // Returns the id put under key within the window, or remembers id for it.
+        std::optional<id_t> remember(std::uint64_t key, id_t id, time_point now) {
+            std::lock_guard<std::mutex> _{dedup_mtx};
+            if (!dedup.has_value())
+                dedup.emplace(dedup_config.window, dedup_config.max_keys);
+            if (auto first{dedup->find(key, now)}; first.has_value()) {
+                stats.deduplicated.fetch_add(1, std::memory_order_relaxed);
+                return first;
             }
+
+            dedup->insert(key, id, now);
+            return std::nullopt;
         };
 
-        worker(worker const& other) = delete;
-        worker(worker&& other) = delete;
-        worker& operator=(worker const& other) = delete;
-        worker& operator=(worker&& other) = delete;
+        // Returns the id put under key within the window without remembering anything.
+        std::optional<id_t> recall(std::uint64_t key, time_point now) {
+            std::lock_guard<std::mutex> _{dedup_mtx};
+            if (!dedup.has_value())
+                return std::nullopt;
 
-        ~worker() {
-            stop();
-            for (auto& thread : threads)
-                if (thread.joinable())
-                    thread.join();
-        }
+            auto first{dedup->find(key, now)};
+            if (first.has_value())
+                stats.deduplicated.fetch_add(1, std::memory_order_relaxed);
+            return first;
+        };
 
-        void stop() {
-            if (stopping)
+        // Takes room for up to count more messages; returns how many fit.
+        size_t reserve(size_t count) {
+            auto limit{max_held.load(std::memory_order_relaxed)};
+            if (limit == capacity_limit::unbounded) {
+                held.fetch_add(count, std::memory_order_relaxed);
+                return count;
+            }
+
+            auto current{held.load(std::memory_order_relaxed)};
+            size_t taken{};
+            do {
+                taken = current >= limit ? 0 : std::min(count, limit - current);
+                if (taken == 0)
+                    return 0;
+            } while (!held.compare_exchange_weak(current, current + taken,
+                                                 std::memory_order_relaxed));
+            return taken;
+        };
+
+        // Drops the oldest ready message of the lowest priority that has any; returns its id.
+        std::optional<id_t> drop_oldest() {
+            message msg{};
+            for (size_t index{}; index < priority_levels; ++index) {
+                auto* source{lanes[index].load(std::memory_order_acquire)};
+                if (source != nullptr && try_pop(*source, msg)) {
+                    stats.dropped.fetch_add(1, std::memory_order_relaxed);
+                    return msg.id;
+                }
+            }
+            return std::nullopt;
+        };
+
+        void push(message&& msg) {
+            auto index{static_cast<size_t>(msg.prio)};
+            auto* target{lanes[index].load(std::memory_order_acquire)};
+            if (target != nullptr && target->overflow_size == 0 &&
+                target->ring.try_push(std::move(msg))) {
+                mark(index);
                 return;
-            std::lock_guard<std::mutex> _{mtx};
-            stopping = true;
-        }
+            }
 
-    private:
-        std::optional<job> next() {
             std::lock_guard<std::mutex> _{mtx};
-            if (size == 0 || stopping)
-                return std::nullopt;
+            push_locked(std::move(msg));
+        };
 
-            if (ready_count > 0) {
-                auto was_ready_at{ready_at};
-                --ready_count;
-                ready_at = (was_ready_at + 1) % size;
-                return jobs[was_ready_at];
+        void push_locked(message&& msg) {
+            auto index{static_cast<size_t>(msg.prio)};
+            auto& target{lane_locked(msg.prio)};
+            if (target.overflow_size != 0 || !target.ring.try_push(std::move(msg))) {
+                target.overflow.push_back(std::move(msg));
+                ++target.overflow_size;
             }
+            mark(index);
+        };
 
-            auto new_jobs{bus.next(kind, size, polling_interval)};
-            if (!new_jobs.has_value() || new_jobs.value().empty()) {
-                stopping = !new_jobs.has_value();
-                return std::nullopt;
+        bool pop(std::vector<message>& batch, size_t count) {
+            message msg{};
+            unsigned drained{};
+            while (batch.size() < count) {
+                auto candidates{nonempty.load(std::memory_order_acquire) & ~drained};
+                if (candidates == 0)
+                    break;
+
+                auto contended{(candidates & (candidates - 1)) != 0};
+                auto turn{contended_pops.load(std::memory_order_relaxed) + 1};
+                auto starving{contended && turn % starvation_interval == 0};
+                auto index{starving ? lowest(candidates) : highest(candidates)};
+
+                if (try_pop(*lanes[index].load(std::memory_order_acquire), msg)) {
+                    if (contended)
+                        contended_pops.fetch_add(1, std::memory_order_relaxed);
+                    batch.push_back(std::move(msg));
+                    continue;
+                }
+
+                drained |= 1U << index;
+                if (index != static_cast<size_t>(priority::normal))
+                    unmark(index);
             }
 
-            for (size_t i{}; i < std::min(new_jobs.value().size(), size) && i < size; ++i) {
-                jobs[(ready_at + i) % size] = new_jobs.value()[i];
-                ++ready_count;
-            }
+            return !batch.empty();
+        };
 
-            auto was_ready_at{ready_at};
-            --ready_count;
-            ready_at = (was_ready_at + 1) % size;
+        bool try_pop(lane& source, message& msg) {
+            while (!source.ring.try_pop(msg))
+                if (source.overflow_size == 0 || !refill(source))
+                    return false;
+            return true;
+        };
+
+        bool refill(lane& target) {
+            std::lock_guard<std::mutex> _{mtx};
+            size_t moved{};
+            while (!target.overflow.empty() &&
+                   target.ring.try_push(std::move(target.overflow.front()))) {
+                target.overflow.pop_front();
+                ++moved;
+            }
+            target.overflow_size -= moved;
 
-            return jobs[was_ready_at];
+            return moved != 0;
         };
 
-        void ack(id_t id) { bus.ack(kind, id); };
-        void nack(id_t id) { bus.nack(kind, id); };
-    };
+        lane& lane_locked(priority prio) {
+            auto index{static_cast<size_t>(prio)};
+            if (auto* found{lanes[index].load(std::memory_order_relaxed)}; found != nullptr)
+                return *found;
 
-    struct state {
-        Bus bus;
-        duration polling_interval;
-        std::map<kind, worker> workers;
+            owned_lanes[index] = std::make_unique<lane>(ready_capacity);
+            lanes[index].store(owned_lanes[index].get(), std::memory_order_release);
+            return *owned_lanes[index];
+        };
 
-        explicit state(Bus bus, duration polling_interval)
-            : bus{bus}, polling_interval(polling_interval) {};
+        // A push sets its bit after the message is in; a pop that found the lane empty clears
+        // the bit and looks again, so one of them always sees the other.
+        void mark(size_t index) {
+            if (index == static_cast<size_t>(priority::normal))
+                return;
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto bit{1U << index};
+            if ((nonempty.load(std::memory_order_relaxed) & bit) == 0)
+                nonempty.fetch_or(bit);
+        };
+
+        void unmark(size_t index) {
+            auto bit{1U << index};
+            nonempty.fetch_and(~bit);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (lanes[index].load(std::memory_order_acquire)->size() != 0)
+                nonempty.fetch_or(bit);
+        };
+
+        static size_t highest(unsigned bits) {
+            size_t result{};
+            while (bits >>= 1U)
+                ++result;
+            return result;
+        };
+
+        static size_t lowest(unsigned bits) {
+            size_t result{};
+            while ((bits & 1U) == 0) {
+                bits >>= 1U;
+                ++result;
+            }
+            return result;
+        };
+
+        void lower_next_due(time_point at) {
+            auto due{at.time_since_epoch().count()};
+            if (due < next_due)
+                next_due = due;
+            timer.lower(due);
+        };
+
+        void update_next_due() {
+            auto due{never};
+            if (auto at{delayed.next_deadline()}; at.has_value())
+                due = at->time_since_epoch().count();
+            if (auto at{unacked.next_deadline()}; at.has_value())
+                due = std::min(due, at->time_since_epoch().count());
+            next_due = due;
+        };
+
+        // Returns how many messages became ready.
+        size_t put_due(time_point now, burial& buried) {
+            if (now.time_since_epoch().count() < next_due)
+                return 0;
+
+            size_t matured{};
+            size_t timed_out{};
+            size_t ready{};
+            {
+                std::lock_guard<std::mutex> _{mtx};
+
+                matured = delayed.expire(now, [this](message&& msg) {
+                    push_locked(std::move(msg));
+                });
+                timed_out = unacked.expire(now, [this, now, &buried, &ready](message&& msg) {
+                    ready += retry_locked(std::move(msg), now, buried) ? 1 : 0;
+                });
+
+                update_next_due();
+            }
+
+            stats.matured.fetch_add(matured, std::memory_order_relaxed);
+            stats.redelivered.fetch_add(timed_out, std::memory_order_relaxed);
+            return matured + ready;
+        };
+
+        // Sends a failed delivery back, after its backoff, or into buried once it used up its
+        // attempts. Returns whether it is ready again right away.
+        bool retry_locked(message&& msg, time_point now, burial& buried) {
+            ++msg.attempts;
+            if (retry.max_attempts != 0 && msg.attempts >= retry.max_attempts) {
+                buried.to = retry.dead_letter;
+                buried.messages.push_back(std::move(msg));
+                return false;
+            }
+
+            held.fetch_add(1, std::memory_order_relaxed);
+            auto backoff{retry.backoff(msg.attempts)};
+            auto at{now + backoff};
+            msg.ready = at;
+            if (backoff <= duration::zero()) {
+                push_locked(std::move(msg));
+                return true;
+            }
+
+            stats.delayed.fetch_add(1, std::memory_order_relaxed);
+            delayed.insert(at, std::move(msg));
+            lower_next_due(at);
+            return false;
+        };
+
+        kind_stats snapshot(bool auto_ack) const {
+            auto load{[](const std::atomic<std::uint64_t>& x) {
+                return x.load(std::memory_order_relaxed);
+            }};
+            // Saturating, since the counters are read one by one while others move them.
+            auto minus{[](std::uint64_t lhs, std::uint64_t rhs) {
+                return static_cast<size_t>(lhs > rhs ? lhs - rhs : 0);
+            }};
+
+            // Later stages first, so a stage is rarely seen ahead of the one feeding it.
+            kind_stats result{};
+            result.kind = std::string{name.name()};
+            result.counters.acked = load(stats.acked);
+            result.counters.nacked = load(stats.nacked);
+            result.counters.redelivered = load(stats.redelivered);
+            result.counters.dead_lettered = load(stats.dead_lettered);
+            result.counters.refused = load(stats.refused);
+            result.counters.dropped = load(stats.dropped);
+            result.counters.deduplicated = load(stats.deduplicated);
+            result.counters.delivered = load(stats.delivered);
+            auto matured{load(stats.matured)};
+            result.delayed = minus(load(stats.delayed), matured);
+            result.counters.put = load(stats.put);
+            result.enqueued = enqueued_size();
+            if (!auto_ack)
+                result.unacked =
+                    minus(result.counters.delivered, result.counters.acked +
+                                                         result.counters.nacked +
+                                                         result.counters.redelivered);
+            result.wait = wait.snapshot();
+            return result;
+        };
+    };
+
+    struct state {
+        // Indexed by kind_id; shards are never erased, so references stay valid.
+        detail::kind_table<shard, kind_id::max_count> shards;
+        std::atomic<bool> stopping{};
+
+        std::atomic<id_t> id{1};
+        id_t next_id() { return id++; };
+        // The first of count consecutive ids.
+        id_t next_ids(size_t count) { return id.fetch_add(count); };
+
+        duration ack_timeout{};
+        bool auto_ack{};
+        size_t ready_capacity{};
+        std::shared_ptr<segment_store> store;
+        std::function<void(id_t)> on_drop;
+        std::function<void(id_t, const squedl::payload&, priority, std::optional<kind_id>)>
+            on_bury;
+        // Width of a level 0 timing wheel slot; deadlines themselves are kept exactly.
+        duration resolution;
+        deadline_timer timer;
+        std::thread tick;
+
+        explicit state(duration ack_timeout, bool auto_ack, duration tick_duration,
+                       size_t ready_capacity, std::shared_ptr<segment_store> store)
+            : ack_timeout{ack_timeout}, auto_ack{auto_ack}, ready_capacity{ready_capacity},
+              store{std::move(store)}, resolution{tick_duration} {
+            if constexpr (!is_manual_clock_v<Clock>)
+                tick = std::thread{[this] { run_timer(); }};
+        };
+
+        state(state const& other) = delete;
+        state(state&& other) = delete;
+        state& operator=(state const& other) = delete;
+        state& operator=(state&& other) = delete;
+
+        ~state() {
+            stop();
+
+            if (tick.joinable())
+                tick.join();
+        };
+
+        shard& get(kind_id kind) {
+            return shards.get(kind.index(), kind, ready_capacity, resolution, timer);
+        };
+
+        std::optional<squedl::payload> make_payload(byte_view bytes) {
+            if (!store)
+                return squedl::payload{bytes};
+
+            try {
+                return store->write(bytes);
+            } catch (std::system_error& e) {
+                return std::nullopt;
+            }
+        };
+
+        // Takes room for one put, applying the kind's overflow policy when it is full.
+        bool admit(shard& shard) {
+            if (shard.reserve(1) == 1)
+                return true;
+
+            overflow_policy on_full{};
+            duration timeout{};
+            {
+                std::lock_guard<std::mutex> _{shard.mtx};
+                on_full = shard.on_full;
+                timeout = shard.block_timeout;
+            }
+
+            if (on_full == overflow_policy::drop_oldest) {
+                // The dropped message leaves its room to the new one.
+                if (drop_oldest(shard))
+                    return true;
+            } else if (on_full == overflow_policy::block) {
+                auto deadline{std::chrono::steady_clock::now() +
+                              std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                  timeout)};
+                for (;;) {
+                    auto ticket{shard.space.prepare_wait()};
+                    if (shard.reserve(1) == 1) {
+                        shard.space.cancel_wait();
+                        return true;
+                    }
+                    if (stopping) {
+                        shard.space.cancel_wait();
+                        break;
+                    }
+                    if (!shard.space.wait_until(ticket, deadline))
+                        break;
+                }
+            }
+
+            shard.stats.refused.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        };
+
+        // Never waits; under drop_oldest it makes room for all it can by dropping.
+        size_t admit_up_to(shard& shard, size_t count) {
+            auto result{shard.reserve(count)};
+            if (result < count && shard.max_held != capacity_limit::unbounded) {
+                bool drops{};
+                {
+                    std::lock_guard<std::mutex> _{shard.mtx};
+                    drops = shard.on_full == overflow_policy::drop_oldest;
+                }
+                while (drops && result < count && drop_oldest(shard))
+                    ++result;
+            }
+
+            shard.stats.refused.fetch_add(count - result, std::memory_order_relaxed);
+            return result;
+        };
+
+        // Stores a batch the kind already has room for and wakes consumers once; returns its
+        // ids.
+        std::vector<id_t> store_batch(shard& shard, std::vector<message>&& batch,
+                                      time_point at) {
+            std::vector<id_t> result{};
+            result.reserve(batch.size());
+            for (const auto& msg : batch)
+                result.push_back(msg.id);
+
+            wake(shard, shard.store_many(std::move(batch), at));
+            return result;
+        };
+
+        bool drop_oldest(shard& shard) {
+            auto dropped{shard.drop_oldest()};
+            if (!dropped.has_value())
+                return false;
+
+            if (on_drop)
+                on_drop(dropped.value());
+            return true;
+        };
+
+        // Room for all count puts or for none, never waiting.
+        bool admit_all(shard& shard, size_t count) {
+            auto admitted{admit_up_to(shard, count)};
+            if (admitted == count)
+                return true;
+
+            release(shard, admitted);
+            shard.stats.refused.fetch_add(admitted, std::memory_order_relaxed);
+            return false;
+        };
+
+        void release(shard& shard, size_t count) {
+            if (count == 0)
+                return;
+
+            shard.held.fetch_sub(count, std::memory_order_relaxed);
+            if (shard.max_held != capacity_limit::unbounded)
+                shard.space.notify_all();
+        };
+
+        // Must not be called with shard.mtx held, like wake and bury.
+        void requeue_due(shard& shard) {
+            burial buried{};
+            wake(shard, shard.put_due(Clock::now(), buried));
+            bury(shard, buried);
+        };
+
+        void bury(shard& from, burial& buried) {
+            if (buried.messages.empty())
+                return;
+
+            from.stats.dead_lettered.fetch_add(buried.messages.size(),
+                                               std::memory_order_relaxed);
+            if (on_bury)
+                for (const auto& msg : buried.messages)
+                    on_bury(msg.id, msg.payload, msg.prio, buried.to);
+            if (!buried.to.has_value())
+                return;
+
+            auto& target{get(buried.to.value())};
+            auto now{Clock::now()};
+            target.held.fetch_add(buried.messages.size(), std::memory_order_relaxed);
+            for (auto& msg : buried.messages) {
+                msg.attempts = 0;
+                msg.ready = now;
+                target.push(std::move(msg));
+            }
+            target.stats.put.fetch_add(buried.messages.size(), std::memory_order_relaxed);
+            wake(target, buried.messages.size());
+        };
+
+        void stop() {
+            stopping = true;
+
+            {
+                std::lock_guard<std::mutex> _{timer.mtx};
+                timer.cv.notify_all();
+            }
+
+            std::vector<shard*> all;
+            shards.for_each([&all](auto /*index*/, auto& shard) {
+                shard.ready.notify_all();
+                shard.space.notify_all();
+                all.push_back(&shard);
+            });
+            for (auto* shard : all)
+                release_receivers(*shard, std::nullopt);
+        };
+
+        // Turns popped messages into deliveries, tracking them as unacked unless auto_ack.
+        std::vector<delivery> deliver(shard& shard, std::vector<message>& batch) {
+            std::vector<delivery> result{};
+            result.reserve(batch.size());
+
+            auto now{Clock::now()};
+            for (const auto& msg : batch)
+                shard.wait.record(now - msg.ready);
+            shard.stats.delivered.fetch_add(batch.size(), std::memory_order_relaxed);
+            release(shard, batch.size());
+
+            if (auto_ack) {
+                for (auto& msg : batch)
+                    result.push_back(delivery{msg.id, std::move(msg.payload)});
+                return result;
+            }
+
+            auto unacked_due{now + ack_timeout};
+            std::lock_guard<std::mutex> _{shard.mtx};
+            for (auto& msg : batch) {
+                auto id{msg.id};
+                auto payload{msg.payload};
+                result.push_back(delivery{id, std::move(payload),
+                                          shard.unacked.insert(unacked_due, std::move(msg))});
+            }
+            shard.lower_next_due(unacked_due);
+
+            return result;
+        };
+
+        // Tells blocked and asynchronous consumers that ready messages arrived: one blocked next
+        // per message, so a batch wakes as many sleepers as it can feed and no more. Must not be
+        // called with shard.mtx held. The fence in notify orders the push before the
+        // receivers_count load, pairing with the increment in next_async.
+        void wake(shard& shard, size_t ready) {
+            if (ready == 0)
+                return;
+
+            shard.ready.notify(ready);
+            if (shard.receivers_count.load() != 0)
+                serve(shard);
+        };
+
+        void serve(shard& shard) {
+            std::vector<std::pair<receiver, std::vector<delivery>>> served;
+            {
+                std::lock_guard<std::mutex> _{shard.receivers_mtx};
+                std::vector<message> batch{};
+                while (!shard.receivers.empty()) {
+                    auto& front{shard.receivers.front()};
+                    batch.clear();
+                    if (!shard.pop(batch, front.count))
+                        break;
+
+                    served.emplace_back(std::move(front.receive), deliver(shard, batch));
+                    shard.receivers.pop_front();
+                    shard.receivers_count.fetch_sub(1);
+                }
+            }
+
+            for (auto& [receive, batch] : served)
+                receive(std::optional{std::move(batch)});
+        };
+
+        void release_receivers(shard& shard, const std::optional<std::vector<delivery>>& result) {
+            std::deque<pending_receive> released;
+            {
+                std::lock_guard<std::mutex> _{shard.receivers_mtx};
+                released.swap(shard.receivers);
+                shard.receivers_count.fetch_sub(released.size());
+            }
+
+            for (auto& x : released)
+                x.receive(result);
+        };
+
+        // Puts what is due in every shard; returns how many messages became ready and lowers
+        // earliest to the next deadline of any shard. Woken outside for_each, since receivers
+        // may run arbitrary code.
+        size_t run_due(rep& earliest) {
+            std::vector<std::pair<shard*, size_t>> woken;
+            std::vector<std::pair<shard*, burial>> buried;
+            auto now{Clock::now()};
+            shards.for_each([&woken, &buried, &earliest, now](auto /*index*/, auto& shard) {
+                burial dead{};
+                if (auto ready{shard.put_due(now, dead)}; ready != 0)
+                    woken.emplace_back(&shard, ready);
+                if (!dead.messages.empty())
+                    buried.emplace_back(&shard, std::move(dead));
+                earliest = std::min(earliest, shard.next_due.load());
+            });
+
+            size_t result{};
+            for (auto [shard, ready] : woken) {
+                wake(*shard, ready);
+                result += ready;
+            }
+            for (auto& [shard, dead] : buried)
+                bury(*shard, dead);
+            return result;
+        };
+
+        // Sleeps until the earliest delayed or unacked deadline of any shard, or indefinitely
+        // when there is none; an earlier insert wakes it through deadline_timer::lower.
+        void run_timer() {
+            std::unique_lock lock{timer.mtx};
+            while (!stopping) {
+                auto due{timer.due.load()};
+                if (due == never) {
+                    timer.cv.wait(lock);
+                    continue;
+                }
+
+                if (Clock::now().time_since_epoch().count() < due) {
+                    timer.cv.wait_until(lock, time_point{duration{due}});
+                    continue;
+                }
+
+                timer.due = never;
+                lock.unlock();
+
+                auto earliest{never};
+                run_due(earliest);
+
+                lock.lock();
+                if (earliest < timer.due)
+                    timer.due = earliest;
+            }
+        };
+    };
+
+    std::shared_ptr<state> data;
+
+    static std::optional<std::vector<delivery>> opt_with_empty_vec() {
+        return std::optional{std::vector<delivery>{}};
+    }
+}; // test_bus
+
+template <typename Bus>
+class scheduler {
+    Bus bus;
+
+public:
+    using clock = typename Bus::clock;
+    using duration = typename Bus::clock::duration;
+    using time_point = typename Bus::clock::time_point;
+    using id_t = typename Bus::id_t;
+
+    using recurring_id = std::uint64_t;
+
+    // When a recurring task is due. fixed_rate ticks every period from first on, however late
+    // the earlier ticks were put. fixed_delay puts each task delay after the one before was
+    // put, so a late one pushes the later ones back and none is ever missed; the scheduler does
+    // not see tasks run, so it cannot count from when they finish. cron ticks at the minutes
+    // the expression matches in UTC; on a clock other than system_clock, such as steady_clock or
+    // manual_clock, those are found through the offset between the two clocks as it was when
+    // the scheduler was made. Catching up puts at most max_catch_up tasks at once for the ticks
+    // missed, so a schedule left behind for long does not flood the bus with them.
+    struct recurrence {
+        enum class mode : std::uint8_t { fixed_rate, fixed_delay, cron };
+
+        static constexpr size_t default_max_catch_up{16};
+
+        mode type{mode::fixed_rate};
+        duration period{};
+        duration first{};
+        std::optional<cron_schedule> expression;
+        missed_ticks missed{missed_ticks::skip};
+        size_t max_catch_up{default_max_catch_up};
+
+        static recurrence fixed_rate(duration period, duration first = duration::zero(),
+                                     missed_ticks missed = missed_ticks::skip,
+                                     size_t max_catch_up = default_max_catch_up) {
+            return recurrence{mode::fixed_rate, period, first, std::nullopt, missed, max_catch_up};
+        };
+
+        static recurrence fixed_delay(duration delay, duration first = duration::zero()) {
+            return recurrence{mode::fixed_delay, delay, first, std::nullopt, missed_ticks::skip};
+        };
+
+        static recurrence cron(cron_schedule expression,
+                               missed_ticks missed = missed_ticks::skip,
+                               size_t max_catch_up = default_max_catch_up) {
+            return recurrence{mode::cron, duration::zero(), duration::zero(),
+                              std::move(expression), missed, max_catch_up};
+        };
+    };
+
+    explicit scheduler<Bus>(Bus bus) : bus{bus}, timers{std::make_shared<recurring>(bus)} {};
+
+    // A task scheduled again under the idempotency key of one the bus still remembers is not
+    // scheduled twice; the id of the first comes back instead.
+    template <typename T, typename Args = typename T::args>
+    expected<id_t> try_schedule(const Args& task, duration after = duration::zero(),
+                                priority prio = priority::normal,
+                                std::string_view idempotency_key = {}) {
+        static_assert(is_serializable_v<T, Args> && has_kind_v<T>);
+
+        auto kind{kind_id::of<T>()};
+
+        if constexpr (is_buffer_serializable_v<T, Args>) {
+            thread_local bytes buffer{};
+            buffer.clear();
+            T::serialize(task, buffer);
+            return bus.put(kind, byte_view{buffer}, after, prio, idempotency_key);
+        } else if constexpr (std::is_same_v<decltype(T::serialize(task)), payload>) {
+            return bus.put(kind, T::serialize(task), after, prio, idempotency_key);
+        } else {
+            return bus.put(kind, byte_view{T::serialize(task)}, after, prio, idempotency_key);
+        }
+    };
+
+    // Schedules a fan-out of tasks, serializing all of args back to back into one buffer that
+    // the bus puts with one lock acquisition and one wakeup. All of them are scheduled or none.
+    template <typename T, typename Range, typename Args = typename T::args>
+    expected<std::vector<id_t>> try_schedule_many(const Range& args,
+                                                  duration after = duration::zero(),
+                                                  priority prio = priority::normal) {
+        static_assert(is_serializable_v<T, Args> && has_kind_v<T>);
+
+        auto kind{kind_id::of<T>()};
+
+        thread_local bytes buffer{};
+        thread_local std::vector<size_t> ends{};
+        buffer.clear();
+        ends.clear();
+        if constexpr (is_buffer_serializable_v<T, Args>) {
+            for (const auto& task : args) {
+                T::serialize(task, buffer);
+                ends.push_back(buffer.size());
+            }
+        } else if constexpr (std::is_same_v<decltype(T::serialize(std::declval<const Args&>())),
+                                            payload>) {
+            std::vector<payload> payloads{};
+            for (const auto& task : args)
+                payloads.push_back(T::serialize(task));
+            return bus.put_many(kind, payloads, after, prio);
+        } else {
+            for (const auto& task : args) {
+                auto serialized{T::serialize(task)};
+                buffer.insert(buffer.end(), serialized.begin(), serialized.end());
+                ends.push_back(buffer.size());
+            }
+        }
+        return bus.put_many(kind, byte_view{buffer}, ends, after, prio);
+    };
+
+    template <typename T, typename Args = typename T::args>
+    expected<id_t> try_schedule(const Args& task, time_point after,
+                                priority prio = priority::normal,
+                                std::string_view idempotency_key = {}) {
+        return try_schedule<T, Args>(task, after - clock::now(), prio, idempotency_key);
+    };
+
+    template <typename T, typename Args = typename T::args>
+    id_t schedule(const Args& task, duration after = duration::zero(),
+                  priority prio = priority::normal, std::string_view idempotency_key = {}) {
+        auto result{try_schedule<T, Args>(task, after, prio, idempotency_key)};
+        if (result.has_value())
+            return result.value();
+
+        throw result.error();
+    };
+
+    template <typename T, typename Args = typename T::args>
+    id_t schedule(const Args& task, time_point after, priority prio = priority::normal,
+                  std::string_view idempotency_key = {}) {
+        return schedule<T, Args>(task, after - clock::now(), prio, idempotency_key);
+    };
+
+    template <typename T, typename Range, typename Args = typename T::args>
+    std::vector<id_t> schedule_many(const Range& args, duration after = duration::zero(),
+                                    priority prio = priority::normal) {
+        auto result{try_schedule_many<T, Range, Args>(args, after, prio)};
+        if (result.has_value())
+            return std::move(result.value());
+
+        throw result.error();
+    };
+
+    // Puts task whenever when ticks, until the schedule is cancelled. The task is serialized
+    // once, here, and puts go straight to the bus from the scheduler's timer thread, so running
+    // tasks have nothing to reschedule.
+    template <typename T, typename Args = typename T::args>
+    recurring_id schedule_recurring(const Args& task, const recurrence& when,
+                                    priority prio = priority::normal) {
+        static_assert(is_serializable_v<T, Args> && has_kind_v<T>);
+
+        bytes serialized{};
+        if constexpr (is_buffer_serializable_v<T, Args>)
+            T::serialize(task, serialized);
+        else if constexpr (std::is_same_v<decltype(T::serialize(task)), payload>)
+            serialized = T::serialize(task).to_bytes();
+        else
+            serialized = T::serialize(task);
+        return timers->add(kind_id::of<T>(), std::move(serialized), when, prio);
+    };
+
+    // Returns whether there was such a schedule; tasks it already put stay put.
+    bool cancel(recurring_id id) { return timers->cancel(id); };
+
+    // Puts the recurring tasks that are due, as the timer thread does; returns how many were
+    // put. On a manual clock there is no timer thread, so whoever moves the clock calls this.
+    size_t run_due() { return timers->run_due(); };
+
+    // No later than the next tick of any recurring schedule, if there is one.
+    std::optional<time_point> next_due() { return timers->next_due(); };
+
+    // Ends every recurring schedule, for all copies of this scheduler.
+    void stop() { timers->stop(); };
+
+private:
+    struct tick {
+        time_point at;
+        recurring_id id{};
+
+        friend bool operator>(const tick& lhs, const tick& rhs) { return lhs.at > rhs.at; };
+    };
+
+    struct schedule_entry {
+        kind_id kind;
+        std::shared_ptr<const bytes> payload;
+        priority prio{};
+        recurrence when;
+        // The schedule's tick in the heap; any other tick of it there is stale.
+        time_point next;
+    };
+
+    struct firing {
+        kind_id kind;
+        std::shared_ptr<const bytes> payload;
+        priority prio{};
+        size_t count{};
+    };
+
+    // The recurring schedules of a scheduler and its copies. A min-heap holds the next tick of
+    // every schedule; cancelled schedules leave theirs behind, to be dropped when it comes up.
+    // The timer thread starts with the first schedule and sleeps until the earliest tick.
+    struct recurring {
+        Bus bus;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::priority_queue<tick, std::vector<tick>, std::greater<tick>> heap;
+        std::unordered_map<recurring_id, schedule_entry> entries;
+        recurring_id last_id{};
+        bool stopping{};
+        std::thread thread;
+        // What to add to a time of clock to get the system_clock time it stands for.
+        std::chrono::system_clock::duration wall_offset{};
+
+        explicit recurring(Bus bus) : bus{bus} {
+            if constexpr (!std::is_same_v<clock, std::chrono::system_clock>)
+                wall_offset = std::chrono::system_clock::now().time_since_epoch() -
+                              std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                                  clock::now().time_since_epoch());
+        };
+
+        recurring(recurring const& other) = delete;
+        recurring(recurring&& other) = delete;
+        recurring& operator=(recurring const& other) = delete;
+        recurring& operator=(recurring&& other) = delete;
+
+        ~recurring() {
+            stop();
+
+            if (thread.joinable())
+                thread.join();
+        };
+
+        recurring_id add(kind_id kind, bytes&& payload, recurrence when, priority prio) {
+            if (when.type != recurrence::mode::cron)
+                when.period = std::max(when.period, duration{1});
+
+            auto now{clock::now()};
+            std::optional<time_point> first{now + std::max(when.first, duration::zero())};
+            if (when.type == recurrence::mode::cron)
+                first = when.expression.has_value() ? next_cron(when.expression.value(), now)
+                                                    : std::nullopt;
+
+            recurring_id id{};
+            {
+                std::lock_guard<std::mutex> _{mtx};
+                id = ++last_id;
+                if (stopping || !first.has_value())
+                    return id;
+
+                entries.emplace(id, schedule_entry{kind,
+                                                   std::make_shared<const bytes>(
+                                                       std::move(payload)),
+                                                   prio, std::move(when), first.value()});
+                heap.push(tick{first.value(), id});
+                if constexpr (!is_manual_clock_v<clock>)
+                    if (!thread.joinable())
+                        thread = std::thread{[this] { run(); }};
+            }
+            cv.notify_one();
+            return id;
+        };
+
+        bool cancel(recurring_id id) {
+            std::lock_guard<std::mutex> _{mtx};
+            return entries.erase(id) != 0;
+        };
+
+        std::optional<time_point> next_due() {
+            std::lock_guard<std::mutex> _{mtx};
+            if (heap.empty())
+                return std::nullopt;
+            return heap.top().at;
+        };
+
+        void stop() {
+            {
+                std::lock_guard<std::mutex> _{mtx};
+                stopping = true;
+                entries.clear();
+                heap = {};
+            }
+            cv.notify_all();
+        };
+
+        // Puts outside mtx, since a put may wait for room.
+        size_t run_due() {
+            std::vector<firing> due;
+            auto now{clock::now()};
+            {
+                std::lock_guard<std::mutex> _{mtx};
+                while (!heap.empty() && heap.top().at <= now) {
+                    auto current{heap.top()};
+                    heap.pop();
+                    auto found{entries.find(current.id)};
+                    if (found == entries.end() || found->second.next != current.at)
+                        continue;
+
+                    auto& entry{found->second};
+                    auto [count, next]{advance(entry.when, current.at, now)};
+                    due.push_back(firing{entry.kind, entry.payload, entry.prio, count});
+                    if (!next.has_value()) {
+                        entries.erase(found);
+                        continue;
+                    }
+                    entry.next = next.value();
+                    heap.push(tick{next.value(), current.id});
+                }
+            }
+
+            size_t result{};
+            for (const auto& x : due)
+                for (size_t i{}; i < x.count; ++i)
+                    if (bus.put(x.kind, byte_view{*x.payload}, duration::zero(), x.prio)
+                            .has_value())
+                        ++result;
+            return result;
+        };
+
+        void run() {
+            std::unique_lock lock{mtx};
+            while (!stopping) {
+                if (heap.empty()) {
+                    cv.wait(lock);
+                    continue;
+                }
+
+                auto at{heap.top().at};
+                if (clock::now() < at) {
+                    cv.wait_until(lock, at);
+                    continue;
+                }
+
+                lock.unlock();
+                run_due();
+                lock.lock();
+            }
+        };
+
+        // How many tasks the tick due at puts by now, and when the schedule ticks next.
+        std::pair<size_t, std::optional<time_point>> advance(const recurrence& when,
+                                                             time_point at, time_point now) {
+            if (when.type == recurrence::mode::fixed_delay)
+                return {1, now + when.period};
+
+            auto limit{when.missed == missed_ticks::catch_up
+                           ? std::max<size_t>(when.max_catch_up, 1)
+                           : size_t{1}};
+            if (when.type == recurrence::mode::fixed_rate) {
+                auto missed{(now - at) / when.period};
+                auto count{std::min(static_cast<size_t>(missed) + 1, limit)};
+                return {count, at + when.period * (missed + 1)};
+            }
+
+            const auto& expression{when.expression.value()};
+            if (limit == 1)
+                return {1, next_cron(expression, now)};
+
+            // Walks the missed minutes one by one only up to the cap, then jumps past the rest.
+            size_t count{};
+            std::optional<time_point> next{at};
+            while (count < limit && next.has_value() && next.value() <= now) {
+                ++count;
+                next = next_cron(expression, next.value());
+            }
+            if (next.has_value() && next.value() <= now)
+                next = next_cron(expression, now);
+            return {count, next};
+        };
+
+        std::optional<time_point> next_cron(const cron_schedule& expression,
+                                            time_point after) const {
+            using wall = std::chrono::system_clock::duration;
+            auto next{expression.next_after(std::chrono::floor<std::chrono::seconds>(
+                std::chrono::duration_cast<wall>(after.time_since_epoch()) + wall_offset))};
+            if (!next.has_value())
+                return std::nullopt;
+            return time_point{std::chrono::ceil<duration>(wall{next.value()} - wall_offset)};
+        };
+    };
+
+    std::shared_ptr<recurring> timers;
+}; // scheduler
+
+// Fetches jobs of the kinds it works on from bus and runs them on its threads.
+//
+// Stopping the pool ends its blocked fetches with bus.interrupt, which ends every blocked next
+// of those kinds on the bus, not only the pool's own: other pools and net_server clients
+// consuming the same kinds from a shared bus see their next return early, possibly several
+// times, while the pool stops.
+template <typename Bus>
+class worker_pool {
+public:
+    using id_t = typename Bus::id_t;
+    using handle_t = typename Bus::handle_t;
+    using duration = typename Bus::duration;
+    using job = typename Bus::delivery;
+
+    static constexpr size_t default_ack_batch_size{64};
+    static constexpr duration default_ack_flush_interval = std::chrono::milliseconds(10);
+
+    // Runs every kind registered through work_on on one shared set of threads, one per core
+    // unless thread_count says otherwise.
+    explicit worker_pool<Bus>(Bus bus, size_t ack_batch_size = default_ack_batch_size,
+                              duration ack_flush_interval = default_ack_flush_interval,
+                              size_t thread_count = std::thread::hardware_concurrency())
+        : data{std::make_shared<state>(bus, ack_batch_size, ack_flush_interval)} {
+        data->start(std::max<size_t>(thread_count, 1));
+    };
+
+    worker_pool(worker_pool const& other) = delete;
+    worker_pool(worker_pool&& other) = delete;
+    worker_pool& operator=(worker_pool const& other) = delete;
+    worker_pool& operator=(worker_pool&& other) = delete;
+    ~worker_pool() { stop(); }
+
+    // pool_size caps how many jobs of this kind run at once; weight sets how often idle threads
+    // pick this kind over others. Asynchronous tasks free their thread as soon as they return,
+    // so a large pool_size keeps that many of them in flight on a few threads. An asynchronous
+    // task that throws has failed and must not call its completion as well.
+    template <typename T, typename TArgs = typename T::args>
+    void work_on(T task, size_t pool_size, size_t weight = 1) {
+        data->add(kind_id::of<T>(), pool_size, weight,
+                  [task, scratch = bytes{}](byte_view payload,
+                                            const finisher& finish) mutable -> std::optional<bool> {
+                      auto args{[&] {
+                          if constexpr (is_view_deserializable_v<T, TArgs>) {
+                              return T::deserialize(payload);
+                          } else {
+                              scratch.assign(payload.begin(), payload.end());
+                              return T::deserialize(scratch);
+                          }
+                      }()};
+
+                      if constexpr (is_callback_task_v<T, TArgs> ||
+                                    is_startable_task_v<T, TArgs>) {
+                          auto done{finish.start()};
+                          try {
+                              if constexpr (is_callback_task_v<T, TArgs>)
+                                  task(std::move(args), done);
+                              else
+                                  task(std::move(args)).start(done);
+                          } catch (std::exception& e) {
+                              done(error{});
+                          }
+                          return std::nullopt;
+                      } else {
+                          return task(std::move(args)) == std::nullopt;
+                      }
+                  });
+    };
+
+    // Returns once the pool no longer takes jobs from the bus.
+    void stop() { data->stop(); };
+
+    std::vector<work_stats> metrics() { return data->metrics(); };
+
+private:
+    // How long stop() waits for a fetcher to leave the bus before interrupting it again.
+    static constexpr std::chrono::milliseconds interrupt_retry{1};
+
+    struct state;
+    struct lane;
+
+    // Settles a job that a task took over, on whatever thread it ends.
+    class finisher {
+    public:
+        finisher(state* owner, lane* kind, handle_t handle,
+                 std::chrono::steady_clock::time_point started)
+            : owner{owner}, kind{kind}, handle{handle}, started{started} {};
+
+        completion start() const {
+            owner->async_started();
+            return [owner = owner, kind = kind, handle = handle,
+                    started = started](std::optional<error> result) {
+                owner->finish(*kind, handle, result == std::nullopt, started);
+            };
+        };
+
+    private:
+        state* owner{};
+        lane* kind{};
+        handle_t handle{};
+        std::chrono::steady_clock::time_point started{};
+    };
+
+    // Returns whether the job succeeded, or nullopt when it finishes through the finisher.
+    using task_fn = std::function<std::optional<bool>(byte_view, const finisher&)>;
+
+    struct unit {
+        lane* owner{};
+        job delivery{};
+    };
+
+    // A kind registered through work_on. Its fetcher thread is the only one blocking on the bus
+    // for the kind and hands jobs over through the lock-free ready ring, which is sized so that
+    // everything in flight always fits.
+    struct lane {
+        kind_id name;
+        size_t index{};
+        size_t concurrency{};
+        size_t weight{};
+        task_fn task;
+
+        // Jobs fetched from the bus and not finished yet, including those being fetched.
+        std::atomic<size_t> in_flight{};
+        detail::event_count capacity;
+        detail::mpmc_queue<unit> ready;
+        std::atomic<bool> fetching{true};
+        std::thread fetcher;
+
+        std::atomic<std::uint64_t> succeeded{};
+        std::atomic<std::uint64_t> failed{};
+        histogram execution;
+
+        void record(bool ok, std::chrono::steady_clock::duration took) {
+            (ok ? succeeded : failed).fetch_add(1, std::memory_order_relaxed);
+            execution.record(took);
+        };
+
+        lane(kind_id name, size_t index, size_t concurrency, size_t weight, task_fn&& task)
+            : name{name}, index{index}, concurrency{concurrency}, weight{weight},
+              task{std::move(task)}, ready{concurrency} {};
+    };
+
+    // Outcomes of finished jobs, held back per thread and kind so they reach the bus in batches.
+    struct completions {
+        std::vector<handle_t> acked;
+        std::vector<handle_t> nacked;
+        std::chrono::steady_clock::time_point since{};
+
+        void add(handle_t handle, bool ok, std::chrono::steady_clock::time_point now) {
+            if (acked.empty() && nacked.empty())
+                since = now;
+            (ok ? acked : nacked).push_back(handle);
+        };
+
+        size_t size() const { return acked.size() + nacked.size(); };
+    };
+
+    // What a thread keeps to itself: a snapshot of the lanes, its own copy of every task and
+    // its pending completions.
+    struct context {
+        size_t self{};
+        size_t version{};
+        std::vector<lane*> lanes;
+        std::vector<lane*> schedule;
+        std::vector<std::optional<task_fn>> tasks;
+        std::vector<completions> done;
+        // When the oldest completions held back in done are due to be flushed.
+        std::chrono::steady_clock::time_point flush_due{
+            std::chrono::steady_clock::time_point::max()};
+        std::minstd_rand rng;
+
+        explicit context(size_t self) : self{self}, rng{static_cast<unsigned>(self + 1)} {};
+    };
+
+    // Every thread owns a lock-free buffer of units it took from a lane; idle threads steal
+    // from the buffers of others. The context outlives the thread, since asynchronous jobs may
+    // still use the task copies in it.
+    struct worker {
+        static constexpr size_t buffer_size{256};
+
+        detail::mpmc_queue<unit> units{buffer_size};
+        context ctx;
+        std::thread thread;
+
+        explicit worker(size_t self) : ctx{self} {};
+    };
+
+    struct state {
+        Bus bus;
+        size_t ack_batch_size{};
+        duration ack_flush_interval;
+        std::atomic<bool> stopping{};
+
+        std::shared_mutex lanes_mtx;
+        std::vector<std::unique_ptr<lane>> lanes;
+        // Lanes repeated by weight; idle threads walk it round-robin from cursor.
+        std::vector<lane*> schedule;
+        std::atomic<size_t> lanes_version{};
+        std::atomic<size_t> cursor{};
+
+        // Notified by every fetcher leaving; stop() waits on it for them to be out of the bus.
+        detail::event_count fetcher_exits;
+
+        std::vector<std::unique_ptr<worker>> workers;
+        // Units sitting in lane rings or thread buffers.
+        std::atomic<size_t> queued{};
+        detail::event_count idle;
+
+        // Jobs that tasks took over and did not finish yet.
+        std::mutex async_mtx;
+        std::condition_variable async_done;
+        size_t async_running{};
+
+        explicit state(Bus bus, size_t ack_batch_size, duration ack_flush_interval)
+            : bus{bus}, ack_batch_size{std::max<size_t>(ack_batch_size, 1)},
+              ack_flush_interval{ack_flush_interval} {};
+
+        state(state const& other) = delete;
+        state(state&& other) = delete;
+        state& operator=(state const& other) = delete;
+        state& operator=(state&& other) = delete;
+
+        ~state() {
+            stop();
+            for (auto& worker : workers)
+                if (worker->thread.joinable())
+                    worker->thread.join();
+
+            {
+                std::unique_lock lock{async_mtx};
+                async_done.wait(lock, [this] { return async_running == 0; });
+            }
+
+            std::unique_lock _{lanes_mtx};
+            for (auto& lane : lanes) {
+                lane->fetcher.join();
+
+                std::vector<handle_t> leftovers;
+                unit current{};
+                while (lane->ready.try_pop(current))
+                    leftovers.push_back(current.delivery.handle);
+                if (!leftovers.empty())
+                    bus.nack_many(lane->name, leftovers);
+            }
+        };
+
+        void start(size_t thread_count) {
+            workers.reserve(thread_count);
+            for (size_t i{}; i < thread_count; ++i)
+                workers.push_back(std::make_unique<worker>(i));
+            for (size_t i{}; i < thread_count; ++i)
+                workers[i]->thread = std::thread{[this, i] { run(i); }};
+        };
+
+        void add(kind_id kind, size_t concurrency, size_t weight, task_fn&& task) {
+            {
+                std::unique_lock _{lanes_mtx};
+                auto exists{std::any_of(lanes.begin(), lanes.end(),
+                                        [&kind](const auto& x) { return x->name == kind; })};
+                if (exists || concurrency == 0 || stopping)
+                    return;
+
+                auto& added{*lanes.emplace_back(std::make_unique<lane>(
+                    kind, lanes.size(), concurrency, std::max<size_t>(weight, 1),
+                    std::move(task)))};
+                schedule.insert(schedule.end(), added.weight, &added);
+                // Bumped before the lane fetches anything, so whoever gets one of its units
+                // finds its context out of date.
+                ++lanes_version;
+                added.fetcher = std::thread{[this, &added] { fetch(added); }};
+            }
+            idle.notify_all();
+        };
+
+        // Returns once every fetcher left the bus, sleeping on fetcher_exits meanwhile. A
+        // fetcher may be past its stopping check but not yet in bus.next, where a single
+        // interrupt would miss it, so one still there after interrupt_retry is interrupted
+        // again. A fetcher stops the pool only when the bus stopped, which ends the other
+        // fetchers too, so it does not wait for them.
+        void stop() {
+            if (!stopping.exchange(true))
+                idle.notify_all();
+
+            // Lanes are never removed before the state goes, and none are added once stopping.
+            std::vector<lane*> all;
+            bool waits{};
+            {
+                std::shared_lock _{lanes_mtx};
+                for (auto& lane : lanes)
+                    all.push_back(lane.get());
+                waits = std::none_of(lanes.begin(), lanes.end(), [](const auto& x) {
+                    return x->fetcher.get_id() == std::this_thread::get_id();
+                });
+            }
+
+            for (auto* lane : all)
+                interrupt(*lane);
+            if (!waits)
+                return;
+
+            for (auto* lane : all) {
+                for (;;) {
+                    auto ticket{fetcher_exits.prepare_wait()};
+                    if (!lane->fetching) {
+                        fetcher_exits.cancel_wait();
+                        break;
+                    }
+                    if (!fetcher_exits.wait_until(ticket,
+                                                  std::chrono::steady_clock::now() +
+                                                      interrupt_retry))
+                        interrupt(*lane);
+                }
+            }
+        };
+
+        void interrupt(lane& lane) {
+            lane.capacity.notify_all();
+            bus.interrupt(lane.name);
+        };
+
+        void run(size_t self) {
+            auto& ctx{workers[self]->ctx};
+            unit current{};
+            auto& own{workers[self]->units};
+
+            while (!stopping) {
+                refresh(ctx);
+
+                if (pop(own, current) || take(ctx, current) || steal(ctx, current)) {
+                    flush_overdue(ctx);
+                    execute(ctx, current);
+                    continue;
+                }
+
+                flush_all(ctx);
+
+                auto ticket{idle.prepare_wait()};
+                if (stopping || queued != 0) {
+                    idle.cancel_wait();
+                    continue;
+                }
+                idle.wait(ticket);
+            }
+
+            refresh(ctx);
+            while (pop(own, current))
+                ctx.done[current.owner->index].add(current.delivery.handle, false,
+                                                   std::chrono::steady_clock::now());
+            flush_all(ctx);
+        };
+
+        // Blocks on the bus whenever the kind has spare capacity; never polls. Only stop()
+        // through bus.interrupt, or a stopped bus, ends it.
+        void fetch(lane& lane) {
+            while (!stopping) {
+                auto ticket{lane.capacity.prepare_wait()};
+                auto in_flight{lane.in_flight.load()};
+                if (in_flight >= lane.concurrency && !stopping) {
+                    lane.capacity.wait(ticket);
+                    continue;
+                }
+                lane.capacity.cancel_wait();
+                if (stopping)
+                    break;
+
+                auto want{lane.concurrency - in_flight};
+                lane.in_flight += want;
+                auto batch{bus.next(lane.name, want)};
+                auto got{batch.has_value() ? batch.value().size() : 0};
+                lane.in_flight -= want - got;
+
+                if (!batch.has_value()) {
+                    stop();
+                    break;
+                }
+
+                for (auto& delivery : batch.value()) {
+                    unit fetched{&lane, std::move(delivery)};
+                    while (!lane.ready.try_push(std::move(fetched)))
+                        std::this_thread::yield();
+                }
+                queued += got;
+
+                if (got == 1)
+                    idle.notify_one();
+                else if (got > 1)
+                    idle.notify_all();
+            }
+
+            lane.fetching = false;
+            fetcher_exits.notify_all();
+        };
+
+        void refresh(context& ctx) {
+            if (ctx.version == lanes_version)
+                return;
+
+            std::shared_lock _{lanes_mtx};
+            ctx.version = lanes_version;
+            ctx.lanes.clear();
+            for (auto& lane : lanes)
+                ctx.lanes.push_back(lane.get());
+            ctx.schedule = schedule;
+            ctx.tasks.resize(ctx.lanes.size());
+            ctx.done.resize(ctx.lanes.size());
+        };
+
+        bool pop(detail::mpmc_queue<unit>& units, unit& result) {
+            if (!units.try_pop(result))
+                return false;
+
+            --queued;
+            return true;
+        };
+
+        // Takes a fair share of the next non-empty lane in weight order: one unit to run now
+        // and the rest into the own buffer for this thread or thieves.
+        bool take(context& ctx, unit& result) {
+            if (ctx.schedule.empty())
+                return false;
+
+            auto start{cursor++};
+            for (size_t i{}; i < ctx.schedule.size(); ++i) {
+                auto& lane{*ctx.schedule[(start + i) % ctx.schedule.size()]};
+                if (!pop(lane.ready, result))
+                    continue;
+
+                auto& own{workers[ctx.self]->units};
+                auto share{lane.concurrency / workers.size()};
+                unit extra{};
+                for (size_t k{1}; k < share && lane.ready.try_pop(extra); ++k) {
+                    if (own.try_push(std::move(extra)))
+                        continue;
+
+                    // The ring just gave up its room for extra, unless a fetcher took it since;
+                    // then extra runs here rather than being lost unsettled.
+                    if (!lane.ready.try_push(std::move(extra))) {
+                        --queued;
+                        execute(ctx, extra);
+                    }
+                    break;
+                }
+
+                return true;
+            }
+
+            return false;
+        };
+
+        bool steal(context& ctx, unit& result) {
+            if (queued == 0 || workers.size() < 2)
+                return false;
+
+            auto start{ctx.rng() % workers.size()};
+            for (size_t i{}; i < workers.size(); ++i) {
+                auto victim{(start + i) % workers.size()};
+                if (victim != ctx.self && pop(workers[victim]->units, result))
+                    return true;
+            }
+
+            return false;
+        };
+
+        void execute(context& ctx, unit& current) {
+            auto& owner{*current.owner};
+            // A unit stolen from a lane added since the last refresh.
+            if (owner.index >= ctx.tasks.size())
+                refresh(ctx);
+            auto& task{ctx.tasks[owner.index]};
+            if (!task.has_value())
+                task.emplace(owner.task);
+
+            std::optional<bool> ok{};
+            auto started{std::chrono::steady_clock::now()};
+            try {
+                ok = (*task)(current.delivery.payload.view(),
+                             finisher{this, &owner, current.delivery.handle, started});
+            } catch (std::exception& e) {
+                ok = false;
+            }
+
+            if (!ok.has_value())
+                return;
+
+            auto finished{std::chrono::steady_clock::now()};
+            owner.record(ok.value(), finished - started);
+
+            auto& done{ctx.done[owner.index]};
+            done.add(current.delivery.handle, ok.value(), finished);
+            if (done.size() >= ack_batch_size || finished - done.since >= ack_flush_interval)
+                flush(owner, done);
+            else if (done.size() == 1)
+                ctx.flush_due = std::min(ctx.flush_due, finished + steady_flush_interval());
+
+            if (owner.in_flight-- == owner.concurrency)
+                owner.capacity.notify_one();
+        };
+
+        void async_started() {
+            std::lock_guard<std::mutex> _{async_mtx};
+            ++async_running;
+        };
+
+        // Asynchronous jobs end on foreign threads without completions to batch into.
+        void finish(lane& lane, handle_t handle, bool ok,
+                    std::chrono::steady_clock::time_point started) {
+            lane.record(ok, std::chrono::steady_clock::now() - started);
+            if (ok)
+                bus.ack(lane.name, handle);
+            else
+                bus.nack(lane.name, handle);
+
+            if (lane.in_flight-- == lane.concurrency)
+                lane.capacity.notify_one();
+
+            std::lock_guard<std::mutex> _{async_mtx};
+            if (--async_running == 0)
+                async_done.notify_all();
+        };
+
+        std::vector<work_stats> metrics() {
+            std::vector<work_stats> result;
+            std::shared_lock _{lanes_mtx};
+            for (auto& lane : lanes) {
+                work_stats stats{};
+                stats.kind = std::string{lane->name.name()};
+                stats.succeeded = lane->succeeded.load(std::memory_order_relaxed);
+                stats.failed = lane->failed.load(std::memory_order_relaxed);
+                stats.in_flight = lane->in_flight.load(std::memory_order_relaxed);
+                stats.execution = lane->execution.snapshot();
+                result.push_back(std::move(stats));
+            }
+            return result;
+        };
+
+        void flush(lane& lane, completions& done) {
+            if (!done.acked.empty())
+                bus.ack_many(lane.name, done.acked);
+            if (!done.nacked.empty())
+                bus.nack_many(lane.name, done.nacked);
+
+            done.acked.clear();
+            done.nacked.clear();
+        };
+
+        void flush_all(context& ctx) {
+            for (size_t i{}; i < ctx.done.size(); ++i)
+                if (ctx.done[i].size() != 0)
+                    flush(*ctx.lanes[i], ctx.done[i]);
+            ctx.flush_due = std::chrono::steady_clock::time_point::max();
+        };
+
+        // Flushes the completions of every kind held back for ack_flush_interval, so a thread
+        // kept busy by other kinds does not sit on them until the bus times them out.
+        void flush_overdue(context& ctx) {
+            if (ctx.flush_due == std::chrono::steady_clock::time_point::max())
+                return;
+            auto now{std::chrono::steady_clock::now()};
+            if (now < ctx.flush_due)
+                return;
+
+            ctx.flush_due = std::chrono::steady_clock::time_point::max();
+            for (size_t i{}; i < ctx.done.size(); ++i) {
+                auto& done{ctx.done[i]};
+                if (done.size() == 0)
+                    continue;
+                if (now - done.since >= ack_flush_interval)
+                    flush(*ctx.lanes[i], done);
+                else
+                    ctx.flush_due = std::min(ctx.flush_due, done.since + steady_flush_interval());
+            }
+        };
+
+        std::chrono::steady_clock::duration steady_flush_interval() const {
+            return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                ack_flush_interval);
+        };
     };
 
     std::shared_ptr<state> data;
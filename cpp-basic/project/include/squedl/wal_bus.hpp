@@ -0,0 +1,384 @@
+#ifndef SQUEDL_WAL_BUS_HPP
+#define SQUEDL_WAL_BUS_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "squedl/kind.hpp"
+#include "squedl/metrics.hpp"
+#include "squedl/payload.hpp"
+#include "squedl/squedl.hpp"
+
+namespace squedl {
+namespace detail {
+
+// A put read back from the log that no ack settled.
+struct wal_entry {
+    std::uint64_t id{};
+    std::string kind;
+    std::int64_t due{};
+    priority prio{priority::normal};
+    payload body;
+};
+
+// Append-only log split into numbered segment files in one directory. Appends only encode into
+// a buffer; one writer thread writes and fdatasyncs whatever piled up meanwhile, so concurrent
+// appenders share a sync. Puts get ids in log order, which lets acks find the segment of their
+// put; segments are deleted from the front once every put in them has been acked.
+class wal_log {
+public:
+    wal_log(std::string directory, size_t segment_size);
+
+    wal_log(wal_log const& other) = delete;
+    wal_log(wal_log&& other) = delete;
+    wal_log& operator=(wal_log const& other) = delete;
+    wal_log& operator=(wal_log&& other) = delete;
+    ~wal_log();
+
+    // Unacked puts found on disk when the log was opened, in id order; hands them out once.
+    std::vector<wal_entry> take_restored();
+
+    // Returns the id of the new put, or nullopt once the log stopped or failed to write. With
+    // durable set it returns only after the record reached the disk.
+    std::optional<std::uint64_t> append_put(std::string_view kind, std::int64_t due,
+                                            priority prio, byte_view body, bool durable) {
+        return append_puts(kind, due, prio, &body, 1, durable);
+    };
+
+    // Appends count puts under consecutive ids with one wakeup of the writer, and one wait for
+    // the disk when durable; returns the first id.
+    std::optional<std::uint64_t> append_puts(std::string_view kind, std::int64_t due,
+                                             priority prio, const byte_view* bodies, size_t count,
+                                             bool durable);
+
+    // Acks are not waited for: one lost in a crash only means a redelivery.
+    void append_acks(const std::uint64_t* ids, size_t count);
+
+    // Logs the put of id again, into kind, settling its earlier put; for messages moved to a
+    // dead letter kind under their id. Not waited for either: one lost in a crash only means
+    // the message is back in its earlier kind.
+    void append_move(std::uint64_t id, std::string_view kind, std::int64_t due, priority prio,
+                     byte_view body);
+
+    void stop();
+
+    size_t segment_count();
+
+private:
+    struct segment {
+        std::uint64_t seq{};
+        std::uint64_t first_id{};
+        size_t live{};
+        size_t size{};
+    };
+
+    struct chunk {
+        std::uint64_t seq{};
+        bytes data;
+    };
+
+    std::string directory;
+    size_t segment_size{};
+
+    std::mutex mtx;
+    std::condition_variable wake;
+    std::condition_variable synced_cv;
+    std::uint64_t next_id{1};
+    std::deque<segment> segments;
+    // Segment of every id whose latest put was moved out of the segment its id belongs to.
+    std::unordered_map<std::uint64_t, std::uint64_t> moved;
+    std::vector<chunk> pending;
+    std::uint64_t appended{};
+    std::uint64_t synced{};
+    bool stopping{};
+    bool failed{};
+    std::vector<wal_entry> restored;
+
+    // Owned by the writer thread.
+    int fd{-1};
+    std::uint64_t fd_seq{};
+    std::thread writer;
+
+    void replay();
+    bytes& buffer_for(size_t record_size);
+    void write_put(std::uint64_t id, std::string_view kind, std::int64_t due, priority prio,
+                   byte_view body);
+    void settle(std::uint64_t id);
+    void run();
+    bool write(const chunk& chunk);
+    std::vector<std::uint64_t> compact();
+    std::string path_of(std::uint64_t seq) const;
+};
+
+} // namespace detail
+
+// A test_bus whose puts and acks also go to a write-ahead log in a directory, so unacked
+// messages survive a restart: opening the same directory again redelivers them under their
+// original ids, keeping the remaining delay of delayed ones. Deadlines are stored as Clock time
+// since its epoch, so Clock has to be one that survives restarts, like system_clock.
+template <typename Clock = std::chrono::system_clock>
+class wal_bus {
+    using inner_bus = test_bus<Clock>;
+
+public:
+    using id_t = typename inner_bus::id_t;
+    using time_point = typename inner_bus::time_point;
+    using duration = typename inner_bus::duration;
+    using clock = Clock;
+
+    // Acks have to reach the log by id, so a handle carries the id next to the delivery.
+    struct handle_t {
+        typename inner_bus::handle_t inner{};
+        id_t id{};
+    };
+
+    struct delivery {
+        id_t id{};
+        squedl::payload payload;
+        handle_t handle{};
+    };
+
+    using receiver = std::function<void(std::optional<std::vector<delivery>>)>;
+    using retry_policy = typename inner_bus::retry_policy;
+    using capacity_limit = typename inner_bus::capacity_limit;
+    using dedup_policy = typename inner_bus::dedup_policy;
+
+    static constexpr size_t default_segment_size{size_t{64} << 20};
+
+    // With durable_puts unset, put returns as soon as the record is buffered and a crash may
+    // lose the puts of the last sync interval.
+    explicit wal_bus(std::string directory, duration ack_timeout = std::chrono::minutes{1},
+                     size_t segment_size = default_segment_size, bool durable_puts = true,
+                     duration tick_duration = std::chrono::milliseconds{1})
+        : data{std::make_shared<state>(std::move(directory), ack_timeout, segment_size,
+                                       durable_puts, tick_duration)} {};
+
+    // Idempotency keys are kept in memory only, so a restart forgets them. A duplicate is
+    // answered before anything is logged.
+    expected<id_t> put(kind_id kind, squedl::payload payload, duration after = duration::zero(),
+                       priority prio = priority::normal, std::string_view idempotency_key = {}) {
+        if (auto first{data->bus.find_duplicate(kind, idempotency_key)}; first.has_value())
+            return expected<id_t>{first.value()};
+
+        auto at{Clock::now() + after};
+        auto id{data->log.append_put(kind.name(), at.time_since_epoch().count(), prio,
+                                     payload.view(), data->durable_puts)};
+        if (!id.has_value())
+            return unexpected{error{}};
+
+        auto result{data->bus.put_with_id(kind, id.value(), std::move(payload), at, prio,
+                                          idempotency_key)};
+        // Refused by a full kind, or a duplicate put concurrently, after it was logged; settled
+        // so a restart does not bring it back.
+        if (!result.has_value() || result.value() != id.value())
+            data->log.append_acks(&id.value(), 1);
+
+        return result;
+    };
+
+    expected<id_t> put(kind_id kind, byte_view payload, duration after = duration::zero(),
+                       priority prio = priority::normal, std::string_view idempotency_key = {}) {
+        return put(kind, squedl::payload{payload}, after, prio, idempotency_key);
+    };
+
+    // Logs the whole batch with one record write and, with durable_puts, one sync, then puts
+    // it like test_bus::put_many; a batch the kind refuses is acked in the log right away.
+    template <typename Payloads>
+    expected<std::vector<id_t>> put_many(kind_id kind, const Payloads& payloads,
+                                         duration after = duration::zero(),
+                                         priority prio = priority::normal) {
+        std::vector<squedl::payload> bodies{};
+        for (const auto& x : payloads) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(x)>, squedl::payload>)
+                bodies.push_back(x);
+            else
+                bodies.emplace_back(byte_view{x});
+        }
+        return put_batch(kind, std::move(bodies), after, prio);
+    };
+
+    expected<std::vector<id_t>> put_many(kind_id kind, byte_view buffer,
+                                         const std::vector<size_t>& ends,
+                                         duration after = duration::zero(),
+                                         priority prio = priority::normal) {
+        if (!detail::valid_ends(ends, buffer.size()))
+            return unexpected{error{}};
+
+        return put_batch(kind, inner_bus::split(squedl::payload{buffer}, ends), after, prio);
+    };
+
+    std::optional<std::vector<delivery>> next(kind_id kind, size_t count,
+                                              duration timeout = duration::zero()) {
+        return wrap(data->bus.next(kind, count, timeout));
+    };
+
+    void next_async(kind_id kind, size_t count, receiver receive) {
+        data->bus.next_async(kind, count,
+                             [receive = std::move(receive)](auto batch) {
+                                 receive(wrap(std::move(batch)));
+                             });
+    };
+
+    // Like in test_bus, acking a delivery that already timed out does nothing; the message is
+    // delivered again.
+    bool ack(kind_id kind, handle_t handle) {
+        if (!data->bus.ack(kind, handle.inner))
+            return false;
+
+        data->log.append_acks(&handle.id, 1);
+        return true;
+    };
+
+    template <typename Handles>
+    void ack_many(kind_id kind, const Handles& handles) {
+        thread_local std::vector<typename inner_bus::handle_t> inner{};
+        thread_local std::vector<std::uint64_t> ids{};
+        thread_local std::vector<std::uint64_t> settled{};
+        inner.clear();
+        ids.clear();
+        settled.clear();
+        for (const auto& handle : handles) {
+            inner.push_back(handle.inner);
+            ids.push_back(handle.id);
+        }
+
+        data->bus.ack_many(kind, inner,
+                           [](size_t position) { settled.push_back(ids[position]); });
+        data->log.append_acks(settled.data(), settled.size());
+    };
+
+    bool reject(kind_id kind, handle_t handle) { return ack(kind, handle); };
+
+    void nack(kind_id kind, handle_t handle) { data->bus.nack(kind, handle.inner); };
+
+    template <typename Handles>
+    void nack_many(kind_id kind, const Handles& handles) {
+        thread_local std::vector<typename inner_bus::handle_t> inner{};
+        inner.clear();
+        for (const auto& handle : handles)
+            inner.push_back(handle.inner);
+
+        data->bus.nack_many(kind, inner);
+    };
+
+    // Messages dropped under overflow_policy::drop_oldest are settled in the log like acked ones.
+    void set_capacity(kind_id kind, capacity_limit limit) { data->bus.set_capacity(kind, limit); };
+
+    void set_dedup_policy(kind_id kind, dedup_policy policy) {
+        data->bus.set_dedup_policy(kind, policy);
+    };
+
+    // A message moved to the dead letter kind is logged there, and one dropped is settled like
+    // an acked one; either way a restart does not bring it back to its original kind.
+    void set_retry_policy(kind_id kind, retry_policy policy) {
+        data->bus.set_retry_policy(kind, std::move(policy));
+    };
+
+    void interrupt(kind_id kind) { data->bus.interrupt(kind); };
+
+    void stop() {
+        data->bus.stop();
+        data->log.stop();
+    };
+
+    size_t enqueued_size(kind_id kind) { return data->bus.enqueued_size(kind); };
+    size_t delayed_size(kind_id kind) { return data->bus.delayed_size(kind); };
+    size_t unacked_size(kind_id kind) { return data->bus.unacked_size(kind); };
+    bool empty() { return data->bus.empty(); };
+
+    kind_stats metrics(kind_id kind) { return data->bus.metrics(kind); };
+    std::vector<kind_stats> metrics() { return data->bus.metrics(); };
+
+    size_t segment_count() { return data->log.segment_count(); };
+
+private:
+    expected<std::vector<id_t>> put_batch(kind_id kind, std::vector<squedl::payload> bodies,
+                                          duration after, priority prio) {
+        std::vector<byte_view> views{};
+        views.reserve(bodies.size());
+        for (const auto& x : bodies)
+            views.push_back(x.view());
+
+        auto at{Clock::now() + after};
+        auto first{data->log.append_puts(kind.name(), at.time_since_epoch().count(), prio,
+                                         views.data(), views.size(), data->durable_puts)};
+        if (!first.has_value())
+            return unexpected{error{}};
+
+        auto result{data->bus.put_with_ids(kind, first.value(), std::move(bodies), at, prio)};
+        if (!result.has_value()) {
+            std::vector<std::uint64_t> ids(views.size());
+            for (size_t i{}; i < ids.size(); ++i)
+                ids[i] = first.value() + i;
+            data->log.append_acks(ids.data(), ids.size());
+        }
+
+        return result;
+    };
+
+    static std::optional<std::vector<delivery>> wrap(
+        std::optional<std::vector<typename inner_bus::delivery>> batch) {
+        if (!batch.has_value())
+            return std::nullopt;
+
+        std::vector<delivery> result{};
+        result.reserve(batch.value().size());
+        for (auto& x : batch.value())
+            result.push_back(delivery{x.id, std::move(x.payload), handle_t{x.handle, x.id}});
+
+        return std::optional{std::move(result)};
+    };
+
+    struct state {
+        // Declared before bus, so it outlives the timer thread of bus, which joins when bus goes
+        // and may still call the drop and bury handlers logging here until then.
+        detail::wal_log log;
+        inner_bus bus;
+        bool durable_puts{};
+
+        state(std::string directory, duration ack_timeout, size_t segment_size,
+              bool durable_puts, duration tick_duration)
+            : log{std::move(directory), segment_size}, bus{ack_timeout, false, tick_duration},
+              durable_puts{durable_puts} {
+            // Settled like a refused put, so a restart does not bring a dropped message back.
+            bus.set_drop_handler([this](id_t id) { log.append_acks(&id, 1); });
+            bus.set_bury_handler([this](id_t id, const squedl::payload& body, priority prio,
+                                        std::optional<kind_id> to) {
+                if (!to.has_value()) {
+                    log.append_acks(&id, 1);
+                    return;
+                }
+                log.append_move(id, to->name(), Clock::now().time_since_epoch().count(), prio,
+                                body.view());
+            });
+            for (auto& entry : log.take_restored())
+                bus.put_with_id(entry.kind, entry.id, std::move(entry.body),
+                                time_point{duration{entry.due}}, entry.prio);
+        };
+
+        state(state const& other) = delete;
+        state(state&& other) = delete;
+        state& operator=(state const& other) = delete;
+        state& operator=(state&& other) = delete;
+        ~state() = default;
+    };
+
+    std::shared_ptr<state> data;
+}; // wal_bus
+
+} // namespace squedl
+
+#endif // SQUEDL_WAL_BUS_HPP
@@ -0,0 +1,47 @@
+// Hosts a test_bus for net_bus clients until SIGINT or SIGTERM.
+//
+// usage: squedl-server [host] [port] [ack timeout in ms] [kind...]
+//
+// Given kinds, it serves only those; otherwise clients may use any kind names.
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+
+#include <pthread.h>
+
+#include "squedl/net_server.hpp"
+
+int main(int argc, char** argv) {
+    std::string host{argc > 1 ? argv[1] : "127.0.0.1"};
+    auto port{static_cast<std::uint16_t>(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 7878)};
+    auto ack_timeout{std::chrono::milliseconds{
+        argc > 3 ? std::strtoll(argv[3], nullptr, 10) : 60'000}};
+
+    // Blocked before any thread starts, so only sigwait below sees them.
+    sigset_t signals{};
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    try {
+        squedl::net_server::bus_type bus{ack_timeout};
+        for (int i{4}; i < argc; ++i)
+            squedl::kind_id{argv[i]};
+        squedl::net_server server{bus, host, port, argc <= 4};
+        std::printf("squedl-server listening on %s:%u\n", host.c_str(), server.port());
+        std::fflush(stdout);
+
+        int received{};
+        sigwait(&signals, &received);
+        server.stop();
+        bus.stop();
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "squedl-server: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
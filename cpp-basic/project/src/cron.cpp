@@ -0,0 +1,234 @@
+#include "squedl/cron.hpp"
+
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace squedl {
+namespace {
+
+constexpr std::int64_t minutes_per_day{24 * 60};
+// How far ahead next_after looks; beyond any gap between February 29ths.
+constexpr std::int64_t horizon_days{30 * 366};
+
+constexpr std::array<std::string_view, 12> month_names{"jan", "feb", "mar", "apr", "may", "jun",
+                                                       "jul", "aug", "sep", "oct", "nov", "dec"};
+constexpr std::array<std::string_view, 7> weekday_names{"sun", "mon", "tue", "wed",
+                                                        "thu", "fri", "sat"};
+
+struct field {
+    unsigned min{};
+    unsigned max{};
+    // Names of the values from min on, if the field takes names.
+    const std::string_view* names{};
+    size_t name_count{};
+};
+
+constexpr field minute_field{0, 59};
+constexpr field hour_field{0, 23};
+constexpr field day_field{1, 31};
+constexpr field month_field{1, 12, month_names.data(), month_names.size()};
+constexpr field weekday_field{0, 7, weekday_names.data(), weekday_names.size()};
+
+std::int64_t floor_div(std::int64_t lhs, std::int64_t rhs) {
+    return lhs / rhs - (lhs % rhs < 0 ? 1 : 0);
+}
+
+struct civil {
+    std::int64_t year{};
+    unsigned month{};
+    unsigned day{};
+};
+
+// Days since 1970-01-01 and the proleptic Gregorian dates they fall on, after Howard Hinnant's
+// chrono-compatible date algorithms.
+std::int64_t days_from_civil(std::int64_t year, unsigned month, unsigned day) {
+    year -= month <= 2 ? 1 : 0;
+    auto era{floor_div(year, 400)};
+    auto yoe{static_cast<unsigned>(year - era * 400)};
+    auto doy{(153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1};
+    auto doe{yoe * 365 + yoe / 4 - yoe / 100 + doy};
+    return era * 146097 + static_cast<std::int64_t>(doe) - 719468;
+}
+
+civil civil_from_days(std::int64_t days) {
+    days += 719468;
+    auto era{floor_div(days, 146097)};
+    auto doe{static_cast<unsigned>(days - era * 146097)};
+    auto yoe{(doe - doe / 1460 + doe / 36524 - doe / 146096) / 365};
+    auto doy{doe - (365 * yoe + yoe / 4 - yoe / 100)};
+    auto mp{(5 * doy + 2) / 153};
+    auto month{mp < 10 ? mp + 3 : mp - 9};
+    return {static_cast<std::int64_t>(yoe) + era * 400 + (month <= 2 ? 1 : 0), month,
+            doy - (153 * mp + 2) / 5 + 1};
+}
+
+unsigned weekday_of(std::int64_t days) {
+    return static_cast<unsigned>(days - floor_div(days + 4, 7) * 7 + 4);
+}
+
+std::optional<unsigned> parse_value(std::string_view text, const field& f) {
+    std::string lower{text};
+    for (auto& c : lower)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    for (size_t i{}; i < f.name_count; ++i)
+        if (lower == f.names[i])
+            return f.min + static_cast<unsigned>(i);
+
+    unsigned result{};
+    auto [end, ec]{std::from_chars(text.data(), text.data() + text.size(), result)};
+    if (text.empty() || ec != std::errc{} || end != text.data() + text.size() || result < f.min ||
+        result > f.max)
+        return std::nullopt;
+    return result;
+}
+
+// Bit v is set for every value v the field matches.
+std::optional<std::uint64_t> parse_field(std::string_view text, const field& f) {
+    std::uint64_t result{};
+    for (;;) {
+        auto comma{text.find(',')};
+        auto part{text.substr(0, comma)};
+
+        auto slash{part.find('/')};
+        auto range{part.substr(0, slash)};
+        unsigned step{1};
+        if (slash != std::string_view::npos) {
+            auto text_step{part.substr(slash + 1)};
+            auto [end, ec]{
+                std::from_chars(text_step.data(), text_step.data() + text_step.size(), step)};
+            // A step beyond the field's range would match only its first value, and could wrap
+            // the loop below.
+            if (text_step.empty() || ec != std::errc{} ||
+                end != text_step.data() + text_step.size() || step == 0 || step > f.max - f.min)
+                return std::nullopt;
+        }
+
+        unsigned low{f.min};
+        unsigned high{f.max};
+        if (range != "*") {
+            auto dash{range.find('-')};
+            auto first{parse_value(range.substr(0, dash), f)};
+            if (!first.has_value())
+                return std::nullopt;
+            low = first.value();
+            high = slash == std::string_view::npos ? low : f.max;
+            if (dash != std::string_view::npos) {
+                auto last{parse_value(range.substr(dash + 1), f)};
+                if (!last.has_value() || last.value() < low)
+                    return std::nullopt;
+                high = last.value();
+            }
+        }
+
+        for (auto value{low}; value <= high; value += step)
+            result |= std::uint64_t{1} << value;
+
+        if (comma == std::string_view::npos)
+            return result;
+        text.remove_prefix(comma + 1);
+    }
+}
+
+std::vector<std::string_view> split_fields(std::string_view text) {
+    std::vector<std::string_view> result;
+    size_t begin{};
+    while (begin < text.size()) {
+        if (std::isspace(static_cast<unsigned char>(text[begin])) != 0) {
+            ++begin;
+            continue;
+        }
+        auto end{begin};
+        while (end < text.size() && std::isspace(static_cast<unsigned char>(text[end])) == 0)
+            ++end;
+        result.push_back(text.substr(begin, end - begin));
+        begin = end;
+    }
+    return result;
+}
+
+} // namespace
+
+std::optional<cron_schedule> cron_schedule::parse(std::string_view expression) {
+    auto fields{split_fields(expression)};
+    if (fields.size() == 1 && fields[0].front() == '@') {
+        constexpr std::array<std::pair<std::string_view, std::string_view>, 6> macros{{
+            {"@yearly", "0 0 1 1 *"},
+            {"@annually", "0 0 1 1 *"},
+            {"@monthly", "0 0 1 * *"},
+            {"@weekly", "0 0 * * 0"},
+            {"@daily", "0 0 * * *"},
+            {"@hourly", "0 * * * *"},
+        }};
+        for (const auto& [name, replacement] : macros)
+            if (fields[0] == name)
+                return parse(replacement);
+        return std::nullopt;
+    }
+    if (fields.size() != 5)
+        return std::nullopt;
+
+    auto minutes{parse_field(fields[0], minute_field)};
+    auto hours{parse_field(fields[1], hour_field)};
+    auto days{parse_field(fields[2], day_field)};
+    auto months{parse_field(fields[3], month_field)};
+    auto weekdays{parse_field(fields[4], weekday_field)};
+    if (!minutes || !hours || !days || !months || !weekdays)
+        return std::nullopt;
+
+    cron_schedule result{};
+    result.minutes = minutes.value();
+    result.hours = static_cast<std::uint32_t>(hours.value());
+    result.days = static_cast<std::uint32_t>(days.value());
+    result.months = static_cast<std::uint16_t>(months.value());
+    // 7 is Sunday too.
+    result.weekdays = static_cast<std::uint8_t>((weekdays.value() | weekdays.value() >> 7) & 0x7f);
+    result.either_day = fields[2].front() != '*' && fields[4].front() != '*';
+    return result;
+}
+
+std::optional<std::chrono::seconds> cron_schedule::next_after(std::chrono::seconds after) const {
+    auto first{floor_div(after.count(), 60) + 1};
+    auto day{floor_div(first, minutes_per_day)};
+    auto from{first - day * minutes_per_day};
+    auto last_day{day + horizon_days};
+
+    while (day <= last_day) {
+        auto date{civil_from_days(day)};
+        if ((months >> date.month & 1U) == 0) {
+            day = date.month == 12 ? days_from_civil(date.year + 1, 1, 1)
+                                   : days_from_civil(date.year, date.month + 1, 1);
+            from = 0;
+            continue;
+        }
+
+        if (matches_day(day, date.day)) {
+            for (auto hour{from / 60}; hour < 24; ++hour) {
+                if ((hours >> hour & 1U) == 0)
+                    continue;
+
+                auto minute{hour == from / 60 ? from % 60 : 0};
+                while (minute < 60 && (minutes >> minute & 1U) == 0)
+                    ++minute;
+                if (minute < 60)
+                    return std::chrono::seconds{(day * minutes_per_day + hour * 60 + minute) * 60};
+            }
+        }
+
+        ++day;
+        from = 0;
+    }
+    return std::nullopt;
+}
+
+bool cron_schedule::matches_day(std::int64_t days_since_epoch, unsigned day) const {
+    auto by_date{(days >> day & 1U) != 0};
+    auto by_weekday{(weekdays >> weekday_of(days_since_epoch) & 1U) != 0};
+    return either_day ? by_date || by_weekday : by_date && by_weekday;
+}
+
+} // namespace squedl
@@ -0,0 +1,82 @@
+#include "squedl/kind.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace squedl {
+namespace {
+
+class registry {
+public:
+    std::uint32_t intern(std::string_view name, std::uint64_t hash) {
+        {
+            std::shared_lock _{mtx};
+            if (auto found{find(name, hash)}; found.has_value())
+                return found.value();
+        }
+
+        std::unique_lock _{mtx};
+        if (auto found{find(name, hash)}; found.has_value())
+            return found.value();
+
+        if (names.size() >= kind_id::max_count)
+            throw std::length_error{"squedl: too many kinds"};
+
+        auto index{static_cast<std::uint32_t>(names.size())};
+        names.emplace_back(name);
+        indices.emplace(hash, index);
+        return index;
+    };
+
+    std::optional<std::uint32_t> lookup(std::string_view name, std::uint64_t hash) {
+        std::shared_lock _{mtx};
+        return find(name, hash);
+    };
+
+    std::string_view name(std::uint32_t index) {
+        std::shared_lock _{mtx};
+        return names[index];
+    };
+
+private:
+    std::shared_mutex mtx;
+    // A deque keeps the strings in place, so views returned by name() stay valid.
+    std::deque<std::string> names;
+    std::unordered_multimap<std::uint64_t, std::uint32_t> indices;
+
+    std::optional<std::uint32_t> find(std::string_view name, std::uint64_t hash) const {
+        auto [first, last]{indices.equal_range(hash)};
+        for (auto it{first}; it != last; ++it)
+            if (names[it->second] == name)
+                return it->second;
+        return std::nullopt;
+    };
+};
+
+registry& shared_registry() {
+    static registry instance{};
+    return instance;
+}
+
+} // namespace
+
+kind_id::kind_id(std::string_view name, std::uint64_t hash)
+    : value{shared_registry().intern(name, hash)} {}
+
+std::optional<kind_id> kind_id::find(std::string_view name) {
+    auto found{shared_registry().lookup(name, detail::hash_kind(name))};
+    if (!found.has_value())
+        return std::nullopt;
+    return kind_id{index_tag{}, found.value()};
+}
+
+std::string_view kind_id::name() const { return shared_registry().name(value); }
+
+} // namespace squedl
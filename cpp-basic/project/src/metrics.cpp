@@ -0,0 +1,210 @@
+#include "squedl/metrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <string_view>
+
+namespace squedl {
+namespace {
+
+// Prometheus wants fixed buckets; powers of four nanoseconds, 1us to about 69s, all line up
+// with histogram buckets.
+constexpr size_t first_le_bit{10};
+constexpr size_t last_le_bit{36};
+constexpr size_t le_step{2};
+
+void append_escaped(std::string& out, std::string_view kind) {
+    for (char c : kind) {
+        if (c == '\n') {
+            out += "\\n";
+            continue;
+        }
+        if (c == '\\' || c == '"')
+            out += '\\';
+        out += c;
+    }
+}
+
+void append_label(std::string& out, std::string_view kind) {
+    out += "{kind=\"";
+    append_escaped(out, kind);
+    out += "\"}";
+}
+
+void append_header(std::string& out, std::string_view name, std::string_view type,
+                   std::string_view help) {
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+// Seconds, for bucket bounds and sums; counts go out exactly through std::to_string.
+void append_seconds(std::string& out, std::uint64_t nanoseconds) {
+    char text[32]{};
+    std::snprintf(text, sizeof(text), "%.9g", static_cast<double>(nanoseconds) / 1e9);
+    out += text;
+}
+
+void append_sample(std::string& out, std::string_view name, std::string_view kind,
+                   std::uint64_t value) {
+    out += name;
+    append_label(out, kind);
+    out += ' ';
+    out += std::to_string(value);
+    out += '\n';
+}
+
+template <typename Stats, typename Get>
+void append_family(std::string& out, const std::vector<Stats>& stats, std::string_view name,
+                   std::string_view type, std::string_view help, Get get) {
+    append_header(out, name, type, help);
+    for (const auto& x : stats)
+        append_sample(out, name, x.kind, static_cast<std::uint64_t>(get(x)));
+}
+
+template <typename Stats, typename Get>
+void append_histogram(std::string& out, const std::vector<Stats>& stats, std::string_view name,
+                      std::string_view help, Get get) {
+    append_header(out, name, "histogram", help);
+    for (const auto& x : stats) {
+        const histogram_snapshot& snapshot{get(x)};
+
+        std::uint64_t cumulative{};
+        size_t bucket{};
+        for (auto bit{first_le_bit}; bit <= last_le_bit; bit += le_step) {
+            auto bound{std::uint64_t{1} << bit};
+            for (auto end{histogram::bucket_of(bound)}; bucket < end; ++bucket)
+                cumulative += bucket < snapshot.counts.size() ? snapshot.counts[bucket] : 0;
+
+            out.append(name).append("_bucket{kind=\"");
+            append_escaped(out, x.kind);
+            out += "\",le=\"";
+            append_seconds(out, bound);
+            out += "\"} ";
+            out += std::to_string(cumulative);
+            out += '\n';
+        }
+
+        out.append(name).append("_bucket{kind=\"");
+        append_escaped(out, x.kind);
+        out += "\",le=\"+Inf\"} ";
+        out += std::to_string(snapshot.count);
+        out += '\n';
+
+        out.append(name).append("_sum");
+        append_label(out, x.kind);
+        out += ' ';
+        append_seconds(out, snapshot.sum);
+        out += '\n';
+
+        out.append(name).append("_count");
+        append_label(out, x.kind);
+        out += ' ';
+        out += std::to_string(snapshot.count);
+        out += '\n';
+    }
+}
+
+} // namespace
+
+std::uint64_t histogram_snapshot::quantile(double q) const {
+    if (count == 0)
+        return 0;
+
+    auto rank{static_cast<std::uint64_t>(std::ceil(std::clamp(q, 0.0, 1.0) * count))};
+    rank = std::clamp<std::uint64_t>(rank, 1, count);
+
+    std::uint64_t seen{};
+    for (size_t i{}; i < counts.size(); ++i) {
+        seen += counts[i];
+        if (seen >= rank)
+            return histogram::upper_bound(i);
+    }
+    return histogram::upper_bound(counts.size() - 1);
+}
+
+histogram_snapshot histogram::snapshot() const {
+    histogram_snapshot result{};
+    result.counts.resize(bucket_count);
+    for (size_t i{}; i < bucket_count; ++i) {
+        result.counts[i] = counts[i].load(std::memory_order_relaxed);
+        result.count += result.counts[i];
+    }
+    // Taken apart from the buckets, so sum may be slightly ahead of them while others record.
+    result.sum = sum.load(std::memory_order_relaxed);
+    return result;
+}
+
+std::uint64_t histogram::lower_bound(size_t bucket) {
+    if (bucket < sub_buckets)
+        return bucket;
+
+    auto group{bucket / sub_buckets};
+    auto top{std::uint64_t{sub_buckets + bucket % sub_buckets}};
+    return top << (group - 1);
+}
+
+std::uint64_t histogram::upper_bound(size_t bucket) {
+    if (bucket + 1 >= bucket_count)
+        return std::numeric_limits<std::uint64_t>::max();
+    return lower_bound(bucket + 1) - 1;
+}
+
+std::string to_prometheus(const std::vector<kind_stats>& stats) {
+    std::string out;
+    append_family(out, stats, "squedl_messages_put_total", "counter", "Messages put.",
+                  [](const kind_stats& x) { return x.counters.put; });
+    append_family(out, stats, "squedl_messages_delivered_total", "counter",
+                  "Deliveries handed to consumers, redeliveries included.",
+                  [](const kind_stats& x) { return x.counters.delivered; });
+    append_family(out, stats, "squedl_messages_acked_total", "counter", "Deliveries acked.",
+                  [](const kind_stats& x) { return x.counters.acked; });
+    append_family(out, stats, "squedl_messages_nacked_total", "counter", "Deliveries nacked.",
+                  [](const kind_stats& x) { return x.counters.nacked; });
+    append_family(out, stats, "squedl_messages_redelivered_total", "counter",
+                  "Deliveries that timed out unacked.",
+                  [](const kind_stats& x) { return x.counters.redelivered; });
+    append_family(out, stats, "squedl_messages_dead_lettered_total", "counter",
+                  "Messages out of attempts.",
+                  [](const kind_stats& x) { return x.counters.dead_lettered; });
+    append_family(out, stats, "squedl_messages_refused_total", "counter",
+                  "Puts turned away by a full kind.",
+                  [](const kind_stats& x) { return x.counters.refused; });
+    append_family(out, stats, "squedl_messages_dropped_total", "counter",
+                  "Ready messages dropped to make room.",
+                  [](const kind_stats& x) { return x.counters.dropped; });
+    append_family(out, stats, "squedl_messages_deduplicated_total", "counter",
+                  "Puts skipped for repeating an idempotency key.",
+                  [](const kind_stats& x) { return x.counters.deduplicated; });
+    append_family(out, stats, "squedl_messages_enqueued", "gauge", "Messages ready to deliver.",
+                  [](const kind_stats& x) { return x.enqueued; });
+    append_family(out, stats, "squedl_messages_delayed", "gauge", "Messages not due yet.",
+                  [](const kind_stats& x) { return x.delayed; });
+    append_family(out, stats, "squedl_messages_unacked", "gauge", "Deliveries awaiting an ack.",
+                  [](const kind_stats& x) { return x.unacked; });
+    append_histogram(out, stats, "squedl_message_wait_seconds",
+                     "Time from a message becoming ready to its delivery.",
+                     [](const kind_stats& x) -> const histogram_snapshot& { return x.wait; });
+    return out;
+}
+
+std::string to_prometheus(const std::vector<work_stats>& stats) {
+    std::string out;
+    append_family(out, stats, "squedl_jobs_succeeded_total", "counter", "Jobs that succeeded.",
+                  [](const work_stats& x) { return x.succeeded; });
+    append_family(out, stats, "squedl_jobs_failed_total", "counter",
+                  "Jobs that failed or threw.", [](const work_stats& x) { return x.failed; });
+    append_family(out, stats, "squedl_jobs_in_flight", "gauge",
+                  "Jobs fetched and not finished yet.",
+                  [](const work_stats& x) { return x.in_flight; });
+    append_histogram(out, stats, "squedl_job_duration_seconds",
+                     "Time from a task being called to its job finishing.",
+                     [](const work_stats& x) -> const histogram_snapshot& {
+                         return x.execution;
+                     });
+    return out;
+}
+
+} // namespace squedl
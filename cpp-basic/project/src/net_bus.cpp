@@ -0,0 +1,466 @@
+#include "squedl/net_bus.hpp"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "squedl/detail/net_wire.hpp"
+
+namespace squedl {
+namespace {
+
+using detail::frame_reader;
+using detail::frame_writer;
+using detail::net_op;
+using detail::net_status;
+using detail::net_unanswered_tag;
+
+struct reply {
+    net_status status{net_status::stopped};
+    squedl::payload body;
+};
+
+std::int64_t ns_of(net_bus::duration value) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(value).count();
+}
+
+int connect_to(const std::string& host, std::uint16_t port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found{};
+    if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0)
+        throw std::system_error{std::make_error_code(std::errc::host_unreachable),
+                                "squedl: cannot resolve " + host};
+
+    auto error{ECONNREFUSED};
+    auto fd{-1};
+    for (auto* x{found}; x != nullptr && fd < 0; x = x->ai_next) {
+        fd = ::socket(x->ai_family, x->ai_socktype, x->ai_protocol);
+        if (fd < 0) {
+            error = errno;
+            continue;
+        }
+        if (::connect(fd, x->ai_addr, x->ai_addrlen) != 0) {
+            error = errno;
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    ::freeaddrinfo(found);
+    if (fd < 0)
+        throw std::system_error{error, std::generic_category(), "squedl: cannot connect"};
+
+    int on{1};
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+bool send_all(int fd, const bytes& data) {
+    size_t sent{};
+    while (sent < data.size()) {
+        auto n{::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL)};
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+struct net_bus::state {
+    // A request whose caller waits for the response.
+    struct call {
+        std::promise<reply> done;
+        net_op op{};
+        std::uint32_t kind{};
+        std::string_view name;
+    };
+
+    int fd{-1};
+
+    std::mutex mtx;
+    std::condition_variable queued;
+    // Frames not handed to the socket yet.
+    bytes outbox;
+    std::uint64_t next_tag{1};
+    std::unordered_map<std::uint64_t, std::shared_ptr<call>> calls;
+    // Nexts ended by an interrupt before their response came; whatever they get is nacked.
+    std::unordered_map<std::uint64_t, std::string_view> abandoned;
+    std::unordered_map<std::uint32_t, std::uint64_t> interrupts;
+    bool stopping{};
+
+    std::thread writer;
+    std::thread reader;
+
+    state(const std::string& host, std::uint16_t port) : fd{connect_to(host, port)} {
+        writer = std::thread{[this] { write(); }};
+        reader = std::thread{[this] { read(); }};
+    };
+
+    state(state const& other) = delete;
+    state(state&& other) = delete;
+    state& operator=(state const& other) = delete;
+    state& operator=(state&& other) = delete;
+
+    ~state() {
+        stop();
+        writer.join();
+        reader.join();
+        ::close(fd);
+    };
+
+    // Queues a request, and unless it is fire and forget returns the future of its response. A
+    // next of kind is answered with an empty batch right away when kind was interrupted since
+    // seen. A request too large for one frame fails without being sent, since the server would
+    // drop the connection over it.
+    template <typename Encode>
+    std::future<reply> request(net_op op, bool answered, Encode&& encode,
+                               std::optional<kind_id> kind = std::nullopt,
+                               std::uint64_t seen = 0) {
+        std::future<reply> result{};
+        {
+            std::lock_guard<std::mutex> _{mtx};
+            if (stopping)
+                return finished(reply{});
+            if (kind.has_value() && interrupts[kind->index()] != seen)
+                return finished(empty_batch());
+
+            auto tag{answered ? next_tag++ : net_unanswered_tag};
+            frame_writer out{outbox, static_cast<std::uint8_t>(op), tag};
+            encode(out);
+            if (!out.fits()) {
+                out.discard();
+                return finished(reply{});
+            }
+            out.finish();
+
+            if (answered) {
+                auto waiting{std::make_shared<call>()};
+                waiting->op = op;
+                if (kind.has_value()) {
+                    waiting->kind = kind->index();
+                    waiting->name = kind->name();
+                }
+                result = waiting->done.get_future();
+                calls.emplace(tag, std::move(waiting));
+            }
+        }
+        queued.notify_one();
+        return result;
+    };
+
+    std::uint64_t interrupts_of(kind_id kind) {
+        std::lock_guard<std::mutex> _{mtx};
+        return interrupts[kind.index()];
+    };
+
+    void interrupt(kind_id kind) {
+        std::vector<std::shared_ptr<call>> ended{};
+        {
+            std::lock_guard<std::mutex> _{mtx};
+            ++interrupts[kind.index()];
+            for (auto it{calls.begin()}; it != calls.end();) {
+                if (it->second->op != net_op::next || it->second->kind != kind.index()) {
+                    ++it;
+                    continue;
+                }
+                abandoned.emplace(it->first, it->second->name);
+                ended.push_back(std::move(it->second));
+                it = calls.erase(it);
+            }
+        }
+
+        for (auto& x : ended)
+            x->done.set_value(empty_batch());
+    };
+
+    // Fails every call waiting and makes later ones fail right away.
+    void stop() {
+        std::unordered_map<std::uint64_t, std::shared_ptr<call>> failed{};
+        {
+            std::lock_guard<std::mutex> _{mtx};
+            stopping = true;
+            failed.swap(calls);
+        }
+        queued.notify_all();
+
+        for (auto& x : failed)
+            x.second->done.set_value(reply{});
+    };
+
+    // Sends whatever piled up while the previous send was underway in one go. Once stopping,
+    // sends what is left, like acks, then closes the connection, which ends read().
+    void write() {
+        bytes sending{};
+        for (;;) {
+            bool last{};
+            {
+                std::unique_lock lock{mtx};
+                queued.wait(lock, [this] { return stopping || !outbox.empty(); });
+                sending.swap(outbox);
+                last = stopping;
+            }
+
+            if (!send_all(fd, sending) || last)
+                break;
+            sending.clear();
+        }
+
+        ::shutdown(fd, SHUT_RDWR);
+        stop();
+    };
+
+    void read() {
+        bytes in{};
+        std::vector<std::byte> chunk(size_t{64} << 10);
+        for (;;) {
+            auto n{::recv(fd, chunk.data(), chunk.size(), 0)};
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+
+            in.insert(in.end(), chunk.begin(), chunk.begin() + n);
+            auto framed{detail::for_each_frame(
+                in, [this](std::uint8_t code, std::uint64_t tag, byte_view body) {
+                    answer(static_cast<net_status>(code), tag, body);
+                })};
+            if (!framed)
+                break;
+        }
+        stop();
+    };
+
+    void answer(net_status status, std::uint64_t tag, byte_view body) {
+        std::shared_ptr<call> waiting{};
+        std::optional<std::string_view> unclaimed{};
+        {
+            std::lock_guard<std::mutex> _{mtx};
+            if (auto it{calls.find(tag)}; it != calls.end()) {
+                waiting = std::move(it->second);
+                calls.erase(it);
+            } else if (auto lost{abandoned.find(tag)}; lost != abandoned.end()) {
+                unclaimed = lost->second;
+                abandoned.erase(lost);
+            }
+        }
+
+        if (waiting != nullptr) {
+            waiting->done.set_value(reply{status, squedl::payload{body}});
+            return;
+        }
+        if (unclaimed.has_value() && status == net_status::ok)
+            give_back(unclaimed.value(), body);
+    };
+
+    // Nacks the deliveries of a next nobody waits for anymore.
+    void give_back(std::string_view kind, byte_view body) {
+        frame_reader in{body};
+        std::vector<handle_t> handles(in.pod<std::uint32_t>());
+        for (auto& x : handles) {
+            in.pod<std::uint64_t>();
+            x.index = in.pod<std::uint32_t>();
+            x.generation = in.pod<std::uint32_t>();
+            in.raw(in.pod<std::uint32_t>());
+        }
+        if (in.bad() || handles.empty())
+            return;
+
+        request(net_op::nack, false, [&](frame_writer& out) {
+            out.str(kind).pod(static_cast<std::uint32_t>(handles.size()));
+            for (const auto& x : handles)
+                out.pod(x.index).pod(x.generation);
+        });
+    };
+
+    static std::future<reply> finished(reply value) {
+        std::promise<reply> done{};
+        done.set_value(std::move(value));
+        return done.get_future();
+    };
+
+    static reply empty_batch() {
+        std::uint32_t none{};
+        const auto* data{reinterpret_cast<const std::byte*>(&none)};
+        return reply{net_status::ok, squedl::payload{byte_view{data, sizeof(none)}}};
+    };
+
+    template <typename T>
+    static std::optional<T> scalar(std::future<reply> pending) {
+        auto result{pending.get()};
+        if (result.status != net_status::ok)
+            return std::nullopt;
+
+        frame_reader in{result.body.view()};
+        auto value{in.pod<T>()};
+        if (in.bad())
+            return std::nullopt;
+        return value;
+    };
+};
+
+net_bus::net_bus(const std::string& host, std::uint16_t port)
+    : data{std::make_shared<state>(host, port)} {}
+
+expected<net_bus::id_t> net_bus::put(kind_id kind, byte_view payload, duration after,
+                                     priority prio, std::string_view idempotency_key) {
+    // Never fits a frame; saves copying it only to find that out.
+    if (payload.size() > detail::net_max_frame)
+        return unexpected{error{}};
+
+    auto id{state::scalar<id_t>(
+        data->request(net_op::put, true, [&](frame_writer& out) {
+            out.str(kind.name())
+                .pod(ns_of(after))
+                .pod(static_cast<std::uint8_t>(prio))
+                .str(idempotency_key)
+                .raw(payload);
+        }))};
+    if (!id.has_value())
+        return unexpected{error{}};
+    return expected<id_t>{id.value()};
+}
+
+expected<std::vector<net_bus::id_t>> net_bus::put_views(kind_id kind, const byte_view* payloads,
+                                                        size_t count, duration after,
+                                                        priority prio) {
+    size_t total{};
+    for (size_t i{}; i < count; ++i)
+        total += payloads[i].size();
+    if (total > detail::net_max_frame)
+        return unexpected{error{}};
+
+    auto result{data->request(net_op::put_many, true, [&](frame_writer& out) {
+                        out.str(kind.name())
+                            .pod(ns_of(after))
+                            .pod(static_cast<std::uint8_t>(prio))
+                            .pod(static_cast<std::uint32_t>(count));
+                        std::uint32_t end{};
+                        for (size_t i{}; i < count; ++i)
+                            out.pod(end += static_cast<std::uint32_t>(payloads[i].size()));
+                        for (size_t i{}; i < count; ++i)
+                            out.raw(payloads[i]);
+                    }).get()};
+    if (result.status != net_status::ok)
+        return unexpected{error{}};
+
+    frame_reader in{result.body.view()};
+    std::vector<id_t> ids(in.pod<std::uint32_t>());
+    for (auto& x : ids)
+        x = in.pod<id_t>();
+    if (in.bad())
+        return unexpected{error{}};
+    return expected<std::vector<id_t>>{std::move(ids)};
+}
+
+std::optional<std::vector<net_bus::delivery>> net_bus::next(kind_id kind, size_t count,
+                                                            duration timeout) {
+    if (count == 0)
+        return std::optional{std::vector<delivery>{}};
+
+    auto seen{data->interrupts_of(kind)};
+    auto result{data->request(
+                        net_op::next, true,
+                        [&](frame_writer& out) {
+                            out.str(kind.name())
+                                .pod(static_cast<std::uint32_t>(count))
+                                .pod(ns_of(timeout));
+                        },
+                        kind, seen)
+                    .get()};
+    if (result.status != net_status::ok)
+        return std::nullopt;
+
+    // Bodies too big to be inline share the block the response was copied into.
+    frame_reader in{result.body.view()};
+    std::vector<delivery> batch(in.pod<std::uint32_t>());
+    for (auto& x : batch) {
+        x.id = in.pod<id_t>();
+        x.handle.index = in.pod<std::uint32_t>();
+        x.handle.generation = in.pod<std::uint32_t>();
+        auto body{in.raw(in.pod<std::uint32_t>())};
+        if (in.bad())
+            return std::nullopt;
+        x.payload = result.body.slice(static_cast<size_t>(body.data() - result.body.data()),
+                                      body.size());
+    }
+    return std::optional{std::move(batch)};
+}
+
+bool net_bus::ack(kind_id kind, handle_t handle) {
+    auto settled{state::scalar<std::uint32_t>(
+        data->request(net_op::ack, true, [&](frame_writer& out) {
+            out.str(kind.name()).pod(std::uint32_t{1}).pod(handle.index).pod(handle.generation);
+        }))};
+    return settled.value_or(0) == 1;
+}
+
+bool net_bus::reject(kind_id kind, handle_t handle) {
+    auto settled{state::scalar<std::uint32_t>(
+        data->request(net_op::reject, true, [&](frame_writer& out) {
+            out.str(kind.name()).pod(std::uint32_t{1}).pod(handle.index).pod(handle.generation);
+        }))};
+    return settled.value_or(0) == 1;
+}
+
+void net_bus::settle(kind_id kind, const handle_t* handles, size_t count, bool acked) {
+    if (count == 0)
+        return;
+
+    data->request(acked ? net_op::ack : net_op::nack, false, [&](frame_writer& out) {
+        out.str(kind.name()).pod(static_cast<std::uint32_t>(count));
+        for (size_t i{}; i < count; ++i)
+            out.pod(handles[i].index).pod(handles[i].generation);
+    });
+}
+
+void net_bus::interrupt(kind_id kind) {
+    data->interrupt(kind);
+    data->request(net_op::interrupt, false, [&](frame_writer& out) { out.str(kind.name()); });
+}
+
+void net_bus::stop() { data->stop(); }
+
+size_t net_bus::enqueued_size(kind_id kind) {
+    return state::scalar<std::uint64_t>(
+               data->request(net_op::enqueued_size, true,
+                             [&](frame_writer& out) { out.str(kind.name()); }))
+        .value_or(0);
+}
+
+size_t net_bus::delayed_size(kind_id kind) {
+    return state::scalar<std::uint64_t>(
+               data->request(net_op::delayed_size, true,
+                             [&](frame_writer& out) { out.str(kind.name()); }))
+        .value_or(0);
+}
+
+size_t net_bus::unacked_size(kind_id kind) {
+    return state::scalar<std::uint64_t>(
+               data->request(net_op::unacked_size, true,
+                             [&](frame_writer& out) { out.str(kind.name()); }))
+        .value_or(0);
+}
+
+bool net_bus::empty() {
+    return state::scalar<std::uint8_t>(
+               data->request(net_op::empty, true, [](frame_writer& /*out*/) {}))
+               .value_or(1) != 0;
+}
+
+} // namespace squedl
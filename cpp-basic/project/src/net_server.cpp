@@ -0,0 +1,637 @@
+#include "squedl/net_server.hpp"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "squedl/detail/net_wire.hpp"
+
+namespace squedl {
+namespace {
+
+using detail::frame_reader;
+using detail::frame_writer;
+using detail::net_op;
+using detail::net_status;
+using detail::net_unanswered_tag;
+using bus_type = net_server::bus_type;
+using steady = std::chrono::steady_clock;
+
+// Keys of the listener and the wakeup eventfd in epoll; connections count up from first_id.
+constexpr std::uint64_t listener_key{0};
+constexpr std::uint64_t wakeup_key{1};
+constexpr std::uint64_t first_id{2};
+
+[[noreturn]] void throw_errno(const char* what) {
+    throw std::system_error{errno, std::generic_category(), what};
+}
+
+// A next of the connection waiting in the bus.
+struct parked_next {
+    kind_id kind;
+    std::uint64_t tag{};
+    std::uint64_t ticket{};
+};
+
+struct connection {
+    std::uint64_t id{};
+    int fd{-1};
+    // Loop thread only.
+    bytes in;
+    bool polling_out{};
+
+    // Guards what follows; receivers of next_async respond from other threads.
+    std::mutex mtx;
+    bytes out;
+    std::vector<parked_next> parked;
+    bool closed{};
+
+    connection(std::uint64_t id, int fd) : id{id}, fd{fd} {};
+
+    // Forgets the parked next of tag; false when it is gone already.
+    bool unpark(std::uint64_t tag) {
+        auto found{std::find_if(parked.begin(), parked.end(),
+                                [tag](const auto& x) { return x.tag == tag; })};
+        if (found == parked.end())
+            return false;
+        parked.erase(found);
+        return true;
+    };
+};
+
+void respond(bytes& out, net_status status, std::uint64_t tag) {
+    frame_writer{out, static_cast<std::uint8_t>(status), tag}.finish();
+}
+
+template <typename T>
+void respond(bytes& out, std::uint64_t tag, T value) {
+    frame_writer frame{out, static_cast<std::uint8_t>(net_status::ok), tag};
+    frame.pod(value);
+    frame.finish();
+}
+
+void respond_batch(bytes& out, std::uint64_t tag,
+                   const std::optional<std::vector<bus_type::delivery>>& batch) {
+    if (!batch.has_value()) {
+        respond(out, net_status::stopped, tag);
+        return;
+    }
+
+    frame_writer frame{out, static_cast<std::uint8_t>(net_status::ok), tag};
+    frame.pod(static_cast<std::uint32_t>(batch->size()));
+    for (const auto& x : batch.value())
+        frame.pod(x.id)
+            .pod(x.handle.index)
+            .pod(x.handle.generation)
+            .pod(static_cast<std::uint32_t>(x.payload.size()))
+            .raw(x.payload.view());
+    frame.finish();
+}
+
+std::vector<bus_type::handle_t> read_handles(frame_reader& in) {
+    auto count{in.pod<std::uint32_t>()};
+    std::vector<bus_type::handle_t> result{};
+    for (std::uint32_t i{}; i < count && !in.bad(); ++i) {
+        bus_type::handle_t handle{};
+        handle.index = in.pod<std::uint32_t>();
+        handle.generation = in.pod<std::uint32_t>();
+        result.push_back(handle);
+    }
+    return result;
+}
+
+} // namespace
+
+struct net_server::state : std::enable_shared_from_this<state> {
+    // A parked next with a timeout, withdrawn at deadline unless served before.
+    struct timed_next {
+        kind_id kind;
+        std::uint64_t ticket{};
+        std::uint64_t tag{};
+        std::weak_ptr<connection> owner;
+    };
+
+    bus_type bus;
+    bool accept_new_kinds{};
+    int listener{-1};
+    int poller{-1};
+    int wakeup{-1};
+    std::uint16_t bound{};
+    std::atomic<bool> stopping{};
+    std::thread loop;
+
+    // Loop thread only.
+    std::unordered_map<std::uint64_t, std::shared_ptr<connection>> connections;
+    std::multimap<steady::time_point, timed_next> timers;
+    std::uint64_t next_connection{first_id};
+
+    // Connections other threads queued responses for.
+    std::mutex dirty_mtx;
+    std::vector<std::weak_ptr<connection>> dirty;
+
+    state(bus_type bus, const std::string& host, std::uint16_t port, bool accept_new_kinds)
+        : bus{std::move(bus)}, accept_new_kinds{accept_new_kinds} {
+        try {
+            listen(host, port);
+            poller = ::epoll_create1(EPOLL_CLOEXEC);
+            wakeup = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (poller < 0 || wakeup < 0)
+                throw_errno("squedl: cannot create epoll");
+            if (!watch(listener, listener_key, EPOLL_CTL_ADD, EPOLLIN) ||
+                !watch(wakeup, wakeup_key, EPOLL_CTL_ADD, EPOLLIN))
+                throw_errno("squedl: cannot watch sockets");
+        } catch (...) {
+            close_fds();
+            throw;
+        }
+    };
+
+    state(state const& other) = delete;
+    state(state&& other) = delete;
+    state& operator=(state const& other) = delete;
+    state& operator=(state&& other) = delete;
+
+    ~state() { close_fds(); };
+
+    void close_fds() {
+        for (auto fd : {listener, poller, wakeup})
+            if (fd >= 0)
+                ::close(fd);
+        listener = poller = wakeup = -1;
+    };
+
+    void listen(const std::string& host, std::uint16_t port) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo* found{};
+        if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0)
+            throw std::system_error{std::make_error_code(std::errc::address_not_available),
+                                    "squedl: cannot resolve " + host};
+
+        for (auto* x{found}; x != nullptr && listener < 0; x = x->ai_next) {
+            listener = ::socket(x->ai_family, x->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                x->ai_protocol);
+            if (listener < 0)
+                continue;
+
+            int on{1};
+            ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (::bind(listener, x->ai_addr, x->ai_addrlen) != 0 ||
+                ::listen(listener, SOMAXCONN) != 0) {
+                ::close(listener);
+                listener = -1;
+            }
+        }
+        ::freeaddrinfo(found);
+        if (listener < 0)
+            throw_errno("squedl: cannot listen");
+
+        sockaddr_storage address{};
+        socklen_t size{sizeof(address)};
+        ::getsockname(listener, reinterpret_cast<sockaddr*>(&address), &size);
+        bound = ntohs(address.ss_family == AF_INET6
+                          ? reinterpret_cast<sockaddr_in6*>(&address)->sin6_port
+                          : reinterpret_cast<sockaddr_in*>(&address)->sin_port);
+    };
+
+    bool watch(int fd, std::uint64_t key, int op, std::uint32_t events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = key;
+        return ::epoll_ctl(poller, op, fd, &event) == 0;
+    };
+
+    void start() {
+        loop = std::thread{[this] { run(); }};
+    };
+
+    void stop() {
+        if (stopping.exchange(true))
+            return;
+
+        std::uint64_t one{1};
+        [[maybe_unused]] auto written{::write(wakeup, &one, sizeof(one))};
+        if (loop.joinable())
+            loop.join();
+    };
+
+    void run() {
+        std::array<epoll_event, 64> events{};
+        while (!stopping) {
+            auto count{::epoll_wait(poller, events.data(), static_cast<int>(events.size()),
+                                    wait_ms())};
+            for (int i{}; i < count; ++i) {
+                auto key{events[i].data.u64};
+                if (key == listener_key) {
+                    accept_all();
+                } else if (key == wakeup_key) {
+                    std::uint64_t ignored{};
+                    [[maybe_unused]] auto read{::read(wakeup, &ignored, sizeof(ignored))};
+                } else if (auto found{connections.find(key)}; found != connections.end()) {
+                    auto conn{found->second};
+                    if ((events[i].events & EPOLLOUT) != 0 && !flush(*conn))
+                        close(conn);
+                    else if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0)
+                        receive(conn);
+                }
+            }
+            flush_dirty();
+            expire();
+        }
+
+        while (!connections.empty())
+            close(connections.begin()->second);
+    };
+
+    int wait_ms() const {
+        if (timers.empty())
+            return -1;
+
+        auto left{timers.begin()->first - steady::now()};
+        auto ms{std::chrono::ceil<std::chrono::milliseconds>(left).count()};
+        return static_cast<int>(std::clamp<std::int64_t>(ms, 0, 60'000));
+    };
+
+    void accept_all() {
+        for (;;) {
+            auto fd{::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)};
+            if (fd < 0)
+                return;
+
+            int on{1};
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            auto conn{std::make_shared<connection>(next_connection++, fd)};
+            if (!watch(fd, conn->id, EPOLL_CTL_ADD, EPOLLIN)) {
+                ::close(fd);
+                continue;
+            }
+            connections.emplace(conn->id, std::move(conn));
+        }
+    };
+
+    void close(const std::shared_ptr<connection>& conn) {
+        std::vector<parked_next> parked{};
+        {
+            std::lock_guard<std::mutex> _{conn->mtx};
+            conn->closed = true;
+            parked.swap(conn->parked);
+        }
+        ::epoll_ctl(poller, EPOLL_CTL_DEL, conn->fd, nullptr);
+        ::close(conn->fd);
+
+        // Those that cannot be withdrawn anymore give their messages back when they run.
+        for (const auto& x : parked)
+            if (x.ticket != 0)
+                bus.cancel_async(x.kind, x.ticket);
+        connections.erase(conn->id);
+    };
+
+    // Reads what arrived, handles every complete frame, then sends all responses at once.
+    void receive(const std::shared_ptr<connection>& conn) {
+        std::array<std::byte, size_t{64} << 10> chunk{};
+        for (;;) {
+            auto n{::recv(conn->fd, chunk.data(), chunk.size(), 0)};
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (n <= 0) {
+                close(conn);
+                return;
+            }
+            conn->in.insert(conn->in.end(), chunk.begin(), chunk.begin() + n);
+        }
+
+        auto framed{detail::for_each_frame(
+            conn->in, [&](std::uint8_t code, std::uint64_t tag, byte_view body) {
+                handle(conn, static_cast<net_op>(code), tag, body);
+            })};
+        if (!framed || !flush(*conn))
+            close(conn);
+    };
+
+    // Sends what the socket takes; the rest waits for EPOLLOUT. False when the peer is gone.
+    bool flush(connection& conn) {
+        std::lock_guard<std::mutex> _{conn.mtx};
+        size_t sent{};
+        while (sent < conn.out.size()) {
+            auto n{::send(conn.fd, conn.out.data() + sent, conn.out.size() - sent,
+                          MSG_NOSIGNAL | MSG_DONTWAIT)};
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (n < 0)
+                return false;
+            sent += static_cast<size_t>(n);
+        }
+        conn.out.erase(conn.out.begin(), conn.out.begin() + static_cast<std::ptrdiff_t>(sent));
+
+        auto pending{!conn.out.empty()};
+        if (pending != conn.polling_out) {
+            watch(conn.fd, conn.id, EPOLL_CTL_MOD, EPOLLIN | (pending ? EPOLLOUT : 0U));
+            conn.polling_out = pending;
+        }
+        return true;
+    };
+
+    void flush_dirty() {
+        std::vector<std::weak_ptr<connection>> marked{};
+        {
+            std::lock_guard<std::mutex> _{dirty_mtx};
+            marked.swap(dirty);
+        }
+
+        for (auto& x : marked) {
+            auto conn{x.lock()};
+            if (conn != nullptr && connections.count(conn->id) != 0 && !flush(*conn))
+                close(conn);
+        }
+    };
+
+    void mark_dirty(const std::shared_ptr<connection>& conn) {
+        {
+            std::lock_guard<std::mutex> _{dirty_mtx};
+            dirty.push_back(conn);
+        }
+        std::uint64_t one{1};
+        [[maybe_unused]] auto written{::write(wakeup, &one, sizeof(one))};
+    };
+
+    // Answers timed nexts still parked at their deadline with an empty batch.
+    void expire() {
+        auto now{steady::now()};
+        while (!timers.empty() && timers.begin()->first <= now) {
+            auto timed{std::move(timers.begin()->second)};
+            timers.erase(timers.begin());
+
+            auto conn{timed.owner.lock()};
+            if (conn == nullptr || !bus.cancel_async(timed.kind, timed.ticket))
+                continue;
+
+            {
+                std::lock_guard<std::mutex> _{conn->mtx};
+                if (conn->closed || !conn->unpark(timed.tag))
+                    continue;
+                respond_batch(conn->out, timed.tag,
+                              std::optional{std::vector<bus_type::delivery>{}});
+            }
+            if (!flush(*conn))
+                close(conn);
+        }
+    };
+
+    void handle(const std::shared_ptr<connection>& conn, net_op op, std::uint64_t tag,
+                byte_view body) {
+        frame_reader in{body};
+        if (op == net_op::empty) {
+            auto empty{static_cast<std::uint8_t>(bus.empty())};
+            std::lock_guard<std::mutex> _{conn->mtx};
+            respond(conn->out, tag, empty);
+            return;
+        }
+
+        auto name{in.str()};
+        if (in.bad() || name.empty()) {
+            fail(conn, net_status::malformed, tag);
+            return;
+        }
+
+        auto found{resolve(name)};
+        if (!found.has_value()) {
+            fail(conn, net_status::refused, tag);
+            return;
+        }
+
+        auto kind{found.value()};
+        if (op == net_op::next) {
+            park(conn, kind, tag, in);
+            return;
+        }
+
+        // Not into conn->out directly: a put can run receivers that respond on this connection.
+        bytes reply{};
+        if (!serve(kind, op, tag, in, reply))
+            respond(reply, net_status::malformed, tag);
+        if (tag == net_unanswered_tag)
+            return;
+
+        std::lock_guard<std::mutex> _{conn->mtx};
+        conn->out.insert(conn->out.end(), reply.begin(), reply.end());
+    };
+
+    // Answers a request that cannot be served, unless it was fire and forget.
+    void fail(const std::shared_ptr<connection>& conn, net_status status, std::uint64_t tag) {
+        if (tag == net_unanswered_tag)
+            return;
+
+        std::lock_guard<std::mutex> _{conn->mtx};
+        respond(conn->out, status, tag);
+    };
+
+    // Interns a kind only when new ones are accepted and there is room for them; running out
+    // must not throw on the loop thread.
+    std::optional<kind_id> resolve(std::string_view name) {
+        if (auto found{kind_id::find(name)}; found.has_value() || !accept_new_kinds)
+            return found;
+
+        try {
+            return kind_id{name};
+        } catch (const std::length_error&) {
+            return std::nullopt;
+        }
+    };
+
+    // Handles every request but next and empty; false when it was malformed.
+    bool serve(kind_id kind, net_op op, std::uint64_t tag, frame_reader& in, bytes& out) {
+        switch (op) {
+        case net_op::put: {
+            auto after{in.pod<std::int64_t>()};
+            auto prio{in.pod<std::uint8_t>()};
+            auto key{in.str()};
+            auto payload{in.rest()};
+            if (in.bad() || prio >= priority_levels)
+                return false;
+
+            auto id{bus.put(kind, payload, delay(after), static_cast<priority>(prio), key)};
+            if (id.has_value())
+                respond(out, tag, id.value());
+            else
+                respond(out, net_status::refused, tag);
+            return true;
+        }
+        case net_op::put_many: {
+            auto after{in.pod<std::int64_t>()};
+            auto prio{in.pod<std::uint8_t>()};
+            auto count{in.pod<std::uint32_t>()};
+            std::vector<size_t> ends{};
+            for (std::uint32_t i{}; i < count && !in.bad(); ++i)
+                ends.push_back(in.pod<std::uint32_t>());
+            auto buffer{in.rest()};
+            if (in.bad() || prio >= priority_levels || !std::is_sorted(ends.begin(), ends.end()) ||
+                (!ends.empty() && ends.back() > buffer.size()))
+                return false;
+
+            auto ids{bus.put_many(kind, buffer, ends, delay(after), static_cast<priority>(prio))};
+            if (!ids.has_value()) {
+                respond(out, net_status::refused, tag);
+                return true;
+            }
+
+            frame_writer frame{out, static_cast<std::uint8_t>(net_status::ok), tag};
+            frame.pod(static_cast<std::uint32_t>(ids->size()));
+            for (auto id : ids.value())
+                frame.pod(id);
+            frame.finish();
+            return true;
+        }
+        case net_op::ack:
+        case net_op::reject: {
+            auto handles{read_handles(in)};
+            if (in.bad())
+                return false;
+
+            std::uint32_t settled{};
+            if (op == net_op::ack) {
+                bus.ack_many(kind, handles, [&settled](size_t /*position*/) { ++settled; });
+            } else {
+                for (const auto& x : handles)
+                    settled += bus.reject(kind, x) ? 1 : 0;
+            }
+            respond(out, tag, settled);
+            return true;
+        }
+        case net_op::nack: {
+            auto handles{read_handles(in)};
+            if (in.bad())
+                return false;
+
+            bus.nack_many(kind, handles);
+            respond(out, net_status::ok, tag);
+            return true;
+        }
+        case net_op::interrupt:
+            bus.interrupt(kind);
+            respond(out, net_status::ok, tag);
+            return true;
+        case net_op::enqueued_size:
+            respond(out, tag, static_cast<std::uint64_t>(bus.enqueued_size(kind)));
+            return true;
+        case net_op::delayed_size:
+            respond(out, tag, static_cast<std::uint64_t>(bus.delayed_size(kind)));
+            return true;
+        case net_op::unacked_size:
+            respond(out, tag, static_cast<std::uint64_t>(bus.unacked_size(kind)));
+            return true;
+        default:
+            return false;
+        }
+    };
+
+    // Hands a next to the bus, to be answered by its receiver whenever messages are ready.
+    void park(const std::shared_ptr<connection>& conn, kind_id kind, std::uint64_t tag,
+              frame_reader& in) {
+        auto count{in.pod<std::uint32_t>()};
+        auto timeout{in.pod<std::int64_t>()};
+        if (in.bad() || count == 0) {
+            std::lock_guard<std::mutex> _{conn->mtx};
+            if (in.bad())
+                respond(conn->out, net_status::malformed, tag);
+            else
+                respond_batch(conn->out, tag, std::optional{std::vector<bus_type::delivery>{}});
+            return;
+        }
+
+        // Listed before it can run, so that its receiver always finds itself to unpark.
+        {
+            std::lock_guard<std::mutex> _{conn->mtx};
+            conn->parked.push_back(parked_next{kind, tag, 0});
+        }
+
+        auto ticket{bus.next_async(
+            kind, count,
+            [weak = weak_from_this(), owner = std::weak_ptr<connection>{conn}, kind,
+             tag](std::optional<std::vector<bus_type::delivery>> batch) {
+                auto self{weak.lock()};
+                if (self == nullptr)
+                    return;
+                self->answer(owner.lock(), kind, tag, batch);
+            })};
+        if (ticket == 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> _{conn->mtx};
+            auto found{std::find_if(conn->parked.begin(), conn->parked.end(),
+                                    [tag](const auto& x) { return x.tag == tag; })};
+            if (found == conn->parked.end())
+                return;
+            found->ticket = ticket;
+        }
+
+        if (timeout > 0)
+            timers.emplace(steady::now() + std::chrono::nanoseconds{timeout},
+                           timed_next{kind, ticket, tag, conn});
+    };
+
+    // Runs on whatever thread served the next; a batch nobody can receive anymore goes back.
+    void answer(const std::shared_ptr<connection>& conn, kind_id kind, std::uint64_t tag,
+                const std::optional<std::vector<bus_type::delivery>>& batch) {
+        if (conn != nullptr) {
+            std::unique_lock lock{conn->mtx};
+            if (!conn->closed && conn->unpark(tag)) {
+                respond_batch(conn->out, tag, batch);
+                lock.unlock();
+                mark_dirty(conn);
+                return;
+            }
+        }
+
+        if (!batch.has_value() || batch->empty())
+            return;
+
+        std::vector<bus_type::handle_t> handles{};
+        for (const auto& x : batch.value())
+            handles.push_back(x.handle);
+        bus.nack_many(kind, handles);
+    };
+
+    static bus_type::duration delay(std::int64_t ns) {
+        return std::chrono::duration_cast<bus_type::duration>(std::chrono::nanoseconds{ns});
+    };
+};
+
+net_server::net_server(bus_type bus, const std::string& host, std::uint16_t port,
+                       bool accept_new_kinds)
+    : data{std::make_shared<state>(std::move(bus), host, port, accept_new_kinds)} {
+    data->start();
+}
+
+net_server::~net_server() { stop(); }
+
+std::uint16_t net_server::port() const { return data->bound; }
+
+void net_server::stop() { data->stop(); }
+
+} // namespace squedl
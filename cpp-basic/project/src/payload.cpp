@@ -0,0 +1,168 @@
+#include "squedl/payload.hpp"
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace squedl::detail {
+namespace {
+
+constexpr size_t min_class_bits{6};
+constexpr size_t max_class_bits{16};
+constexpr size_t class_count{max_class_bits - min_class_bits + 1};
+// Blocks a thread keeps per size class before handing half of them back to the depot.
+constexpr size_t cache_limit{64};
+// Blocks the depot keeps per size class; anything beyond goes back to the heap.
+constexpr size_t depot_limit{4096};
+
+struct pooled_block : payload_block {
+    size_t size_class{};
+};
+
+constexpr size_t header_size{(sizeof(pooled_block) + alignof(std::max_align_t) - 1) /
+                             alignof(std::max_align_t) * alignof(std::max_align_t)};
+
+size_t class_of(size_t size) {
+    size_t result{};
+    while ((size_t{1} << (min_class_bits + result)) < size)
+        ++result;
+    return result;
+}
+
+size_t class_bytes(size_t size_class) { return size_t{1} << (min_class_bits + size_class); }
+
+std::byte* data_of(payload_block* block) {
+    return reinterpret_cast<std::byte*>(block) + header_size;
+}
+
+void free_block(payload_block* block) {
+    static_cast<pooled_block*>(block)->~pooled_block();
+    ::operator delete(block);
+}
+
+class depot {
+public:
+    void put(size_t size_class, std::vector<pooled_block*>& blocks, size_t count) {
+        std::lock_guard<std::mutex> _{mtx};
+        auto& free{classes[size_class]};
+        for (size_t i{}; i < count; ++i) {
+            auto* block{blocks.back()};
+            blocks.pop_back();
+            if (free.size() < depot_limit)
+                free.push_back(block);
+            else
+                free_block(block);
+        }
+    };
+
+    void take(size_t size_class, std::vector<pooled_block*>& blocks, size_t count) {
+        std::lock_guard<std::mutex> _{mtx};
+        auto& free{classes[size_class]};
+        for (; count != 0 && !free.empty(); --count) {
+            blocks.push_back(free.back());
+            free.pop_back();
+        }
+    };
+
+    depot() = default;
+    depot(depot const& other) = delete;
+    depot(depot&& other) = delete;
+    depot& operator=(depot const& other) = delete;
+    depot& operator=(depot&& other) = delete;
+
+    ~depot() {
+        for (auto& free : classes)
+            for (auto* block : free)
+                free_block(block);
+    };
+
+private:
+    std::mutex mtx;
+    std::array<std::vector<pooled_block*>, class_count> classes;
+};
+
+depot& shared_depot() {
+    static depot instance{};
+    return instance;
+}
+
+class cache {
+public:
+    pooled_block* take(size_t size_class) {
+        auto& free{classes[size_class]};
+        if (free.empty())
+            shared_depot().take(size_class, free, cache_limit / 2);
+        if (free.empty())
+            return nullptr;
+
+        auto* block{free.back()};
+        free.pop_back();
+        return block;
+    };
+
+    void put(pooled_block* block) {
+        auto& free{classes[block->size_class]};
+        if (free.capacity() == 0)
+            free.reserve(cache_limit + 1);
+
+        free.push_back(block);
+        if (free.size() > cache_limit)
+            shared_depot().put(block->size_class, free, cache_limit / 2);
+    };
+
+    cache() { shared_depot(); };
+    cache(cache const& other) = delete;
+    cache(cache&& other) = delete;
+    cache& operator=(cache const& other) = delete;
+    cache& operator=(cache&& other) = delete;
+
+    ~cache() {
+        for (size_t i{}; i < class_count; ++i)
+            shared_depot().put(i, classes[i], classes[i].size());
+    };
+
+private:
+    std::array<std::vector<pooled_block*>, class_count> classes;
+};
+
+cache& local_cache() {
+    thread_local cache instance{};
+    return instance;
+}
+
+void release_pooled(payload_block* block) {
+    auto* pooled{static_cast<pooled_block*>(block)};
+    pooled->refs.store(1, std::memory_order_relaxed);
+    local_cache().put(pooled);
+}
+
+void release_unpooled(payload_block* block) {
+    block->~payload_block();
+    ::operator delete(block);
+}
+
+} // namespace
+
+payload_block* allocate_block(size_t size, std::byte*& data) {
+    auto size_class{class_of(size)};
+    if (size_class >= class_count) {
+        auto* block{new (::operator new(header_size + size)) payload_block{}};
+        block->release = release_unpooled;
+        data = data_of(block);
+        return block;
+    }
+
+    auto* block{local_cache().take(size_class)};
+    if (block == nullptr) {
+        block = new (::operator new(header_size + class_bytes(size_class))) pooled_block{};
+        block->release = release_pooled;
+        block->size_class = size_class;
+    }
+
+    data = data_of(block);
+    return block;
+}
+
+} // namespace squedl::detail
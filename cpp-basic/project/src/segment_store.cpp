@@ -0,0 +1,123 @@
+#include "squedl/segment_store.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <utility>
+
+namespace squedl {
+namespace detail {
+
+struct mapped_segment : payload_block {
+    std::byte* base{};
+    size_t size{};
+    std::shared_ptr<std::atomic<size_t>> mapped;
+};
+
+namespace {
+
+constexpr size_t alignment{alignof(std::max_align_t)};
+
+size_t align_up(size_t value) { return (value + alignment - 1) / alignment * alignment; }
+
+void release_segment(payload_block* block) {
+    auto* segment{static_cast<mapped_segment*>(block)};
+    ::munmap(segment->base, segment->size);
+    --*segment->mapped;
+    delete segment;
+}
+
+void unref(payload_block* block) {
+    if (block != nullptr && block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        block->release(block);
+}
+
+[[noreturn]] void throw_errno(const char* what) {
+    throw std::system_error{errno, std::generic_category(), what};
+}
+
+} // namespace
+} // namespace detail
+
+segment_store::segment_store(std::string directory, size_t segment_size)
+    : directory{std::move(directory)},
+      segment_size{detail::align_up(std::max<size_t>(segment_size, 1))},
+      mapped{std::make_shared<std::atomic<size_t>>()} {
+    std::filesystem::create_directories(this->directory);
+}
+
+segment_store::~segment_store() { detail::unref(active); }
+
+payload segment_store::write(byte_view bytes) {
+    if (bytes.size() <= payload::inline_capacity)
+        return payload{bytes};
+
+    auto size{detail::align_up(bytes.size())};
+    detail::mapped_segment* target{};
+    std::byte* at{};
+    {
+        std::lock_guard<std::mutex> _{mtx};
+        if (size > segment_size) {
+            target = map_segment(size);
+            at = target->base;
+        } else {
+            if (active == nullptr || offset + size > segment_size) {
+                auto* fresh{map_segment(segment_size)};
+                detail::unref(active);
+                active = fresh;
+                offset = 0;
+            }
+
+            target = active;
+            target->refs.fetch_add(1, std::memory_order_relaxed);
+            at = target->base + offset;
+            offset += size;
+        }
+    }
+
+    // Regions are handed out once, so copying in does not need the lock.
+    std::memcpy(at, bytes.data(), bytes.size());
+    return payload{target, at, bytes.size()};
+}
+
+// Returns a segment holding one reference for its first owner.
+detail::mapped_segment* segment_store::map_segment(size_t size) {
+    auto path{directory + "/squedl-XXXXXX"};
+    auto fd{::mkstemp(path.data())};
+    if (fd < 0)
+        detail::throw_errno("squedl: cannot create segment");
+    ::unlink(path.c_str());
+
+    // Blocks are reserved up front: a sparse file would leave a full disk to surface as SIGBUS
+    // on the first write into the mapping instead of as an error here.
+    if (auto failed{::posix_fallocate(fd, 0, static_cast<off_t>(size))}; failed != 0) {
+        ::close(fd);
+        throw std::system_error{failed, std::generic_category(), "squedl: cannot size segment"};
+    }
+
+    auto* base{::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)};
+    ::close(fd);
+    if (base == MAP_FAILED)
+        detail::throw_errno("squedl: cannot map segment");
+
+    auto* segment{new detail::mapped_segment{}};
+    segment->release = detail::release_segment;
+    segment->base = static_cast<std::byte*>(base);
+    segment->size = size;
+    segment->mapped = mapped;
+    ++*mapped;
+    return segment;
+}
+
+} // namespace squedl
@@ -0,0 +1,694 @@
+#include "squedl/shm_bus.hpp"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include "squedl/detail/kind_table.hpp"
+
+namespace squedl {
+namespace {
+
+constexpr std::uint64_t segment_magic{0x31306c6465757173ULL}; // "squedl01"
+constexpr std::uint32_t segment_version{1};
+constexpr size_t block_alignment{64};
+constexpr size_t class_count{48};
+constexpr std::int64_t never{std::numeric_limits<std::int64_t>::max()};
+// How long opening waits for the process creating the segment to initialize it.
+constexpr auto open_timeout{std::chrono::seconds{5}};
+
+enum class node_state : std::uint8_t { free, ready, delayed, unacked };
+
+// A message and, right behind it, its payload. Links are offsets from the segment start, with
+// 0, where the header lives, for none.
+struct node {
+    std::uint64_t prev{};
+    std::uint64_t next{};
+    std::uint64_t id{};
+    // Nanoseconds of steady_clock: when it is due while delayed, its deadline while unacked.
+    std::int64_t due{};
+    std::uint64_t size{};
+    // The bus holds one reference while the message is queued or in flight, every delivered
+    // payload pointing into it another.
+    std::atomic<std::uint32_t> refs{};
+    std::uint32_t attempts{};
+    std::uint32_t kind{};
+    std::uint8_t size_class{};
+    priority prio{priority::normal};
+    node_state state{node_state::free};
+};
+
+constexpr size_t node_size{(sizeof(node) + 15) / 16 * 16};
+
+struct list {
+    std::uint64_t head{};
+    std::uint64_t tail{};
+};
+
+struct kind_slot {
+    // Futex words: the mutex guarding everything below, and the one consumers sleep on, bumped
+    // whenever messages become ready.
+    std::atomic<std::uint32_t> lock{};
+    std::atomic<std::uint32_t> seq{};
+    std::atomic<std::uint32_t> waiters{};
+
+    std::uint32_t name_size{};
+    char name[shm_bus::max_kind_name]{};
+
+    std::array<list, priority_levels> ready{};
+    // Sorted by due.
+    list delayed{};
+    list unacked{};
+    std::uint64_t ready_count{};
+    std::uint64_t delayed_count{};
+    std::uint64_t unacked_count{};
+};
+
+struct segment_header {
+    std::uint64_t magic{};
+    std::uint32_t version{};
+    std::atomic<std::uint32_t> initialized{};
+    std::uint64_t size{};
+    std::atomic<std::uint64_t> next_id{1};
+
+    std::atomic<std::uint32_t> kinds_lock{};
+    std::uint32_t kind_count{};
+    std::array<kind_slot, shm_bus::max_kinds> kinds{};
+
+    // Blocks are powers of two from block_alignment up, cut from top and kept on a free list
+    // per size once released; they are never split or merged.
+    std::atomic<std::uint32_t> arena_lock{};
+    std::uint64_t top{};
+    std::array<std::uint64_t, class_count> free_heads{};
+};
+
+constexpr size_t arena_begin{(sizeof(segment_header) + block_alignment - 1) / block_alignment *
+                             block_alignment};
+
+[[noreturn]] void throw_errno(const char* what) {
+    throw std::system_error{errno, std::generic_category(), what};
+}
+
+std::int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               shm_bus::clock::now().time_since_epoch())
+        .count();
+}
+
+std::int64_t ns_of(shm_bus::duration value) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(value).count();
+}
+
+std::int64_t saturating_add(std::int64_t lhs, std::int64_t rhs) {
+    if (rhs > 0 && lhs > never - rhs)
+        return never;
+    return lhs + rhs;
+}
+
+// Process-shared futex operations; the words live in the segment, so no FUTEX_PRIVATE_FLAG.
+void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected,
+                std::int64_t timeout_ns) {
+    timespec timeout{};
+    timespec* bounded{};
+    if (timeout_ns != never) {
+        timeout.tv_sec = static_cast<time_t>(timeout_ns / 1'000'000'000);
+        timeout.tv_nsec = static_cast<long>(timeout_ns % 1'000'000'000);
+        bounded = &timeout;
+    }
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT, expected, bounded,
+              nullptr, 0);
+}
+
+void futex_wake(std::atomic<std::uint32_t>& word, int count) {
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, count, nullptr,
+              nullptr, 0);
+}
+
+// Mutex on a futex word: 0 unlocked, 1 locked, 2 locked with sleepers.
+class futex_lock {
+public:
+    explicit futex_lock(std::atomic<std::uint32_t>& word) : word{word} {
+        std::uint32_t current{0};
+        if (word.compare_exchange_strong(current, 1, std::memory_order_acquire))
+            return;
+
+        if (current != 2)
+            current = word.exchange(2, std::memory_order_acquire);
+        while (current != 0) {
+            futex_wait(word, 2, never);
+            current = word.exchange(2, std::memory_order_acquire);
+        }
+    };
+
+    futex_lock(futex_lock const& other) = delete;
+    futex_lock(futex_lock&& other) = delete;
+    futex_lock& operator=(futex_lock const& other) = delete;
+    futex_lock& operator=(futex_lock&& other) = delete;
+
+    ~futex_lock() {
+        if (word.fetch_sub(1, std::memory_order_release) != 1) {
+            word.store(0, std::memory_order_release);
+            futex_wake(word, 1);
+        }
+    };
+
+private:
+    std::atomic<std::uint32_t>& word;
+};
+
+size_t class_of(size_t size) {
+    size_t result{};
+    while ((block_alignment << result) < size)
+        ++result;
+    return result;
+}
+
+} // namespace
+
+struct shm_bus::state {
+    // What this process knows about a kind: its slot in the segment and its own interrupts.
+    struct local_kind {
+        kind_slot* slot{};
+        std::uint32_t index{};
+        std::atomic<std::uint64_t> interrupts{};
+
+        local_kind(kind_slot* slot, std::uint32_t index) : slot{slot}, index{index} {};
+    };
+
+    // Keeps a node alive while a payload of this process points into it.
+    struct node_block : detail::payload_block {
+        std::shared_ptr<state> owner;
+        std::uint64_t offset{};
+    };
+
+    std::byte* base{};
+    size_t size{};
+    segment_header* header{};
+    duration ack_timeout{};
+    std::atomic<bool> stopping{};
+    detail::kind_table<local_kind, kind_id::max_count> kinds;
+
+    state(const std::string& name, size_t requested, duration ack_timeout)
+        : ack_timeout{ack_timeout} {
+        auto fd{::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600)};
+        auto created{fd >= 0};
+        if (!created && errno == EEXIST)
+            fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd < 0)
+            throw_errno("squedl: cannot open shared memory");
+
+        try {
+            if (created)
+                create(fd, std::max(requested, arena_begin + block_alignment));
+            else
+                attach(fd);
+        } catch (...) {
+            ::close(fd);
+            if (created)
+                ::shm_unlink(name.c_str());
+            throw;
+        }
+        ::close(fd);
+    };
+
+    state(state const& other) = delete;
+    state(state&& other) = delete;
+    state& operator=(state const& other) = delete;
+    state& operator=(state&& other) = delete;
+
+    ~state() {
+        if (base != nullptr)
+            ::munmap(base, size);
+    };
+
+    void create(int fd, size_t bytes) {
+        if (::ftruncate(fd, static_cast<off_t>(bytes)) != 0)
+            throw_errno("squedl: cannot size shared memory");
+        map(fd, bytes);
+
+        header = new (base) segment_header{};
+        header->magic = segment_magic;
+        header->version = segment_version;
+        header->size = bytes;
+        header->top = arena_begin;
+        header->initialized.store(1, std::memory_order_release);
+    };
+
+    void attach(int fd) {
+        auto deadline{clock::now() + open_timeout};
+        struct stat info {};
+        for (;;) {
+            if (::fstat(fd, &info) != 0)
+                throw_errno("squedl: cannot stat shared memory");
+            if (static_cast<size_t>(info.st_size) >= arena_begin)
+                break;
+            if (clock::now() > deadline)
+                throw std::invalid_argument{"squedl: shared memory is not a squedl bus"};
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+        map(fd, static_cast<size_t>(info.st_size));
+
+        header = reinterpret_cast<segment_header*>(base);
+        while (header->initialized.load(std::memory_order_acquire) == 0) {
+            if (clock::now() > deadline)
+                throw std::invalid_argument{"squedl: shared memory is not a squedl bus"};
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+        if (header->magic != segment_magic || header->version != segment_version ||
+            header->size != size)
+            throw std::invalid_argument{"squedl: shared memory is not a squedl bus"};
+    };
+
+    void map(int fd, size_t bytes) {
+        auto* mapped{::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)};
+        if (mapped == MAP_FAILED)
+            throw_errno("squedl: cannot map shared memory");
+        base = static_cast<std::byte*>(mapped);
+        size = bytes;
+    };
+
+    local_kind& get(kind_id kind) {
+        if (auto* found{kinds.find(kind.index())}; found != nullptr)
+            return *found;
+
+        auto index{resolve(kind.name())};
+        return kinds.get(kind.index(), &header->kinds[index], index);
+    };
+
+    // Finds the kind's slot by name, taking a free one the first time any process uses it.
+    std::uint32_t resolve(std::string_view name) {
+        if (name.size() > max_kind_name)
+            throw std::length_error{"squedl: kind name too long for shm_bus"};
+
+        futex_lock _{header->kinds_lock};
+        for (std::uint32_t i{}; i < header->kind_count; ++i) {
+            const auto& slot{header->kinds[i]};
+            if (std::string_view{slot.name, slot.name_size} == name)
+                return i;
+        }
+
+        if (header->kind_count == max_kinds)
+            throw std::length_error{"squedl: too many kinds for shm_bus"};
+
+        auto& slot{header->kinds[header->kind_count]};
+        std::memcpy(slot.name, name.data(), name.size());
+        slot.name_size = static_cast<std::uint32_t>(name.size());
+        return header->kind_count++;
+    };
+
+    node* at(std::uint64_t offset) { return reinterpret_cast<node*>(base + offset); };
+    std::byte* payload_of(std::uint64_t offset) { return base + offset + node_size; };
+
+    // A node for size payload bytes, or 0 when the arena is exhausted.
+    std::uint64_t allocate(size_t bytes) {
+        auto size_class{class_of(node_size + bytes)};
+        if (size_class >= class_count)
+            return 0;
+
+        std::uint64_t offset{};
+        {
+            futex_lock _{header->arena_lock};
+            auto& free{header->free_heads[size_class]};
+            if (free != 0) {
+                offset = free;
+                free = at(offset)->next;
+            } else {
+                auto block{std::uint64_t{block_alignment} << size_class};
+                if (header->top + block > size)
+                    return 0;
+                offset = header->top;
+                header->top += block;
+            }
+        }
+
+        auto* fresh{new (at(offset)) node{}};
+        fresh->size = bytes;
+        fresh->size_class = static_cast<std::uint8_t>(size_class);
+        fresh->refs.store(1, std::memory_order_relaxed);
+        return offset;
+    };
+
+    void unref(std::uint64_t offset) {
+        auto* target{at(offset)};
+        if (target->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+
+        futex_lock _{header->arena_lock};
+        auto& free{header->free_heads[target->size_class]};
+        target->state = node_state::free;
+        target->next = free;
+        free = offset;
+    };
+
+    bool valid(std::uint64_t offset) const {
+        return offset >= arena_begin && offset % block_alignment == 0 &&
+               offset + node_size <= size;
+    };
+
+    // Lists are only touched with the slot's lock held.
+    void push_back(list& target, std::uint64_t offset) {
+        auto* entry{at(offset)};
+        entry->next = 0;
+        entry->prev = target.tail;
+        if (target.tail != 0)
+            at(target.tail)->next = offset;
+        else
+            target.head = offset;
+        target.tail = offset;
+    };
+
+    void insert_by_due(list& target, std::uint64_t offset) {
+        auto* entry{at(offset)};
+        auto after{target.tail};
+        while (after != 0 && at(after)->due > entry->due)
+            after = at(after)->prev;
+
+        entry->prev = after;
+        entry->next = after == 0 ? target.head : at(after)->next;
+        if (entry->next != 0)
+            at(entry->next)->prev = offset;
+        else
+            target.tail = offset;
+        if (after != 0)
+            at(after)->next = offset;
+        else
+            target.head = offset;
+    };
+
+    void remove(list& target, std::uint64_t offset) {
+        auto* entry{at(offset)};
+        if (entry->prev != 0)
+            at(entry->prev)->next = entry->next;
+        else
+            target.head = entry->next;
+        if (entry->next != 0)
+            at(entry->next)->prev = entry->prev;
+        else
+            target.tail = entry->prev;
+        entry->prev = 0;
+        entry->next = 0;
+    };
+
+    void make_ready(kind_slot& slot, std::uint64_t offset) {
+        auto* entry{at(offset)};
+        entry->state = node_state::ready;
+        push_back(slot.ready[static_cast<size_t>(entry->prio)], offset);
+        ++slot.ready_count;
+    };
+
+    // Moves delayed messages that are due, and deliveries whose ack timed out, to ready.
+    size_t requeue_due(kind_slot& slot, std::int64_t now) {
+        size_t moved{};
+        while (slot.delayed.head != 0 && at(slot.delayed.head)->due <= now) {
+            auto offset{slot.delayed.head};
+            remove(slot.delayed, offset);
+            --slot.delayed_count;
+            make_ready(slot, offset);
+            ++moved;
+        }
+        while (slot.unacked.head != 0 && at(slot.unacked.head)->due <= now) {
+            auto offset{slot.unacked.head};
+            remove(slot.unacked, offset);
+            --slot.unacked_count;
+            ++at(offset)->attempts;
+            make_ready(slot, offset);
+            ++moved;
+        }
+        return moved;
+    };
+
+    // Wakes up to count consumers of the slot, in any process.
+    static void notify(kind_slot& slot, size_t count) {
+        if (count == 0)
+            return;
+
+        slot.seq.fetch_add(1, std::memory_order_seq_cst);
+        auto sleeping{slot.waiters.load(std::memory_order_seq_cst)};
+        if (sleeping == 0)
+            return;
+        futex_wake(slot.seq, count >= sleeping ? INT_MAX : static_cast<int>(count));
+    };
+
+    squedl::payload payload_for(const std::shared_ptr<state>& self, std::uint64_t offset) {
+        auto* entry{at(offset)};
+        const auto* bytes{payload_of(offset)};
+        if (entry->size <= squedl::payload::inline_capacity)
+            return squedl::payload{byte_view{bytes, entry->size}};
+
+        entry->refs.fetch_add(1, std::memory_order_relaxed);
+        auto* block{new node_block{}};
+        block->release = release_block;
+        block->owner = self;
+        block->offset = offset;
+        return squedl::payload{block, bytes, entry->size};
+    };
+
+    static void release_block(detail::payload_block* released) {
+        auto* block{static_cast<node_block*>(released)};
+        block->owner->unref(block->offset);
+        delete block;
+    };
+};
+
+shm_bus::shm_bus(std::string name, size_t size, duration ack_timeout)
+    : data{std::make_shared<state>(name, size, ack_timeout)} {}
+
+void shm_bus::unlink(const std::string& name) { ::shm_unlink(name.c_str()); }
+
+std::optional<shm_bus::id_t> shm_bus::put_views(kind_id kind, const byte_view* payloads,
+                                                size_t count, duration after, priority prio) {
+    auto& local{data->get(kind)};
+    auto& slot{*local.slot};
+
+    std::vector<std::uint64_t> offsets{};
+    offsets.reserve(count);
+    for (size_t i{}; i < count; ++i) {
+        auto offset{data->allocate(payloads[i].size())};
+        if (offset == 0) {
+            for (auto x : offsets)
+                data->unref(x);
+            return std::nullopt;
+        }
+        offsets.push_back(offset);
+        if (!payloads[i].empty())
+            std::memcpy(data->payload_of(offset), payloads[i].data(), payloads[i].size());
+    }
+
+    auto first{data->header->next_id.fetch_add(count)};
+    auto now{now_ns()};
+    auto due{saturating_add(now, ns_of(after))};
+    size_t ready{};
+    bool earlier{};
+    {
+        futex_lock _{slot.lock};
+        for (size_t i{}; i < count; ++i) {
+            auto* entry{data->at(offsets[i])};
+            entry->id = first + i;
+            entry->kind = local.index;
+            entry->prio = prio;
+            entry->due = due;
+            if (due <= now) {
+                data->make_ready(slot, offsets[i]);
+                ++ready;
+                continue;
+            }
+
+            entry->state = node_state::delayed;
+            data->insert_by_due(slot.delayed, offsets[i]);
+            ++slot.delayed_count;
+            earlier = earlier || slot.delayed.head == offsets[i];
+        }
+    }
+
+    // Sleepers waiting for a later due have to look again.
+    data->notify(slot, earlier ? std::numeric_limits<size_t>::max() : ready);
+    return first;
+}
+
+std::optional<std::vector<shm_bus::delivery>> shm_bus::next(kind_id kind, size_t count,
+                                                            duration timeout) {
+    auto& local{data->get(kind)};
+    auto& slot{*local.slot};
+    auto interrupts{local.interrupts.load()};
+    auto deadline{timeout == duration::zero() ? never : saturating_add(now_ns(), ns_of(timeout))};
+
+    if (count == 0)
+        return std::optional{std::vector<delivery>{}};
+
+    for (;;) {
+        if (data->stopping)
+            return std::nullopt;
+
+        std::vector<delivery> result{};
+        size_t moved{};
+        size_t left{};
+        std::uint32_t seq{};
+        auto wake_at{deadline};
+        {
+            futex_lock _{slot.lock};
+            auto now{now_ns()};
+            moved = data->requeue_due(slot, now);
+
+            for (auto lane{priority_levels}; lane-- > 0 && result.size() < count;) {
+                auto& ready{slot.ready[lane]};
+                while (ready.head != 0 && result.size() < count) {
+                    auto offset{ready.head};
+                    data->remove(ready, offset);
+                    --slot.ready_count;
+
+                    auto* entry{data->at(offset)};
+                    entry->state = node_state::unacked;
+                    entry->due = saturating_add(now, ns_of(data->ack_timeout));
+                    data->insert_by_due(slot.unacked, offset);
+                    ++slot.unacked_count;
+                    result.push_back(delivery{entry->id, data->payload_for(data, offset),
+                                              handle_t{offset, entry->id, entry->attempts}});
+                }
+            }
+            left = slot.ready_count;
+
+            if (result.empty()) {
+                seq = slot.seq.load();
+                if (slot.delayed.head != 0)
+                    wake_at = std::min(wake_at, data->at(slot.delayed.head)->due);
+                if (slot.unacked.head != 0)
+                    wake_at = std::min(wake_at, data->at(slot.unacked.head)->due);
+                slot.waiters.fetch_add(1);
+            }
+        }
+
+        if (!result.empty()) {
+            // Others can have what this call made ready but did not take.
+            if (moved != 0 && left != 0)
+                data->notify(slot, left);
+            return std::optional{std::move(result)};
+        }
+
+        auto now{now_ns()};
+        if (local.interrupts != interrupts || data->stopping ||
+            (deadline != never && now >= deadline)) {
+            slot.waiters.fetch_sub(1);
+            if (data->stopping)
+                return std::nullopt;
+            return std::optional{std::vector<delivery>{}};
+        }
+
+        futex_wait(slot.seq, seq,
+                   wake_at == never ? never : std::max<std::int64_t>(wake_at - now, 0));
+        slot.waiters.fetch_sub(1);
+    }
+}
+
+size_t shm_bus::settle(kind_id kind, const handle_t* handles, size_t count, bool acked) {
+    auto& local{data->get(kind)};
+    auto& slot{*local.slot};
+
+    std::vector<std::uint64_t> released{};
+    size_t ready{};
+    {
+        futex_lock _{slot.lock};
+        for (size_t i{}; i < count; ++i) {
+            auto offset{handles[i].offset};
+            if (!data->valid(offset))
+                continue;
+
+            auto* entry{data->at(offset)};
+            if (entry->state != node_state::unacked || entry->id != handles[i].id ||
+                entry->attempts != handles[i].attempt || entry->kind != local.index)
+                continue;
+
+            data->remove(slot.unacked, offset);
+            --slot.unacked_count;
+            if (acked) {
+                entry->state = node_state::free;
+                released.push_back(offset);
+            } else {
+                ++entry->attempts;
+                data->make_ready(slot, offset);
+                ++ready;
+            }
+        }
+    }
+
+    for (auto offset : released)
+        data->unref(offset);
+    data->notify(slot, ready);
+    return released.size() + ready;
+}
+
+bool shm_bus::ack(kind_id kind, handle_t handle) { return settle(kind, &handle, 1, true) == 1; }
+
+void shm_bus::nack(kind_id kind, handle_t handle) { settle(kind, &handle, 1, false); }
+
+void shm_bus::interrupt(kind_id kind) {
+    auto& local{data->get(kind)};
+    ++local.interrupts;
+    // Every sleeper of the kind wakes, those of other processes only to sleep again.
+    local.slot->seq.fetch_add(1);
+    futex_wake(local.slot->seq, INT_MAX);
+}
+
+void shm_bus::stop() {
+    data->stopping = true;
+    data->kinds.for_each([](auto /*index*/, auto& local) {
+        local.slot->seq.fetch_add(1);
+        futex_wake(local.slot->seq, INT_MAX);
+    });
+}
+
+size_t shm_bus::enqueued_size(kind_id kind) {
+    auto& slot{*data->get(kind).slot};
+    futex_lock _{slot.lock};
+    return slot.ready_count;
+}
+
+size_t shm_bus::delayed_size(kind_id kind) {
+    auto& slot{*data->get(kind).slot};
+    futex_lock _{slot.lock};
+    return slot.delayed_count;
+}
+
+size_t shm_bus::unacked_size(kind_id kind) {
+    auto& slot{*data->get(kind).slot};
+    futex_lock _{slot.lock};
+    return slot.unacked_count;
+}
+
+bool shm_bus::empty() {
+    std::uint32_t kinds{};
+    {
+        futex_lock _{data->header->kinds_lock};
+        kinds = data->header->kind_count;
+    }
+
+    for (std::uint32_t i{}; i < kinds; ++i) {
+        auto& slot{data->header->kinds[i]};
+        futex_lock _{slot.lock};
+        if (slot.ready_count + slot.delayed_count + slot.unacked_count != 0)
+            return false;
+    }
+    return true;
+}
+
+size_t shm_bus::available() {
+    futex_lock _{data->header->arena_lock};
+    return data->size - data->header->top;
+}
+
+} // namespace squedl
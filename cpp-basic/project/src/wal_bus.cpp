@@ -0,0 +1,408 @@
+#include "squedl/wal_bus.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace squedl::detail {
+namespace {
+
+// Every record is [u32 body size][u32 checksum][body]; the body starts with its type.
+// put:  [u8 type][u64 id][i64 due][u8 priority][u32 kind size][kind][payload]; a put of an id
+//       logged before moves that message, settling the earlier put
+// acks: [u8 type][u32 count][u64 id]...
+enum class record_type : std::uint8_t { put = 1, acks = 2 };
+
+constexpr size_t header_size{sizeof(std::uint32_t) * 2};
+constexpr size_t put_fixed_size{sizeof(std::uint8_t) * 2 + sizeof(std::uint64_t) * 2 +
+                                sizeof(std::uint32_t)};
+constexpr size_t acks_fixed_size{sizeof(std::uint8_t) + sizeof(std::uint32_t)};
+constexpr std::string_view segment_suffix{".wal"};
+
+std::uint32_t checksum(const std::byte* data, size_t size) {
+    std::uint32_t result{2166136261U};
+    for (size_t i{}; i < size; ++i) {
+        result ^= static_cast<std::uint8_t>(data[i]);
+        result *= 16777619U;
+    }
+    return result;
+}
+
+template <typename T>
+std::byte* write_pod(std::byte* at, T value) {
+    std::memcpy(at, &value, sizeof(value));
+    return at + sizeof(value);
+}
+
+template <typename T>
+const std::byte* read_pod(const std::byte* at, T& value) {
+    std::memcpy(&value, at, sizeof(value));
+    return at + sizeof(value);
+}
+
+// Fills in the header of the record whose body was just written behind it.
+void seal(std::byte* record, size_t body_size) {
+    auto* body{record + header_size};
+    record = write_pod(record, static_cast<std::uint32_t>(body_size));
+    write_pod(record, checksum(body, body_size));
+}
+
+std::optional<std::uint64_t> seq_of(const std::filesystem::path& path) {
+    auto name{path.filename().string()};
+    if (name.size() <= segment_suffix.size() ||
+        name.compare(name.size() - segment_suffix.size(), segment_suffix.size(),
+                     segment_suffix) != 0)
+        return std::nullopt;
+
+    name.resize(name.size() - segment_suffix.size());
+    if (!std::all_of(name.begin(), name.end(), [](char c) { return c >= '0' && c <= '9'; }))
+        return std::nullopt;
+
+    return std::stoull(name);
+}
+
+bytes read_file(const std::string& path) {
+    std::ifstream in{path, std::ios::binary};
+    std::vector<char> raw{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+    bytes result(raw.size());
+    std::memcpy(result.data(), raw.data(), raw.size());
+    return result;
+}
+
+void sync_directory(const std::string& directory) {
+    auto dir{::open(directory.c_str(), O_RDONLY | O_DIRECTORY)};
+    if (dir < 0)
+        return;
+    ::fsync(dir);
+    ::close(dir);
+}
+
+} // namespace
+
+wal_log::wal_log(std::string directory, size_t segment_size)
+    : directory{std::move(directory)}, segment_size{std::max<size_t>(segment_size, 1)} {
+    std::filesystem::create_directories(this->directory);
+    replay();
+    writer = std::thread{[this] { run(); }};
+}
+
+wal_log::~wal_log() {
+    stop();
+    if (writer.joinable())
+        writer.join();
+    if (fd >= 0)
+        ::close(fd);
+}
+
+std::vector<wal_entry> wal_log::take_restored() {
+    std::lock_guard<std::mutex> _{mtx};
+    return std::move(restored);
+}
+
+std::optional<std::uint64_t> wal_log::append_puts(std::string_view kind, std::int64_t due,
+                                                  priority prio, const byte_view* bodies,
+                                                  size_t count, bool durable) {
+    std::unique_lock lock{mtx};
+    if (stopping || failed)
+        return std::nullopt;
+
+    auto first{next_id};
+    for (size_t i{}; i < count; ++i) {
+        write_put(next_id, kind, due, prio, bodies[i]);
+        ++next_id;
+    }
+    if (count == 0)
+        return first;
+
+    auto ticket{++appended};
+    wake.notify_one();
+
+    if (durable) {
+        synced_cv.wait(lock, [this, ticket] { return synced >= ticket || failed; });
+        if (synced < ticket)
+            return std::nullopt;
+    }
+
+    return first;
+}
+
+void wal_log::append_acks(const std::uint64_t* ids, size_t count) {
+    if (count == 0)
+        return;
+
+    auto body_size{acks_fixed_size + count * sizeof(std::uint64_t)};
+
+    std::lock_guard<std::mutex> _{mtx};
+    if (stopping || failed)
+        return;
+
+    auto& buffer{buffer_for(header_size + body_size)};
+    auto* record{buffer.data() + buffer.size() - header_size - body_size};
+    auto* at{record + header_size};
+    at = write_pod(at, record_type::acks);
+    at = write_pod(at, static_cast<std::uint32_t>(count));
+    std::memcpy(at, ids, count * sizeof(std::uint64_t));
+    seal(record, body_size);
+
+    for (size_t i{}; i < count; ++i)
+        settle(ids[i]);
+
+    ++appended;
+    wake.notify_one();
+}
+
+void wal_log::append_move(std::uint64_t id, std::string_view kind, std::int64_t due,
+                          priority prio, byte_view body) {
+    std::lock_guard<std::mutex> _{mtx};
+    if (stopping || failed)
+        return;
+
+    settle(id);
+    write_put(id, kind, due, prio, body);
+    moved[id] = segments.back().seq;
+
+    ++appended;
+    wake.notify_one();
+}
+
+void wal_log::stop() {
+    std::lock_guard<std::mutex> _{mtx};
+    stopping = true;
+    wake.notify_one();
+}
+
+size_t wal_log::segment_count() {
+    std::lock_guard<std::mutex> _{mtx};
+    return segments.size();
+}
+
+// Grows the pending chunk of the active segment by record_size bytes.
+bytes& wal_log::buffer_for(size_t record_size) {
+    auto& active{segments.back()};
+    if (pending.empty() || pending.back().seq != active.seq)
+        pending.push_back(chunk{active.seq, {}});
+
+    auto& buffer{pending.back().data};
+    buffer.resize(buffer.size() + record_size);
+    active.size += record_size;
+    return buffer;
+}
+
+// Appends a put record to the active segment, starting a new one when it is full.
+void wal_log::write_put(std::uint64_t id, std::string_view kind, std::int64_t due, priority prio,
+                        byte_view body) {
+    auto body_size{put_fixed_size + kind.size() + body.size()};
+    if (segments.back().size >= segment_size)
+        segments.push_back(segment{segments.back().seq + 1, next_id});
+
+    auto& buffer{buffer_for(header_size + body_size)};
+    auto* record{buffer.data() + buffer.size() - header_size - body_size};
+    auto* at{record + header_size};
+    at = write_pod(at, record_type::put);
+    at = write_pod(at, id);
+    at = write_pod(at, due);
+    at = write_pod(at, prio);
+    at = write_pod(at, static_cast<std::uint32_t>(kind.size()));
+    std::memcpy(at, kind.data(), kind.size());
+    at += kind.size();
+    if (!body.empty())
+        std::memcpy(at, body.data(), body.size());
+    seal(record, body_size);
+
+    ++segments.back().live;
+}
+
+void wal_log::settle(std::uint64_t id) {
+    if (auto found{moved.find(id)}; found != moved.end()) {
+        auto seq{found->second};
+        moved.erase(found);
+        auto it{std::lower_bound(
+            segments.begin(), segments.end(), seq,
+            [](const segment& x, std::uint64_t value) { return x.seq < value; })};
+        if (it != segments.end() && it->seq == seq)
+            --it->live;
+        return;
+    }
+
+    auto it{std::upper_bound(
+        segments.begin(), segments.end(), id,
+        [](std::uint64_t value, const segment& x) { return value < x.first_id; })};
+    if (it == segments.begin())
+        return;
+
+    --std::prev(it)->live;
+}
+
+void wal_log::replay() {
+    std::vector<std::uint64_t> seqs;
+    for (const auto& entry : std::filesystem::directory_iterator{directory})
+        if (auto seq{seq_of(entry.path())}; entry.is_regular_file() && seq.has_value())
+            seqs.push_back(seq.value());
+    std::sort(seqs.begin(), seqs.end());
+
+    std::map<std::uint64_t, wal_entry> live;
+    for (auto seq : seqs) {
+        segments.push_back(segment{seq, next_id});
+
+        auto content{read_file(path_of(seq))};
+        const auto* at{content.data()};
+        const auto* end{content.data() + content.size()};
+        // A torn or corrupt record ends the segment; everything after it is unreadable anyway.
+        while (static_cast<size_t>(end - at) >= header_size) {
+            std::uint32_t body_size{};
+            std::uint32_t sum{};
+            at = read_pod(read_pod(at, body_size), sum);
+            if (static_cast<size_t>(end - at) < body_size || body_size == 0 ||
+                checksum(at, body_size) != sum)
+                break;
+
+            const auto* body_end{at + body_size};
+            record_type type{};
+            at = read_pod(at, type);
+            if (type == record_type::put && body_size >= put_fixed_size) {
+                wal_entry entry{};
+                std::uint32_t kind_size{};
+                at = read_pod(read_pod(read_pod(at, entry.id), entry.due), entry.prio);
+                at = read_pod(at, kind_size);
+                if (static_cast<size_t>(entry.prio) >= priority_levels)
+                    break;
+                if (kind_size > static_cast<size_t>(body_end - at))
+                    break;
+                entry.kind.assign(reinterpret_cast<const char*>(at), kind_size);
+                at += kind_size;
+                entry.body = payload{byte_view{at, static_cast<size_t>(body_end - at)}};
+
+                // A put of an id seen before, or older than the segment, moved the message.
+                auto id{entry.id};
+                auto move{entry.id < segments.back().first_id || live.count(id) != 0};
+                if (move && live.erase(id) != 0)
+                    settle(id);
+                next_id = std::max(next_id, id + 1);
+                ++segments.back().live;
+                if (move)
+                    moved[id] = seq;
+                live.emplace(id, std::move(entry));
+            } else if (type == record_type::acks && body_size >= acks_fixed_size) {
+                std::uint32_t count{};
+                at = read_pod(at, count);
+                if (count > static_cast<size_t>(body_end - at) / sizeof(std::uint64_t))
+                    break;
+                for (std::uint32_t i{}; i < count; ++i) {
+                    std::uint64_t id{};
+                    at = read_pod(at, id);
+                    if (live.erase(id) != 0)
+                        settle(id);
+                }
+            }
+            at = body_end;
+        }
+    }
+
+    restored.reserve(live.size());
+    for (auto& [_, entry] : live)
+        restored.push_back(std::move(entry));
+
+    // Appends always start a fresh segment, so a torn tail is never written after.
+    auto active{segments.empty() ? std::uint64_t{1} : segments.back().seq + 1};
+    segments.push_back(segment{active, next_id});
+
+    for (auto seq : compact())
+        std::filesystem::remove(path_of(seq));
+}
+
+void wal_log::run() {
+    std::vector<chunk> writing;
+    std::unique_lock lock{mtx};
+    for (;;) {
+        wake.wait(lock, [this] { return !pending.empty() || stopping; });
+        if (pending.empty())
+            break;
+
+        writing.swap(pending);
+        auto target{appended};
+        lock.unlock();
+
+        auto ok{std::all_of(writing.begin(), writing.end(),
+                            [this](const chunk& x) { return write(x); })};
+        ok = ok && ::fdatasync(fd) == 0;
+        writing.clear();
+
+        lock.lock();
+        if (ok)
+            synced = target;
+        else
+            failed = true;
+        synced_cv.notify_all();
+
+        auto obsolete{compact()};
+        if (obsolete.empty())
+            continue;
+
+        lock.unlock();
+        for (auto seq : obsolete)
+            std::filesystem::remove(path_of(seq));
+        lock.lock();
+    }
+}
+
+bool wal_log::write(const chunk& chunk) {
+    if (fd < 0 || fd_seq != chunk.seq) {
+        if (fd >= 0) {
+            if (::fdatasync(fd) != 0)
+                return false;
+            ::close(fd);
+        }
+
+        fd = ::open(path_of(chunk.seq).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+        fd_seq = chunk.seq;
+        sync_directory(directory);
+    }
+
+    const auto* at{chunk.data.data()};
+    auto left{chunk.data.size()};
+    while (left != 0) {
+        auto written{::write(fd, at, left)};
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        at += written;
+        left -= static_cast<size_t>(written);
+    }
+
+    return true;
+}
+
+// Drops fully acked segments from the front; the active one and the one being written stay.
+std::vector<std::uint64_t> wal_log::compact() {
+    std::vector<std::uint64_t> result;
+    while (segments.size() > 1 && segments.front().live == 0 &&
+           (fd < 0 || segments.front().seq < fd_seq)) {
+        result.push_back(segments.front().seq);
+        segments.pop_front();
+    }
+    return result;
+}
+
+std::string wal_log::path_of(std::uint64_t seq) const {
+    char name[32]{};
+    std::snprintf(name, sizeof(name), "%020llu", static_cast<unsigned long long>(seq));
+    return directory + "/" + name + std::string{segment_suffix};
+}
+
+} // namespace squedl::detail
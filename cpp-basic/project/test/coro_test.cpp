@@ -0,0 +1,251 @@
+#include "squedl/coro.hpp"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "squedl/squedl.hpp"
+#include "squedl/wal_bus.hpp"
+
+namespace {
+using namespace std::chrono_literals;
+
+// Holds coroutines back until opened, standing in for I/O they would wait on.
+class gate {
+public:
+    explicit gate(squedl::executor& on) : on{&on} {};
+
+    auto wait() {
+        struct awaiter {
+            gate* owner{};
+
+            bool await_ready() noexcept { return false; };
+            bool await_suspend(std::coroutine_handle<> awaiting) {
+                std::lock_guard<std::mutex> _{owner->mtx};
+                if (owner->opened)
+                    return false;
+                owner->waiting.push_back(awaiting);
+                return true;
+            };
+            void await_resume() noexcept {};
+        };
+        return awaiter{this};
+    };
+
+    void open() {
+        std::vector<std::coroutine_handle<>> resumed;
+        {
+            std::lock_guard<std::mutex> _{mtx};
+            opened = true;
+            resumed.swap(waiting);
+        }
+        for (auto handle : resumed)
+            on->post(handle);
+    };
+
+    size_t waiting_count() {
+        std::lock_guard<std::mutex> _{mtx};
+        return waiting.size();
+    };
+
+private:
+    squedl::executor* on{};
+    std::mutex mtx;
+    std::vector<std::coroutine_handle<>> waiting;
+    bool opened{};
+};
+
+template <typename Predicate>
+bool wait_for(Predicate done) {
+    auto deadline{std::chrono::steady_clock::now() + 10s};
+    while (!done() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(1ms);
+    return done();
+}
+
+squedl::task<int> add(int a, int b) { co_return a + b; }
+
+squedl::task<int> sum_to(int n) {
+    int result{};
+    for (int i{1}; i <= n; ++i)
+        result = co_await add(result, i);
+    co_return result;
+}
+
+squedl::task<> fail() {
+    throw std::runtime_error{"failed"};
+    co_return;
+}
+
+struct coro_task {
+    struct args {
+        int64_t value{};
+    };
+
+    static std::string kind() { return "coro_task"; }
+
+    static void serialize(const args& arg, squedl::bytes& out) {
+        const auto* data{reinterpret_cast<const std::byte*>(&arg.value)};
+        out.assign(data, data + sizeof(arg.value));
+    }
+
+    static args deserialize(squedl::byte_view data) {
+        args args{};
+        if (data.size() >= sizeof(args.value))
+            std::memcpy(&args.value, data.data(), sizeof(args.value));
+        return args;
+    }
+
+    squedl::executor* on{};
+    std::shared_ptr<gate> io;
+    std::shared_ptr<std::atomic<int64_t>> total;
+
+    squedl::task<std::optional<squedl::error>> operator()(args args) {
+        co_await on->schedule();
+        co_await io->wait();
+        if (args.value < 0)
+            throw std::runtime_error{"negative"};
+        *total += args.value;
+        co_return std::nullopt;
+    }
+};
+} // namespace
+
+TEST(coro, tasks_chain_and_rethrow) {
+    squedl::executor on{1};
+    std::promise<int> sum;
+    std::promise<bool> thrown;
+
+    on.spawn([](std::promise<int>& sum, std::promise<bool>& thrown) -> squedl::task<> {
+        sum.set_value(co_await sum_to(1000));
+        try {
+            co_await fail();
+            thrown.set_value(false);
+        } catch (std::runtime_error& e) {
+            thrown.set_value(true);
+        }
+    }(sum, thrown));
+
+    EXPECT_EQ(sum.get_future().get(), 500500);
+    EXPECT_TRUE(thrown.get_future().get());
+}
+
+TEST(coro, executor_keeps_thousands_in_flight_on_few_threads) {
+    const size_t total{5000};
+
+    squedl::executor on{2};
+    gate io{on};
+    std::atomic<size_t> finished{};
+
+    for (size_t i{}; i < total; ++i)
+        on.spawn([](gate& io, std::atomic<size_t>& finished) -> squedl::task<> {
+            co_await io.wait();
+            ++finished;
+        }(io, finished));
+
+    ASSERT_TRUE(wait_for([&io] { return io.waiting_count() == total; }));
+    EXPECT_EQ(finished, 0);
+    io.open();
+    ASSERT_TRUE(wait_for([&finished] { return finished == total; }));
+}
+
+TEST(coro, await_next_on_buses) {
+    const std::string kind{"coro_kind"};
+    const size_t total{200};
+    const size_t consumers{20};
+
+    squedl::executor on{2};
+    squedl::test_bus<> bus{};
+    std::atomic<size_t> received{};
+    std::atomic<size_t> ended{};
+
+    for (size_t i{}; i < consumers; ++i)
+        on.spawn([](squedl::test_bus<> bus, squedl::executor& on, std::string kind,
+                    std::atomic<size_t>& received, std::atomic<size_t>& ended) -> squedl::task<> {
+            for (;;) {
+                auto batch{co_await squedl::next(bus, on, kind, 3)};
+                if (!batch.has_value())
+                    break;
+                for (const auto& x : batch.value())
+                    bus.ack(kind, x.handle);
+                received += batch.value().size();
+            }
+            ++ended;
+        }(bus, on, kind, received, ended));
+
+    for (size_t i{}; i < total; ++i)
+        ASSERT_TRUE(bus.put(kind, std::vector{std::byte{1}}).has_value());
+
+    ASSERT_TRUE(wait_for([&received] { return received == total; }));
+    EXPECT_TRUE(bus.empty());
+    bus.stop();
+    ASSERT_TRUE(wait_for([&ended] { return ended == consumers; }));
+
+    // wal_bus hands out its own handles the same way
+    auto directory{::testing::TempDir() + "coro_wal"};
+    std::filesystem::remove_all(directory);
+    {
+        squedl::wal_bus<> durable{directory};
+        ASSERT_TRUE(durable.put(kind, std::vector{std::byte{2}}).has_value());
+        std::promise<size_t> acked;
+        on.spawn([](squedl::wal_bus<> bus, squedl::executor& on, std::string kind,
+                    std::promise<size_t>& acked) -> squedl::task<> {
+            auto batch{co_await squedl::next(bus, on, kind, 10)};
+            size_t count{};
+            for (const auto& x : batch.value())
+                count += bus.ack(kind, x.handle) ? 1 : 0;
+            acked.set_value(count);
+        }(durable, on, kind, acked));
+        EXPECT_EQ(acked.get_future().get(), 1);
+        durable.stop();
+    }
+    std::filesystem::remove_all(directory);
+}
+
+TEST(coro, worker_pool_runs_coroutine_tasks) {
+    const int64_t total{1000};
+
+    static_assert(squedl::is_workable_v<coro_task>);
+
+    squedl::executor on{2};
+    squedl::test_bus<> bus{};
+    squedl::scheduler scheduler{bus};
+    squedl::worker_pool pool{bus, 8, 1ms, 2};
+    auto io{std::make_shared<gate>(on)};
+    auto sum{std::make_shared<std::atomic<int64_t>>()};
+
+    int64_t expected{};
+    for (int64_t i{}; i < total; ++i) {
+        scheduler.schedule<coro_task>(coro_task::args{i});
+        expected += i;
+    }
+    // throws on every run, so it keeps being nacked and coming back
+    scheduler.schedule<coro_task>(coro_task::args{-1});
+
+    pool.work_on(coro_task{&on, io, sum}, total + 1);
+
+    ASSERT_TRUE(wait_for([&io, total] { return io->waiting_count() == total + 1; }));
+    io->open();
+    ASSERT_TRUE(wait_for([&sum, expected] { return *sum == expected; }));
+    ASSERT_TRUE(wait_for([&bus] { return bus.enqueued_size(coro_task::kind()) +
+                                             bus.unacked_size(coro_task::kind()) <= 1; }));
+
+    pool.stop();
+    bus.stop();
+}
+
+#endif // __cpp_impl_coroutine
@@ -0,0 +1,79 @@
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "squedl/cron.hpp"
+#include "squedl/squedl.hpp"
+
+namespace {
+class cron_task {
+public:
+    struct args {};
+
+    static std::string kind() { return "cron_task"; }
+    static squedl::bytes serialize(const args& /*arg*/) { return {}; }
+};
+
+std::optional<std::int64_t> next_after(const std::string& expression, std::int64_t after) {
+    auto parsed{squedl::cron_schedule::parse(expression)};
+    EXPECT_TRUE(parsed.has_value()) << expression;
+    if (!parsed.has_value())
+        return std::nullopt;
+
+    auto next{parsed->next_after(std::chrono::seconds{after})};
+    if (!next.has_value())
+        return std::nullopt;
+    return next->count();
+}
+} // namespace
+
+TEST(cron, rejects_malformed_expressions) {
+    for (const auto* x : {"", "* * * *", "* * * * * *", "60 * * * *", "* 24 * * *", "* * 0 * *",
+                          "* * * 13 *", "* * * * 8", "*/0 * * * *", "5-1 * * * *", "1,,2 * * * *",
+                          "a * * * *", "* * * foo *", "@never", "1- * * * *", "*/60 * * * *",
+                          "0 */24 * * *", "0 0 1 */12 *", "*/4294967295 * * * *",
+                          "5-10/4294967295 * * * *"})
+        EXPECT_FALSE(squedl::cron_schedule::parse(x).has_value()) << x;
+}
+
+TEST(cron, finds_the_next_matching_minute) {
+    // 2024-01-01 00:07:30 UTC, a Monday.
+    EXPECT_EQ(next_after("*/15 * * * *", 1704067650), 1704068100);
+    // Strictly after: a matching minute itself is skipped.
+    EXPECT_EQ(next_after("*/15 * * * *", 1704068100), 1704069000);
+    // Saturday 2024-01-06 10:00 to Monday 09:00.
+    EXPECT_EQ(next_after("0 9 * * mon-fri", 1704535200), 1704704400);
+    // The next February 29th after 2024's.
+    EXPECT_EQ(next_after("0 0 29 2 *", 1709251200), 1835395200);
+    // The 13th or a Friday, whichever comes first: Friday 2024-01-05.
+    EXPECT_EQ(next_after("30 12 13 * 5", 1704067200), 1704457800);
+    EXPECT_EQ(next_after("@monthly", 1706745540), 1706745600);
+    // 7 is Sunday, 2024-01-07.
+    EXPECT_EQ(next_after("0 0 * * 7", 1704067200), 1704585600);
+    EXPECT_EQ(next_after("59 23 31 DEC *", 1717200000), 1735689540);
+    EXPECT_EQ(next_after("0 0 30 2 *", 1704067200), std::nullopt);
+}
+
+TEST(cron, follows_the_wall_clock_on_other_clocks) {
+    using namespace std::chrono_literals;
+    using steady_bus = squedl::test_bus<std::chrono::steady_clock>;
+    using recurrence = squedl::scheduler<steady_bus>::recurrence;
+
+    // steady_clock counts from boot, so its own epoch would put the ticks anywhere.
+    steady_bus bus{1min};
+    squedl::scheduler scheduler{bus};
+    auto hourly{squedl::cron_schedule::parse("@hourly").value()};
+    scheduler.schedule_recurring<cron_task>(cron_task::args{}, recurrence::cron(hourly));
+
+    auto wall{std::chrono::system_clock::now() +
+              (scheduler.next_due().value() - std::chrono::steady_clock::now())};
+    auto into_hour{wall.time_since_epoch() % 1h};
+    EXPECT_TRUE(into_hour < 1s || into_hour > 1h - 1s)
+        << std::chrono::duration_cast<std::chrono::milliseconds>(into_hour).count();
+    EXPECT_LE(wall, std::chrono::system_clock::now() + 1h);
+    scheduler.stop();
+    bus.stop();
+}
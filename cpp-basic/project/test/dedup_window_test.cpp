@@ -0,0 +1,64 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include <gtest/gtest.h>
+
+#include "squedl/detail/dedup_window.hpp"
+
+namespace {
+using clock = std::chrono::steady_clock;
+using window = squedl::detail::dedup_window<std::uint64_t, clock>;
+
+std::uint64_t key_of(std::uint64_t i) { return i * 0x9e3779b97f4a7c15ULL; }
+} // namespace
+
+TEST(dedup_window, remembers_keys_for_the_window) {
+    using namespace std::chrono_literals;
+    const auto origin{clock::time_point{} + 1h};
+    const std::uint64_t total{100000};
+
+    window seen{3s, 1'000'000};
+    for (std::uint64_t i{}; i < total; ++i) {
+        auto now{origin + std::chrono::microseconds{i * 10}};
+        ASSERT_FALSE(seen.find(key_of(i), now).has_value());
+        seen.insert(key_of(i), i, now);
+    }
+
+    // a second in, every key is still there, with its value
+    auto now{origin + 1s};
+    for (std::uint64_t i{}; i < total; ++i)
+        ASSERT_EQ(seen.find(key_of(i), now), std::optional<std::uint64_t>{i});
+
+    seen.erase(key_of(7), 8);
+    ASSERT_TRUE(seen.find(key_of(7), now).has_value());
+    seen.erase(key_of(7), 7);
+    ASSERT_FALSE(seen.find(key_of(7), now).has_value());
+    seen.insert(key_of(7), 70, now);
+    ASSERT_EQ(seen.find(key_of(7), now), std::optional<std::uint64_t>{70});
+
+    // past the window and one generation, all are gone, even without inserts meanwhile
+    now = origin + 5s;
+    for (std::uint64_t i{}; i < total; i += 97)
+        ASSERT_FALSE(seen.find(key_of(i), now).has_value());
+}
+
+TEST(dedup_window, bounds_keys_by_retiring_generations_early) {
+    using namespace std::chrono_literals;
+    const auto now{clock::time_point{} + 1h};
+    const size_t max_keys{3000};
+
+    window seen{1h, max_keys};
+    for (std::uint64_t i{}; i < max_keys * 10; ++i)
+        seen.insert(key_of(i), i, now);
+
+    // the newest keys survive, the oldest were forgotten early to stay within max_keys
+    size_t remembered{};
+    for (std::uint64_t i{}; i < max_keys * 10; ++i)
+        remembered += seen.find(key_of(i), now).has_value() ? 1 : 0;
+    ASSERT_LE(remembered, max_keys * window::generations / (window::generations - 1));
+    ASSERT_GE(remembered, max_keys);
+    ASSERT_TRUE(seen.find(key_of(max_keys * 10 - 1), now).has_value());
+    ASSERT_FALSE(seen.find(key_of(0), now).has_value());
+}
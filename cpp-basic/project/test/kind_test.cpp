@@ -0,0 +1,57 @@
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "squedl/kind.hpp"
+
+namespace {
+struct constexpr_kind {
+    static constexpr std::string_view kind() { return "kind_test_constexpr"; }
+};
+
+struct runtime_kind {
+    static std::string kind() { return "kind_test_runtime"; }
+};
+} // namespace
+
+TEST(kind_id, interns_names) {
+    squedl::kind_id first{"kind_test_first"};
+    squedl::kind_id second{std::string{"kind_test_second"}};
+
+    ASSERT_NE(first, second);
+    ASSERT_EQ(first, squedl::kind_id{std::string_view{"kind_test_first"}});
+    ASSERT_EQ(first.name(), "kind_test_first");
+    ASSERT_EQ(second.name(), "kind_test_second");
+}
+
+TEST(kind_id, of_task_types) {
+    static_assert(squedl::detail::has_constexpr_kind_v<constexpr_kind>);
+    static_assert(!squedl::detail::has_constexpr_kind_v<runtime_kind>);
+
+    ASSERT_EQ(squedl::kind_id::of<constexpr_kind>(), squedl::kind_id{"kind_test_constexpr"});
+    ASSERT_EQ(squedl::kind_id::of<runtime_kind>(), squedl::kind_id{"kind_test_runtime"});
+    ASSERT_EQ(squedl::kind_id::of<runtime_kind>().name(), runtime_kind::kind());
+}
+
+TEST(kind_id, concurrent_interning_agrees) {
+    const size_t NUM_THREADS{8};
+    const size_t NUM_KINDS{200};
+
+    std::vector<std::vector<squedl::kind_id>> seen(NUM_THREADS);
+    std::vector<std::thread> threads;
+    for (size_t t{}; t < NUM_THREADS; ++t)
+        threads.emplace_back([&seen, t] {
+            for (size_t i{}; i < NUM_KINDS; ++i)
+                seen[t].emplace_back("kind_test_concurrent_" + std::to_string(i));
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    for (size_t t{1}; t < NUM_THREADS; ++t)
+        ASSERT_EQ(seen[t], seen[0]);
+    for (size_t i{1}; i < NUM_KINDS; ++i)
+        ASSERT_NE(seen[0][i], seen[0][i - 1]);
+}
@@ -0,0 +1,176 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "squedl/metrics.hpp"
+#include "squedl/squedl.hpp"
+
+namespace {
+using namespace std::chrono_literals;
+
+struct metered_task {
+    struct args {
+        std::int64_t value{};
+    };
+
+    static std::string kind() { return "metrics_test_task"; }
+
+    static void serialize(const args& arg, squedl::bytes& out) {
+        const auto* data{reinterpret_cast<const std::byte*>(&arg.value)};
+        out.assign(data, data + sizeof(arg.value));
+    }
+
+    static args deserialize(squedl::byte_view data) {
+        args args{};
+        if (data.size() >= sizeof(args.value))
+            std::memcpy(&args.value, data.data(), sizeof(args.value));
+        return args;
+    }
+
+    std::optional<squedl::error> operator()(args /*args*/) {
+        std::this_thread::sleep_for(1ms);
+        return std::nullopt;
+    }
+};
+} // namespace
+
+TEST(histogram, buckets_bound_relative_error) {
+    for (std::uint64_t value : {std::uint64_t{0}, std::uint64_t{15}, std::uint64_t{16},
+                                std::uint64_t{1000}, std::uint64_t{123456789},
+                                std::uint64_t{1} << 40, ~std::uint64_t{0}}) {
+        auto bucket{squedl::histogram::bucket_of(value)};
+        ASSERT_LT(bucket, squedl::histogram::bucket_count);
+        auto lower{squedl::histogram::lower_bound(bucket)};
+        auto upper{squedl::histogram::upper_bound(bucket)};
+        ASSERT_LE(lower, value);
+        ASSERT_GE(upper, value);
+        ASSERT_LE(upper - lower, value / squedl::histogram::sub_buckets);
+    }
+
+    squedl::histogram latencies;
+    for (std::uint64_t i{1}; i <= 1000; ++i)
+        latencies.record(std::chrono::microseconds{i});
+
+    auto snapshot{latencies.snapshot()};
+    ASSERT_EQ(snapshot.count, 1000);
+    EXPECT_NEAR(snapshot.mean(), 500500.0, 1.0);
+    EXPECT_NEAR(static_cast<double>(snapshot.quantile(0.5)), 500000.0, 500000.0 / 16);
+    EXPECT_NEAR(static_cast<double>(snapshot.quantile(0.99)), 990000.0, 990000.0 / 16);
+    EXPECT_GE(snapshot.quantile(1.0), 1000000);
+}
+
+TEST(metrics, test_bus_counts_message_lifecycle) {
+    const std::string kind{"metrics_test_kind"};
+    const auto ack_timeout{50ms};
+
+    squedl::test_bus<> bus{ack_timeout};
+    for (int i{}; i < 8; ++i)
+        ASSERT_TRUE(bus.put(kind, std::vector{std::byte{1}}).has_value());
+    ASSERT_TRUE(bus.put(kind, std::vector{std::byte{2}}, 1min).has_value());
+
+    auto batch{bus.next(kind, 6)};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), 6);
+    bus.ack(kind, batch.value()[0].handle);
+    bus.ack_many(kind, std::vector{batch.value()[1].handle, batch.value()[2].handle});
+    bus.nack(kind, batch.value()[3].handle);
+    // stale by now, so not counted again
+    bus.ack(kind, batch.value()[0].handle);
+
+    auto stats{bus.metrics(kind)};
+    EXPECT_EQ(stats.kind, kind);
+    EXPECT_EQ(stats.counters.put, 9);
+    EXPECT_EQ(stats.counters.delivered, 6);
+    EXPECT_EQ(stats.counters.acked, 3);
+    EXPECT_EQ(stats.counters.nacked, 1);
+    EXPECT_EQ(stats.counters.redelivered, 0);
+    EXPECT_EQ(stats.enqueued, bus.enqueued_size(kind));
+    EXPECT_EQ(stats.delayed, bus.delayed_size(kind));
+    EXPECT_EQ(stats.unacked, bus.unacked_size(kind));
+    EXPECT_EQ(stats.wait.count, 6);
+
+    // the two left unacked time out and come back
+    auto deadline{std::chrono::steady_clock::now() + 5s};
+    while (bus.metrics(kind).counters.redelivered != 2 &&
+           std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(5ms);
+    stats = bus.metrics(kind);
+    EXPECT_EQ(stats.counters.redelivered, 2);
+    EXPECT_EQ(stats.unacked, 0);
+    EXPECT_EQ(stats.enqueued, 5);
+
+    auto all{bus.metrics()};
+    ASSERT_EQ(all.size(), 1);
+    auto text{squedl::to_prometheus(all)};
+    EXPECT_NE(text.find("# TYPE squedl_messages_put_total counter\n"), std::string::npos);
+    EXPECT_NE(text.find("squedl_messages_put_total{kind=\"metrics_test_kind\"} 9\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("squedl_messages_delayed{kind=\"metrics_test_kind\"} 1\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("squedl_message_wait_seconds_bucket{kind=\"metrics_test_kind\","
+                        "le=\"+Inf\"} 6\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("squedl_message_wait_seconds_count{kind=\"metrics_test_kind\"} 6\n"),
+              std::string::npos);
+
+    bus.stop();
+}
+
+TEST(metrics, prints_large_counts_exactly) {
+    squedl::kind_stats stats{};
+    stats.kind = "big";
+    stats.counters.put = 12345678901234567ULL;
+    stats.wait.counts.assign(squedl::histogram::bucket_count, 0);
+    stats.wait.counts[0] = 9876543210123ULL;
+    stats.wait.count = 9876543210123ULL;
+    stats.wait.sum = 1500000000;
+
+    auto text{squedl::to_prometheus(std::vector{stats})};
+    EXPECT_NE(text.find("squedl_messages_put_total{kind=\"big\"} 12345678901234567\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("squedl_message_wait_seconds_bucket{kind=\"big\",le=\"1.024e-06\"} "
+                        "9876543210123\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("squedl_message_wait_seconds_count{kind=\"big\"} 9876543210123\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("squedl_message_wait_seconds_sum{kind=\"big\"} 1.5\n"),
+              std::string::npos);
+}
+
+TEST(metrics, worker_pool_times_jobs) {
+    const int total{40};
+
+    squedl::test_bus<> bus{};
+    squedl::scheduler scheduler{bus};
+    squedl::worker_pool pool{bus, 8, 1ms, 2};
+    for (int i{1}; i <= total; ++i)
+        scheduler.schedule<metered_task>(metered_task::args{i});
+    pool.work_on(metered_task{}, 4);
+
+    auto deadline{std::chrono::steady_clock::now() + 10s};
+    while (!bus.empty() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(5ms);
+    ASSERT_TRUE(bus.empty());
+
+    auto stats{pool.metrics()};
+    ASSERT_EQ(stats.size(), 1);
+    EXPECT_EQ(stats[0].kind, metered_task::kind());
+    EXPECT_EQ(stats[0].succeeded, total);
+    EXPECT_EQ(stats[0].failed, 0);
+    EXPECT_EQ(stats[0].execution.count, total);
+    EXPECT_GE(stats[0].execution.quantile(0.5), 1000000);
+
+    auto text{squedl::to_prometheus(stats)};
+    EXPECT_NE(text.find("squedl_jobs_succeeded_total{kind=\"metrics_test_task\"} 40\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("# TYPE squedl_job_duration_seconds histogram\n"), std::string::npos);
+
+    pool.stop();
+    bus.stop();
+}
@@ -0,0 +1,69 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "squedl/detail/mpmc_queue.hpp"
+
+TEST(mpmc_queue, bounded_fifo) {
+    squedl::detail::mpmc_queue<int> queue{3};
+    ASSERT_EQ(queue.capacity(), 4);
+
+    for (int i{}; i < 4; ++i)
+        ASSERT_TRUE(queue.try_push(int{i}));
+
+    int rejected{42};
+    ASSERT_FALSE(queue.try_push(std::move(rejected)));
+    ASSERT_EQ(rejected, 42);
+    ASSERT_EQ(queue.size(), 4);
+
+    int value{};
+    for (int i{}; i < 4; ++i) {
+        ASSERT_TRUE(queue.try_pop(value));
+        ASSERT_EQ(value, i);
+    }
+    ASSERT_FALSE(queue.try_pop(value));
+    ASSERT_TRUE(queue.empty());
+}
+
+TEST(mpmc_queue, concurrent_producers_and_consumers) {
+    const size_t producers{4};
+    const size_t consumers{4};
+    const std::uint64_t per_producer{20000};
+
+    squedl::detail::mpmc_queue<std::uint64_t> queue{64};
+    std::atomic<std::uint64_t> popped{};
+    std::atomic<std::uint64_t> sum{};
+
+    std::vector<std::thread> threads;
+    for (size_t p{}; p < producers; ++p)
+        threads.emplace_back([&queue] {
+            for (std::uint64_t i{1}; i <= per_producer; ++i) {
+                auto value{i};
+                while (!queue.try_push(std::move(value)))
+                    std::this_thread::yield();
+            }
+        });
+
+    for (size_t c{}; c < consumers; ++c)
+        threads.emplace_back([&queue, &popped, &sum] {
+            std::uint64_t value{};
+            while (popped < producers * per_producer) {
+                if (!queue.try_pop(value)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                sum += value;
+                ++popped;
+            }
+        });
+
+    for (auto& thread : threads)
+        thread.join();
+
+    ASSERT_EQ(popped, producers * per_producer);
+    ASSERT_EQ(sum, producers * per_producer * (per_producer + 1) / 2);
+}
@@ -0,0 +1,258 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstddef>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "squedl/detail/net_wire.hpp"
+#include "squedl/net_bus.hpp"
+#include "squedl/net_server.hpp"
+
+namespace {
+std::atomic<int64_t> net_sum{0};
+
+class net_sum_task {
+public:
+    struct args {
+        int64_t value{};
+    };
+
+    static std::string kind() { return "net_sum_task"; }
+
+    static std::vector<std::byte> serialize(const args& arg) {
+        const auto* bytes{reinterpret_cast<const std::byte*>(&arg.value)};
+        return {bytes, bytes + sizeof(arg.value)};
+    }
+
+    static args deserialize(const std::vector<std::byte>& data) {
+        args args{};
+        if (data.size() >= sizeof(int64_t))
+            std::memcpy(&args.value, data.data(), sizeof(int64_t));
+        return args;
+    }
+
+    std::optional<squedl::error> operator()(args args) {
+        net_sum += args.value;
+        return std::nullopt;
+    }
+};
+// Sends request to the server on port and returns the first frame of the response.
+squedl::bytes exchange(std::uint16_t port, const squedl::bytes& request) {
+    auto fd{::socket(AF_INET, SOCK_STREAM, 0)};
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    squedl::bytes result{};
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::send(fd, request.data(), request.size(), 0) != static_cast<ssize_t>(request.size())) {
+        ::close(fd);
+        return result;
+    }
+
+    std::array<std::byte, 256> chunk{};
+    std::uint32_t size{};
+    while (result.size() < sizeof(size) || result.size() < sizeof(size) + size) {
+        auto received{::recv(fd, chunk.data(), chunk.size(), 0)};
+        if (received <= 0)
+            break;
+        result.insert(result.end(), chunk.begin(), chunk.begin() + received);
+        if (result.size() >= sizeof(size))
+            std::memcpy(&size, result.data(), sizeof(size));
+    }
+    ::close(fd);
+    return result;
+}
+} // namespace
+
+TEST(net_bus, runs_tasks_over_loopback) {
+    using namespace std::chrono_literals;
+    const int64_t NUM_TASKS{2000};
+
+    net_sum = 0;
+    squedl::test_bus bus{1min};
+    squedl::net_server server{bus};
+
+    // Producer and workers on separate connections, like on separate hosts.
+    squedl::net_bus producer{"127.0.0.1", server.port()};
+    squedl::net_bus consumer{"127.0.0.1", server.port()};
+    squedl::scheduler scheduler{producer};
+    squedl::worker_pool pool{consumer, 8, 1ms, 4};
+    pool.work_on(net_sum_task{}, 4);
+
+    std::vector<net_sum_task::args> batch;
+    for (int64_t i{}; i < NUM_TASKS / 2; ++i)
+        batch.push_back(net_sum_task::args{i});
+    ASSERT_EQ(scheduler.schedule_many<net_sum_task>(batch).size(), batch.size());
+    for (int64_t i{NUM_TASKS / 2}; i < NUM_TASKS; ++i)
+        scheduler.schedule<net_sum_task>(net_sum_task::args{i}, 50ms);
+
+    const int64_t expected{NUM_TASKS * (NUM_TASKS - 1) / 2};
+    auto deadline{std::chrono::steady_clock::now() + 10s};
+    while ((!bus.empty() || net_sum != expected) && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(10ms);
+
+    EXPECT_TRUE(producer.empty());
+    EXPECT_EQ(net_sum, expected);
+    pool.stop();
+    server.stop();
+    bus.stop();
+}
+
+TEST(net_bus, settles_times_out_and_interrupts) {
+    using namespace std::chrono_literals;
+    const std::string kind{"net_kind"};
+
+    squedl::test_bus bus{100ms};
+    squedl::net_server server{bus};
+    squedl::net_bus client{"127.0.0.1", server.port()};
+
+    const squedl::bytes big(1000, std::byte{7});
+    const squedl::bytes small(8, std::byte{1});
+    auto ids{client.put_many(kind, std::vector<squedl::bytes>{big, small})};
+    ASSERT_TRUE(ids.has_value());
+    ASSERT_EQ(ids.value().size(), 2);
+    EXPECT_EQ(ids.value()[1], ids.value()[0] + 1);
+    EXPECT_EQ(client.enqueued_size(kind), 2);
+    EXPECT_FALSE(client.put_many(kind, squedl::byte_view{big}, {600, 500}).has_value());
+    EXPECT_FALSE(client.put_many(kind, squedl::byte_view{big}, {500, 1001}).has_value());
+
+    auto batch{client.next(kind, 10)};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), 2);
+    EXPECT_EQ(batch.value()[0].payload.to_bytes(), big);
+    EXPECT_EQ(batch.value()[1].payload.to_bytes(), small);
+    EXPECT_EQ(client.unacked_size(kind), 2);
+
+    // One acked, one nacked and taken again, then left to time out on the server.
+    EXPECT_TRUE(client.ack(kind, batch.value()[0].handle));
+    EXPECT_FALSE(client.ack(kind, batch.value()[0].handle));
+    client.nack(kind, batch.value()[1].handle);
+    batch = client.next(kind, 10, 1s);
+    ASSERT_EQ(batch.value().size(), 1);
+    EXPECT_EQ(batch.value()[0].id, ids.value()[1]);
+    batch = client.next(kind, 10, 1s);
+    ASSERT_EQ(batch.value().size(), 1);
+    client.ack_many(kind, std::vector{batch.value()[0].handle});
+
+    auto started{std::chrono::steady_clock::now()};
+    EXPECT_TRUE(client.next(kind, 1, 50ms).value().empty());
+    EXPECT_GE(std::chrono::steady_clock::now() - started, 50ms);
+    EXPECT_TRUE(client.empty());
+
+    auto blocked{std::async(std::launch::async, [&] { return client.next(kind, 1); })};
+    std::this_thread::sleep_for(20ms);
+    client.interrupt(kind);
+    ASSERT_EQ(blocked.wait_for(1s), std::future_status::ready);
+    EXPECT_TRUE(blocked.get().value().empty());
+
+    // A message put after the interrupt goes to the next taker, not the abandoned receiver.
+    ASSERT_TRUE(client.put(kind, squedl::byte_view{small}).has_value());
+    batch = client.next(kind, 1, 1s);
+    ASSERT_EQ(batch.value().size(), 1);
+
+    client.stop();
+    EXPECT_FALSE(client.next(kind, 1).has_value());
+    EXPECT_FALSE(client.put(kind, squedl::byte_view{small}).has_value());
+    server.stop();
+    bus.stop();
+}
+
+TEST(net_bus, refuses_puts_too_large_for_a_frame) {
+    using namespace std::chrono_literals;
+    const std::string kind{"net_kind"};
+
+    squedl::test_bus bus{1min};
+    squedl::net_server server{bus};
+    squedl::net_bus client{"127.0.0.1", server.port()};
+
+    // The body alone fits, the frame around it does not.
+    const squedl::bytes huge(squedl::detail::net_max_frame, std::byte{7});
+    EXPECT_FALSE(client.put(kind, squedl::byte_view{huge}).has_value());
+    const std::vector halves{squedl::byte_view{huge.data(), huge.size() / 2 + 1},
+                             squedl::byte_view{huge.data(), huge.size() / 2}};
+    EXPECT_FALSE(client.put_many(kind, halves).has_value());
+
+    // The connection is still up.
+    const squedl::bytes small(8, std::byte{1});
+    ASSERT_TRUE(client.put(kind, squedl::byte_view{small}).has_value());
+    EXPECT_EQ(client.enqueued_size(kind), 1);
+
+    client.stop();
+    server.stop();
+    bus.stop();
+}
+
+TEST(net_bus, refuses_unknown_kinds) {
+    const std::string known{"net_known_kind"};
+    const std::string unknown{"net_unknown_kind"};
+    const squedl::bytes body(8, std::byte{1});
+
+    squedl::test_bus bus{std::chrono::minutes{1}};
+    squedl::kind_id{known};
+    squedl::net_server server{bus, "127.0.0.1", 0, false};
+
+    // By hand, since a net_bus in this process would intern the kind itself.
+    squedl::bytes request{};
+    squedl::detail::frame_writer frame{
+        request, static_cast<std::uint8_t>(squedl::detail::net_op::put), 42};
+    frame.str(unknown).pod(std::int64_t{}).pod(std::uint8_t{1}).str({}).raw(body);
+    frame.finish();
+    auto response{exchange(server.port(), request)};
+    ASSERT_EQ(response.size(), squedl::detail::net_header_size);
+    EXPECT_EQ(static_cast<squedl::detail::net_status>(response[sizeof(std::uint32_t)]),
+              squedl::detail::net_status::refused);
+    EXPECT_FALSE(squedl::kind_id::find(unknown).has_value()) << "the server did not intern it";
+
+    squedl::net_bus client{"127.0.0.1", server.port()};
+    ASSERT_TRUE(client.put(known, squedl::byte_view{body}).has_value());
+    EXPECT_EQ(client.enqueued_size(known), 1);
+
+    client.stop();
+    server.stop();
+    bus.stop();
+}
+
+TEST(net_bus, leaves_fire_and_forget_requests_unanswered) {
+    const std::string kind{"net_unanswered_kind"};
+
+    squedl::test_bus bus{std::chrono::minutes{1}};
+    squedl::net_server server{bus};
+
+    // A nack and a malformed ack, both fire and forget, then an empty that wants its answer.
+    squedl::bytes request{};
+    const auto unanswered{squedl::detail::net_unanswered_tag};
+    squedl::detail::frame_writer nack{
+        request, static_cast<std::uint8_t>(squedl::detail::net_op::nack), unanswered};
+    nack.str(kind).pod(std::uint32_t{1}).pod(std::uint32_t{}).pod(std::uint32_t{});
+    nack.finish();
+    squedl::detail::frame_writer ack{
+        request, static_cast<std::uint8_t>(squedl::detail::net_op::ack), unanswered};
+    ack.str(kind).pod(std::uint32_t{3});
+    ack.finish();
+    squedl::detail::frame_writer{request, static_cast<std::uint8_t>(squedl::detail::net_op::empty),
+                                 7}
+        .finish();
+
+    auto response{exchange(server.port(), request)};
+    ASSERT_GE(response.size(), squedl::detail::net_header_size);
+    std::uint64_t tag{};
+    std::memcpy(&tag, response.data() + sizeof(std::uint32_t) + sizeof(std::uint8_t), sizeof(tag));
+    EXPECT_EQ(tag, 7);
+    EXPECT_EQ(static_cast<squedl::detail::net_status>(response[sizeof(std::uint32_t)]),
+              squedl::detail::net_status::ok);
+
+    server.stop();
+    bus.stop();
+}
@@ -0,0 +1,91 @@
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "squedl/payload.hpp"
+
+namespace {
+squedl::bytes make_bytes(size_t size) {
+    squedl::bytes result(size);
+    for (size_t i{}; i < size; ++i)
+        result[i] = static_cast<std::byte>(i % 251);
+    return result;
+}
+} // namespace
+
+TEST(payload, keeps_bytes_inline_and_shared) {
+    for (size_t size : {size_t{0}, size_t{1}, squedl::payload::inline_capacity,
+                        squedl::payload::inline_capacity + 1, size_t{4096}, size_t{1} << 20}) {
+        auto source{make_bytes(size)};
+        squedl::payload original{source};
+        ASSERT_EQ(original.size(), size);
+        ASSERT_EQ(original.to_bytes(), source);
+
+        auto copy{original};
+        ASSERT_EQ(copy.to_bytes(), source);
+        if (size > squedl::payload::inline_capacity) {
+            ASSERT_EQ(copy.data(), original.data()) << "copies of large payloads share bytes";
+        }
+
+        auto moved{std::move(original)};
+        ASSERT_TRUE(original.empty());
+        ASSERT_EQ(moved.to_bytes(), source);
+
+        copy = moved;
+        moved = squedl::payload{};
+        ASSERT_EQ(copy.to_bytes(), source);
+    }
+}
+
+TEST(payload, reuses_released_blocks) {
+    auto source{make_bytes(1000)};
+    const std::byte* first{};
+    {
+        squedl::payload body{source};
+        first = body.data();
+    }
+
+    squedl::payload body{source};
+    ASSERT_EQ(body.data(), first);
+}
+
+TEST(payload, released_on_other_threads) {
+    const size_t total{10000};
+    auto source{make_bytes(300)};
+
+    std::vector<squedl::payload> bodies;
+    bodies.reserve(total);
+    for (size_t i{}; i < total; ++i)
+        bodies.emplace_back(source);
+
+    std::thread consumer{[bodies = std::move(bodies), &source]() mutable {
+        for (auto& body : bodies)
+            ASSERT_EQ(body.to_bytes(), source);
+        bodies.clear();
+    }};
+    consumer.join();
+
+    squedl::payload body{source};
+    ASSERT_EQ(body.to_bytes(), source);
+}
+
+TEST(payload, slices_share_the_block) {
+    auto source{make_bytes(4096)};
+    squedl::payload whole{source};
+
+    auto large{whole.slice(100, 1000)};
+    ASSERT_EQ(large.data(), whole.data() + 100);
+    ASSERT_EQ(large.to_bytes(), squedl::bytes(source.begin() + 100, source.begin() + 1100));
+
+    auto small{whole.slice(4000, squedl::payload::inline_capacity)};
+    ASSERT_NE(small.data(), whole.data() + 4000);
+    ASSERT_EQ(small.to_bytes(), squedl::bytes(source.begin() + 4000,
+                                              source.begin() + 4000 +
+                                                  squedl::payload::inline_capacity));
+
+    // slices keep the block alive on their own
+    whole = squedl::payload{};
+    ASSERT_EQ(large.to_bytes(), squedl::bytes(source.begin() + 100, source.begin() + 1100));
+}
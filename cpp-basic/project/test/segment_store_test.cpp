@@ -0,0 +1,85 @@
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "squedl/segment_store.hpp"
+#include "squedl/squedl.hpp"
+
+namespace {
+std::string store_directory() {
+    return (std::filesystem::temp_directory_path() /
+            ("squedl_segments_" + std::to_string(::getpid())))
+        .string();
+}
+
+squedl::bytes make_bytes(size_t size, size_t seed) {
+    squedl::bytes result(size);
+    for (size_t i{}; i < size; ++i)
+        result[i] = static_cast<std::byte>((i + seed) % 251);
+    return result;
+}
+} // namespace
+
+TEST(segment_store, maps_and_unmaps_segments) {
+    const size_t segment_size{4096};
+    const size_t total{64};
+
+    squedl::segment_store store{store_directory(), segment_size};
+    ASSERT_EQ(store.mapped_segments(), 0);
+
+    std::vector<squedl::payload> bodies;
+    for (size_t i{}; i < total; ++i)
+        bodies.push_back(store.write(make_bytes(500, i)));
+    bodies.push_back(store.write(make_bytes(3 * segment_size, total)));
+
+    for (size_t i{}; i < total; ++i)
+        ASSERT_EQ(bodies[i].to_bytes(), make_bytes(500, i));
+    ASSERT_EQ(bodies.back().to_bytes(), make_bytes(3 * segment_size, total));
+    ASSERT_EQ(bodies[1].data(), bodies[0].data() + 512) << "payloads are packed into a segment";
+    ASSERT_GT(store.mapped_segments(), 2);
+
+    auto small{store.write(make_bytes(8, 0))};
+    ASSERT_EQ(small.to_bytes(), make_bytes(8, 0)) << "small payloads stay inline";
+
+    bodies.clear();
+    ASSERT_EQ(store.mapped_segments(), 1) << "only the active segment is left";
+    ASSERT_TRUE(std::filesystem::is_empty(store_directory()));
+    std::filesystem::remove_all(store_directory());
+}
+
+TEST(segment_store, backs_test_bus_payloads) {
+    const std::string kind{"mapped_kind"};
+    const size_t total{200};
+
+    auto store{std::make_shared<squedl::segment_store>(store_directory(), 64 * 1024)};
+    {
+        squedl::test_bus<> bus{std::chrono::minutes{1}, false, std::chrono::milliseconds{1},
+                               squedl::test_bus<>::default_ready_capacity, store};
+        for (size_t i{}; i < total; ++i)
+            ASSERT_TRUE(bus.put(kind, make_bytes(1000, i)).has_value());
+        ASSERT_GT(store->mapped_segments(), 1);
+
+        auto batch{bus.next(kind, total)};
+        ASSERT_TRUE(batch.has_value());
+        ASSERT_EQ(batch.value().size(), total);
+        std::vector<squedl::test_bus<>::handle_t> handles;
+        for (size_t i{}; i < total; ++i) {
+            ASSERT_EQ(batch.value()[i].payload.to_bytes(), make_bytes(1000, i));
+            handles.push_back(batch.value()[i].handle);
+        }
+
+        bus.ack_many(kind, handles);
+        batch.reset();
+        bus.stop();
+    }
+
+    ASSERT_EQ(store->mapped_segments(), 1);
+    std::filesystem::remove_all(store_directory());
+}
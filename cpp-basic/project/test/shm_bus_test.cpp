@@ -0,0 +1,166 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "squedl/shm_bus.hpp"
+
+namespace {
+std::atomic<int64_t> shm_sum{0};
+
+std::string fresh_name(const std::string& name) {
+    auto result{"/squedl_" + name + "_" + std::to_string(::getpid())};
+    squedl::shm_bus::unlink(result);
+    return result;
+}
+
+class shm_sum_task {
+public:
+    struct args {
+        int64_t value{};
+    };
+
+    static std::string kind() { return "shm_sum_task"; }
+
+    static std::vector<std::byte> serialize(const args& arg) {
+        const auto* bytes{reinterpret_cast<const std::byte*>(&arg.value)};
+        return {bytes, bytes + sizeof(arg.value)};
+    }
+
+    static args deserialize(const std::vector<std::byte>& data) {
+        args args{};
+        if (data.size() >= sizeof(int64_t))
+            std::memcpy(&args.value, data.data(), sizeof(int64_t));
+        return args;
+    }
+
+    std::optional<squedl::error> operator()(args args) {
+        shm_sum += args.value;
+        return std::nullopt;
+    }
+};
+} // namespace
+
+TEST(shm_bus, delivers_across_processes) {
+    using namespace std::chrono_literals;
+    const int64_t NUM_TASKS{2000};
+    auto name{fresh_name("processes")};
+
+    shm_sum = 0;
+    // Created before forking, so both processes see the same segment.
+    squedl::shm_bus bus{name, size_t{8} << 20};
+
+    auto child{::fork()};
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        squedl::shm_bus producer{name};
+        squedl::scheduler scheduler{producer};
+
+        std::vector<shm_sum_task::args> batch;
+        for (int64_t i{}; i < NUM_TASKS / 2; ++i)
+            batch.push_back(shm_sum_task::args{i});
+        auto ok{scheduler.schedule_many<shm_sum_task>(batch).size() == batch.size()};
+        for (int64_t i{NUM_TASKS / 2}; i < NUM_TASKS; ++i) {
+            auto id{scheduler.try_schedule<shm_sum_task>(shm_sum_task::args{i}, 50ms)};
+            ok = ok && id.has_value();
+        }
+        ::_exit(ok ? 0 : 1);
+    }
+
+    squedl::worker_pool pool{bus, 8, 1ms, 4};
+    pool.work_on(shm_sum_task{}, 4);
+
+    int status{};
+    ASSERT_EQ(::waitpid(child, &status, 0), child);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    const int64_t expected{NUM_TASKS * (NUM_TASKS - 1) / 2};
+    auto deadline{std::chrono::steady_clock::now() + 10s};
+    while ((!bus.empty() || shm_sum != expected) && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(10ms);
+
+    EXPECT_TRUE(bus.empty());
+    EXPECT_EQ(shm_sum, expected);
+    pool.stop();
+    squedl::shm_bus::unlink(name);
+}
+
+TEST(shm_bus, acks_nacks_and_redelivers) {
+    using namespace std::chrono_literals;
+    const std::string kind{"shm_kind"};
+    auto name{fresh_name("settle")};
+
+    squedl::shm_bus bus{name, size_t{1} << 20, 100ms};
+    const squedl::bytes body(1000, std::byte{7});
+
+    ASSERT_FALSE(bus.put(kind, squedl::byte_view{body}, 0ms, squedl::priority::normal, "key")
+                     .has_value());
+    EXPECT_FALSE(
+        bus.put_many(kind, squedl::byte_view{body}, std::vector<size_t>{600, 500}).has_value());
+    EXPECT_FALSE(
+        bus.put_many(kind, squedl::byte_view{body}, std::vector<size_t>{500, 1001}).has_value());
+
+    auto id{bus.put(kind, squedl::byte_view{body})};
+    ASSERT_TRUE(id.has_value());
+    auto batch{bus.next(kind, 10)};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), 1);
+    auto first{batch.value().front()};
+    EXPECT_EQ(first.id, id.value());
+
+    // nacked right away, then left to time out
+    bus.nack(kind, first.handle);
+    EXPECT_FALSE(bus.ack(kind, first.handle));
+    batch = bus.next(kind, 10);
+    ASSERT_EQ(batch.value().size(), 1);
+    EXPECT_EQ(bus.unacked_size(kind), 1);
+    auto timed_out{batch.value().front().handle};
+    batch = bus.next(kind, 10, 1s);
+    ASSERT_EQ(batch.value().size(), 1);
+    EXPECT_EQ(batch.value().front().id, id.value());
+
+    // A late ack of the delivery that timed out does not settle the one after it.
+    EXPECT_FALSE(bus.ack(kind, timed_out));
+    bus.nack(kind, timed_out);
+    EXPECT_EQ(bus.unacked_size(kind), 1);
+    EXPECT_EQ(bus.enqueued_size(kind), 0);
+
+    // The payload points into the segment and keeps its message alive past the ack.
+    auto delivered{batch.value().front().payload};
+    EXPECT_TRUE(bus.ack(kind, batch.value().front().handle));
+    batch.reset();
+    first = {};
+    EXPECT_TRUE(bus.empty());
+    EXPECT_EQ(delivered.to_bytes(), body);
+
+    auto before{bus.available()};
+    ASSERT_TRUE(bus.put(kind, squedl::byte_view{body}).has_value());
+    EXPECT_LT(bus.available(), before);
+    delivered = {};
+    batch = bus.next(kind, 1);
+    ASSERT_TRUE(bus.ack(kind, batch.value().front().handle));
+    batch.reset();
+
+    // the two blocks are free now and get reused
+    before = bus.available();
+    ASSERT_TRUE(bus.put(kind, squedl::byte_view{body}, 50ms).has_value());
+    EXPECT_EQ(bus.available(), before);
+    EXPECT_EQ(bus.delayed_size(kind), 1);
+    EXPECT_TRUE(bus.next(kind, 1, 10ms).value().empty());
+    batch = bus.next(kind, 1, 1s);
+    ASSERT_EQ(batch.value().size(), 1);
+    EXPECT_EQ(batch.value().front().payload.to_bytes(), body);
+
+    bus.stop();
+    EXPECT_FALSE(bus.next(kind, 1).has_value());
+    squedl::shm_bus::unlink(name);
+}
@@ -0,0 +1,256 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "squedl/manual_clock.hpp"
+#include "squedl/simulation.hpp"
+#include "squedl/squedl.hpp"
+
+namespace {
+using namespace std::chrono_literals;
+using sim_clock = squedl::manual_clock;
+using bus_t = squedl::test_bus<sim_clock>;
+
+// Clock times at which sim_task ran, and the values it ran with.
+std::vector<std::pair<sim_clock::time_point, std::int64_t>> runs;
+// Values below this fail.
+std::int64_t failing_below{};
+
+class sim_task {
+public:
+    struct args {
+        std::int64_t value{};
+    };
+
+    static std::string kind() { return "sim_task"; }
+
+    static squedl::bytes serialize(const args& arg) {
+        const auto* data{reinterpret_cast<const std::byte*>(&arg.value)};
+        return {data, data + sizeof(arg.value)};
+    }
+
+    static args deserialize(squedl::byte_view data) {
+        args result{};
+        if (data.size() >= sizeof(result.value))
+            std::memcpy(&result.value, data.data(), sizeof(result.value));
+        return result;
+    }
+
+    std::optional<squedl::error> operator()(args arg) {
+        runs.emplace_back(sim_clock::now(), arg.value);
+        if (arg.value < failing_below)
+            return squedl::error{};
+        return std::nullopt;
+    }
+};
+} // namespace
+
+TEST(simulation, manual_clock_only_moves_forward) {
+    auto start{sim_clock::now()};
+    sim_clock::advance(1h);
+    EXPECT_EQ(sim_clock::now(), start + 1h);
+    sim_clock::advance_to(start);
+    sim_clock::advance(-1s);
+    EXPECT_EQ(sim_clock::now(), start + 1h);
+    sim_clock::advance_to(start + 2h);
+    EXPECT_EQ(sim_clock::now(), start + 2h);
+    static_assert(squedl::is_manual_clock_v<sim_clock>);
+    static_assert(!squedl::is_manual_clock_v<std::chrono::steady_clock>);
+}
+
+TEST(simulation, runs_delayed_tasks_at_their_due_times) {
+    runs.clear();
+    failing_below = 0;
+    bus_t bus{1min};
+    squedl::scheduler scheduler{bus};
+    squedl::simulation sim{bus};
+    sim.work_on(sim_task{});
+
+    auto start{sim_clock::now()};
+    scheduler.schedule<sim_task>(sim_task::args{3}, 2h);
+    scheduler.schedule<sim_task>(sim_task::args{2}, 90min);
+    scheduler.schedule<sim_task>(sim_task::args{1});
+
+    EXPECT_EQ(sim.run_until(start + 100min), 2);
+    EXPECT_EQ(sim_clock::now(), start + 100min);
+    EXPECT_EQ(bus.delayed_size("sim_task"), 1);
+
+    EXPECT_EQ(sim.run(), 1);
+    ASSERT_EQ(runs.size(), 3);
+    EXPECT_EQ(runs[0], std::make_pair(start, std::int64_t{1}));
+    EXPECT_EQ(runs[1], std::make_pair(start + 90min, std::int64_t{2}));
+    EXPECT_EQ(runs[2], std::make_pair(start + 2h, std::int64_t{3}));
+    EXPECT_TRUE(bus.empty());
+    bus.stop();
+}
+
+TEST(simulation, times_out_and_retries_on_the_manual_clock) {
+    runs.clear();
+    failing_below = 1;
+    bus_t bus{1min};
+    const squedl::kind_id kind{"sim_task"};
+    const squedl::bytes body(8, std::byte{});
+
+    // Taken and never settled: back exactly one ack timeout later.
+    ASSERT_TRUE(bus.put(kind, squedl::byte_view{body}).has_value());
+    ASSERT_EQ(bus.try_next(kind, 10).value().size(), 1);
+    EXPECT_TRUE(bus.try_next(kind, 10).value().empty());
+    auto start{sim_clock::now()};
+    sim_clock::advance(59s);
+    EXPECT_EQ(bus.run_due(), 0);
+    EXPECT_EQ(bus.next_due(), start + 1min);
+    sim_clock::advance(1s);
+    EXPECT_EQ(bus.run_due(), 1);
+    auto batch{bus.try_next(kind, 10)};
+    ASSERT_EQ(batch.value().size(), 1);
+    bus.ack(kind, batch.value()[0].handle);
+
+    // Failing every time: retried after 1s, then 2s, then dead-lettered.
+    bus_t::retry_policy policy{};
+    policy.max_attempts = 3;
+    policy.initial_backoff = 1s;
+    policy.dead_letter = squedl::kind_id{"sim_dead"};
+    bus.set_retry_policy(kind, policy);
+
+    squedl::simulation sim{bus};
+    sim.work_on(sim_task{});
+    start = sim_clock::now();
+    ASSERT_TRUE(bus.put(kind, squedl::byte_view{body}).has_value());
+    EXPECT_EQ(sim.run(), 3);
+    ASSERT_EQ(runs.size(), 3);
+    EXPECT_EQ(runs[0].first, start);
+    EXPECT_EQ(runs[1].first, start + 1s);
+    EXPECT_EQ(runs[2].first, start + 3s);
+    EXPECT_EQ(bus.enqueued_size("sim_dead"), 1);
+    bus.stop();
+}
+
+TEST(simulation, runs_many_delayed_tasks_in_due_order) {
+    const std::int64_t NUM_TASKS{100000};
+    runs.clear();
+    runs.reserve(NUM_TASKS);
+    failing_below = 0;
+    bus_t bus{1min};
+    squedl::scheduler scheduler{bus};
+    squedl::simulation sim{bus};
+    sim.work_on(sim_task{});
+
+    // Spread over a day; every task carries its own due time.
+    auto start{sim_clock::now()};
+    std::minstd_rand rng{7};
+    std::uniform_int_distribution<std::int64_t> delay{0, std::chrono::nanoseconds{24h}.count()};
+    for (std::int64_t i{}; i < NUM_TASKS; ++i) {
+        auto after{std::chrono::nanoseconds{delay(rng)}};
+        scheduler.schedule<sim_task>(sim_task::args{(start + after).time_since_epoch().count()},
+                                     after);
+    }
+
+    EXPECT_EQ(sim.run(), NUM_TASKS);
+    ASSERT_EQ(runs.size(), NUM_TASKS);
+    for (size_t i{}; i < runs.size(); ++i) {
+        EXPECT_EQ(runs[i].first.time_since_epoch().count(), runs[i].second);
+        if (i != 0) {
+            EXPECT_LE(runs[i - 1].first, runs[i].first);
+        }
+    }
+    bus.stop();
+}
+
+TEST(simulation, ticks_recurring_schedules) {
+    runs.clear();
+    failing_below = 0;
+    bus_t bus{1min};
+    squedl::scheduler scheduler{bus};
+    squedl::simulation sim{bus};
+    sim.work_on(sim_task{});
+    sim.drive(scheduler);
+    using recurrence = squedl::scheduler<bus_t>::recurrence;
+
+    auto start{sim_clock::now()};
+    auto rate{
+        scheduler.schedule_recurring<sim_task>(sim_task::args{1}, recurrence::fixed_rate(10s))};
+    scheduler.schedule_recurring<sim_task>(sim_task::args{2},
+                                           recurrence::fixed_delay(25s, 5s));
+    EXPECT_EQ(sim.run_until(start + 1min), 7 + 3);
+    EXPECT_TRUE(scheduler.cancel(rate));
+    EXPECT_FALSE(scheduler.cancel(rate));
+
+    std::vector<sim_clock::time_point> delays;
+    for (const auto& [at, value] : runs)
+        if (value == 2)
+            delays.push_back(at);
+    EXPECT_EQ(delays, (std::vector{start + 5s, start + 30s, start + 55s}));
+
+    runs.clear();
+    EXPECT_EQ(sim.run_until(start + 2min), 2);
+    scheduler.stop();
+    EXPECT_EQ(scheduler.next_due(), std::nullopt);
+    bus.stop();
+}
+
+TEST(simulation, catches_up_or_skips_missed_ticks) {
+    bus_t bus{1min};
+    squedl::scheduler scheduler{bus};
+    using recurrence = squedl::scheduler<bus_t>::recurrence;
+    const squedl::kind_id kind{"sim_task"};
+
+    // Nothing runs the schedules while the clock jumps five and a half ticks ahead.
+    auto start{sim_clock::now()};
+    scheduler.schedule_recurring<sim_task>(
+        sim_task::args{}, recurrence::fixed_rate(1min, 1min, squedl::missed_ticks::catch_up));
+    scheduler.schedule_recurring<sim_task>(
+        sim_task::args{}, recurrence::fixed_rate(1min, 1min, squedl::missed_ticks::skip));
+    sim_clock::advance(5min + 30s);
+    EXPECT_EQ(scheduler.run_due(), 5 + 1);
+    EXPECT_EQ(scheduler.next_due(), start + 6min);
+    EXPECT_EQ(scheduler.run_due(), 0);
+    scheduler.stop();
+    bus.try_next(kind, 100);
+
+    // Every five minutes of wall time, which the manual clock is tied to when other is made.
+    auto cron{squedl::cron_schedule::parse("*/5 * * * *").value()};
+    squedl::scheduler other{bus};
+    other.schedule_recurring<sim_task>(sim_task::args{},
+                                       recurrence::cron(cron, squedl::missed_ticks::catch_up));
+    other.schedule_recurring<sim_task>(sim_task::args{},
+                                       recurrence::cron(cron, squedl::missed_ticks::skip));
+    auto next{other.next_due().value()};
+    EXPECT_GT(next, sim_clock::now());
+    EXPECT_LE(next, sim_clock::now() + 5min);
+    sim_clock::advance_to(next + 12min);
+    EXPECT_EQ(other.run_due(), 3 + 1);
+    EXPECT_EQ(other.next_due(), next + 15min);
+    EXPECT_EQ(bus.enqueued_size(kind), 4);
+    bus.stop();
+}
+
+TEST(simulation, caps_how_many_missed_ticks_are_caught_up) {
+    bus_t bus{1min};
+    squedl::scheduler scheduler{bus};
+    using recurrence = squedl::scheduler<bus_t>::recurrence;
+    const squedl::kind_id kind{"sim_task"};
+
+    // A year behind, both schedules put only up to their caps and go on from now.
+    auto start{sim_clock::now()};
+    auto cron{squedl::cron_schedule::parse("* * * * *").value()};
+    scheduler.schedule_recurring<sim_task>(
+        sim_task::args{}, recurrence::fixed_rate(1min, 1min, squedl::missed_ticks::catch_up, 3));
+    scheduler.schedule_recurring<sim_task>(
+        sim_task::args{}, recurrence::cron(cron, squedl::missed_ticks::catch_up));
+    sim_clock::advance_to(start + 24h * 365 + 30s);
+    EXPECT_EQ(scheduler.run_due(), 3 + recurrence::default_max_catch_up);
+    EXPECT_EQ(bus.enqueued_size(kind), 3 + recurrence::default_max_catch_up);
+    auto next{scheduler.next_due().value()};
+    EXPECT_GT(next, sim_clock::now());
+    EXPECT_LE(next, sim_clock::now() + 1min);
+    EXPECT_EQ(scheduler.run_due(), 0);
+    scheduler.stop();
+    bus.stop();
+}
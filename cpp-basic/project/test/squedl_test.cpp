@@ -2,6 +2,8 @@
 
 #include <atomic>
 #include <chrono>
+#include <cstring>
+#include <mutex>
 #include <gtest/gtest.h>
 #include <random>
 
@@ -106,3 +108,357 @@ TEST(squedl, e2e_task_processing) {
     pool.stop();
     bus.stop();
 }
+
+namespace {
+std::atomic<int> capped_running{0};
+std::atomic<int> capped_max_running{0};
+std::atomic<int> capped_done{0};
+
+class capped_task : public single_serializable_value_task {
+public:
+    static std::string kind() { return "capped_task"; }
+
+    std::optional<squedl::error> operator()(args /*args*/) {
+        auto running{++capped_running};
+        auto seen{capped_max_running.load()};
+        while (running > seen && !capped_max_running.compare_exchange_weak(seen, running)) {
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds{2});
+        --capped_running;
+        ++capped_done;
+
+        return std::nullopt;
+    }
+};
+} // namespace
+
+TEST(squedl, worker_pool_shares_threads_and_caps_kinds) {
+    using namespace std::chrono_literals;
+    const int NUM_TASKS{60};
+    const size_t CAP{2};
+
+    sum_result = 0;
+    capped_done = 0;
+    capped_max_running = 0;
+
+    squedl::test_bus bus{1min};
+    squedl::scheduler scheduler{bus};
+    squedl::worker_pool pool{bus, 8, 1ms, 8};
+
+    int64_t expected_sum{};
+    for (int i{}; i < NUM_TASKS; ++i) {
+        scheduler.schedule<capped_task>(capped_task::args{i});
+        scheduler.schedule<sum_task>(sum_task::args{i});
+        expected_sum += i;
+    }
+
+    pool.work_on(capped_task{}, CAP);
+    pool.work_on(sum_task{}, 4, 2);
+
+    auto deadline{std::chrono::steady_clock::now() + 10s};
+    while (!bus.empty() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(10ms);
+
+    EXPECT_TRUE(bus.empty());
+    EXPECT_EQ(capped_done, NUM_TASKS);
+    EXPECT_EQ(sum_result, expected_sum);
+    EXPECT_LE(capped_max_running, static_cast<int>(CAP));
+    pool.stop();
+    bus.stop();
+}
+
+namespace {
+std::atomic<int64_t> view_result{0};
+
+// Serializes into the scheduler's reusable buffer and reads the payload in place.
+class view_task {
+public:
+    struct args {
+        int64_t value{};
+    };
+
+    static std::string kind() { return "view_task"; }
+
+    static void serialize(const args& arg, squedl::bytes& out) {
+        const auto* bytes{reinterpret_cast<const std::byte*>(&arg.value)};
+        out.insert(out.end(), bytes, bytes + sizeof(arg.value));
+    }
+
+    static args deserialize(squedl::byte_view data) {
+        args args{};
+        if (data.size() >= sizeof(int64_t))
+            std::memcpy(&args.value, data.data(), sizeof(int64_t));
+        return args;
+    }
+
+    std::optional<squedl::error> operator()(args args) {
+        view_result += args.value;
+
+        return std::nullopt;
+    }
+};
+} // namespace
+
+TEST(squedl, buffer_serialized_view_deserialized_tasks) {
+    using namespace std::chrono_literals;
+    const int NUM_TASKS{100};
+
+    static_assert(squedl::is_serializable_v<view_task> && squedl::is_workable_v<view_task>);
+
+    view_result = 0;
+
+    squedl::test_bus bus{1min};
+    squedl::scheduler scheduler{bus};
+    squedl::worker_pool pool{bus, 8, 1ms, 4};
+
+    int64_t expected{};
+    for (int i{}; i < NUM_TASKS; ++i) {
+        scheduler.schedule<view_task>(view_task::args{i});
+        expected += i;
+    }
+
+    pool.work_on(view_task{}, 4);
+
+    auto deadline{std::chrono::steady_clock::now() + 10s};
+    while (!bus.empty() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(10ms);
+
+    EXPECT_TRUE(bus.empty());
+    EXPECT_EQ(view_result, expected);
+    pool.stop();
+    bus.stop();
+}
+
+namespace {
+std::mutex callback_mtx;
+std::vector<std::pair<int64_t, squedl::completion>> callback_started;
+
+// Finishes later, from whoever calls the completion.
+class callback_task : public single_serializable_value_task {
+public:
+    static std::string kind() { return "callback_task"; }
+
+    void operator()(args args, squedl::completion done) {
+        std::lock_guard<std::mutex> _{callback_mtx};
+        callback_started.emplace_back(args.value, std::move(done));
+    }
+};
+} // namespace
+
+TEST(squedl, worker_pool_runs_callback_tasks_beyond_its_threads) {
+    using namespace std::chrono_literals;
+    const size_t NUM_TASKS{200};
+
+    static_assert(squedl::is_workable_v<callback_task>);
+
+    squedl::test_bus bus{1min};
+    squedl::scheduler scheduler{bus};
+    squedl::worker_pool pool{bus, 8, 1ms, 2};
+
+    for (size_t i{}; i < NUM_TASKS; ++i)
+        scheduler.schedule<callback_task>(callback_task::args{static_cast<int64_t>(i)});
+    pool.work_on(callback_task{}, NUM_TASKS);
+
+    // every job is in flight at once on two threads
+    auto started{[] {
+        std::lock_guard<std::mutex> _{callback_mtx};
+        return callback_started.size();
+    }};
+    auto deadline{std::chrono::steady_clock::now() + 10s};
+    while (started() != NUM_TASKS && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(1ms);
+    ASSERT_EQ(started(), NUM_TASKS);
+
+    // odd ones fail once and come back
+    std::vector<std::pair<int64_t, squedl::completion>> finishing;
+    {
+        std::lock_guard<std::mutex> _{callback_mtx};
+        finishing.swap(callback_started);
+    }
+    for (auto& [value, done] : finishing)
+        done(value % 2 == 0 ? std::nullopt : std::optional{squedl::error{}});
+
+    deadline = std::chrono::steady_clock::now() + 10s;
+    while (started() != NUM_TASKS / 2 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(1ms);
+    ASSERT_EQ(started(), NUM_TASKS / 2);
+    {
+        std::lock_guard<std::mutex> _{callback_mtx};
+        finishing.swap(callback_started);
+    }
+    for (auto& [value, done] : finishing) {
+        EXPECT_EQ(value % 2, 1);
+        done(std::nullopt);
+    }
+
+    deadline = std::chrono::steady_clock::now() + 10s;
+    while (!bus.empty() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(1ms);
+    EXPECT_TRUE(bus.empty());
+    pool.stop();
+    bus.stop();
+}
+
+TEST(squedl, schedule_many_fans_out) {
+    using namespace std::chrono_literals;
+    const int64_t NUM_TASKS{10000};
+
+    view_result = 0;
+    sum_result = 0;
+
+    squedl::test_bus bus{1min};
+    squedl::scheduler scheduler{bus};
+    squedl::worker_pool pool{bus, 8, 1ms, 4};
+
+    std::vector<view_task::args> views;
+    std::vector<sum_task::args> sums;
+    int64_t expected{};
+    for (int64_t i{}; i < NUM_TASKS; ++i) {
+        views.push_back(view_task::args{i});
+        sums.push_back(sum_task::args{i});
+        expected += i;
+    }
+
+    auto ids{scheduler.schedule_many<view_task>(views)};
+    ASSERT_EQ(ids.size(), NUM_TASKS);
+    for (size_t i{1}; i < ids.size(); ++i)
+        ASSERT_EQ(ids[i], ids[0] + i);
+    ASSERT_EQ(bus.enqueued_size(view_task::kind()), NUM_TASKS);
+
+    ASSERT_EQ(scheduler.schedule_many<sum_task>(sums, 200ms).size(), NUM_TASKS);
+    ASSERT_EQ(bus.delayed_size(sum_task::kind()), NUM_TASKS);
+    ASSERT_TRUE(scheduler.schedule_many<sum_task>(std::vector<sum_task::args>{}).empty());
+
+    pool.work_on(view_task{}, 4);
+    pool.work_on(sum_task{}, 4);
+
+    auto deadline{std::chrono::steady_clock::now() + 10s};
+    while (!bus.empty() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(10ms);
+
+    EXPECT_TRUE(bus.empty());
+    EXPECT_EQ(view_result, expected);
+    EXPECT_EQ(sum_result, expected);
+    pool.stop();
+    bus.stop();
+}
+
+TEST(squedl, schedule_with_idempotency_key) {
+    using namespace std::chrono_literals;
+
+    squedl::test_bus bus{1min};
+    squedl::scheduler scheduler{bus};
+
+    auto first{scheduler.schedule<sum_task>(sum_task::args{1}, 0ms, squedl::priority::normal,
+                                            "order-42")};
+    ASSERT_EQ(scheduler.schedule<sum_task>(sum_task::args{1}, 0ms, squedl::priority::normal,
+                                           "order-42"),
+              first);
+    ASSERT_NE(scheduler.schedule<sum_task>(sum_task::args{1}), first);
+    ASSERT_EQ(bus.enqueued_size(sum_task::kind()), 2);
+    bus.stop();
+}
+
+TEST(squedl, schedule_recurring_puts_until_cancelled) {
+    using namespace std::chrono_literals;
+    using recurrence = squedl::scheduler<squedl::test_bus<>>::recurrence;
+
+    sum_result = 0;
+    squedl::test_bus bus{1min};
+    squedl::scheduler scheduler{bus};
+    squedl::worker_pool pool{bus, 1, 1ms, 2};
+    pool.work_on(sum_task{}, 1);
+
+    auto id{scheduler.schedule_recurring<sum_task>(sum_task::args{1}, recurrence::fixed_rate(5ms))};
+    auto deadline{std::chrono::steady_clock::now() + 10s};
+    while (sum_result < 5 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(1ms);
+    EXPECT_GE(sum_result, 5);
+
+    // Ticks already put may still run; none come after them.
+    ASSERT_TRUE(scheduler.cancel(id));
+    std::this_thread::sleep_for(20ms);
+    auto settled{sum_result.load()};
+    std::this_thread::sleep_for(50ms);
+    EXPECT_EQ(sum_result, settled);
+    EXPECT_EQ(scheduler.next_due(), std::nullopt);
+    pool.stop();
+    bus.stop();
+}
+
+namespace {
+std::atomic<int64_t> quick_runs{0};
+
+class quick_task : public single_serializable_value_task {
+public:
+    static std::string kind() { return "quick_task"; }
+
+    std::optional<squedl::error> operator()(args /*args*/) {
+        ++quick_runs;
+        return std::nullopt;
+    }
+};
+
+class busy_task : public single_serializable_value_task {
+public:
+    static std::string kind() { return "busy_task"; }
+
+    std::optional<squedl::error> operator()(args /*args*/) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        return std::nullopt;
+    }
+};
+} // namespace
+
+TEST(squedl, worker_pool_flushes_acks_of_a_kind_while_busy_with_others) {
+    using namespace std::chrono_literals;
+
+    quick_runs = 0;
+    squedl::test_bus bus{100ms};
+    squedl::scheduler scheduler{bus};
+    // One thread that never goes idle while busy_task is saturated, and batches that never fill.
+    squedl::worker_pool pool{bus, 1000, 5ms, 1};
+
+    std::vector<busy_task::args> busy(400);
+    scheduler.schedule_many<busy_task>(busy);
+    scheduler.schedule<quick_task>(quick_task::args{});
+    pool.work_on(busy_task{}, 4);
+    pool.work_on(quick_task{}, 1);
+
+    auto deadline{std::chrono::steady_clock::now() + 10s};
+    while (quick_runs == 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(1ms);
+    ASSERT_EQ(quick_runs, 1);
+
+    // Acked well before the ack timeout, though busy_task keeps the thread going for longer.
+    std::this_thread::sleep_for(50ms);
+    EXPECT_NE(bus.enqueued_size(busy_task::kind()), 0);
+    EXPECT_EQ(bus.unacked_size(quick_task::kind()), 0);
+    std::this_thread::sleep_for(100ms);
+    EXPECT_EQ(quick_runs, 1);
+    pool.stop();
+    bus.stop();
+}
+
+TEST(squedl, worker_pool_stop_leaves_the_bus_alone) {
+    using namespace std::chrono_literals;
+
+    squedl::test_bus bus{1min};
+    squedl::scheduler scheduler{bus};
+    for (size_t i{}; i < 100; ++i) {
+        quick_runs = 0;
+        squedl::worker_pool pool{bus, 1, 10ms, 2};
+        pool.work_on(quick_task{}, 1);
+        pool.stop();
+
+        // No fetcher is left in next to take it.
+        scheduler.schedule<quick_task>(quick_task::args{});
+        std::this_thread::sleep_for(1ms);
+        ASSERT_EQ(bus.enqueued_size(quick_task::kind()), 1);
+        ASSERT_EQ(quick_runs, 0);
+        auto taken{bus.try_next(quick_task::kind(), 1)};
+        bus.ack(quick_task::kind(), taken.value().at(0).handle);
+    }
+    bus.stop();
+}
@@ -1,6 +1,11 @@
+#include <atomic>
 #include <chrono>
 #include <cstddef>
+#include <future>
 #include <set>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -37,10 +42,10 @@ TEST(squedl, test_bus) {
     ASSERT_TRUE(batch.has_value());
     ASSERT_EQ(batch.value().size(), total_messages / 10);
     for (size_t i{}; i < batch.value().size(); ++i) {
-        auto const& [id, _]{batch.value()[i]};
+        auto const& [id, _, handle]{batch.value()[i]};
         ASSERT_TRUE(immediate_ids.count(id));
         if (i % 2 == 0) {
-            bus.ack(kind, id);
+            bus.ack(kind, handle);
             ++final_count;
         } else {
             unacked_ids.insert(id);
@@ -50,9 +55,9 @@ TEST(squedl, test_bus) {
     batch = bus.next(kind, total_messages);
     ASSERT_TRUE(batch.has_value());
     ASSERT_EQ(batch.value().size(), total_messages * 8 / 10); // actually didn't get delayed
-    for (const auto& [id, _] : batch.value()) {
+    for (const auto& [id, _, handle] : batch.value()) {
         ASSERT_TRUE(immediate_ids.count(id));
-        bus.ack(kind, id);
+        bus.ack(kind, handle);
         ++final_count;
     }
 
@@ -61,9 +66,9 @@ TEST(squedl, test_bus) {
     batch = bus.next(kind, total_messages / 10); // try to get all
     ASSERT_TRUE(batch.has_value());
     ASSERT_EQ(batch.value().size(), total_messages / 20); // actually get only acked
-    for (const auto& [id, _] : batch.value()) {
+    for (const auto& [id, _, handle] : batch.value()) {
         ASSERT_TRUE(unacked_ids.count(id));
-        bus.ack(kind, id);
+        bus.ack(kind, handle);
         ++final_count;
     }
 
@@ -72,9 +77,9 @@ TEST(squedl, test_bus) {
         batch = bus.next(kind, total_messages);
         if (!batch.has_value())
             break;
-        for (const auto& [id, _] : batch.value()) {
+        for (const auto& [id, _, handle] : batch.value()) {
             ASSERT_TRUE(delayed_ids.count(id));
-            bus.ack(kind, id);
+            bus.ack(kind, handle);
             ++final_count;
         }
     }
@@ -84,3 +89,621 @@ TEST(squedl, test_bus) {
     ASSERT_EQ(bus.delayed_size(kind), 0);
     ASSERT_EQ(bus.unacked_size(kind), 0);
 }
+
+TEST(squedl, test_bus_kinds_do_not_block_each_other) {
+    using namespace std::chrono_literals;
+    const std::string idle_kind{"idle_kind"};
+    const std::string busy_kind{"busy_kind"};
+    const size_t total_messages{100};
+
+    squedl::test_bus<> bus{1min, true};
+
+    std::thread idle_consumer{[&bus, &idle_kind] {
+        auto batch{bus.next(idle_kind, 1)};
+        ASSERT_FALSE(batch.has_value());
+    }};
+
+    size_t received{};
+    std::thread busy_consumer{[&bus, &busy_kind, &received] {
+        while (received < total_messages) {
+            auto batch{bus.next(busy_kind, total_messages, 5s)};
+            ASSERT_TRUE(batch.has_value());
+            received += batch.value().size();
+        }
+    }};
+
+    for (size_t i{}; i < total_messages; ++i)
+        ASSERT_TRUE(bus.put(busy_kind, std::vector{static_cast<std::byte>(i)}).has_value());
+
+    busy_consumer.join();
+    ASSERT_EQ(received, total_messages);
+    ASSERT_EQ(bus.enqueued_size(busy_kind), 0);
+    ASSERT_TRUE(bus.empty());
+
+    bus.stop();
+    idle_consumer.join();
+}
+
+TEST(squedl, test_bus_stale_handles) {
+    using namespace std::chrono_literals;
+    const std::string kind{"test_kind"};
+
+    squedl::test_bus<> bus{50ms, false, 10ms};
+    auto id{bus.put(kind, std::vector{std::byte{1}})};
+    ASSERT_TRUE(id.has_value());
+
+    auto first{bus.next(kind, 1)};
+    ASSERT_TRUE(first.has_value());
+    ASSERT_EQ(first.value().size(), 1);
+    ASSERT_EQ(first.value()[0].id, id.value());
+
+    // redelivered after the ack timeout, the first delivery's handle no longer refers to it
+    auto second{bus.next(kind, 1, 1s)};
+    ASSERT_TRUE(second.has_value());
+    ASSERT_EQ(second.value().size(), 1);
+    ASSERT_EQ(second.value()[0].id, id.value());
+
+    bus.ack(kind, first.value()[0].handle);
+    ASSERT_EQ(bus.unacked_size(kind), 1);
+
+    bus.nack(kind, second.value()[0].handle);
+    ASSERT_EQ(bus.unacked_size(kind), 0);
+    ASSERT_EQ(bus.enqueued_size(kind), 1);
+
+    auto third{bus.next(kind, 1)};
+    ASSERT_TRUE(third.has_value());
+    bus.ack(kind, third.value()[0].handle);
+    ASSERT_TRUE(bus.empty());
+
+    bus.stop();
+}
+
+TEST(squedl, test_bus_ack_many) {
+    const std::string kind{"test_kind"};
+    const size_t total_messages{100};
+
+    squedl::test_bus<> bus{};
+    for (size_t i{}; i < total_messages; ++i)
+        ASSERT_TRUE(bus.put(kind, std::vector{static_cast<std::byte>(i)}).has_value());
+
+    auto batch{bus.next(kind, total_messages)};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), total_messages);
+
+    std::vector<squedl::test_bus<>::handle_t> acked;
+    std::vector<squedl::test_bus<>::handle_t> nacked;
+    for (const auto& delivery : batch.value())
+        (delivery.id % 4 == 0 ? nacked : acked).push_back(delivery.handle);
+
+    bus.ack_many(kind, acked);
+    bus.nack_many(kind, nacked);
+    ASSERT_EQ(bus.unacked_size(kind), 0);
+    ASSERT_EQ(bus.enqueued_size(kind), nacked.size());
+
+    batch = bus.next(kind, total_messages);
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), nacked.size());
+    for (const auto& delivery : batch.value())
+        ASSERT_EQ(delivery.id % 4, 0);
+
+    bus.stop();
+}
+
+TEST(squedl, test_bus_delayed_delivery_is_prompt) {
+    using namespace std::chrono_literals;
+    const std::string kind{"test_kind"};
+    const auto delay{30ms};
+
+    squedl::test_bus<std::chrono::steady_clock> bus{1min, true, 1s};
+    auto started{std::chrono::steady_clock::now()};
+    ASSERT_TRUE(bus.put(kind, std::vector{std::byte{1}}, delay).has_value());
+
+    auto batch{bus.next(kind, 1, 1s)};
+    auto waited{std::chrono::steady_clock::now() - started};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), 1);
+    ASSERT_GE(waited, delay);
+    ASSERT_LT(waited, delay + 20ms) << "delivery should not wait for a coarse tick";
+
+    bus.stop();
+}
+
+TEST(squedl, test_bus_interrupt) {
+    const std::string kind{"test_kind"};
+
+    squedl::test_bus<> bus{};
+    std::atomic<bool> returned{};
+    std::thread consumer{[&bus, &kind, &returned] {
+        auto batch{bus.next(kind, 1)};
+        ASSERT_TRUE(batch.has_value());
+        ASSERT_TRUE(batch.value().empty());
+        returned = true;
+    }};
+
+    while (!returned) {
+        bus.interrupt(kind);
+        std::this_thread::yield();
+    }
+    consumer.join();
+
+    ASSERT_TRUE(bus.put(kind, std::vector{std::byte{1}}).has_value());
+    auto batch{bus.next(kind, 1)};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), 1);
+
+    bus.stop();
+}
+
+TEST(squedl, test_bus_priorities) {
+    const std::string kind{"test_kind"};
+    const size_t per_priority{5};
+    const std::vector<squedl::priority> order{squedl::priority::urgent, squedl::priority::high,
+                                              squedl::priority::normal, squedl::priority::low};
+
+    squedl::test_bus<> bus{};
+    for (size_t i{}; i < per_priority; ++i)
+        for (auto prio : order)
+            ASSERT_TRUE(bus.put(kind, std::vector{static_cast<std::byte>(prio)},
+                                squedl::test_bus<>::duration::zero(), prio)
+                            .has_value());
+    ASSERT_EQ(bus.enqueued_size(kind), per_priority * order.size());
+
+    auto batch{bus.next(kind, per_priority * order.size())};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), per_priority * order.size());
+    for (size_t i{}; i < batch.value().size(); ++i)
+        ASSERT_EQ(batch.value()[i].payload.data()[0],
+                  static_cast<std::byte>(order[i / per_priority]));
+
+    // a nacked message keeps its priority
+    bus.nack(kind, batch.value().front().handle);
+    ASSERT_TRUE(bus.put(kind, std::vector{std::byte{0xff}}).has_value());
+    auto again{bus.next(kind, 1)};
+    ASSERT_TRUE(again.has_value());
+    ASSERT_EQ(again.value().front().id, batch.value().front().id);
+
+    bus.stop();
+}
+
+TEST(squedl, test_bus_low_priority_is_not_starved) {
+    const std::string kind{"test_kind"};
+    const size_t total_high{100};
+
+    squedl::test_bus<> bus{std::chrono::minutes{1}, true};
+    for (size_t i{}; i < total_high; ++i)
+        ASSERT_TRUE(bus.put(kind, std::vector{std::byte{1}}, squedl::test_bus<>::duration::zero(),
+                            squedl::priority::high)
+                        .has_value());
+    ASSERT_TRUE(bus.put(kind, std::vector{std::byte{0}}, squedl::test_bus<>::duration::zero(),
+                        squedl::priority::low)
+                    .has_value());
+
+    size_t position{};
+    for (;; ++position) {
+        auto batch{bus.next(kind, 1)};
+        ASSERT_TRUE(batch.has_value());
+        ASSERT_EQ(batch.value().size(), 1);
+        if (batch.value().front().payload.data()[0] == std::byte{0})
+            break;
+    }
+    ASSERT_LT(position, 20) << "low priority waited behind " << position << " messages";
+
+    bus.stop();
+}
+
+TEST(squedl, test_bus_next_async) {
+    using namespace std::chrono_literals;
+    using batch_t = std::optional<std::vector<squedl::test_bus<>::delivery>>;
+    const std::string kind{"test_kind"};
+    const size_t total_receivers{100};
+
+    squedl::test_bus<> bus{};
+
+    // served on the spot when messages are ready
+    ASSERT_TRUE(bus.put(kind, std::vector{std::byte{1}}).has_value());
+    batch_t immediate{};
+    bus.next_async(kind, 10, [&immediate](batch_t batch) { immediate = std::move(batch); });
+    ASSERT_TRUE(immediate.has_value());
+    ASSERT_EQ(immediate.value().size(), 1);
+    bus.ack(kind, immediate.value().front().handle);
+
+    // otherwise by the put, delayed or not, that makes them ready
+    std::atomic<size_t> received{};
+    std::atomic<size_t> served{};
+    for (size_t i{}; i < total_receivers; ++i)
+        bus.next_async(kind, 1, [&bus, &kind, &received, &served](batch_t batch) {
+            ASSERT_TRUE(batch.has_value());
+            received += batch.value().size();
+            for (const auto& x : batch.value())
+                bus.ack(kind, x.handle);
+            ++served;
+        });
+    ASSERT_EQ(served, 0);
+
+    std::thread producer{[&bus, &kind] {
+        for (size_t i{}; i < total_receivers; ++i)
+            ASSERT_TRUE(bus.put(kind, std::vector{std::byte{2}}, i % 2 == 0 ? 5ms : 0ms)
+                            .has_value());
+    }};
+    producer.join();
+
+    auto deadline{std::chrono::steady_clock::now() + 5s};
+    while (served != total_receivers && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(1ms);
+    ASSERT_EQ(served, total_receivers);
+    ASSERT_EQ(received, total_receivers);
+    ASSERT_TRUE(bus.empty());
+
+    // left waiting receivers hear about interrupts and the stop
+    batch_t interrupted{std::nullopt};
+    bus.next_async(kind, 1, [&interrupted](batch_t batch) { interrupted = std::move(batch); });
+    bus.interrupt(kind);
+    ASSERT_TRUE(interrupted.has_value());
+    ASSERT_TRUE(interrupted.value().empty());
+
+    std::atomic<bool> stopped{};
+    bus.next_async(kind, 1, [&stopped](batch_t batch) { stopped = !batch.has_value(); });
+    bus.stop();
+    ASSERT_TRUE(stopped);
+}
+
+TEST(squedl, test_bus_retries_with_backoff_then_dead_letters) {
+    using namespace std::chrono_literals;
+    const std::string kind{"test_kind"};
+    const std::string dead{"test_kind_dead"};
+    const auto backoff{20ms};
+
+    squedl::test_bus<> bus{50ms};
+    squedl::test_bus<>::retry_policy policy{};
+    policy.max_attempts = 3;
+    policy.initial_backoff = backoff;
+    policy.dead_letter = dead;
+    bus.set_retry_policy(kind, policy);
+
+    auto id{bus.put(kind, std::vector{std::byte{7}})};
+    ASSERT_TRUE(id.has_value());
+
+    auto first{bus.next(kind, 1)};
+    ASSERT_TRUE(first.has_value());
+    ASSERT_EQ(first.value().size(), 1);
+    // Timed from before the calls the bus times from, so a slow test thread cannot make the
+    // bus look early.
+    auto nacked{std::chrono::steady_clock::now()};
+    bus.nack(kind, first.value().front().handle);
+    ASSERT_EQ(bus.enqueued_size(kind), 0);
+    ASSERT_EQ(bus.delayed_size(kind), 1);
+
+    // back after the backoff; this time left to time out
+    auto taken{std::chrono::steady_clock::now()};
+    auto second{bus.next(kind, 1, 5s)};
+    ASSERT_TRUE(second.has_value());
+    ASSERT_EQ(second.value().size(), 1);
+    ASSERT_EQ(second.value().front().id, id.value());
+    ASSERT_GE(std::chrono::steady_clock::now() - nacked, backoff);
+
+    // the ack timeout plus twice the backoff
+    auto third{bus.next(kind, 1, 5s)};
+    ASSERT_TRUE(third.has_value());
+    ASSERT_EQ(third.value().size(), 1);
+    ASSERT_GE(std::chrono::steady_clock::now() - taken, 50ms + backoff * 2);
+    bus.nack(kind, third.value().front().handle);
+
+    // out of attempts: moved to the dead letter kind under the same id
+    ASSERT_EQ(bus.enqueued_size(kind) + bus.delayed_size(kind) + bus.unacked_size(kind), 0);
+    auto buried{bus.next(dead, 1, 5s)};
+    ASSERT_TRUE(buried.has_value());
+    ASSERT_EQ(buried.value().size(), 1);
+    ASSERT_EQ(buried.value().front().id, id.value());
+    ASSERT_EQ(buried.value().front().payload.data()[0], std::byte{7});
+    ASSERT_TRUE(bus.ack(dead, buried.value().front().handle));
+
+    auto stats{bus.metrics(kind)};
+    EXPECT_EQ(stats.counters.delivered, 3);
+    EXPECT_EQ(stats.counters.nacked, 2);
+    EXPECT_EQ(stats.counters.redelivered, 1);
+    EXPECT_EQ(stats.counters.dead_lettered, 1);
+    EXPECT_TRUE(bus.empty());
+
+    bus.stop();
+}
+
+TEST(squedl, test_bus_drops_exhausted_without_dead_letter_kind) {
+    const std::string kind{"test_kind"};
+
+    squedl::test_bus<> bus{};
+    squedl::test_bus<>::retry_policy policy{};
+    policy.max_attempts = 1;
+    bus.set_retry_policy(kind, policy);
+
+    for (size_t i{}; i < 10; ++i)
+        ASSERT_TRUE(bus.put(kind, std::vector{std::byte{1}}).has_value());
+    auto batch{bus.next(kind, 10)};
+    ASSERT_TRUE(batch.has_value());
+    std::vector<squedl::test_bus<>::handle_t> handles;
+    for (const auto& x : batch.value())
+        handles.push_back(x.handle);
+    bus.nack_many(kind, handles);
+
+    EXPECT_TRUE(bus.empty());
+    EXPECT_EQ(bus.metrics(kind).counters.dead_lettered, 10);
+
+    bus.stop();
+}
+
+TEST(squedl, test_bus_capacity_fails_or_drops) {
+    const std::string failing{"test_kind_failing"};
+    const std::string dropping{"test_kind_dropping"};
+    const size_t capacity{3};
+
+    squedl::test_bus<> bus{};
+    squedl::test_bus<>::capacity_limit limit{};
+    limit.max_messages = capacity;
+    bus.set_capacity(failing, limit);
+    limit.on_full = squedl::overflow_policy::drop_oldest;
+    bus.set_capacity(dropping, limit);
+
+    // delayed messages take room as well
+    ASSERT_TRUE(bus.put(failing, std::vector{std::byte{0}}, std::chrono::minutes{1}).has_value());
+    for (size_t i{1}; i < capacity; ++i)
+        ASSERT_TRUE(bus.put(failing, std::vector{static_cast<std::byte>(i)}).has_value());
+    ASSERT_FALSE(bus.put(failing, std::vector{std::byte{9}}).has_value());
+
+    // a delivery frees room; a nack brings the message back even into a full kind
+    auto batch{bus.next(failing, 1)};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_TRUE(bus.put(failing, std::vector{std::byte{9}}).has_value());
+    bus.nack(failing, batch.value().front().handle);
+    ASSERT_EQ(bus.enqueued_size(failing) + bus.delayed_size(failing), capacity + 1);
+    ASSERT_EQ(bus.metrics(failing).counters.refused, 1);
+
+    for (size_t i{}; i < 5; ++i)
+        ASSERT_TRUE(bus.put(dropping, std::vector{static_cast<std::byte>(i)}).has_value());
+    ASSERT_TRUE(bus.put(dropping, std::vector{std::byte{5}}, squedl::test_bus<>::duration::zero(),
+                        squedl::priority::high)
+                    .has_value());
+    batch = bus.next(dropping, 5);
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), capacity);
+    EXPECT_EQ(batch.value()[0].payload.data()[0], std::byte{5});
+    EXPECT_EQ(batch.value()[1].payload.data()[0], std::byte{3});
+    EXPECT_EQ(batch.value()[2].payload.data()[0], std::byte{4});
+    EXPECT_EQ(bus.metrics(dropping).counters.dropped, 3);
+
+    bus.stop();
+}
+
+TEST(squedl, test_bus_capacity_blocks_producers) {
+    using namespace std::chrono_literals;
+    const std::string kind{"test_kind"};
+
+    squedl::test_bus<> bus{};
+    squedl::test_bus<>::capacity_limit limit{};
+    limit.max_messages = 1;
+    limit.on_full = squedl::overflow_policy::block;
+    limit.block_timeout = 20ms;
+    bus.set_capacity(kind, limit);
+
+    ASSERT_TRUE(bus.put(kind, std::vector{std::byte{1}}).has_value());
+    auto started{std::chrono::steady_clock::now()};
+    ASSERT_FALSE(bus.put(kind, std::vector{std::byte{2}}).has_value());
+    ASSERT_GE(std::chrono::steady_clock::now() - started, 20ms);
+
+    limit.block_timeout = 5s;
+    bus.set_capacity(kind, limit);
+    std::atomic<bool> put{};
+    std::thread producer{[&bus, &kind, &put] {
+        ASSERT_TRUE(bus.put(kind, std::vector{std::byte{3}}).has_value());
+        put = true;
+    }};
+    std::this_thread::sleep_for(20ms);
+    ASSERT_FALSE(put);
+
+    auto batch{bus.next(kind, 1)};
+    ASSERT_TRUE(batch.has_value());
+    producer.join();
+    ASSERT_TRUE(put);
+
+    // stopping releases blocked producers
+    std::thread blocked{[&bus, &kind] {
+        ASSERT_FALSE(bus.put(kind, std::vector{std::byte{4}}).has_value());
+    }};
+    std::this_thread::sleep_for(20ms);
+    bus.stop();
+    blocked.join();
+}
+
+TEST(squedl, test_bus_try_put_many) {
+    const std::string kind{"test_kind"};
+
+    squedl::test_bus<> bus{};
+    squedl::test_bus<>::capacity_limit limit{};
+    limit.max_messages = 5;
+    bus.set_capacity(kind, limit);
+
+    std::vector<squedl::bytes> payloads;
+    for (size_t i{}; i < 8; ++i)
+        payloads.push_back(squedl::bytes{static_cast<std::byte>(i)});
+
+    auto ids{bus.try_put_many(kind, payloads)};
+    ASSERT_EQ(ids.size(), 5);
+    ASSERT_EQ(bus.enqueued_size(kind), 5);
+    ASSERT_EQ(bus.metrics(kind).counters.refused, 3);
+
+    auto batch{bus.next(kind, 8)};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), 5);
+    for (size_t i{}; i < ids.size(); ++i) {
+        EXPECT_EQ(batch.value()[i].id, ids[i]);
+        EXPECT_EQ(batch.value()[i].payload.data()[0], static_cast<std::byte>(i));
+    }
+    ASSERT_TRUE(bus.try_put_many(kind, std::vector<squedl::bytes>{}).empty());
+
+    bus.stop();
+}
+
+TEST(squedl, test_bus_put_many_all_or_nothing) {
+    const std::string kind{"test_kind"};
+
+    squedl::test_bus<> bus{};
+    squedl::test_bus<>::capacity_limit limit{};
+    limit.max_messages = 5;
+    bus.set_capacity(kind, limit);
+
+    // back to back in one buffer, large bodies next to inline ones
+    squedl::bytes buffer;
+    std::vector<size_t> ends;
+    for (size_t i{}; i < 4; ++i) {
+        buffer.insert(buffer.end(), i % 2 == 0 ? 8 : 100, static_cast<std::byte>(i));
+        ends.push_back(buffer.size());
+    }
+
+    auto ids{bus.put_many(kind, squedl::byte_view{buffer}, ends)};
+    ASSERT_TRUE(ids.has_value());
+    ASSERT_EQ(ids.value().size(), 4);
+    ASSERT_FALSE(bus.put_many(kind, squedl::byte_view{buffer}, ends).has_value());
+    ASSERT_EQ(bus.enqueued_size(kind), 4);
+    ASSERT_EQ(bus.metrics(kind).counters.refused, 4);
+
+    auto batch{bus.next(kind, 10)};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), 4);
+    for (size_t i{}; i < 4; ++i) {
+        EXPECT_EQ(batch.value()[i].id, ids.value()[i]);
+        EXPECT_EQ(batch.value()[i].payload.size(), i % 2 == 0 ? 8 : 100);
+        EXPECT_EQ(batch.value()[i].payload.data()[0], static_cast<std::byte>(i));
+    }
+
+    // a delayed batch becomes ready together
+    std::vector<squedl::bytes> payloads(3, squedl::bytes{std::byte{1}});
+    ASSERT_TRUE(bus.put_many(kind, payloads, std::chrono::milliseconds{20}).has_value());
+    ASSERT_EQ(bus.delayed_size(kind), 3);
+    batch = bus.next(kind, 10, std::chrono::seconds{5});
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), 3);
+
+    bus.stop();
+}
+
+TEST(squedl, test_bus_put_many_rejects_bad_ends) {
+    const std::string kind{"test_kind"};
+
+    squedl::test_bus<> bus{};
+    const squedl::bytes buffer(300, std::byte{7});
+    const squedl::byte_view view{buffer};
+
+    EXPECT_FALSE(bus.put_many(kind, view, std::vector<size_t>{200, 100, 300}).has_value());
+    EXPECT_FALSE(bus.put_many(kind, view, std::vector<size_t>{100, 301}).has_value());
+    EXPECT_FALSE(bus.put_many(kind, squedl::byte_view{}, std::vector<size_t>{8}).has_value());
+    EXPECT_EQ(bus.enqueued_size(kind), 0);
+
+    auto ids{bus.put_many(kind, view, std::vector<size_t>{100, 100, 300})};
+    ASSERT_TRUE(ids.has_value());
+    auto batch{bus.next(kind, 10)};
+    ASSERT_EQ(batch.value().size(), 3);
+    EXPECT_EQ(batch.value()[1].payload.size(), 0);
+    EXPECT_EQ(batch.value()[2].payload.size(), 200);
+    bus.stop();
+}
+
+TEST(squedl, test_bus_wakes_consumers_of_the_kind) {
+    using namespace std::chrono_literals;
+    const size_t kinds{16};
+    const size_t per_kind{4};
+
+    squedl::test_bus<> bus{1min, true};
+    std::vector<std::string> names;
+    for (size_t i{}; i < kinds; ++i)
+        names.push_back("test_kind_" + std::to_string(i));
+
+    // several consumers asleep on every kind, with timeouts far beyond what the test waits
+    std::atomic<size_t> received{};
+    std::vector<std::thread> consumers;
+    for (size_t i{}; i < kinds * per_kind; ++i)
+        consumers.emplace_back([&bus, &received, kind = names[i % kinds]] {
+            for (;;) {
+                auto batch{bus.next(kind, 1, 30s)};
+                if (!batch.has_value() || batch.value().empty())
+                    return;
+                ++received;
+            }
+        });
+    std::this_thread::sleep_for(20ms);
+
+    // one put per kind reaches a consumer of that kind, and a batch reaches as many as it feeds
+    for (const auto& kind : names)
+        ASSERT_TRUE(bus.put(kind, std::vector{std::byte{1}}).has_value());
+    std::vector<squedl::bytes> payloads(per_kind, squedl::bytes{std::byte{2}});
+    ASSERT_TRUE(bus.put_many(names.front(), payloads).has_value());
+
+    auto expected{kinds + per_kind};
+    auto deadline{std::chrono::steady_clock::now() + 5s};
+    while (received != expected && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(1ms);
+    ASSERT_EQ(received, expected);
+
+    // Stopped rather than interrupted: a consumer between its batch and its next call would
+    // sleep through an interrupt until its timeout.
+    bus.stop();
+    for (auto& x : consumers)
+        x.join();
+}
+
+TEST(squedl, test_bus_drops_duplicate_idempotency_keys) {
+    using namespace std::chrono_literals;
+    const std::string kind{"test_kind"};
+    const std::string full{"test_kind_full"};
+
+    squedl::test_bus<> bus{};
+    squedl::test_bus<>::dedup_policy policy{};
+    policy.window = 50ms;
+    bus.set_dedup_policy(kind, policy);
+
+    auto first{bus.put(kind, std::vector{std::byte{1}}, 0ms, squedl::priority::normal, "a")};
+    ASSERT_TRUE(first.has_value());
+    auto again{bus.put(kind, std::vector{std::byte{2}}, 0ms, squedl::priority::normal, "a")};
+    ASSERT_TRUE(again.has_value());
+    ASSERT_EQ(again.value(), first.value());
+    ASSERT_NE(bus.put(kind, std::vector{std::byte{3}}, 0ms, squedl::priority::normal, "b").value(),
+              first.value());
+    ASSERT_TRUE(bus.put(kind, std::vector{std::byte{4}}).has_value());
+    ASSERT_EQ(bus.enqueued_size(kind), 3);
+    ASSERT_EQ(bus.metrics(kind).counters.deduplicated, 1);
+
+    // still a duplicate once delivered and acked, but not after the window
+    auto batch{bus.next(kind, 3)};
+    ASSERT_TRUE(batch.has_value());
+    for (const auto& x : batch.value())
+        bus.ack(kind, x.handle);
+    ASSERT_EQ(bus.put(kind, std::vector{std::byte{5}}, 0ms, squedl::priority::normal, "a").value(),
+              first.value());
+    std::this_thread::sleep_for(100ms);
+    ASSERT_NE(bus.put(kind, std::vector{std::byte{6}}, 0ms, squedl::priority::normal, "a").value(),
+              first.value());
+
+    // a refused put leaves its key free for the retry
+    squedl::test_bus<>::capacity_limit limit{};
+    limit.max_messages = 0;
+    bus.set_capacity(full, limit);
+    ASSERT_FALSE(bus.put(full, std::vector{std::byte{7}}, 0ms, squedl::priority::normal, "c")
+                     .has_value());
+    limit.max_messages = 1;
+    bus.set_capacity(full, limit);
+    ASSERT_TRUE(bus.put(full, std::vector{std::byte{7}}, 0ms, squedl::priority::normal, "c")
+                    .has_value());
+    ASSERT_EQ(bus.metrics(full).counters.deduplicated, 0);
+
+    // nor does a duplicate get the id of a put still waiting for room, which is then refused
+    limit.on_full = squedl::overflow_policy::block;
+    limit.block_timeout = 200ms;
+    bus.set_capacity(full, limit);
+    auto waiting{std::async(std::launch::async, [&bus, &full] {
+        return bus.put(full, std::vector{std::byte{8}}, 0ms, squedl::priority::normal, "d");
+    })};
+    std::this_thread::sleep_for(50ms);
+    ASSERT_FALSE(bus.put(full, std::vector{std::byte{8}}, 0ms, squedl::priority::normal, "d")
+                     .has_value());
+    ASSERT_FALSE(waiting.get().has_value());
+    ASSERT_EQ(bus.metrics(full).counters.deduplicated, 0);
+
+    bus.stop();
+}
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "squedl/detail/timing_wheel.hpp"
+
+namespace {
+using clock = std::chrono::steady_clock;
+using wheel = squedl::detail::timing_wheel<size_t, clock>;
+} // namespace
+
+TEST(timing_wheel, expires_each_entry_once_and_on_time) {
+    using namespace std::chrono_literals;
+    const auto origin{clock::time_point{} + 1h};
+    const auto step{7ms};
+
+    wheel wheel{1ms, origin};
+    std::mt19937 gen{42};
+    std::uniform_int_distribution<int> near_dist{0, 2000};
+    std::uniform_int_distribution<int> far_dist{0, 100'000'000};
+
+    std::map<size_t, clock::time_point> deadlines;
+    for (size_t i{}; i < 5000; ++i) {
+        auto at{origin + std::chrono::milliseconds{i % 50 == 0 ? far_dist(gen) : near_dist(gen)}};
+        deadlines[i] = at;
+        wheel.insert(at, size_t{i});
+    }
+    ASSERT_EQ(wheel.size(), deadlines.size());
+
+    auto now{origin};
+    std::vector<bool> expired(deadlines.size());
+    while (!wheel.empty()) {
+        auto next{wheel.next_deadline()};
+        ASSERT_TRUE(next.has_value());
+        now = std::max(now + step, *next);
+
+        wheel.expire(now, [&](size_t&& i) {
+            ASSERT_FALSE(expired[i]);
+            ASSERT_LE(deadlines[i], now);
+            expired[i] = true;
+        });
+
+        for (const auto& [i, at] : deadlines) {
+            if (at <= now) {
+                ASSERT_TRUE(expired[i]) << "entry " << i << " is late";
+            }
+        }
+    }
+}
+
+TEST(timing_wheel, cancel_and_stale_handles) {
+    using namespace std::chrono_literals;
+    const auto origin{clock::time_point{} + 1h};
+
+    wheel wheel{1s, origin};
+    auto first{wheel.insert(origin + 10s, 1)};
+    auto second{wheel.insert(origin + 10s, 2)};
+
+    auto cancelled{wheel.cancel(first)};
+    ASSERT_TRUE(cancelled.has_value());
+    ASSERT_EQ(*cancelled, 1);
+    ASSERT_FALSE(wheel.cancel(first).has_value());
+    ASSERT_FALSE(wheel.contains(first));
+
+    auto reused{wheel.insert(origin + 20s, 3)};
+    ASSERT_EQ(reused.index, first.index);
+    ASSERT_FALSE(wheel.cancel(first).has_value());
+    ASSERT_TRUE(wheel.contains(reused));
+
+    std::vector<size_t> expired;
+    wheel.expire(origin + 10s, [&](size_t&& i) { expired.push_back(i); });
+    ASSERT_EQ(expired, std::vector<size_t>{2});
+    ASSERT_FALSE(wheel.contains(second));
+    ASSERT_EQ(wheel.size(), 1);
+}
+
+TEST(timing_wheel, skips_empty_ticks_on_long_jumps) {
+    using namespace std::chrono_literals;
+    const auto origin{clock::time_point{} + 1h};
+
+    // A day at a time at a millisecond resolution, tens of millions of ticks per jump.
+    wheel wheel{1ms, origin};
+    std::mt19937_64 gen{7};
+    std::uniform_int_distribution<std::int64_t> dist{0,
+                                                     std::chrono::milliseconds{10 * 24h}.count()};
+
+    std::map<size_t, clock::time_point> deadlines;
+    auto now{origin};
+    std::vector<clock::time_point> expired;
+    for (size_t day{}; day < 12; ++day) {
+        for (size_t i{}; i < 1000; ++i) {
+            auto at{now + std::chrono::milliseconds{dist(gen)}};
+            deadlines[deadlines.size()] = at;
+            wheel.insert(at, deadlines.size() - 1);
+        }
+
+        now += 24h;
+        auto before{expired.size()};
+        wheel.expire(now, [&](size_t&& i) {
+            ASSERT_LE(deadlines[i], now);
+            expired.push_back(deadlines[i]);
+        });
+        ASSERT_TRUE(std::is_sorted(expired.begin() + static_cast<std::ptrdiff_t>(before),
+                                   expired.end()));
+        auto due{std::count_if(deadlines.begin(), deadlines.end(),
+                               [now](const auto& x) { return x.second <= now; })};
+        ASSERT_EQ(expired.size(), static_cast<size_t>(due));
+    }
+}
@@ -0,0 +1,418 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "squedl/wal_bus.hpp"
+
+namespace {
+std::filesystem::path fresh_directory(const std::string& name) {
+    auto result{std::filesystem::temp_directory_path() /
+                ("squedl_" + name + "_" + std::to_string(::getpid()))};
+    std::filesystem::remove_all(result);
+    return result;
+}
+
+size_t count_files(const std::filesystem::path& directory) {
+    size_t result{};
+    for (const auto& entry : std::filesystem::directory_iterator{directory})
+        result += entry.is_regular_file();
+    return result;
+}
+} // namespace
+
+TEST(wal_bus, restores_unacked_messages) {
+    using namespace std::chrono_literals;
+    const std::string kind{"wal_kind"};
+    const size_t total_messages{100};
+    const size_t delayed_messages{10};
+    auto directory{fresh_directory("wal_restore")};
+
+    std::map<squedl::wal_bus<>::id_t, squedl::bytes> expected_ready;
+    std::map<squedl::wal_bus<>::id_t, squedl::bytes> expected_delayed;
+    {
+        squedl::wal_bus<> bus{directory.string()};
+        for (size_t i{}; i < total_messages; ++i) {
+            squedl::bytes body(i + 1, static_cast<std::byte>(i));
+            auto id{bus.put(kind, body)};
+            ASSERT_TRUE(id.has_value());
+            expected_ready[id.value()] = body;
+        }
+        for (size_t i{}; i < delayed_messages; ++i) {
+            squedl::bytes body{static_cast<std::byte>(i)};
+            auto id{bus.put(kind, body, 1h)};
+            ASSERT_TRUE(id.has_value());
+            expected_delayed[id.value()] = body;
+        }
+
+        auto batch{bus.next(kind, total_messages)};
+        ASSERT_TRUE(batch.has_value());
+        ASSERT_EQ(batch.value().size(), total_messages);
+
+        std::vector<squedl::wal_bus<>::handle_t> acked;
+        for (size_t i{}; i < batch.value().size(); ++i) {
+            const auto& [id, payload, handle]{batch.value()[i]};
+            ASSERT_EQ(payload.to_bytes(), expected_ready[id]);
+            if (i % 2 == 0) {
+                acked.push_back(handle);
+                expected_ready.erase(id);
+            }
+        }
+        bus.ack_many(kind, acked);
+        ASSERT_FALSE(bus.ack(kind, acked.front())) << "handles settle only once";
+    }
+
+    squedl::wal_bus<> bus{directory.string()};
+    ASSERT_EQ(bus.enqueued_size(kind), expected_ready.size());
+    ASSERT_EQ(bus.delayed_size(kind), expected_delayed.size());
+
+    auto batch{bus.next(kind, total_messages)};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), expected_ready.size());
+    for (const auto& [id, payload, handle] : batch.value()) {
+        ASSERT_EQ(payload.to_bytes(), expected_ready[id]);
+        ASSERT_TRUE(bus.ack(kind, handle));
+    }
+
+    auto id{bus.put(kind, squedl::bytes{std::byte{1}})};
+    ASSERT_TRUE(id.has_value());
+    ASSERT_GT(id.value(), expected_delayed.rbegin()->first) << "ids continue after restored ones";
+
+    bus.stop();
+    std::filesystem::remove_all(directory);
+}
+
+TEST(wal_bus, compacts_acked_segments) {
+    using namespace std::chrono_literals;
+    const std::string kind{"wal_kind"};
+    const size_t total_messages{1000};
+    auto directory{fresh_directory("wal_compact")};
+
+    {
+        squedl::wal_bus<> bus{directory.string(), 1min, 1024, false};
+        for (size_t i{}; i < total_messages; ++i)
+            ASSERT_TRUE(bus.put(kind, squedl::bytes(16, std::byte{7})).has_value());
+
+        auto batch{bus.next(kind, total_messages)};
+        ASSERT_TRUE(batch.has_value());
+        ASSERT_EQ(batch.value().size(), total_messages);
+
+        std::vector<squedl::wal_bus<>::handle_t> handles;
+        for (const auto& delivery : batch.value())
+            handles.push_back(delivery.handle);
+        bus.ack_many(kind, handles);
+        ASSERT_TRUE(bus.put(kind, squedl::bytes(1024, std::byte{7})).has_value());
+
+        auto deadline{std::chrono::steady_clock::now() + 5s};
+        while (bus.segment_count() > 2 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(1ms);
+        ASSERT_LE(bus.segment_count(), 2);
+    }
+    ASSERT_LE(count_files(directory), 2);
+
+    squedl::wal_bus<> bus{directory.string()};
+    ASSERT_EQ(bus.enqueued_size(kind), 1);
+    bus.stop();
+    std::filesystem::remove_all(directory);
+}
+
+TEST(wal_bus, ignores_torn_tail) {
+    const std::string kind{"wal_kind"};
+    auto directory{fresh_directory("wal_torn")};
+
+    {
+        squedl::wal_bus<> bus{directory.string()};
+        ASSERT_TRUE(bus.put(kind, squedl::bytes{std::byte{1}, std::byte{2}}).has_value());
+    }
+
+    for (const auto& entry : std::filesystem::directory_iterator{directory}) {
+        std::ofstream out{entry.path(), std::ios::binary | std::ios::app};
+        out << "torn";
+    }
+
+    squedl::wal_bus<> bus{directory.string()};
+    auto batch{bus.next(kind, 10)};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), 1);
+    ASSERT_EQ(batch.value()[0].payload.to_bytes(), (squedl::bytes{std::byte{1}, std::byte{2}}));
+    bus.stop();
+    std::filesystem::remove_all(directory);
+}
+
+namespace {
+std::atomic<int64_t> wal_sum{0};
+
+class wal_sum_task {
+public:
+    struct args {
+        int64_t value{};
+    };
+
+    static std::string kind() { return "wal_sum_task"; }
+
+    static void serialize(const args& arg, squedl::bytes& out) {
+        const auto* bytes{reinterpret_cast<const std::byte*>(&arg.value)};
+        out.insert(out.end(), bytes, bytes + sizeof(arg.value));
+    }
+
+    static args deserialize(squedl::byte_view data) {
+        args args{};
+        std::memcpy(&args.value, data.data(), sizeof(args.value));
+        return args;
+    }
+
+    std::optional<squedl::error> operator()(args args) {
+        wal_sum += args.value;
+        return std::nullopt;
+    }
+};
+} // namespace
+
+TEST(wal_bus, drives_scheduler_and_worker_pool) {
+    using namespace std::chrono_literals;
+    const int NUM_TASKS{200};
+    auto directory{fresh_directory("wal_e2e")};
+
+    wal_sum = 0;
+    int64_t expected{};
+    {
+        squedl::wal_bus<> bus{directory.string()};
+        squedl::scheduler scheduler{bus};
+        for (int i{}; i < NUM_TASKS; ++i) {
+            scheduler.schedule<wal_sum_task>(wal_sum_task::args{i});
+            expected += i;
+        }
+    }
+
+    squedl::wal_bus<> bus{directory.string()};
+    squedl::worker_pool pool{bus, 16, 1ms, 4};
+    pool.work_on(wal_sum_task{}, 8);
+
+    auto deadline{std::chrono::steady_clock::now() + 10s};
+    while (!bus.empty() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(10ms);
+
+    EXPECT_TRUE(bus.empty());
+    EXPECT_EQ(wal_sum, expected);
+    pool.stop();
+    bus.stop();
+    std::filesystem::remove_all(directory);
+}
+
+TEST(wal_bus, restores_put_many) {
+    using namespace std::chrono_literals;
+    const std::string kind{"wal_kind"};
+    const size_t total_messages{100};
+    auto directory{fresh_directory("wal_put_many")};
+
+    squedl::bytes buffer;
+    std::vector<size_t> ends;
+    for (size_t i{}; i < total_messages; ++i) {
+        buffer.insert(buffer.end(), 64, static_cast<std::byte>(i));
+        ends.push_back(buffer.size());
+    }
+
+    std::vector<std::uint64_t> ids;
+    {
+        // small segments, so the batch spans several of them
+        squedl::wal_bus<> bus{directory.string(), 1min, 1024};
+        ASSERT_FALSE(bus.put_many(kind, squedl::byte_view{buffer}, {buffer.size() + 1})
+                         .has_value());
+        auto result{bus.put_many(kind, squedl::byte_view{buffer}, ends)};
+        ASSERT_TRUE(result.has_value());
+        ids = result.value();
+        ASSERT_EQ(ids.size(), total_messages);
+        ASSERT_GT(bus.segment_count(), 1);
+        ASSERT_EQ(bus.enqueued_size(kind), total_messages);
+        bus.stop();
+    }
+
+    squedl::wal_bus<> bus{directory.string()};
+    auto batch{bus.next(kind, total_messages)};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), total_messages);
+    for (size_t i{}; i < total_messages; ++i) {
+        EXPECT_EQ(batch.value()[i].id, ids[i]);
+        EXPECT_EQ(batch.value()[i].payload.to_bytes(),
+                  squedl::bytes(64, static_cast<std::byte>(i)));
+    }
+    bus.stop();
+    std::filesystem::remove_all(directory);
+}
+
+TEST(wal_bus, settles_dropped_messages) {
+    using namespace std::chrono_literals;
+    const std::string kind{"wal_kind"};
+    const size_t capacity{10};
+    const size_t total_messages{1000};
+    auto directory{fresh_directory("wal_drop")};
+
+    std::vector<std::uint64_t> ids;
+    {
+        squedl::wal_bus<> bus{directory.string(), 1min, 1024, false};
+        squedl::wal_bus<>::capacity_limit limit{};
+        limit.max_messages = capacity;
+        limit.on_full = squedl::overflow_policy::drop_oldest;
+        bus.set_capacity(kind, limit);
+
+        for (size_t i{}; i < total_messages; ++i) {
+            auto id{bus.put(kind, squedl::bytes(16, std::byte{7}))};
+            ASSERT_TRUE(id.has_value());
+            ids.push_back(id.value());
+        }
+        std::vector<squedl::bytes> bodies(capacity / 2, squedl::bytes(16, std::byte{7}));
+        auto batch{bus.put_many(kind, bodies)};
+        ASSERT_TRUE(batch.has_value());
+        ids.insert(ids.end(), batch.value().begin(), batch.value().end());
+        ASSERT_EQ(bus.enqueued_size(kind), capacity);
+
+        // The dropped messages' segments are compacted away.
+        auto deadline{std::chrono::steady_clock::now() + 5s};
+        while (bus.segment_count() > 2 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(1ms);
+        ASSERT_LE(bus.segment_count(), 2);
+        bus.stop();
+    }
+
+    squedl::wal_bus<> bus{directory.string()};
+    auto batch{bus.next(kind, total_messages)};
+    ASSERT_TRUE(batch.has_value());
+    ASSERT_EQ(batch.value().size(), capacity);
+    for (size_t i{}; i < capacity; ++i)
+        EXPECT_EQ(batch.value()[i].id, ids[ids.size() - capacity + i]);
+    bus.stop();
+    std::filesystem::remove_all(directory);
+}
+
+TEST(wal_bus, settles_dead_lettered_messages) {
+    using namespace std::chrono_literals;
+    const std::string kind{"wal_kind"};
+    const std::string dead_letter{"wal_dead"};
+    const size_t total_messages{100};
+    auto directory{fresh_directory("wal_dead_letter")};
+
+    squedl::wal_bus<>::retry_policy policy{};
+    policy.max_attempts = 1;
+    policy.dead_letter = dead_letter;
+
+    squedl::wal_bus<>::id_t poison{};
+    {
+        squedl::wal_bus<> bus{directory.string(), 1min, 1024, false};
+        bus.set_retry_policy(kind, policy);
+
+        auto id{bus.put(kind, squedl::bytes(16, std::byte{1}))};
+        ASSERT_TRUE(id.has_value());
+        poison = id.value();
+        for (size_t i{}; i < total_messages; ++i)
+            ASSERT_TRUE(bus.put(kind, squedl::bytes(16, std::byte{7})).has_value());
+
+        auto batch{bus.next(kind, total_messages + 1)};
+        ASSERT_TRUE(batch.has_value());
+        ASSERT_EQ(batch.value().size(), total_messages + 1);
+
+        std::vector<squedl::wal_bus<>::handle_t> handles;
+        for (const auto& delivery : batch.value()) {
+            if (delivery.id == poison)
+                bus.nack(kind, delivery.handle);
+            else
+                handles.push_back(delivery.handle);
+        }
+        bus.ack_many(kind, handles);
+        ASSERT_EQ(bus.enqueued_size(dead_letter), 1);
+        ASSERT_TRUE(bus.put(kind, squedl::bytes(1024, std::byte{7})).has_value());
+
+        // The poison message no longer pins the segment it was put into.
+        auto deadline{std::chrono::steady_clock::now() + 5s};
+        while (bus.segment_count() > 2 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(1ms);
+        ASSERT_LE(bus.segment_count(), 2);
+        bus.stop();
+    }
+    ASSERT_LE(count_files(directory), 2);
+
+    {
+        squedl::wal_bus<> bus{directory.string()};
+        ASSERT_EQ(bus.enqueued_size(kind), 1);
+        auto batch{bus.next(kind, total_messages)};
+        ASSERT_TRUE(batch.has_value());
+        ASSERT_EQ(batch.value().size(), 1);
+        ASSERT_NE(batch.value().front().id, poison);
+
+        auto dead{bus.next(dead_letter, total_messages)};
+        ASSERT_TRUE(dead.has_value());
+        ASSERT_EQ(dead.value().size(), 1);
+        ASSERT_EQ(dead.value().front().id, poison);
+        ASSERT_EQ(dead.value().front().payload.to_bytes(), squedl::bytes(16, std::byte{1}));
+        ASSERT_TRUE(bus.ack(dead_letter, dead.value().front().handle));
+        bus.stop();
+    }
+
+    squedl::wal_bus<> bus{directory.string()};
+    ASSERT_EQ(bus.enqueued_size(dead_letter), 0) << "acked in the dead letter kind";
+    ASSERT_EQ(bus.enqueued_size(kind), 1);
+    bus.stop();
+    std::filesystem::remove_all(directory);
+}
+
+TEST(wal_bus, skips_logging_duplicates) {
+    const std::string kind{"wal_kind"};
+    auto directory{fresh_directory("wal_dedup")};
+
+    auto logged{[&directory] {
+        size_t result{};
+        for (const auto& entry : std::filesystem::directory_iterator{directory})
+            result += entry.file_size();
+        return result;
+    }};
+
+    squedl::wal_bus<> bus{directory.string()};
+    auto first{bus.put(kind, squedl::bytes(16, std::byte{7}), {}, squedl::priority::normal, "a")};
+    ASSERT_TRUE(first.has_value());
+    auto before{logged()};
+
+    auto again{bus.put(kind, squedl::bytes(16, std::byte{7}), {}, squedl::priority::normal, "a")};
+    ASSERT_TRUE(again.has_value());
+    ASSERT_EQ(again.value(), first.value());
+    ASSERT_EQ(bus.metrics(kind).counters.deduplicated, 1);
+    bus.stop();
+    ASSERT_EQ(logged(), before);
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST(wal_bus, shuts_down_while_burying_timed_out_messages) {
+    using namespace std::chrono_literals;
+    const std::string kind{"wal_kind"};
+    const std::string dead_letter{"wal_dead"};
+    const size_t total_messages{5000};
+    const size_t rounds{10};
+    auto directory{fresh_directory("wal_bury_shutdown")};
+
+    // Buses go away while their timer thread buries a burst of timed out deliveries.
+    for (size_t round{}; round < rounds; ++round) {
+        std::filesystem::remove_all(directory);
+        squedl::wal_bus<> bus{directory.string(), 10ms, size_t{1} << 20, false};
+        squedl::wal_bus<>::retry_policy policy{};
+        policy.max_attempts = 1;
+        if (round % 2 == 0)
+            policy.dead_letter = dead_letter;
+        bus.set_retry_policy(kind, policy);
+
+        std::vector<squedl::bytes> bodies(total_messages, squedl::bytes(16, std::byte{7}));
+        ASSERT_TRUE(bus.put_many(kind, bodies).has_value());
+        ASSERT_TRUE(bus.next(kind, total_messages).has_value());
+        std::this_thread::sleep_for(9ms + std::chrono::milliseconds{round % 3});
+    }
+
+    std::filesystem::remove_all(directory);
+}